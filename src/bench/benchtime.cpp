@@ -0,0 +1,175 @@
+#include "json.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <excmd.h>
+#include <fmt/base.h>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+using std::cerr;
+using std::cout;
+
+/*
+ * Runs a shell command a number of times and writes how long it took as one
+ * JSON object per line, so the results of different versions can be compared.
+ * The median is the value to compare, it is the least affected by other
+ * processes.
+ */
+
+static void
+show_help(std::ostream &out,
+          const excmd::parser &parser,
+          const std::string &exec_name)
+{
+   fmt::println(out, "Usage:");
+   fmt::println(out, "  {} [options] <name> <command>\n", exec_name);
+   fmt::println(out, "{}", parser.format_help(exec_name));
+   fmt::println(out, "Report bugs to {}", PACKAGE_BUGREPORT);
+}
+
+int
+main(int argc, char **argv)
+{
+   excmd::parser parser;
+   excmd::option_state options;
+
+   try {
+      using excmd::description;
+      using excmd::value;
+      parser.global_options()
+         .add_option("H,help",
+                     description { "Show help" })
+         .add_option("v,version",
+                     description { "Show version" })
+         .add_option("r,runs",
+                     description { "Number of timed runs (default is 3)" },
+                     value<int> {})
+         .add_option("warmup",
+                     description { "Run the command once more before timing it, to fill the caches" })
+         .add_option("bytes",
+                     description { "Size of the input in bytes, to also write the throughput" },
+                     value<std::string> {})
+         .add_option("o,output",
+                     description { "Append the result to this file, and only print the median time" },
+                     value<std::string> {})
+         ;
+
+      parser.default_command()
+         .add_argument("name",
+                       description { "Name of the benchmark in the result" },
+                       value<std::string> {})
+         .add_argument("command",
+                       description { "Command run through the shell" },
+                       value<std::string> {})
+         ;
+
+      options = parser.parse(argc, argv);
+   }
+   catch (std::exception& ex) {
+      fmt::println(cerr, "Error parsing options: {}", ex.what());
+      return -1;
+   }
+
+   if (options.has("help")) {
+      show_help(cout, parser, argv[0]);
+      return 0;
+   }
+
+   if (options.has("version")) {
+      fmt::println(cout, "{} ({}) {}", argv[0], PACKAGE_NAME, PACKAGE_VERSION);
+      return 0;
+   }
+
+   if (!options.has("name") || !options.has("command")) {
+      fmt::println(cerr, "Missing mandatory arguments: <name> <command>\n");
+      show_help(cerr, parser, argv[0]);
+      return -1;
+   }
+
+   auto runs = 3;
+   if (options.has("runs")) {
+      runs = options.get<int>("runs");
+      if (runs < 1) {
+         fmt::println(cerr, "Invalid number of runs: {}", runs);
+         return -1;
+      }
+   }
+
+   // Taken as a string, a number of bytes can be larger than an int
+   auto bytes = uint64_t { 0 };
+   if (options.has("bytes")) {
+      auto value = options.get<std::string>("bytes");
+      char *end = nullptr;
+      bytes = std::strtoull(value.c_str(), &end, 10);
+      if (value.empty() || *end) {
+         fmt::println(cerr, "Invalid number of bytes: {}", value);
+         return -1;
+      }
+   }
+
+   auto name = options.get<std::string>("name");
+   auto command = options.get<std::string>("command");
+
+   if (options.has("warmup") && std::system(command.c_str()) != 0) {
+      fmt::println(cerr, "Benchmark {} failed: {}", name, command);
+      return -1;
+   }
+
+   using Clock = std::chrono::steady_clock;
+   std::vector<double> times;
+   for (auto i = 0; i < runs; ++i) {
+      auto start = Clock::now();
+      auto status = std::system(command.c_str());
+      times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+      if (status != 0) {
+         fmt::println(cerr, "Benchmark {} failed: {}", name, command);
+         return -1;
+      }
+   }
+
+   std::sort(times.begin(), times.end());
+   auto middle = times.size() / 2;
+   auto median = times.size() % 2 ? times[middle] : (times[middle - 1] + times[middle]) / 2;
+   auto total = 0.0;
+   for (auto time : times) {
+      total += time;
+   }
+
+   auto result = fmt::format("{{\"benchmark\":{},\"version\":{},\"runs\":{},"
+                             "\"min_ms\":{:.3f},\"median_ms\":{:.3f},\"mean_ms\":{:.3f},\"max_ms\":{:.3f}",
+                             escape_json(name), escape_json(PACKAGE_VERSION), runs,
+                             times.front(), median, total / runs, times.back());
+   if (bytes) {
+      result += fmt::format(",\"bytes\":{},\"mib_per_second\":{:.1f}", bytes,
+                            median > 0 ? bytes / (1024.0 * 1024.0) / (median / 1000.0) : 0.0);
+   }
+   result += '}';
+
+   if (options.has("output")) {
+      auto path = options.get<std::string>("output");
+      std::ofstream out { path, std::ofstream::app };
+      if (!out.is_open()) {
+         fmt::println(cerr, "Could not open \"{}\" for writing.", path);
+         return -1;
+      }
+
+      fmt::println(out, "{}", result);
+      fmt::println(cout, "{}: {:.3f} ms", name, median);
+   } else {
+      fmt::println(cout, "{}", result);
+   }
+
+   return 0;
+}
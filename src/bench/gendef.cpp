@@ -0,0 +1,226 @@
+#include "random.h"
+
+#include <cctype>
+#include <cstdint>
+#include <excmd.h>
+#include <filesystem>
+#include <fmt/base.h>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+using std::cerr;
+using std::cout;
+
+/*
+ * Writes synthetic exports .def files for rplimportgen, with names shaped like
+ * the ones of the system libraries, such as OSGetSomethingTime42.
+ */
+
+struct GenOptions
+{
+   unsigned numExports = 5000;
+   unsigned dataPercent = 10;
+   unsigned wrapPercent = 5;
+   uint64_t seed = 1;
+};
+
+static const char *const
+sNameParts[] = {
+   "Get", "Set", "Init", "Shutdown", "Create", "Destroy", "Open", "Close",
+   "Read", "Write", "Alloc", "Free", "Lock", "Unlock", "Wait", "Signal",
+   "Thread", "Mutex", "Memory", "Heap", "Block", "File", "Dir", "Stat",
+   "Time", "Tick", "Alarm", "Event", "Queue", "Message", "Buffer", "Handle",
+   "Device", "Sound", "Voice", "Texture", "Shader", "Context", "State", "Flag",
+};
+
+static std::string
+makeName(BenchRandom &random,
+         const std::string &prefix,
+         unsigned index)
+{
+   auto name = prefix;
+   auto numParts = 2 + random.below(3);
+   for (auto i = 0u; i < numParts; ++i) {
+      name += sNameParts[random.below(std::size(sNameParts))];
+   }
+
+   // The index keeps every name unique
+   return name + std::to_string(index);
+}
+
+static bool
+generateDef(const GenOptions &opts,
+            const std::string &moduleName,
+            const std::string &path)
+{
+   BenchRandom random { opts.seed };
+   auto prefix = moduleName.substr(0, 2);
+   for (auto &c : prefix) {
+      c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+   }
+
+   // Sorted by kind, the way the sections of a .def file are
+   std::vector<std::string> lists[4];
+   for (auto i = 0u; i < opts.numExports; ++i) {
+      auto data = random.chance(opts.dataPercent);
+      auto wrap = random.chance(opts.wrapPercent);
+      lists[(data ? 2 : 0) + (wrap ? 1 : 0)].push_back(makeName(random, prefix, i));
+   }
+
+   std::ofstream out { path };
+   if (!out.is_open()) {
+      fmt::println(cerr, "Could not open \"{}\" for writing.", path);
+      return false;
+   }
+
+   static const char *const headers[4] = { ":TEXT", ":TEXT_WRAP", ":DATA", ":DATA_WRAP" };
+   fmt::println(out, ":NAME {}", moduleName);
+   for (auto i = 0u; i < 4; ++i) {
+      if (lists[i].empty()) {
+         continue;
+      }
+
+      fmt::println(out, "\n{}", headers[i]);
+      for (auto &name : lists[i]) {
+         fmt::println(out, "{}", name);
+      }
+   }
+
+   if (!out) {
+      fmt::println(cerr, "Could not write \"{}\".", path);
+      return false;
+   }
+
+   return true;
+}
+
+static void
+show_help(std::ostream &out,
+          const excmd::parser &parser,
+          const std::string &exec_name)
+{
+   fmt::println(out, "Usage:");
+   fmt::println(out, "  {} [options] <output.def>", exec_name);
+   fmt::println(out, "  {} [options] --modules <count> <output directory>\n", exec_name);
+   fmt::println(out, "{}", parser.format_help(exec_name));
+   fmt::println(out, "Report bugs to {}", PACKAGE_BUGREPORT);
+}
+
+int
+main(int argc, char **argv)
+{
+   excmd::parser parser;
+   excmd::option_state options;
+
+   try {
+      using excmd::description;
+      using excmd::value;
+      parser.global_options()
+         .add_option("H,help",
+                     description { "Show help" })
+         .add_option("v,version",
+                     description { "Show version" })
+         .add_option("exports",
+                     description { "Number of exports of every module (default is 5000)" },
+                     value<int> {})
+         .add_option("data",
+                     description { "Percentage of data exports (default is 10)" },
+                     value<int> {})
+         .add_option("wrap",
+                     description { "Percentage of exports in the _WRAP sections (default is 5)" },
+                     value<int> {})
+         .add_option("modules",
+                     description { "Write this many modules, bench0.def to benchN.def, into the output directory" },
+                     value<int> {})
+         .add_option("seed",
+                     description { "Seed of the generated names (default is 1)" },
+                     value<int> {})
+         ;
+
+      parser.default_command()
+         .add_argument("output",
+                       description { "Path to the output .def file, or directory with --modules" },
+                       value<std::string> {})
+         ;
+
+      options = parser.parse(argc, argv);
+   }
+   catch (std::exception& ex) {
+      fmt::println(cerr, "Error parsing options: {}", ex.what());
+      return -1;
+   }
+
+   if (options.has("help")) {
+      show_help(cout, parser, argv[0]);
+      return 0;
+   }
+
+   if (options.has("version")) {
+      fmt::println(cout, "{} ({}) {}", argv[0], PACKAGE_NAME, PACKAGE_VERSION);
+      return 0;
+   }
+
+   if (!options.has("output")) {
+      fmt::println(cerr, "Missing mandatory argument: <output>\n");
+      show_help(cerr, parser, argv[0]);
+      return -1;
+   }
+
+   GenOptions opts;
+   auto numModules = 0u;
+   auto seed = 1u;
+   auto readOption = [&](const char *name, unsigned &value, int max) {
+      if (!options.has(name)) {
+         return true;
+      }
+
+      auto number = options.get<int>(name);
+      if (number < 0 || number > max) {
+         fmt::println(cerr, "Invalid --{}: {}", name, number);
+         return false;
+      }
+
+      value = static_cast<unsigned>(number);
+      return true;
+   };
+
+   if (!readOption("exports", opts.numExports, 1000000) ||
+       !readOption("data", opts.dataPercent, 100) ||
+       !readOption("wrap", opts.wrapPercent, 100) ||
+       !readOption("modules", numModules, 100000) ||
+       !readOption("seed", seed, INT32_MAX)) {
+      return -1;
+   }
+
+   auto output = options.get<std::string>("output");
+   if (!options.has("modules")) {
+      opts.seed = seed;
+      return generateDef(opts, "bench", output) ? 0 : -1;
+   }
+
+   std::error_code ec;
+   std::filesystem::create_directories(output, ec);
+   if (ec) {
+      fmt::println(cerr, "Could not create directory \"{}\": {}", output, ec.message());
+      return -1;
+   }
+
+   // Every module gets different names
+   for (auto i = 0u; i < numModules; ++i) {
+      auto name = fmt::format("bench{}", i);
+      opts.seed = static_cast<uint64_t>(seed) * 100003 + i;
+      if (!generateDef(opts, name, (std::filesystem::path { output } / (name + ".def")).string())) {
+         return -1;
+      }
+   }
+
+   return 0;
+}
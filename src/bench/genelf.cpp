@@ -0,0 +1,552 @@
+#include "elf.h"
+#include "random.h"
+#include "rplwrap.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <excmd.h>
+#include <fmt/base.h>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+using std::cerr;
+using std::cout;
+
+/*
+ * Writes a synthetic linked big-endian PowerPC ELF, laid out like the output
+ * of the wut linker script with --emit-relocs, so elf2rpl can be timed on large
+ * inputs without a devkitPPC toolchain. The code isn't meant to run: functions
+ * are filled with the instructions their relocations apply to, nops and a blr.
+ */
+
+constexpr auto CodeBaseAddress = 0x02000000u;
+constexpr auto DataBaseAddress = 0x10000000u;
+
+constexpr auto InstrLis = 0x3C600000u;   // lis r3, 0
+constexpr auto InstrAddi = 0x38630000u;  // addi r3, r3, 0
+constexpr auto InstrBl = 0x48000001u;    // bl 0
+constexpr auto InstrNop = 0x60000000u;
+constexpr auto InstrBlr = 0x4E800020u;
+
+struct GenOptions
+{
+   uint32_t textSize = 4096 * 1024;
+   uint32_t dataSize = 1024 * 1024;
+   uint32_t bssSize = 256 * 1024;
+   uint32_t debugSize = 0;
+   uint32_t numSymbols = 20000;
+   uint32_t numRelocations = 200000;
+   unsigned rplwrapPercent = 5;
+   uint64_t seed = 1;
+};
+
+struct GenSection
+{
+   std::string name;
+   elf::SectionHeader header;
+   std::vector<char> data;
+};
+
+static void
+setWord(std::vector<char> &data,
+        uint32_t offset,
+        uint32_t value)
+{
+   auto word = be_val<uint32_t> { value };
+   memcpy(data.data() + offset, &word, sizeof(word));
+}
+
+static uint32_t
+addSection(std::vector<GenSection> &sections,
+           const std::string &name,
+           uint32_t type,
+           uint32_t flags,
+           uint32_t addr,
+           uint32_t addralign,
+           std::vector<char> data,
+           uint32_t size)
+{
+   auto &section = sections.emplace_back();
+   section.name = name;
+   section.header = elf::SectionHeader { };
+   section.header.type = type;
+   section.header.flags = flags;
+   section.header.addr = addr;
+   section.header.addralign = addralign;
+   section.header.size = size;
+   section.data = std::move(data);
+   return static_cast<uint32_t>(sections.size() - 1);
+}
+
+template<typename Type>
+static std::vector<char>
+toBytes(const std::vector<Type> &records)
+{
+   auto first = reinterpret_cast<const char *>(records.data());
+   return std::vector<char>(first, first + records.size() * sizeof(Type));
+}
+
+static bool
+generateElf(const GenOptions &opts,
+            const std::string &path)
+{
+   BenchRandom random { opts.seed };
+
+   // Half of the symbols are functions, the others are objects spread over
+   // .rodata, .data and .bss
+   auto numFunctions = std::max(1u, opts.numSymbols / 2);
+   auto numObjects = std::max(3u, opts.numSymbols - numFunctions);
+   auto functionWords = std::max(2u, opts.textSize / 4 / numFunctions);
+   auto textSize = numFunctions * functionWords * 4;
+
+   uint32_t objectCounts[3] = {
+      (numObjects + 2) / 3,
+      (numObjects + 1) / 3,
+      numObjects / 3,
+   };
+   uint32_t objectSizes[3] = {
+      std::max(4u, align_down(opts.dataSize / 2 / objectCounts[0], 4)),
+      std::max(4u, align_down(opts.dataSize / 2 / objectCounts[1], 4)),
+      std::max(4u, align_down(opts.bssSize / objectCounts[2], 4)),
+   };
+
+   auto rodataAddr = DataBaseAddress;
+   auto rodataSize = objectCounts[0] * objectSizes[0];
+   auto dataAddr = align_up(rodataAddr + rodataSize, 32);
+   auto dataSize = objectCounts[1] * objectSizes[1];
+   auto bssAddr = align_up(dataAddr + dataSize, 32);
+   auto bssSize = objectCounts[2] * objectSizes[2];
+
+   // Names, with __rplwrap_ on some of the symbols. Some of the wrapped
+   // functions are followed by one with the unwrapped name, which makes
+   // renameRplWrap swap them.
+   std::vector<std::string> names;
+   names.reserve(numFunctions + numObjects);
+   auto conflict = false;
+   for (auto i = 0u; i < numFunctions; ++i) {
+      if (conflict) {
+         names.push_back(fmt::format("f{}", i - 1));
+         conflict = false;
+      } else if (random.chance(opts.rplwrapPercent)) {
+         names.push_back(fmt::format("{}f{}", RPLWRAP_PREFIX, i));
+         conflict = random.chance(50);
+      } else {
+         names.push_back(fmt::format("f{}", i));
+      }
+   }
+
+   for (auto i = 0u; i < numObjects; ++i) {
+      if (random.chance(opts.rplwrapPercent)) {
+         names.push_back(fmt::format("{}d{}", RPLWRAP_PREFIX, i));
+      } else {
+         names.push_back(fmt::format("d{}", i));
+      }
+   }
+
+   // Sections 1 to 4 have a local section symbol each, the functions and
+   // objects follow in the order of their names
+   constexpr auto TextIndex = 1u, RodataIndex = 2u, DataIndex = 3u, BssIndex = 4u;
+   constexpr auto FirstGlobal = 5u;
+
+   std::vector<elf::Symbol> symbols(FirstGlobal, elf::Symbol { });
+   std::string strings(1, '\0');
+   for (auto i = 1u; i < FirstGlobal; ++i) {
+      symbols[i].info = uint8_t { (elf::STB_LOCAL << 4) | elf::STT_SECTION };
+      symbols[i].shndx = static_cast<uint16_t>(i);
+   }
+
+   auto addSymbol = [&](const std::string &name, uint32_t type, uint32_t section,
+                        uint32_t value, uint32_t size) {
+      auto &symbol = symbols.emplace_back();
+      symbol.name = static_cast<uint32_t>(strings.size());
+      symbol.value = value;
+      symbol.size = size;
+      symbol.info = static_cast<uint8_t>((elf::STB_GLOBAL << 4) | type);
+      symbol.other = uint8_t { 0 };
+      symbol.shndx = static_cast<uint16_t>(section);
+      strings.append(name);
+      strings.push_back('\0');
+   };
+
+   for (auto i = 0u; i < numFunctions; ++i) {
+      addSymbol(names[i], elf::STT_FUNC, TextIndex,
+                CodeBaseAddress + i * functionWords * 4, functionWords * 4);
+   }
+
+   std::vector<uint32_t> objectAddrs;
+   objectAddrs.reserve(numObjects);
+   for (auto i = 0u; i < numObjects; ++i) {
+      auto kind = i % 3;
+      auto slot = i / 3;
+      uint32_t base[3] = { rodataAddr, dataAddr, bssAddr };
+      uint32_t index[3] = { RodataIndex, DataIndex, BssIndex };
+      objectAddrs.push_back(base[kind] + slot * objectSizes[kind]);
+      addSymbol(names[numFunctions + i], elf::STT_OBJECT, index[kind],
+                objectAddrs.back(), objectSizes[kind]);
+   }
+
+   auto functionAddr = [&](uint32_t i) { return CodeBaseAddress + i * functionWords * 4; };
+   auto relaInfo = [](uint32_t symbol, uint32_t type) { return (symbol << 8) | type; };
+
+   // .text: every function starts with its relocations, cycling through
+   // lis/addi pairs to an object and a bl to a function
+   auto maxTextRelocs = static_cast<uint64_t>(numFunctions) * (functionWords - 1);
+   auto numTextRelocs = std::min<uint64_t>(opts.numRelocations * 3ull / 4, maxTextRelocs);
+   std::vector<char> text(textSize);
+   std::vector<elf::Rela> textRelas;
+   textRelas.reserve(numTextRelocs);
+
+   for (auto i = 0u; i < numFunctions; ++i) {
+      auto count = numTextRelocs / numFunctions + (i < numTextRelocs % numFunctions ? 1 : 0);
+      auto object = 0u;
+
+      for (auto w = 0u; w < functionWords; ++w) {
+         auto offset = i * functionWords * 4 + w * 4;
+         auto place = CodeBaseAddress + offset;
+
+         if (w == functionWords - 1) {
+            setWord(text, offset, InstrBlr);
+            continue;
+         } else if (w >= count) {
+            setWord(text, offset, InstrNop);
+            continue;
+         }
+
+         auto &rela = textRelas.emplace_back();
+         rela.offset = place;
+         rela.addend = 0;
+
+         if (w % 3 == 0) {
+            object = static_cast<uint32_t>(random.below(numObjects));
+            auto value = objectAddrs[object];
+            rela.info = relaInfo(FirstGlobal + numFunctions + object, elf::R_PPC_ADDR16_HA);
+            setWord(text, offset, InstrLis | (((value + 0x8000) >> 16) & 0xFFFF));
+         } else if (w % 3 == 1) {
+            auto value = objectAddrs[object];
+            rela.info = relaInfo(FirstGlobal + numFunctions + object, elf::R_PPC_ADDR16_LO);
+            setWord(text, offset, InstrAddi | (value & 0xFFFF));
+         } else {
+            auto target = static_cast<uint32_t>(random.below(numFunctions));
+            rela.info = relaInfo(FirstGlobal + target, elf::R_PPC_REL24);
+            setWord(text, offset, InstrBl | ((functionAddr(target) - place) & 0x03FFFFFC));
+         }
+      }
+   }
+
+   // .rodata: strings, which compress about as well as real ones
+   std::vector<char> rodata(rodataSize);
+   for (auto i = 0u; i < objectCounts[0]; ++i) {
+      auto string = fmt::format("string number {} of {} ", i, random.below(1000000));
+      auto first = rodata.begin() + i * objectSizes[0];
+      for (auto j = 0u; j + 1 < objectSizes[0]; ++j) {
+         first[j] = string[j % string.size()];
+      }
+   }
+
+   // .data: pointers to symbols spread over the section, some of them relative
+   auto dataWords = dataSize / 4;
+   auto numDataRelocs = std::min<uint64_t>(opts.numRelocations - numTextRelocs, dataWords);
+   std::vector<char> data(dataSize);
+   std::vector<elf::Rela> dataRelas;
+   dataRelas.reserve(numDataRelocs);
+
+   for (auto k = 0ull; k < numDataRelocs; ++k) {
+      auto offset = static_cast<uint32_t>(k * dataWords / numDataRelocs * 4);
+      auto place = dataAddr + offset;
+      auto &rela = dataRelas.emplace_back();
+      rela.offset = place;
+      rela.addend = 0;
+
+      if (k % 16 == 15) {
+         auto target = static_cast<uint32_t>(random.below(numFunctions));
+         rela.info = relaInfo(FirstGlobal + target, elf::R_PPC_REL32);
+         setWord(data, offset, functionAddr(target) - place);
+      } else {
+         auto target = static_cast<uint32_t>(random.below(numFunctions + numObjects));
+         auto value = target < numFunctions ? functionAddr(target) :
+                                              objectAddrs[target - numFunctions];
+         rela.info = relaInfo(FirstGlobal + target, elf::R_PPC_ADDR32);
+         setWord(data, offset, value);
+      }
+   }
+
+   std::vector<GenSection> sections;
+   addSection(sections, "", elf::SHT_NULL, 0, 0, 0, { }, 0);
+   addSection(sections, ".text", elf::SHT_PROGBITS, elf::SHF_ALLOC | elf::SHF_EXECINSTR,
+              CodeBaseAddress, 32, std::move(text), textSize);
+   addSection(sections, ".rodata", elf::SHT_PROGBITS, elf::SHF_ALLOC,
+              rodataAddr, 32, std::move(rodata), rodataSize);
+   addSection(sections, ".data", elf::SHT_PROGBITS, elf::SHF_ALLOC | elf::SHF_WRITE,
+              dataAddr, 32, std::move(data), dataSize);
+   addSection(sections, ".bss", elf::SHT_NOBITS, elf::SHF_ALLOC | elf::SHF_WRITE,
+              bssAddr, 32, { }, bssSize);
+
+   // Debug information, which elf2rpl discards along with its relocations
+   auto debugIndex = 0u;
+   std::vector<elf::Rela> debugRelas;
+   if (opts.debugSize) {
+      auto debugSize = align_up(opts.debugSize, 16);
+      std::vector<char> debug(debugSize);
+      for (auto offset = 0u; offset < debugSize; offset += 16) {
+         auto target = static_cast<uint32_t>(random.below(numFunctions));
+         auto &rela = debugRelas.emplace_back();
+         rela.offset = offset;
+         rela.info = relaInfo(FirstGlobal + target, elf::R_PPC_ADDR32);
+         rela.addend = 0;
+         setWord(debug, offset, functionAddr(target));
+         setWord(debug, offset + 4, offset);
+      }
+
+      debugIndex = addSection(sections, ".debug_info", elf::SHT_PROGBITS, 0,
+                              0, 1, std::move(debug), debugSize);
+   }
+
+   auto symTabIndex = static_cast<uint32_t>(sections.size() + (debugIndex ? 3 : 2));
+
+   auto addRela = [&](uint32_t target, const std::vector<elf::Rela> &relas) {
+      auto size = static_cast<uint32_t>(relas.size() * sizeof(elf::Rela));
+      auto index = addSection(sections, ".rela" + sections[target].name, elf::SHT_RELA, 0,
+                              0, 4, toBytes(relas), size);
+      sections[index].header.link = symTabIndex;
+      sections[index].header.info = target;
+      sections[index].header.entsize = static_cast<uint32_t>(sizeof(elf::Rela));
+   };
+
+   addRela(TextIndex, textRelas);
+   addRela(DataIndex, dataRelas);
+   if (debugIndex) {
+      addRela(debugIndex, debugRelas);
+   }
+
+   auto symbolsSize = static_cast<uint32_t>(symbols.size() * sizeof(elf::Symbol));
+   addSection(sections, ".symtab", elf::SHT_SYMTAB, 0, 0, 4, toBytes(symbols), symbolsSize);
+   sections[symTabIndex].header.link = symTabIndex + 1;
+   sections[symTabIndex].header.info = FirstGlobal;
+   sections[symTabIndex].header.entsize = static_cast<uint32_t>(sizeof(elf::Symbol));
+
+   auto stringsSize = static_cast<uint32_t>(strings.size());
+   addSection(sections, ".strtab", elf::SHT_STRTAB, 0, 0, 1,
+              std::vector<char>(strings.begin(), strings.end()), stringsSize);
+
+   // Add the name before taking the size, since it is in the table too
+   std::string shStrings(1, '\0');
+   auto addName = [&](elf::SectionHeader &header, const std::string &name) {
+      header.name = static_cast<uint32_t>(shStrings.size());
+      shStrings.append(name);
+      shStrings.push_back('\0');
+   };
+
+   for (auto i = 1u; i < sections.size(); ++i) {
+      addName(sections[i].header, sections[i].name);
+   }
+
+   auto shStrTabHeader = elf::SectionHeader { };
+   addName(shStrTabHeader, ".shstrtab");
+   auto shStrTabIndex = addSection(sections, ".shstrtab", elf::SHT_STRTAB, 0, 0, 1,
+                                   std::vector<char>(shStrings.begin(), shStrings.end()),
+                                   static_cast<uint32_t>(shStrings.size()));
+   sections[shStrTabIndex].header.name = shStrTabHeader.name;
+
+   // Lay out the section data after the file header, then the section headers
+   auto offset = static_cast<uint32_t>(sizeof(elf::Header));
+   for (auto i = 1u; i < sections.size(); ++i) {
+      auto &header = sections[i].header;
+      offset = align_up(offset, std::max<uint32_t>(header.addralign, 1u));
+      header.offset = offset;
+      if (header.type != elf::SHT_NOBITS) {
+         offset += header.size;
+      }
+   }
+
+   auto shoff = align_up(offset, 4);
+
+   auto header = elf::Header { };
+   header.magic = elf::HeaderMagic;
+   header.fileClass = uint8_t { elf::ELFCLASS32 };
+   header.encoding = uint8_t { elf::ELFDATA2MSB };
+   header.elfVersion = uint8_t { elf::EV_CURRENT };
+   header.abi = uint16_t { 0 };
+   memset(&header.pad, 0, 7);
+   header.type = uint16_t { elf::ET_EXEC };
+   header.machine = uint16_t { elf::EM_PPC };
+   header.version = 1u;
+   header.entry = CodeBaseAddress;
+   header.phoff = 0u;
+   header.shoff = shoff;
+   header.flags = 0u;
+   header.ehsize = static_cast<uint16_t>(sizeof(elf::Header));
+   header.phentsize = uint16_t { 0 };
+   header.phnum = uint16_t { 0 };
+   header.shentsize = static_cast<uint16_t>(sizeof(elf::SectionHeader));
+   header.shnum = static_cast<uint16_t>(sections.size());
+   header.shstrndx = static_cast<uint16_t>(shStrTabIndex);
+
+   std::ofstream out { path, std::ofstream::binary };
+   if (!out.is_open()) {
+      fmt::println(cerr, "Could not open \"{}\" for writing.", path);
+      return false;
+   }
+
+   auto position = static_cast<uint32_t>(sizeof(elf::Header));
+   auto padTo = [&](uint32_t next) {
+      static const char zeroes[16] = { };
+      while (position < next) {
+         auto size = std::min<uint32_t>(next - position, sizeof(zeroes));
+         out.write(zeroes, size);
+         position += size;
+      }
+   };
+
+   out.write(reinterpret_cast<const char *>(&header), sizeof(elf::Header));
+   for (auto i = 1u; i < sections.size(); ++i) {
+      const auto &section = sections[i];
+      if (section.header.type == elf::SHT_NOBITS) {
+         continue;
+      }
+
+      padTo(section.header.offset);
+      out.write(section.data.data(), section.data.size());
+      position += static_cast<uint32_t>(section.data.size());
+   }
+
+   padTo(shoff);
+   for (const auto &section : sections) {
+      out.write(reinterpret_cast<const char *>(&section.header), sizeof(elf::SectionHeader));
+   }
+
+   if (!out) {
+      fmt::println(cerr, "Could not write \"{}\".", path);
+      return false;
+   }
+
+   fmt::println(cout, "{}: {} functions, {} objects, {} relocations, {} bytes",
+                path, numFunctions, numObjects,
+                textRelas.size() + dataRelas.size() + debugRelas.size(), shoff +
+                sections.size() * sizeof(elf::SectionHeader));
+   return true;
+}
+
+static void
+show_help(std::ostream &out,
+          const excmd::parser &parser,
+          const std::string &exec_name)
+{
+   fmt::println(out, "Usage:");
+   fmt::println(out, "  {} [options] <output.elf>\n", exec_name);
+   fmt::println(out, "{}", parser.format_help(exec_name));
+   fmt::println(out, "Report bugs to {}", PACKAGE_BUGREPORT);
+}
+
+int
+main(int argc, char **argv)
+{
+   excmd::parser parser;
+   excmd::option_state options;
+
+   try {
+      using excmd::description;
+      using excmd::value;
+      parser.global_options()
+         .add_option("H,help",
+                     description { "Show help" })
+         .add_option("v,version",
+                     description { "Show version" })
+         .add_option("text-size",
+                     description { "Size of .text in KiB (default is 4096)" },
+                     value<int> {})
+         .add_option("data-size",
+                     description { "Size of .rodata and .data together in KiB (default is 1024)" },
+                     value<int> {})
+         .add_option("bss-size",
+                     description { "Size of .bss in KiB (default is 256)" },
+                     value<int> {})
+         .add_option("debug-size",
+                     description { "Size of .debug_info in KiB, which elf2rpl discards (default is 0)" },
+                     value<int> {})
+         .add_option("symbols",
+                     description { "Number of symbols, half functions and half objects (default is 20000)" },
+                     value<int> {})
+         .add_option("relocations",
+                     description { "Number of relocations in .text and .data (default is 200000)" },
+                     value<int> {})
+         .add_option("rplwrap",
+                     description { "Percentage of symbols named " RPLWRAP_PREFIX "<name> (default is 5)" },
+                     value<int> {})
+         .add_option("seed",
+                     description { "Seed of the generated contents (default is 1)" },
+                     value<int> {})
+         ;
+
+      parser.default_command()
+         .add_argument("output.elf",
+                       description { "Path to the output ELF file" },
+                       value<std::string> {})
+         ;
+
+      options = parser.parse(argc, argv);
+   }
+   catch (std::exception& ex) {
+      fmt::println(cerr, "Error parsing options: {}", ex.what());
+      return -1;
+   }
+
+   if (options.has("help")) {
+      show_help(cout, parser, argv[0]);
+      return 0;
+   }
+
+   if (options.has("version")) {
+      fmt::println(cout, "{} ({}) {}", argv[0], PACKAGE_NAME, PACKAGE_VERSION);
+      return 0;
+   }
+
+   if (!options.has("output.elf")) {
+      fmt::println(cerr, "Missing mandatory argument: <output.elf>\n");
+      show_help(cerr, parser, argv[0]);
+      return -1;
+   }
+
+   GenOptions opts;
+   auto readOption = [&](const char *name, uint32_t &value, uint32_t scale,
+                         int max) {
+      if (!options.has(name)) {
+         return true;
+      }
+
+      auto number = options.get<int>(name);
+      if (number < 0 || number > max) {
+         fmt::println(cerr, "Invalid --{}: {}", name, number);
+         return false;
+      }
+
+      value = static_cast<uint32_t>(number) * scale;
+      return true;
+   };
+
+   // Sizes are limited so every address stays inside of its area
+   uint32_t rplwrap = opts.rplwrapPercent;
+   uint32_t seed = static_cast<uint32_t>(opts.seed);
+   if (!readOption("text-size", opts.textSize, 1024, 256 * 1024) ||
+       !readOption("data-size", opts.dataSize, 1024, 1024 * 1024) ||
+       !readOption("bss-size", opts.bssSize, 1024, 1024 * 1024) ||
+       !readOption("debug-size", opts.debugSize, 1024, 1024 * 1024) ||
+       !readOption("symbols", opts.numSymbols, 1, 0xFF0000) ||
+       !readOption("relocations", opts.numRelocations, 1, 0x10000000) ||
+       !readOption("rplwrap", rplwrap, 1, 100) ||
+       !readOption("seed", seed, 1, INT32_MAX)) {
+      return -1;
+   }
+
+   opts.rplwrapPercent = rplwrap;
+   opts.seed = seed;
+   return generateElf(opts, options.get<std::string>("output.elf")) ? 0 : -1;
+}
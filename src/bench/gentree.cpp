@@ -0,0 +1,278 @@
+#include "random.h"
+
+#include <cmath>
+#include <cstdint>
+#include <excmd.h>
+#include <filesystem>
+#include <fmt/base.h>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+using std::cerr;
+using std::cout;
+
+/*
+ * Writes a synthetic content tree for wuhbtool: directories nested a few levels
+ * deep, full of files of random contents with sizes picked from a distribution.
+ */
+
+enum class SizeDistribution
+{
+   // Every size between the minimum and the maximum is as likely
+   Uniform,
+   // Every power of two between them is as likely, so most files are small and
+   // a few are large, like the content of most games
+   Log,
+};
+
+struct GenOptions
+{
+   unsigned numFiles = 10000;
+   unsigned numDirs = 100;
+   unsigned fanout = 8;
+   uint64_t minSize = 0;
+   uint64_t maxSize = 1024 * 1024;
+   SizeDistribution distribution = SizeDistribution::Log;
+   unsigned duplicatePercent = 0;
+   uint64_t seed = 1;
+};
+
+static uint64_t
+pickSize(BenchRandom &random,
+         const GenOptions &opts)
+{
+   if (opts.maxSize <= opts.minSize) {
+      return opts.minSize;
+   }
+
+   if (opts.distribution == SizeDistribution::Uniform) {
+      return opts.minSize + random.below(opts.maxSize - opts.minSize + 1);
+   }
+
+   auto unit = static_cast<double>(random.next() >> 11) / static_cast<double>(1ull << 53);
+   auto low = std::log(static_cast<double>(opts.minSize + 1));
+   auto high = std::log(static_cast<double>(opts.maxSize + 1));
+   auto size = static_cast<uint64_t>(std::exp(low + unit * (high - low))) - 1;
+   return std::min(std::max(size, opts.minSize), opts.maxSize);
+}
+
+// Files with the same seed get the same contents
+static bool
+writeFile(const std::filesystem::path &path,
+          uint64_t size,
+          uint64_t seed)
+{
+   std::ofstream out { path, std::ofstream::binary };
+   if (!out.is_open()) {
+      fmt::println(cerr, "Could not open \"{}\" for writing.", path.string());
+      return false;
+   }
+
+   BenchRandom random { seed };
+   std::vector<uint64_t> block(8192);
+   while (size) {
+      for (auto &word : block) {
+         word = random.next();
+      }
+
+      auto chunk = std::min<uint64_t>(size, block.size() * sizeof(uint64_t));
+      out.write(reinterpret_cast<const char *>(block.data()), static_cast<std::streamsize>(chunk));
+      size -= chunk;
+   }
+
+   if (!out) {
+      fmt::println(cerr, "Could not write \"{}\".", path.string());
+      return false;
+   }
+
+   return true;
+}
+
+static bool
+generateTree(const GenOptions &opts,
+             const std::filesystem::path &root)
+{
+   BenchRandom random { opts.seed };
+
+   // Directory 0 is the root, the parent of directory i is (i - 1) / fanout
+   std::vector<std::filesystem::path> dirs;
+   dirs.reserve(opts.numDirs + 1);
+   dirs.push_back(root);
+   for (auto i = 1u; i <= opts.numDirs; ++i) {
+      dirs.push_back(dirs[(i - 1) / opts.fanout] / fmt::format("dir{}", i));
+   }
+
+   for (auto &dir : dirs) {
+      std::error_code ec;
+      std::filesystem::create_directories(dir, ec);
+      if (ec) {
+         fmt::println(cerr, "Could not create directory \"{}\": {}", dir.string(), ec.message());
+         return false;
+      }
+   }
+
+   struct FileContents
+   {
+      uint64_t size;
+      uint64_t seed;
+   };
+
+   std::vector<FileContents> files;
+   files.reserve(opts.numFiles);
+   auto totalSize = uint64_t { 0 };
+   auto numDuplicates = 0u;
+
+   for (auto i = 0u; i < opts.numFiles; ++i) {
+      if (!files.empty() && random.chance(opts.duplicatePercent)) {
+         files.push_back(files[random.below(files.size())]);
+         numDuplicates++;
+      } else {
+         files.push_back({ pickSize(random, opts), random.next() });
+      }
+
+      auto dir = random.below(dirs.size());
+      auto path = dirs[dir] / fmt::format("file{}.bin", i);
+      if (!writeFile(path, files.back().size, files.back().seed)) {
+         return false;
+      }
+
+      totalSize += files.back().size;
+   }
+
+   fmt::println(cout, "{}: {} files in {} directories, {} duplicates, {} bytes",
+                root.string(), opts.numFiles, opts.numDirs, numDuplicates, totalSize);
+   return true;
+}
+
+static void
+show_help(std::ostream &out,
+          const excmd::parser &parser,
+          const std::string &exec_name)
+{
+   fmt::println(out, "Usage:");
+   fmt::println(out, "  {} [options] <output directory>\n", exec_name);
+   fmt::println(out, "{}", parser.format_help(exec_name));
+   fmt::println(out, "Report bugs to {}", PACKAGE_BUGREPORT);
+}
+
+int
+main(int argc, char **argv)
+{
+   excmd::parser parser;
+   excmd::option_state options;
+
+   try {
+      using excmd::description;
+      using excmd::value;
+      parser.global_options()
+         .add_option("H,help",
+                     description { "Show help" })
+         .add_option("v,version",
+                     description { "Show version" })
+         .add_option("files",
+                     description { "Number of files (default is 10000)" },
+                     value<int> {})
+         .add_option("dirs",
+                     description { "Number of directories below the output one (default is 100)" },
+                     value<int> {})
+         .add_option("fanout",
+                     description { "Number of subdirectories of every directory (default is 8)" },
+                     value<int> {})
+         .add_option("min-size",
+                     description { "Smallest file size in bytes (default is 0)" },
+                     value<int> {})
+         .add_option("max-size",
+                     description { "Largest file size in bytes (default is 1048576)" },
+                     value<int> {})
+         .add_option("distribution",
+                     description { "Distribution of the file sizes, uniform or log (default is log)" },
+                     value<std::string> {})
+         .add_option("duplicates",
+                     description { "Percentage of files with the contents of an earlier one (default is 0)" },
+                     value<int> {})
+         .add_option("seed",
+                     description { "Seed of the generated contents (default is 1)" },
+                     value<int> {})
+         ;
+
+      parser.default_command()
+         .add_argument("output",
+                       description { "Directory the tree is written to" },
+                       value<std::string> {})
+         ;
+
+      options = parser.parse(argc, argv);
+   }
+   catch (std::exception& ex) {
+      fmt::println(cerr, "Error parsing options: {}", ex.what());
+      return -1;
+   }
+
+   if (options.has("help")) {
+      show_help(cout, parser, argv[0]);
+      return 0;
+   }
+
+   if (options.has("version")) {
+      fmt::println(cout, "{} ({}) {}", argv[0], PACKAGE_NAME, PACKAGE_VERSION);
+      return 0;
+   }
+
+   if (!options.has("output")) {
+      fmt::println(cerr, "Missing mandatory argument: <output>\n");
+      show_help(cerr, parser, argv[0]);
+      return -1;
+   }
+
+   GenOptions opts;
+   auto minSize = 0u;
+   auto maxSize = 1024u * 1024;
+   auto seed = 1u;
+   auto readOption = [&](const char *name, unsigned &value, int min, int max) {
+      if (!options.has(name)) {
+         return true;
+      }
+
+      auto number = options.get<int>(name);
+      if (number < min || number > max) {
+         fmt::println(cerr, "Invalid --{}: {}", name, number);
+         return false;
+      }
+
+      value = static_cast<unsigned>(number);
+      return true;
+   };
+
+   if (!readOption("files", opts.numFiles, 0, 10000000) ||
+       !readOption("dirs", opts.numDirs, 0, 1000000) ||
+       !readOption("fanout", opts.fanout, 1, 1000000) ||
+       !readOption("min-size", minSize, 0, INT32_MAX) ||
+       !readOption("max-size", maxSize, 0, INT32_MAX) ||
+       !readOption("duplicates", opts.duplicatePercent, 0, 100) ||
+       !readOption("seed", seed, 0, INT32_MAX)) {
+      return -1;
+   }
+
+   if (options.has("distribution")) {
+      auto name = options.get<std::string>("distribution");
+      if (name == "uniform") {
+         opts.distribution = SizeDistribution::Uniform;
+      } else if (name != "log") {
+         fmt::println(cerr, "Unknown size distribution: {}", name);
+         return -1;
+      }
+   }
+
+   opts.minSize = minSize;
+   opts.maxSize = maxSize;
+   opts.seed = seed;
+   return generateTree(opts, options.get<std::string>("output")) ? 0 : -1;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+
+// Seeded generator for the benchmark inputs. The standard distributions can
+// differ between library implementations, this gives the same inputs for the
+// same seed everywhere, so results from different machines can be compared.
+class BenchRandom
+{
+public:
+   explicit BenchRandom(uint64_t seed) :
+      mState(seed)
+   {
+   }
+
+   // splitmix64
+   uint64_t
+   next()
+   {
+      auto z = (mState += 0x9E3779B97F4A7C15ull);
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+   }
+
+   // A value in [0, bound), bound must not be 0
+   uint64_t
+   below(uint64_t bound)
+   {
+      return next() % bound;
+   }
+
+   // True percent times out of 100
+   bool
+   chance(unsigned percent)
+   {
+      return below(100) < percent;
+   }
+
+private:
+   uint64_t mState;
+};
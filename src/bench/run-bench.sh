@@ -0,0 +1,165 @@
+#!/bin/sh
+# Generates synthetic inputs and times the tools on them, run by "make bench".
+#
+# usage: run-bench.sh <directory of the programs> <work directory>
+#
+# The results go to <work directory>/results.jsonl, one JSON object per line
+# with a "benchmark" name: the commands timed by benchtime, the passes of
+# elf2rpl from --stats-json, the steps of wuhbtool from its summary and the
+# ingest rate of udplogserver. Keep that file to compare releases.
+#
+# In the udplogserver record, peak_datagrams_per_second_window is the most
+# datagrams received in any one second window, not a rate averaged over the run.
+#
+# Environment:
+#   BENCH_RUNS   times every command is run, the median is the one to compare
+#                (default is 3)
+#   BENCH_SCALE  multiplies the size of the inputs (default is 1)
+#   BENCH_PORT   port udplogserver listens on (default is 44050)
+
+set -e
+
+bin=${1:-.}
+work=${2:-bench-results}
+runs=${BENCH_RUNS:-3}
+scale=${BENCH_SCALE:-1}
+port=${BENCH_PORT:-44050}
+
+mkdir -p "$work"
+results="$work/results.jsonl"
+: > "$results"
+
+version=$("$bin/elf2rpl" --version | awk '{ print $NF }')
+printf '{"benchmark":"info","version":"%s","date":"%s","system":"%s","runs":%s,"scale":%s}\n' \
+       "$version" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -sm)" "$runs" "$scale" >> "$results"
+
+file_size() {
+   wc -c < "$1" | tr -d ' '
+}
+
+# name, command, size of the input in bytes (optional)
+bench() {
+   "$bin/benchtime" --runs "$runs" --output "$results" ${3:+--bytes "$3"} "$1" "$2"
+}
+
+
+echo "Generating inputs in $work"
+
+"$bin/genelf" \
+   --text-size $((4096 * scale)) \
+   --data-size $((1024 * scale)) \
+   --debug-size $((2048 * scale)) \
+   --symbols $((20000 * scale)) \
+   --relocations $((200000 * scale)) \
+   --rplwrap 5 \
+   "$work/bench.elf"
+
+"$bin/gendef" --exports $((5000 * scale)) "$work/bench.def"
+"$bin/gendef" --modules $((50 * scale)) --exports 1000 "$work/defs"
+
+rm -rf "$work/content"
+"$bin/gentree" \
+   --files $((2000 * scale)) \
+   --dirs 100 \
+   --max-size 262144 \
+   --duplicates 5 \
+   "$work/content"
+
+elf="$work/bench.elf"
+rpx="$work/bench.rpx"
+elf_size=$(file_size "$elf")
+
+
+echo "Timing elf2rpl"
+
+bench elf2rpl "\"$bin/elf2rpl\" \"$elf\" \"$rpx\"" "$elf_size"
+bench elf2rpl-jobs "\"$bin/elf2rpl\" -j 0 \"$elf\" \"$rpx\"" "$elf_size"
+bench elf2rpl-level-9 "\"$bin/elf2rpl\" -j 0 -z 9 \"$elf\" \"$rpx\"" "$elf_size"
+bench elf2rpl-all-passes \
+      "\"$bin/elf2rpl\" -j 0 --merge-strings --sort-relocations --prune-imports \"$elf\" \"$rpx\"" \
+      "$elf_size"
+
+# Time of every pass, from a single run
+rm -f "$work/elf2rpl-stats.jsonl"
+"$bin/elf2rpl" -j 0 --stats-json "$work/elf2rpl-stats.jsonl" "$elf" "$rpx"
+sed "s/^{/{\"benchmark\":\"elf2rpl-passes\",\"version\":\"$version\",/" "$work/elf2rpl-stats.jsonl" >> "$results"
+
+rpx_size=$(file_size "$rpx")
+
+
+echo "Timing readrpl"
+
+bench readrpl-verify "\"$bin/readrpl\" -c \"$rpx\" > /dev/null" "$rpx_size"
+bench readrpl-verify-jobs "\"$bin/readrpl\" -j 0 -c \"$rpx\" > /dev/null" "$rpx_size"
+bench readrpl-print "\"$bin/readrpl\" --no-verify -S -s -r \"$rpx\" > /dev/null" "$rpx_size"
+
+
+echo "Timing rplimportgen"
+
+def="$work/bench.def"
+bench rplimportgen-asm \
+      "rm -f \"$work/bench.S\" && \"$bin/rplimportgen\" \"$def\" \"$work/bench.S\" \"$work/bench.ld\"" \
+      "$(file_size "$def")"
+bench rplimportgen-object \
+      "rm -f \"$work/bench.o\" && \"$bin/rplimportgen\" --object \"$def\" \"$work/bench.o\"" \
+      "$(file_size "$def")"
+bench rplimportgen-batch \
+      "rm -rf \"$work/imports\" && mkdir \"$work/imports\" && \"$bin/rplimportgen\" -j 0 --object --batch \"$work/defs\" --output-dir \"$work/imports\""
+
+
+if [ -x "$bin/wuhbtool" ]; then
+   echo "Timing wuhbtool"
+
+   wuhb="$work/bench.wuhb"
+   content="$work/content"
+   content_size=$(du -sk "$content" | awk '{ print $1 * 1024 }')
+   wuhbtool="\"$bin/wuhbtool\" -j 0 --quiet --content=\"$content\" \"$rpx\" \"$wuhb\""
+
+   bench wuhbtool "rm -f \"$wuhb\" && $wuhbtool" "$content_size"
+   bench wuhbtool-dedup "rm -f \"$wuhb\" && $wuhbtool --dedup" "$content_size"
+   bench wuhbtool-update "$wuhbtool --update" "$content_size"
+   bench wuhbtool-list "\"$bin/wuhbtool\" list \"$wuhb\" > /dev/null"
+
+   # Time of every step, from the summary of a single run
+   rm -f "$wuhb"
+   "$bin/wuhbtool" -j 0 --content="$content" "$rpx" "$wuhb" | awk -v version="$version" '
+      /^Summary:/ { summary = 1; next }
+      summary && NF == 3 && $3 == "s" {
+         steps = steps sep "\"" $1 "\":" sprintf("%.3f", $2 * 1000)
+         sep = ","
+      }
+      END { printf "{\"benchmark\":\"wuhbtool-steps\",\"version\":\"%s\",\"steps_ms\":{%s}}\n", version, steps }
+   ' >> "$results"
+fi
+
+
+echo "Timing udplogserver"
+
+# Four consoles sending as fast as they can, the server writing their logs to
+# files. Whatever it can't take is counted as dropped.
+rm -rf "$work/logs"
+"$bin/udplogserver" -o "$work/logs" "$port" > "$work/udplogserver.txt" 2>&1 &
+server=$!
+sleep 1
+
+flood=$("$bin/udpflood" --count $((50000 * scale)) --sources 4 "$port")
+sleep 1
+kill -INT "$server"
+wait "$server" || true
+
+counter() {
+   value=$(sed -n "s/^$1 \\([0-9]*\\) .*/\\1/p" "$work/udplogserver.txt")
+   echo "${value:-null}"
+}
+
+flood=${flood#\{}
+flood=${flood%\}}
+printf '{"benchmark":"udplogserver-ingest","version":"%s",%s,"received":%s,"peak_datagrams_per_second_window":%s,"kernel_drops":%s,"queue_drops":%s}\n' \
+       "$version" "$flood" \
+       "$(counter 'Received')" \
+       "$(counter 'Peak rate:')" \
+       "$(counter 'Dropped by the system:')" \
+       "$(counter "Dropped because output couldn't keep up:")" >> "$results"
+
+
+echo "Results written to $results"
@@ -0,0 +1,215 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "net.h"
+#include "random.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <cstdint>
+#include <excmd.h>
+#include <fmt/base.h>
+#include <fmt/ostream.h>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::cerr;
+using std::cout;
+
+/*
+ * Sends log lines to udplogserver as fast as possible, or at a fixed rate,
+ * from one or more source ports, the way several consoles would, then prints
+ * how many were sent and how long it took as a JSON object.
+ */
+
+#define SERVER_PORT 4405
+
+static void
+close_socket(socket_t fd)
+{
+#ifdef _WIN32
+   closesocket(fd);
+#else
+   close(fd);
+#endif
+}
+
+static void
+show_help(std::ostream& out,
+          const excmd::parser& parser,
+          const std::string& exec_name)
+{
+   fmt::println(out, "Usage:");
+   fmt::println(out, "  {} [options] [port]\n", exec_name);
+   fmt::println(out, "{}", parser.format_help(exec_name));
+   fmt::println(out, "Report bugs to {}", PACKAGE_BUGREPORT);
+}
+
+int main(int argc, char **argv)
+{
+   excmd::parser parser;
+   excmd::option_state options;
+   using excmd::description;
+   using excmd::value;
+
+   unsigned short port = SERVER_PORT;
+   std::string host = "127.0.0.1";
+   int count = 100000;
+   int minSize = 64;
+   int maxSize = 256;
+   int sources = 1;
+   int rate = 0;
+
+   try {
+      parser.global_options()
+         .add_option("h,help",
+                     description { "Show help" })
+         .add_option("version",
+                     description { "Show version" })
+         .add_option("host",
+                     description { "Address the datagrams are sent to (default is 127.0.0.1)" },
+                     value<std::string>{})
+         .add_option("n,count",
+                     description { "Number of datagrams sent from every source (default is 100000)" },
+                     value<int>{})
+         .add_option("min-size",
+                     description { "Smallest datagram in bytes (default is 64)" },
+                     value<int>{})
+         .add_option("max-size",
+                     description { "Largest datagram in bytes (default is 256)" },
+                     value<int>{})
+         .add_option("sources",
+                     description { "Number of sockets sending, each from its own port (default is 1)" },
+                     value<int>{})
+         .add_option("rate",
+                     description { "Datagrams per second from all sources, 0 is as fast as possible (default is 0)" },
+                     value<int>{});
+
+      parser.default_command()
+         .add_argument("port",
+                       description { "Port the datagrams are sent to (default is "
+                                     + std::to_string(SERVER_PORT) + ")" },
+                       value<int>{});
+
+      options = parser.parse(argc, argv);
+   } catch (std::exception &ex) {
+      fmt::println(cerr, "Error parsing command line: {}", ex.what());
+      return -1;
+   }
+
+   if (options.has("help")) {
+      show_help(cout, parser, argv[0]);
+      return 0;
+   }
+
+   if (options.has("version")) {
+      fmt::println(cout, "{} ({}) {}", argv[0], PACKAGE_NAME, PACKAGE_VERSION);
+      return 0;
+   }
+
+   if (options.has("port"))
+      port = options.get<int>("port");
+   if (options.has("host"))
+      host = options.get<std::string>("host");
+   if (options.has("count"))
+      count = options.get<int>("count");
+   if (options.has("min-size"))
+      minSize = options.get<int>("min-size");
+   if (options.has("max-size"))
+      maxSize = options.get<int>("max-size");
+   if (options.has("sources"))
+      sources = options.get<int>("sources");
+   if (options.has("rate"))
+      rate = options.get<int>("rate");
+
+   if (count < 0 || sources < 1 || rate < 0 ||
+       minSize < 1 || maxSize < minSize || maxSize > 65507) {
+      fmt::println(cerr, "Invalid count, sources, rate or datagram size.");
+      return -1;
+   }
+
+#ifdef _WIN32
+   WSADATA wsaData;
+   if (WSAStartup(MAKEWORD(2, 2), &wsaData) == SOCKET_ERROR) {
+      fmt::println(cerr, "WSAStartup() failed");
+      return -1;
+   }
+#endif
+
+   sockaddr_in addr = {};
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+      fmt::println(cerr, "Invalid address: {}", host);
+      return -1;
+   }
+
+   std::vector<socket_t> fds;
+   for (int i = 0; i < sources; ++i) {
+      auto fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+#ifdef _WIN32
+      if (fd == INVALID_SOCKET) {
+#else
+      if (fd < 0) {
+#endif
+         fmt::println(cerr, "Failed to create socket: {}", errno_to_string());
+         return -1;
+      }
+      fds.push_back(fd);
+   }
+
+   // Lines of text like the ones a console sends, with a sequence number to find
+   // missing ones in the logs
+   BenchRandom random{1};
+   std::string payload;
+   uint64_t sent = 0;
+   uint64_t bytes = 0;
+   uint64_t failed = 0;
+
+   using Clock = std::chrono::steady_clock;
+   auto start = Clock::now();
+   auto interval = rate ? std::chrono::nanoseconds{1000000000 / rate} : std::chrono::nanoseconds{0};
+
+   for (int seq = 0; seq < count; ++seq) {
+      for (int source = 0; source < sources; ++source) {
+         auto size = minSize + random.below(maxSize - minSize + 1);
+         payload = fmt::format("bench source {} line {} ", source, seq);
+         payload.resize(size - 1, '.');
+         payload.push_back('\n');
+
+         if (rate)
+            std::this_thread::sleep_until(start + interval * sent);
+
+         auto res = sendto(fds[source],
+                           payload.data(), static_cast<int>(payload.size()),
+                           0,
+                           reinterpret_cast<const sockaddr*>(&addr), sizeof addr);
+         if (res < 0) {
+            ++failed;
+            continue;
+         }
+
+         ++sent;
+         bytes += payload.size();
+      }
+   }
+
+   auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+   for (auto fd : fds)
+      close_socket(fd);
+#ifdef _WIN32
+   WSACleanup();
+#endif
+
+   fmt::println(cout,
+                "{{\"sent\":{},\"failed\":{},\"bytes\":{},\"seconds\":{:.6f},\"datagrams_per_second\":{:.0f}}}",
+                sent, failed, bytes, seconds, seconds > 0 ? sent / seconds : 0.0);
+   return 0;
+}
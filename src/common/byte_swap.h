@@ -0,0 +1,181 @@
+#pragma once
+#include "utils.h"
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BYTE_SWAP_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#ifdef BYTE_SWAP_X86
+
+// The AVX2 and SSSE3 kernels are built for their own targets and picked from
+// what the CPU supports, so a default build uses them too. Checked once:
+// 2 is AVX2, 1 is SSSE3, 0 is neither.
+inline int
+byte_swap_x86_level()
+{
+   static const int level = __builtin_cpu_supports("avx2") ? 2 :
+                            __builtin_cpu_supports("ssse3") ? 1 : 0;
+   return level;
+}
+
+// Shuffle that reverses the bytes of every Size sized word of 16 bytes
+template<std::size_t Size>
+__attribute__((target("ssse3")))
+inline __m128i
+byte_swap_mask()
+{
+   if constexpr (Size == 2) {
+      return _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+   } else if constexpr (Size == 4) {
+      return _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+   } else {
+      return _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+   }
+}
+
+template<std::size_t Size>
+__attribute__((target("ssse3")))
+inline std::size_t
+byte_swap_block_ssse3(const unsigned char *src,
+                      unsigned char *dst,
+                      std::size_t bytes)
+{
+   auto mask = byte_swap_mask<Size>();
+   auto done = std::size_t { 0 };
+   for (; done + 16 <= bytes; done += 16) {
+      auto value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + done));
+      value = _mm_shuffle_epi8(value, mask);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + done), value);
+   }
+   return done;
+}
+
+template<std::size_t Size>
+__attribute__((target("avx2")))
+inline std::size_t
+byte_swap_block_avx2(const unsigned char *src,
+                     unsigned char *dst,
+                     std::size_t bytes)
+{
+   // The shuffle works within each 16 byte lane, so the same mask goes in both
+   auto mask = _mm256_broadcastsi128_si256(byte_swap_mask<Size>());
+   auto done = std::size_t { 0 };
+   for (; done + 32 <= bytes; done += 32) {
+      auto value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + done));
+      value = _mm256_shuffle_epi8(value, mask);
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + done), value);
+   }
+   return done + byte_swap_block_ssse3<Size>(src + done, dst + done, bytes - done);
+}
+
+#endif
+
+// Swaps the bytes of every Size sized word in [src, src + bytes) into dst, 16 or
+// 32 bytes at a time, using the widest instructions the CPU supports. Returns
+// how many bytes were done, the remaining ones are left to the caller.
+template<std::size_t Size>
+inline std::size_t
+byte_swap_block(const unsigned char *src,
+                unsigned char *dst,
+                std::size_t bytes)
+{
+   static_assert(Size == 2 || Size == 4 || Size == 8,
+                 "byte_swap_block invalid word size");
+
+   auto done = std::size_t { 0 };
+
+#ifdef BYTE_SWAP_X86
+   auto level = byte_swap_x86_level();
+   if (level == 2) {
+      return byte_swap_block_avx2<Size>(src, dst, bytes);
+   } else if (level == 1) {
+      return byte_swap_block_ssse3<Size>(src, dst, bytes);
+   }
+#endif
+
+#if defined(__SSE2__)
+   // No byte shuffle, so reverse the 16 bit halves of each word, then the bytes
+   // of each half
+   for (; done + 16 <= bytes; done += 16) {
+      auto value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + done));
+      if constexpr (Size == 4) {
+         value = _mm_shufflelo_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+         value = _mm_shufflehi_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+      } else if constexpr (Size == 8) {
+         value = _mm_shufflelo_epi16(value, _MM_SHUFFLE(0, 1, 2, 3));
+         value = _mm_shufflehi_epi16(value, _MM_SHUFFLE(0, 1, 2, 3));
+      }
+      value = _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + done), value);
+   }
+#elif defined(__ARM_NEON)
+   for (; done + 16 <= bytes; done += 16) {
+      auto value = vld1q_u8(src + done);
+      if constexpr (Size == 2) {
+         value = vrev16q_u8(value);
+      } else if constexpr (Size == 4) {
+         value = vrev32q_u8(value);
+      } else {
+         value = vrev64q_u8(value);
+      }
+      vst1q_u8(dst + done, value);
+   }
+#endif
+
+   return done;
+}
+
+// Swaps the endian of count values of Type from src into dst, which may be the
+// same array. Neither has to be aligned, so both can point into a section.
+template<typename Type>
+inline void
+byte_swap_array(const void *src,
+                void *dst,
+                std::size_t count)
+{
+   static_assert(std::is_trivially_copyable<Type>::value,
+                 "byte_swap_array invalid type: not trivially copyable");
+
+   auto in = static_cast<const unsigned char *>(src);
+   auto out = static_cast<unsigned char *>(dst);
+   auto bytes = count * sizeof(Type);
+
+   for (auto i = byte_swap_block<sizeof(Type)>(in, out, bytes); i < bytes; i += sizeof(Type)) {
+      Type value;
+      std::memcpy(&value, in + i, sizeof(Type));
+      value = byte_swap(value);
+      std::memcpy(out + i, &value, sizeof(Type));
+   }
+}
+
+// Converts count big-endian records from src, made only of Word sized fields like
+// elf::Rela, into Record, their counterpart in native order.
+template<typename Word, typename Record>
+inline void
+records_to_native(const void *src,
+                  Record *dst,
+                  std::size_t count)
+{
+   static_assert(sizeof(Record) % sizeof(Word) == 0,
+                 "records_to_native invalid record: not made of words");
+   byte_swap_array<Word>(src, dst, count * (sizeof(Record) / sizeof(Word)));
+}
+
+// Writes count native records from src back to big-endian records in dst.
+template<typename Word, typename Record>
+inline void
+records_from_native(const Record *src,
+                    void *dst,
+                    std::size_t count)
+{
+   static_assert(sizeof(Record) % sizeof(Word) == 0,
+                 "records_from_native invalid record: not made of words");
+   byte_swap_array<Word>(src, dst, count * (sizeof(Record) / sizeof(Word)));
+}
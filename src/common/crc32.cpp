@@ -0,0 +1,177 @@
+#include "crc32.h"
+
+#include <algorithm>
+#include <zlib.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32_X86_PCLMUL
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32_ARM
+#include <arm_acle.h>
+#endif
+
+#ifdef CRC32_X86_PCLMUL
+
+/**
+ * Check once whether the CPU supports PCLMULQDQ and SSE4.1.
+ */
+static bool
+hasPclmul()
+{
+   static const bool result = __builtin_cpu_supports("pclmul") &&
+                              __builtin_cpu_supports("sse4.1");
+   return result;
+}
+
+
+/**
+ * Multiply both halves of x by the folding constants, and add the next block.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i
+fold(__m128i x,
+     __m128i k,
+     __m128i next)
+{
+   auto lo = _mm_clmulepi64_si128(x, k, 0x00);
+   auto hi = _mm_clmulepi64_si128(x, k, 0x11);
+   return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+
+/**
+ * Fold 16 bytes at a time with carry-less multiplications, then Barrett reduce
+ * to 32 bits, as described in Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction".
+ *
+ * size must be a multiple of 16, and at least 64. crc is not inverted.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t
+crc32Pclmul(uint32_t crc,
+            const uint8_t *data,
+            std::size_t size)
+{
+   // Constants for the bit-reflected CRC-32 polynomial
+   alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+   alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+   alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+   alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+   auto load = [](const uint8_t *ptr) {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+   };
+
+   auto x1 = _mm_xor_si128(load(data), _mm_cvtsi32_si128(static_cast<int>(crc)));
+   auto x2 = load(data + 0x10);
+   auto x3 = load(data + 0x20);
+   auto x4 = load(data + 0x30);
+   data += 64;
+   size -= 64;
+
+   // Fold 64 bytes at a time
+   auto k = _mm_load_si128(reinterpret_cast<const __m128i *>(k1k2));
+   while (size >= 64) {
+      x1 = fold(x1, k, load(data));
+      x2 = fold(x2, k, load(data + 0x10));
+      x3 = fold(x3, k, load(data + 0x20));
+      x4 = fold(x4, k, load(data + 0x30));
+      data += 64;
+      size -= 64;
+   }
+
+   // Fold into 128 bits
+   k = _mm_load_si128(reinterpret_cast<const __m128i *>(k3k4));
+   x1 = fold(x1, k, x2);
+   x1 = fold(x1, k, x3);
+   x1 = fold(x1, k, x4);
+
+   // Fold the remaining 16 byte blocks
+   while (size >= 16) {
+      x1 = fold(x1, k, load(data));
+      data += 16;
+      size -= 16;
+   }
+
+   // Fold 128 bits to 64 bits
+   auto mask = _mm_setr_epi32(~0, 0, ~0, 0);
+   x2 = _mm_clmulepi64_si128(x1, k, 0x10);
+   x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+   k = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(k5k0));
+   x2 = _mm_srli_si128(x1, 4);
+   x1 = _mm_and_si128(x1, mask);
+   x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k, 0x00), x2);
+
+   // Barrett reduce to 32 bits
+   k = _mm_load_si128(reinterpret_cast<const __m128i *>(poly));
+   x2 = _mm_and_si128(x1, mask);
+   x2 = _mm_clmulepi64_si128(x2, k, 0x10);
+   x2 = _mm_and_si128(x2, mask);
+   x2 = _mm_clmulepi64_si128(x2, k, 0x00);
+   x1 = _mm_xor_si128(x1, x2);
+
+   return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+#endif // CRC32_X86_PCLMUL
+
+#ifdef CRC32_ARM
+
+static uint32_t
+crc32Arm(uint32_t crc,
+         const uint8_t *data,
+         std::size_t size)
+{
+   crc = ~crc;
+
+   while (size >= 8) {
+      uint64_t value;
+      __builtin_memcpy(&value, data, 8);
+      crc = __crc32d(crc, value);
+      data += 8;
+      size -= 8;
+   }
+
+   while (size--) {
+      crc = __crc32b(crc, *data++);
+   }
+
+   return ~crc;
+}
+
+#endif // CRC32_ARM
+
+uint32_t
+crc32_update(uint32_t crc,
+             const void *data,
+             std::size_t size)
+{
+   auto bytes = static_cast<const uint8_t *>(data);
+
+#if defined(CRC32_ARM)
+   return crc32Arm(crc, bytes, size);
+#else
+#if defined(CRC32_X86_PCLMUL)
+   if (size >= 64 && hasPclmul()) {
+      auto blocks = size & ~std::size_t { 15 };
+      crc = ~crc32Pclmul(~crc, bytes, blocks);
+      bytes += blocks;
+      size -= blocks;
+   }
+#endif
+
+   // zlib takes the size as an unsigned int
+   while (size) {
+      auto chunk = static_cast<uInt>(std::min<std::size_t>(size, 0x40000000u));
+      crc = static_cast<uint32_t>(crc32(crc, bytes, chunk));
+      bytes += chunk;
+      size -= chunk;
+   }
+
+   return crc;
+#endif
+}
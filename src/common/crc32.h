@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Updates a CRC-32 with more data, with the same result as zlib's crc32().
+//
+// Uses the carry-less multiply instructions on x86 and the CRC32 instructions
+// on ARMv8 when the CPU has them, and falls back to zlib otherwise. A new CRC
+// starts from 0.
+uint32_t
+crc32_update(uint32_t crc,
+             const void *data,
+             std::size_t size);
@@ -0,0 +1,217 @@
+#include "elf_object.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fmt/base.h>
+#include <fmt/format.h>
+
+uint32_t
+ElfObjectWriter::addSection(const std::string &name,
+                            uint32_t type,
+                            uint32_t flags,
+                            uint32_t addralign,
+                            std::vector<char> data)
+{
+   auto &section = mSections.emplace_back();
+   section.name = name;
+   section.header = elf::SectionHeader { };
+   section.header.type = type;
+   section.header.flags = flags;
+   section.header.addralign = addralign;
+   section.header.size = static_cast<uint32_t>(data.size());
+   section.data = std::move(data);
+
+   // Index 0 is the null section
+   return static_cast<uint32_t>(mSections.size());
+}
+
+uint32_t
+ElfObjectWriter::addSymbol(const std::string &name,
+                           uint32_t type,
+                           uint32_t section,
+                           uint32_t value,
+                           uint32_t size)
+{
+   if (mStrings.empty()) {
+      mStrings.push_back('\0');
+   }
+
+   auto &symbol = mSymbols.emplace_back();
+   symbol.name = static_cast<uint32_t>(mStrings.size());
+   symbol.value = value;
+   symbol.size = size;
+   symbol.info = static_cast<uint8_t>((elf::STB_GLOBAL << 4) | (type & 0xf));
+   symbol.other = uint8_t { 0 };
+   symbol.shndx = static_cast<uint16_t>(section);
+
+   mStrings.append(name);
+   mStrings.push_back('\0');
+
+   // Index 0 is the null symbol
+   return static_cast<uint32_t>(mSymbols.size());
+}
+
+void
+ElfObjectWriter::addRelocation(uint32_t section,
+                               uint32_t offset,
+                               uint32_t symbol,
+                               uint32_t type,
+                               int32_t addend)
+{
+   auto &rela = mSections[section - 1].relocations.emplace_back();
+   rela.offset = offset;
+   rela.info = (symbol << 8) | (type & 0xff);
+   rela.addend = addend;
+}
+
+bool
+ElfObjectWriter::write(std::ostream &out,
+                       std::string &error) const
+{
+   // Every section index must be below SHN_LORESERVE to fit in a symbol's shndx
+   auto numRelaSections = 0u;
+   for (const auto &section : mSections) {
+      if (!section.relocations.empty()) {
+         numRelaSections++;
+      }
+   }
+
+   auto numSections = 1 + mSections.size() + numRelaSections + 3;
+   if (numSections >= elf::SHN_LORESERVE) {
+      error = fmt::format("Too many sections for one object file: {}", numSections);
+      return false;
+   }
+
+   std::vector<elf::SectionHeader> headers(numSections, elf::SectionHeader { });
+   std::vector<const char *> contents(numSections, nullptr);
+   std::string shStrings(1, '\0');
+   auto addName = [&](elf::SectionHeader &header, const std::string &name) {
+      header.name = static_cast<uint32_t>(shStrings.size());
+      shStrings.append(name);
+      shStrings.push_back('\0');
+   };
+
+   auto symTabIndex = static_cast<uint32_t>(1 + mSections.size() + numRelaSections);
+   auto strTabIndex = symTabIndex + 1;
+   auto shStrTabIndex = symTabIndex + 2;
+
+   for (auto i = 0u; i < mSections.size(); ++i) {
+      headers[i + 1] = mSections[i].header;
+      addName(headers[i + 1], mSections[i].name);
+      contents[i + 1] = mSections[i].data.data();
+   }
+
+   auto relaIndex = 1 + mSections.size();
+   for (auto i = 0u; i < mSections.size(); ++i) {
+      const auto &section = mSections[i];
+      if (section.relocations.empty()) {
+         continue;
+      }
+
+      auto &header = headers[relaIndex];
+      addName(header, ".rela" + section.name);
+      header.type = uint32_t { elf::SHT_RELA };
+      header.size = static_cast<uint32_t>(section.relocations.size() * sizeof(elf::Rela));
+      header.link = symTabIndex;
+      header.info = i + 1;
+      header.addralign = 4u;
+      header.entsize = static_cast<uint32_t>(sizeof(elf::Rela));
+      contents[relaIndex] = reinterpret_cast<const char *>(section.relocations.data());
+      relaIndex++;
+   }
+
+   // Every symbol after the null one is global
+   auto nullSymbol = elf::Symbol { };
+   std::vector<elf::Symbol> symbols;
+   symbols.reserve(mSymbols.size() + 1);
+   symbols.push_back(nullSymbol);
+   symbols.insert(symbols.end(), mSymbols.begin(), mSymbols.end());
+
+   auto strings = mStrings.empty() ? std::string(1, '\0') : mStrings;
+
+   auto &symTab = headers[symTabIndex];
+   addName(symTab, ".symtab");
+   symTab.type = uint32_t { elf::SHT_SYMTAB };
+   symTab.size = static_cast<uint32_t>(symbols.size() * sizeof(elf::Symbol));
+   symTab.link = strTabIndex;
+   symTab.info = 1u;
+   symTab.addralign = 4u;
+   symTab.entsize = static_cast<uint32_t>(sizeof(elf::Symbol));
+   contents[symTabIndex] = reinterpret_cast<const char *>(symbols.data());
+
+   auto &strTab = headers[strTabIndex];
+   addName(strTab, ".strtab");
+   strTab.type = uint32_t { elf::SHT_STRTAB };
+   strTab.size = static_cast<uint32_t>(strings.size());
+   strTab.addralign = 1u;
+   contents[strTabIndex] = strings.data();
+
+   // Add the name before taking the size, since it is in the table too
+   auto &shStrTab = headers[shStrTabIndex];
+   addName(shStrTab, ".shstrtab");
+   shStrTab.type = uint32_t { elf::SHT_STRTAB };
+   shStrTab.size = static_cast<uint32_t>(shStrings.size());
+   shStrTab.addralign = 1u;
+   contents[shStrTabIndex] = shStrings.data();
+
+   // Lay out the section data after the file header, then the section headers
+   auto offset = static_cast<uint32_t>(sizeof(elf::Header));
+   for (auto i = 1u; i < numSections; ++i) {
+      auto &header = headers[i];
+      offset = align_up(offset, std::max<uint32_t>(header.addralign, 1u));
+      header.offset = offset;
+      offset += header.size;
+   }
+
+   auto shoff = align_up(offset, 4);
+
+   auto header = elf::Header { };
+   header.magic = elf::HeaderMagic;
+   header.fileClass = uint8_t { elf::ELFCLASS32 };
+   header.encoding = uint8_t { elf::ELFDATA2MSB };
+   header.elfVersion = uint8_t { elf::EV_CURRENT };
+   header.abi = uint16_t { 0 };
+   memset(&header.pad, 0, 7);
+   header.type = uint16_t { elf::ET_REL };
+   header.machine = uint16_t { elf::EM_PPC };
+   header.version = 1u;
+   header.entry = 0u;
+   header.phoff = 0u;
+   header.shoff = shoff;
+   header.flags = 0u;
+   header.ehsize = static_cast<uint16_t>(sizeof(elf::Header));
+   header.phentsize = uint16_t { 0 };
+   header.phnum = uint16_t { 0 };
+   header.shentsize = static_cast<uint16_t>(sizeof(elf::SectionHeader));
+   header.shnum = static_cast<uint16_t>(numSections);
+   header.shstrndx = static_cast<uint16_t>(shStrTabIndex);
+
+   auto position = static_cast<uint32_t>(sizeof(elf::Header));
+   auto padTo = [&](uint32_t next) {
+      static const char zeroes[16] = { };
+      while (position < next) {
+         auto size = std::min<uint32_t>(next - position, sizeof(zeroes));
+         out.write(zeroes, size);
+         position += size;
+      }
+   };
+
+   out.write(reinterpret_cast<const char *>(&header), sizeof(elf::Header));
+   for (auto i = 1u; i < numSections; ++i) {
+      padTo(headers[i].offset);
+      out.write(contents[i], headers[i].size);
+      position += headers[i].size;
+   }
+
+   padTo(shoff);
+   out.write(reinterpret_cast<const char *>(headers.data()),
+             headers.size() * sizeof(elf::SectionHeader));
+
+   if (!out) {
+      error = "Could not write the object file";
+      return false;
+   }
+
+   return true;
+}
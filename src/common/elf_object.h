@@ -0,0 +1,57 @@
+#pragma once
+#include "elf.h"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Builds a big endian PowerPC relocatable object, for code generators that
+// would otherwise write assembly just to have it assembled.
+//
+// Every symbol is global. The relocations of each section are written to a
+// .rela section, before the symbol and string tables at the end.
+class ElfObjectWriter
+{
+public:
+   // Adds a section and returns its index
+   uint32_t
+   addSection(const std::string &name,
+              uint32_t type,
+              uint32_t flags,
+              uint32_t addralign,
+              std::vector<char> data);
+
+   // Adds a global symbol, which is undefined when section is 0, and
+   // returns its index
+   uint32_t
+   addSymbol(const std::string &name,
+             uint32_t type,
+             uint32_t section,
+             uint32_t value,
+             uint32_t size);
+
+   void
+   addRelocation(uint32_t section,
+                 uint32_t offset,
+                 uint32_t symbol,
+                 uint32_t type,
+                 int32_t addend);
+
+   // Fails when there are too many sections for symbols to refer to them
+   bool
+   write(std::ostream &out,
+         std::string &error) const;
+
+private:
+   struct Section
+   {
+      std::string name;
+      elf::SectionHeader header;
+      std::vector<char> data;
+      std::vector<elf::Rela> relocations;
+   };
+
+   std::vector<Section> mSections;
+   std::vector<elf::Symbol> mSymbols;
+   std::string mStrings;
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace hash_detail
+{
+
+constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t Prime3 = 0x165667B19E3779F9ull;
+constexpr uint64_t Prime4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t Prime5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t
+rotl(uint64_t value,
+     int bits)
+{
+   return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t
+read64(const uint8_t *ptr)
+{
+   uint64_t value;
+   std::memcpy(&value, ptr, sizeof(value));
+   return value;
+}
+
+inline uint32_t
+read32(const uint8_t *ptr)
+{
+   uint32_t value;
+   std::memcpy(&value, ptr, sizeof(value));
+   return value;
+}
+
+inline uint64_t
+round(uint64_t acc,
+      uint64_t input)
+{
+   acc += input * Prime2;
+   acc = rotl(acc, 31);
+   return acc * Prime1;
+}
+
+inline uint64_t
+merge(uint64_t acc,
+      uint64_t value)
+{
+   acc ^= round(0, value);
+   return acc * Prime1 + Prime4;
+}
+
+} // namespace hash_detail
+
+// XXH64 hash of a block of memory, for content-addressed lookups.
+//
+// Not a cryptographic hash, so users should still check what they found.
+// Input words are read in host byte order, so the result only matches the
+// reference implementation on little endian hosts.
+inline uint64_t
+hash64(const void *data,
+       std::size_t size,
+       uint64_t seed = 0)
+{
+   using namespace hash_detail;
+   auto ptr = static_cast<const uint8_t *>(data);
+   auto end = ptr + size;
+   uint64_t h;
+
+   if (size >= 32) {
+      auto v1 = seed + Prime1 + Prime2;
+      auto v2 = seed + Prime2;
+      auto v3 = seed;
+      auto v4 = seed - Prime1;
+
+      do {
+         v1 = round(v1, read64(ptr));
+         v2 = round(v2, read64(ptr + 8));
+         v3 = round(v3, read64(ptr + 16));
+         v4 = round(v4, read64(ptr + 24));
+         ptr += 32;
+      } while (end - ptr >= 32);
+
+      h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+      h = merge(h, v1);
+      h = merge(h, v2);
+      h = merge(h, v3);
+      h = merge(h, v4);
+   } else {
+      h = seed + Prime5;
+   }
+
+   h += static_cast<uint64_t>(size);
+
+   while (end - ptr >= 8) {
+      h ^= round(0, read64(ptr));
+      h = rotl(h, 27) * Prime1 + Prime4;
+      ptr += 8;
+   }
+
+   if (end - ptr >= 4) {
+      h ^= static_cast<uint64_t>(read32(ptr)) * Prime1;
+      h = rotl(h, 23) * Prime2 + Prime3;
+      ptr += 4;
+   }
+
+   while (ptr < end) {
+      h ^= static_cast<uint64_t>(*ptr) * Prime5;
+      h = rotl(h, 11) * Prime1;
+      ++ptr;
+   }
+
+   h ^= h >> 33;
+   h *= Prime2;
+   h ^= h >> 29;
+   h *= Prime3;
+   h ^= h >> 32;
+   return h;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <fmt/format.h>
+#include <string>
+#include <string_view>
+
+// Quotes and escapes a string for use as a JSON value
+inline std::string
+escape_json(std::string_view value)
+{
+   std::string result;
+   result.reserve(value.size() + 2);
+   result += '"';
+
+   for (auto c : value) {
+      switch (c) {
+      case '"':
+         result += "\\\"";
+         break;
+      case '\\':
+         result += "\\\\";
+         break;
+      case '\n':
+         result += "\\n";
+         break;
+      case '\t':
+         result += "\\t";
+         break;
+      default:
+         if (static_cast<unsigned char>(c) < 0x20) {
+            result += fmt::format("\\u{:04x}", static_cast<unsigned>(c));
+         } else {
+            result += c;
+         }
+      }
+   }
+
+   result += '"';
+   return result;
+}
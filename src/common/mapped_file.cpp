@@ -0,0 +1,116 @@
+#include "mapped_file.h"
+
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool
+MappedFile::open(const std::string &filename)
+{
+   close();
+
+#ifdef _WIN32
+   auto file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                           nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+   if (file != INVALID_HANDLE_VALUE) {
+      LARGE_INTEGER size;
+      if (GetFileSizeEx(file, &size)) {
+         mSize = static_cast<std::size_t>(size.QuadPart);
+         mOpen = true;
+
+         if (mSize) {
+            mMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mMapping) {
+               mData = static_cast<const char *>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+               if (mData) {
+                  mMapped = true;
+               } else {
+                  CloseHandle(mMapping);
+                  mMapping = nullptr;
+               }
+            }
+         }
+      }
+
+      CloseHandle(file);
+   }
+#else
+   auto fd = ::open(filename.c_str(), O_RDONLY);
+   if (fd >= 0) {
+      struct stat st;
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+         mSize = static_cast<std::size_t>(st.st_size);
+         mOpen = true;
+
+         if (mSize) {
+            auto ptr = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED) {
+               mData = static_cast<const char *>(ptr);
+               mMapped = true;
+            }
+         }
+      }
+
+      ::close(fd);
+   }
+#endif
+
+   if (mOpen && (mMapped || !mSize)) {
+      return true;
+   }
+
+   // Could not map it, read the whole file instead
+   mOpen = false;
+   mSize = 0;
+
+   std::ifstream in { filename, std::ifstream::binary | std::ifstream::ate };
+   if (!in.is_open()) {
+      return false;
+   }
+
+   auto end = in.tellg();
+   if (end < 0) {
+      return false;
+   }
+
+   mBuffer.resize(static_cast<std::size_t>(end));
+   in.seekg(0);
+   if (!in.read(mBuffer.data(), mBuffer.size())) {
+      mBuffer.clear();
+      return false;
+   }
+
+   mData = mBuffer.data();
+   mSize = mBuffer.size();
+   mOpen = true;
+   return true;
+}
+
+void
+MappedFile::close()
+{
+   if (mMapped) {
+#ifdef _WIN32
+      UnmapViewOfFile(mData);
+      CloseHandle(mMapping);
+      mMapping = nullptr;
+#else
+      munmap(const_cast<char *>(mData), mSize);
+#endif
+   }
+
+   mBuffer.clear();
+   mBuffer.shrink_to_fit();
+   mData = nullptr;
+   mSize = 0;
+   mOpen = false;
+   mMapped = false;
+}
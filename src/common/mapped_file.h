@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file.
+//
+// The file is memory mapped when the platform supports it, so only the pages
+// that are actually accessed get read from disk. Otherwise it falls back to
+// reading the whole file into memory.
+class MappedFile
+{
+public:
+   MappedFile() = default;
+   MappedFile(const MappedFile &) = delete;
+   MappedFile &operator =(const MappedFile &) = delete;
+
+   ~MappedFile()
+   {
+      close();
+   }
+
+   bool
+   open(const std::string &filename);
+
+   void
+   close();
+
+   bool
+   isOpen() const
+   {
+      return mOpen;
+   }
+
+   const char *
+   data() const
+   {
+      return mData;
+   }
+
+   std::size_t
+   size() const
+   {
+      return mSize;
+   }
+
+private:
+   const char *mData = nullptr;
+   std::size_t mSize = 0;
+   bool mOpen = false;
+   bool mMapped = false;
+   std::vector<char> mBuffer;
+#ifdef _WIN32
+   void *mMapping = nullptr;
+#endif
+};
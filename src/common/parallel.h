@@ -0,0 +1,77 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Turns a user supplied job count into a thread count, 0 means one thread per
+// hardware thread
+inline unsigned
+resolve_jobs(int jobs)
+{
+   if (jobs > 0) {
+      return static_cast<unsigned>(jobs);
+   }
+
+   return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Calls func(i) for every i in [0, count), using up to jobs threads.
+//
+// Indices are handed out in increasing order, so callers that want the largest
+// work items to start first should sort them beforehand. func must be safe to
+// call concurrently for distinct indices. With a single job everything runs on
+// the calling thread. The first exception thrown by func is rethrown once all
+// threads have stopped.
+template<typename Func>
+void
+parallel_for(std::size_t count,
+             unsigned jobs,
+             Func &&func)
+{
+   jobs = static_cast<unsigned>(std::min<std::size_t>(jobs, count));
+
+   if (jobs <= 1) {
+      for (auto i = std::size_t { 0 }; i < count; ++i) {
+         func(i);
+      }
+      return;
+   }
+
+   std::atomic<std::size_t> next { 0 };
+   std::exception_ptr error;
+   std::mutex errorMutex;
+
+   auto worker = [&]() {
+      for (auto i = next++; i < count; i = next++) {
+         try {
+            func(i);
+         } catch (...) {
+            std::lock_guard lock { errorMutex };
+            if (!error) {
+               error = std::current_exception();
+            }
+            next = count;
+         }
+      }
+   };
+
+   std::vector<std::thread> threads;
+   threads.reserve(jobs - 1);
+   for (auto i = 1u; i < jobs; ++i) {
+      threads.emplace_back(worker);
+   }
+
+   worker();
+
+   for (auto &thread : threads) {
+      thread.join();
+   }
+
+   if (error) {
+      std::rethrow_exception(error);
+   }
+}
@@ -0,0 +1,337 @@
+#include "rpl_reader.h"
+#include "crc32.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fmt/base.h>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+#include <iostream>
+#include <zlib.h>
+
+using std::cerr;
+
+// Best possible compression ratio of deflate
+static constexpr auto MaxDeflateRatio = 1032u;
+
+// Deflated sections are decoded this many bytes at a time
+static constexpr auto InflateChunkSize = uint32_t { 64 * 1024 };
+
+uint32_t
+getSectionIndex(const Rpl &rpl,
+                const Section &section)
+{
+   return static_cast<uint32_t>(&section - &rpl.sections[0]);
+}
+
+/**
+ * Checks that the data of a section is inside of the file, and for a deflated
+ * section reads the inflated size which precedes the deflated stream.
+ */
+static bool
+sGetSectionSource(const Section &section,
+                  const char *&src,
+                  size_t &size,
+                  uint32_t &inflatedSize,
+                  std::string &error)
+{
+   auto offset = static_cast<size_t>(section.header.offset);
+   size = static_cast<size_t>(section.header.size);
+   if (offset > section.file->size() || size > section.file->size() - offset) {
+      error = fmt::format("Section data at offset 0x{:X} with size 0x{:X} is outside of the file",
+                          offset, size);
+      return false;
+   }
+
+   src = section.file->data() + offset;
+   if (!(section.header.flags & elf::SHF_DEFLATED)) {
+      inflatedSize = static_cast<uint32_t>(size);
+      return true;
+   }
+
+   // Read the original size
+   if (size < sizeof(uint32_t)) {
+      error = "Deflated section is too small to contain its inflated size";
+      return false;
+   }
+
+   memcpy(&inflatedSize, src, sizeof(uint32_t));
+   inflatedSize = byte_swap(inflatedSize);
+
+   // Deflate can not compress better than this, so a larger size is corrupt
+   if (inflatedSize / MaxDeflateRatio > size) {
+      error = fmt::format("Deflated section of 0x{:X} bytes can not inflate to 0x{:X} bytes",
+                          size, inflatedSize);
+      return false;
+   }
+
+   src += sizeof(uint32_t);
+   size -= sizeof(uint32_t);
+   return true;
+}
+
+/**
+ * Inflates a deflated stream of at most inflatedSize bytes, InflateChunkSize
+ * bytes at a time, and passes every decoded chunk to consume. The data is
+ * decoded to out when it is not null, otherwise every chunk reuses chunk.
+ *
+ * The number of bytes decoded, which can be less than inflatedSize, is
+ * returned in decodedSize.
+ */
+template<typename Consume>
+static bool
+sInflate(const char *src,
+         size_t size,
+         uint32_t inflatedSize,
+         char *out,
+         char *chunk,
+         uint32_t &decodedSize,
+         std::string &error,
+         Consume &&consume)
+{
+   auto stream = z_stream {};
+   auto ret = inflateInit(&stream);
+   if (ret != Z_OK) {
+      error = fmt::format("Couldn't decompress .rpx section because inflateInit returned {}", ret);
+      return false;
+   }
+
+   stream.avail_in = static_cast<uInt>(size);
+   stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(src));
+   decodedSize = 0;
+
+   while (true) {
+      auto dst = out ? out + decodedSize : chunk;
+      auto dstSize = std::min<uint32_t>(InflateChunkSize, inflatedSize - decodedSize);
+      stream.avail_out = static_cast<uInt>(dstSize);
+      stream.next_out = reinterpret_cast<Bytef *>(dst);
+
+      // Once the output is full, this fails with Z_BUF_ERROR unless the
+      // stream ends here
+      ret = inflate(&stream, Z_NO_FLUSH);
+
+      auto produced = dstSize - stream.avail_out;
+      consume(dst, produced);
+      decodedSize += produced;
+
+      if (ret != Z_OK) {
+         break;
+      }
+   }
+
+   inflateEnd(&stream);
+
+   if (ret != Z_STREAM_END) {
+      error = fmt::format("Couldn't decompress .rpx section because inflate returned {}", ret);
+      return false;
+   }
+
+   return true;
+}
+
+bool
+Section::load(std::string &error) const
+{
+   if (loaded) {
+      return !failed;
+   }
+
+   loaded = true;
+   if (header.type == elf::SHT_NOBITS || !header.size) {
+      return true;
+   }
+
+   failed = true;
+   auto src = static_cast<const char *>(nullptr);
+   auto size = size_t { 0 };
+   auto inflatedSize = uint32_t { 0 };
+   if (!sGetSectionSource(*this, src, size, inflatedSize, error)) {
+      return false;
+   }
+
+   if (!(header.flags & elf::SHF_DEFLATED)) {
+      contents.borrow(src, size);
+      failed = false;
+      return true;
+   }
+
+   // A stream which ends early leaves the rest of the contents zeroed
+   auto decodedSize = uint32_t { 0 };
+   auto inflated = std::vector<char>(inflatedSize);
+   if (!sInflate(src, size, inflatedSize, inflated.data(), nullptr, decodedSize, error,
+                 [](const char *, size_t) { })) {
+      return false;
+   }
+
+   contents = std::move(inflated);
+   failed = false;
+   return true;
+}
+
+bool
+Section::scan(std::string &error) const
+{
+   if (scanned) {
+      return !failed;
+   }
+
+   scanned = true;
+
+   // Everything but the program data is read again by the checks, so keep it
+   if (!loaded && header.type != elf::SHT_PROGBITS) {
+      load(error);
+   }
+
+   if (loaded) {
+      if (!failed) {
+         crc = crc32_update(0, contents.data(), contents.size());
+         inflatedSize = static_cast<uint32_t>(contents.size());
+      }
+
+      return !failed;
+   }
+
+   if (header.type == elf::SHT_NOBITS || !header.size) {
+      return true;
+   }
+
+   failed = true;
+   auto src = static_cast<const char *>(nullptr);
+   auto size = size_t { 0 };
+   auto declaredSize = uint32_t { 0 };
+   if (!sGetSectionSource(*this, src, size, declaredSize, error)) {
+      return false;
+   }
+
+   if (!(header.flags & elf::SHF_DEFLATED)) {
+      crc = crc32_update(0, src, size);
+      inflatedSize = declaredSize;
+      failed = false;
+      return true;
+   }
+
+   auto decodedSize = uint32_t { 0 };
+   auto chunk = std::vector<char>(std::min<uint32_t>(InflateChunkSize, declaredSize));
+   auto value = uint32_t { 0 };
+   if (!sInflate(src, size, declaredSize, nullptr, chunk.data(), decodedSize, error,
+                 [&](const char *data, size_t dataSize) {
+                    value = crc32_update(value, data, dataSize);
+                 })) {
+      return false;
+   }
+
+   // Same as the zeroed end of the contents after load
+   std::fill(chunk.begin(), chunk.end(), 0);
+   while (decodedSize < declaredSize) {
+      auto zeroes = std::min<uint32_t>(static_cast<uint32_t>(chunk.size()),
+                                       declaredSize - decodedSize);
+      value = crc32_update(value, chunk.data(), zeroes);
+      decodedSize += zeroes;
+   }
+
+   crc = value;
+   inflatedSize = declaredSize;
+   failed = false;
+   return true;
+}
+
+const SectionData &
+Section::data() const
+{
+   if (!loaded) {
+      std::string error;
+      if (!load(error)) {
+         fmt::println(cerr, "{}", error);
+         fmt::println(cerr, "Error reading section {}", index);
+      }
+   }
+
+   return contents;
+}
+
+bool
+readRpl(const MappedFile &file,
+        Rpl &rpl,
+        std::ostream &err)
+{
+   if (file.size() < sizeof(rpl.header)) {
+      fmt::println(err, "File is too small to contain an ELF header");
+      return false;
+   }
+
+   memcpy(&rpl.header, file.data(), sizeof(rpl.header));
+   rpl.fileSize = static_cast<uint32_t>(file.size());
+
+   if (rpl.header.magic != elf::HeaderMagic) {
+      fmt::println(err, "Invalid ELF magic header: {:08X}", rpl.header.magic.value());
+      return false;
+   }
+
+   auto shentsize = rpl.header.shentsize ?
+                    static_cast<size_t>(rpl.header.shentsize) :
+                    sizeof(elf::SectionHeader);
+   auto shoff = static_cast<size_t>(rpl.header.shoff);
+
+   if (shentsize < sizeof(elf::SectionHeader) ||
+       shoff > file.size() ||
+       (file.size() - shoff) / shentsize < rpl.header.shnum) {
+      fmt::println(err, "Section headers are outside of the file");
+      return false;
+   }
+
+   rpl.sections.resize(rpl.header.shnum);
+   for (auto i = 0u; i < rpl.sections.size(); ++i) {
+      auto &section = rpl.sections[i];
+      memcpy(&section.header, file.data() + shoff + shentsize * i,
+             sizeof(elf::SectionHeader));
+      section.file = &file;
+      section.index = i;
+   }
+
+   // Set section names
+   if (rpl.header.shstrndx < rpl.sections.size()) {
+      std::string error;
+      auto &shStrTab = rpl.sections[rpl.header.shstrndx];
+      if (!shStrTab.load(error)) {
+         fmt::println(err, "{}", error);
+         fmt::println(err, "Error reading section {}", shStrTab.index);
+         return true;
+      }
+
+      const auto &names = shStrTab.data();
+      for (auto &section : rpl.sections) {
+         auto offset = static_cast<size_t>(section.header.name);
+         if (offset < names.size()) {
+            section.name = std::string { names.data() + offset,
+                                         strnlen(names.data() + offset, names.size() - offset) };
+         }
+      }
+   }
+
+   return true;
+}
+
+bool
+scanSections(const Rpl &rpl,
+             unsigned jobs,
+             std::ostream &err)
+{
+   std::vector<std::string> errors(rpl.sections.size());
+   parallel_for(rpl.sections.size(), jobs, [&](size_t i) {
+      rpl.sections[i].scan(errors[i]);
+   });
+
+   for (auto i = 0u; i < errors.size(); ++i) {
+      if (rpl.sections[i].readFailed()) {
+         // Sections which failed before were already reported
+         if (!errors[i].empty()) {
+            fmt::println(err, "{}", errors[i]);
+            fmt::println(err, "Error reading section {}", i);
+         }
+         return false;
+      }
+   }
+
+   return true;
+}
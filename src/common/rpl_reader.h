@@ -0,0 +1,86 @@
+#pragma once
+#include "elf.h"
+#include "mapped_file.h"
+#include "section_data.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+// A section of an RPL mapped in memory. Its data is used in place, unless it has
+// to be inflated.
+struct Section
+{
+   elf::SectionHeader header;
+   std::string name;
+
+   // Returns the section data, which is read and inflated from the file the
+   // first time it is needed. Prints the error and returns empty data when
+   // the section can not be read.
+   const SectionData &
+   data() const;
+
+   // Reads the section data if that was not done yet, without printing
+   // errors. Can be called concurrently for different sections.
+   bool
+   load(std::string &error) const;
+
+   // Decodes the section data once to compute its crc and inflated size.
+   // Program data is not kept in memory and deflated program data is inflated
+   // in chunks, so memory use does not depend on its size. Other sections are
+   // loaded. Can be called concurrently for different sections.
+   bool
+   scan(std::string &error) const;
+
+   // Size of the section data, scanning it first if needed
+   uint32_t
+   dataSize() const
+   {
+      if (loaded) {
+         return static_cast<uint32_t>(contents.size());
+      }
+
+      std::string error;
+      scan(error);
+      return inflatedSize;
+   }
+
+   bool
+   readFailed() const
+   {
+      return (loaded || scanned) && failed;
+   }
+
+   const MappedFile *file = nullptr;
+   uint32_t index = 0;
+   mutable bool loaded = false;
+   mutable bool scanned = false;
+   mutable bool failed = false;
+   mutable uint32_t crc = 0;
+   mutable uint32_t inflatedSize = 0;
+   mutable SectionData contents;
+};
+
+struct Rpl
+{
+   elf::Header header;
+   uint32_t fileSize;
+   std::vector<Section> sections;
+};
+
+uint32_t
+getSectionIndex(const Rpl &rpl,
+                const Section &section);
+
+// Reads the ELF header and the section headers and names of file, which must
+// outlive rpl. Errors are printed to err.
+bool
+readRpl(const MappedFile &file,
+        Rpl &rpl,
+        std::ostream &err);
+
+// Scans the data of every section using up to jobs threads, errors are
+// printed to err in section order.
+bool
+scanSections(const Rpl &rpl,
+             unsigned jobs,
+             std::ostream &err);
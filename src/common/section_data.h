@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <span>
+#include <vector>
+
+/**
+ * Section contents, either borrowed from a mapped file or owned.
+ *
+ * Passes that only read the data use it in place. Anything that modifies it
+ * must go through mutate(), which copies borrowed data on first use.
+ */
+class SectionData
+{
+public:
+   const char *
+   data() const
+   {
+      return mView ? mView : mStorage.data();
+   }
+
+   size_t
+   size() const
+   {
+      return mView ? mViewSize : mStorage.size();
+   }
+
+   bool
+   empty() const
+   {
+      return size() == 0;
+   }
+
+   const char &
+   operator [](size_t index) const
+   {
+      return data()[index];
+   }
+
+   // The data as a table of Type, such as elf::Symbol, ignoring any bytes
+   // after the last whole entry
+   template<typename Type>
+   std::span<const Type>
+   view() const
+   {
+      return { reinterpret_cast<const Type *>(data()), size() / sizeof(Type) };
+   }
+
+   void
+   borrow(const char *data,
+          size_t size)
+   {
+      mStorage.clear();
+      mView = data;
+      mViewSize = size;
+   }
+
+   std::vector<char> &
+   mutate()
+   {
+      if (mView) {
+         mStorage.assign(mView, mView + mViewSize);
+         mView = nullptr;
+         mViewSize = 0;
+      }
+
+      return mStorage;
+   }
+
+   void
+   clear()
+   {
+      mView = nullptr;
+      mViewSize = 0;
+      mStorage.clear();
+   }
+
+   SectionData &
+   operator =(std::vector<char> &&data)
+   {
+      mView = nullptr;
+      mViewSize = 0;
+      mStorage = std::move(data);
+      return *this;
+   }
+
+private:
+   const char *mView = nullptr;
+   size_t mViewSize = 0;
+   std::vector<char> mStorage;
+};
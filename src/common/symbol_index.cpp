@@ -0,0 +1,87 @@
+#include "symbol_index.h"
+#include "elf.h"
+
+#include <algorithm>
+#include <cstring>
+
+void
+SymbolIndex::add(std::string name,
+                 uint32_t address,
+                 uint32_t size,
+                 uint32_t section)
+{
+   mSymbols.push_back({ std::move(name), address, size, section });
+}
+
+void
+SymbolIndex::addSymbolTable(const char *symbols,
+                            std::size_t symbolsSize,
+                            std::size_t entsize,
+                            const char *strings,
+                            std::size_t stringsSize)
+{
+   if (entsize < sizeof(elf::Symbol)) {
+      entsize = sizeof(elf::Symbol);
+   }
+
+   for (auto offset = std::size_t { 0 }; offset + sizeof(elf::Symbol) <= symbolsSize; offset += entsize) {
+      elf::Symbol symbol;
+      std::memcpy(&symbol, symbols + offset, sizeof(elf::Symbol));
+
+      auto type = symbol.info & 0xF;
+      if ((type != elf::STT_FUNC && type != elf::STT_OBJECT) ||
+          !symbol.size ||
+          symbol.shndx == elf::SHN_UNDEF ||
+          symbol.shndx >= elf::SHN_LORESERVE) {
+         continue;
+      }
+
+      std::string name;
+      if (symbol.name < stringsSize) {
+         auto start = strings + symbol.name;
+         name.assign(start, strnlen(start, stringsSize - symbol.name));
+      }
+
+      add(std::move(name), symbol.value, symbol.size, symbol.shndx);
+   }
+}
+
+void
+SymbolIndex::finalize()
+{
+   std::stable_sort(mSymbols.begin(), mSymbols.end(),
+                    [](const Symbol &lhs, const Symbol &rhs) {
+                       return lhs.address < rhs.address;
+                    });
+
+   mMaxEnd.resize(mSymbols.size());
+   auto maxEnd = uint64_t { 0 };
+   for (auto i = 0u; i < mSymbols.size(); ++i) {
+      maxEnd = std::max(maxEnd, uint64_t { mSymbols[i].address } + mSymbols[i].size);
+      mMaxEnd[i] = maxEnd;
+   }
+}
+
+const SymbolIndex::Symbol *
+SymbolIndex::find(uint32_t address) const
+{
+   // First symbol starting after address
+   auto itr = std::upper_bound(mSymbols.begin(), mSymbols.end(), address,
+                               [](uint32_t address, const Symbol &symbol) {
+                                  return address < symbol.address;
+                               });
+
+   for (auto i = itr - mSymbols.begin(); i > 0; --i) {
+      if (mMaxEnd[i - 1] <= address) {
+         // No earlier symbol reaches this far
+         break;
+      }
+
+      const auto &symbol = mSymbols[i - 1];
+      if (address - symbol.address < symbol.size) {
+         return &symbol;
+      }
+   }
+
+   return nullptr;
+}
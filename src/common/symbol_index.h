@@ -0,0 +1,66 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Sorted interval index of symbol address ranges, to map addresses back to
+// the symbol that contains them.
+//
+// Add every symbol, call finalize() once, then look up as many addresses as
+// needed. Each lookup is a binary search. When symbols overlap, the one that
+// starts closest to the address wins.
+class SymbolIndex
+{
+public:
+   struct Symbol
+   {
+      std::string name;
+      uint32_t address;
+      uint32_t size;
+      uint32_t section;
+   };
+
+   void
+   add(std::string name,
+       uint32_t address,
+       uint32_t size,
+       uint32_t section);
+
+   // Adds the function and object symbols of an ELF SHT_SYMTAB section, with
+   // names from its linked string table. Symbols without a size are skipped
+   // since they do not cover any address.
+   void
+   addSymbolTable(const char *symbols,
+                  std::size_t symbolsSize,
+                  std::size_t entsize,
+                  const char *strings,
+                  std::size_t stringsSize);
+
+   void
+   finalize();
+
+   // Returns the symbol containing address, or nullptr
+   const Symbol *
+   find(uint32_t address) const;
+
+   std::size_t
+   size() const
+   {
+      return mSymbols.size();
+   }
+
+   // Every symbol added, sorted by address once finalized
+   const std::vector<Symbol> &
+   symbols() const
+   {
+      return mSymbols;
+   }
+
+private:
+   std::vector<Symbol> mSymbols;
+
+   // Highest end address of mSymbols[0..i], so a lookup knows when it can
+   // stop looking at earlier symbols
+   std::vector<uint64_t> mMaxEnd;
+};
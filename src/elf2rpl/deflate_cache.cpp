@@ -0,0 +1,114 @@
+#include "deflate_cache.h"
+#include "be_val.h"
+#include "hash.h"
+
+#include <fmt/format.h>
+#include <fstream>
+#include <random>
+#include <system_error>
+
+struct DeflateCacheHeader
+{
+   be_val<uint32_t> magic;
+   be_val<uint32_t> inflatedSize;
+   be_val<uint32_t> crc;
+   be_val<uint32_t> deflatedSize;
+};
+
+constexpr auto DeflateCacheMagic = 0x52504C5Au; // "RPLZ"
+
+bool
+DeflateCache::open(const std::filesystem::path &dir)
+{
+   std::error_code ec;
+   std::filesystem::create_directories(dir, ec);
+   if (ec || !std::filesystem::is_directory(dir, ec)) {
+      return false;
+   }
+
+   mDir = dir;
+   return true;
+}
+
+std::filesystem::path
+DeflateCache::entryPath(const char *data,
+                        std::size_t size,
+                        uint32_t crc,
+                        const std::string &settings) const
+{
+   return mDir / fmt::format("{:016x}{:08x}{:08x}-{}",
+                             hash64(data, size), crc,
+                             static_cast<uint32_t>(size), settings);
+}
+
+bool
+DeflateCache::load(const std::filesystem::path &entry,
+                   std::size_t size,
+                   uint32_t crc,
+                   std::vector<char> &deflated) const
+{
+   std::ifstream in { entry, std::ifstream::binary };
+   if (!in.is_open()) {
+      return false;
+   }
+
+   DeflateCacheHeader header;
+   if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+       header.magic != DeflateCacheMagic ||
+       header.inflatedSize != size ||
+       header.crc != crc ||
+       header.deflatedSize < 4u) {
+      return false;
+   }
+
+   deflated.resize(header.deflatedSize);
+   if (!in.read(deflated.data(), deflated.size())) {
+      return false;
+   }
+
+   // The payload starts with the inflated size, like in the RPL
+   return *reinterpret_cast<be_val<uint32_t> *>(deflated.data()) == size;
+}
+
+bool
+DeflateCache::store(const std::filesystem::path &entry,
+                    std::size_t size,
+                    uint32_t crc,
+                    const char *deflated,
+                    std::size_t deflatedSize) const
+{
+   DeflateCacheHeader header;
+   header.magic = DeflateCacheMagic;
+   header.inflatedSize = static_cast<uint32_t>(size);
+   header.crc = crc;
+   header.deflatedSize = static_cast<uint32_t>(deflatedSize);
+
+   // Write to a unique name first, so readers never see a partial entry
+   auto tmp = entry;
+   tmp += fmt::format(".{:08x}.tmp", std::random_device { }());
+
+   {
+      std::ofstream out { tmp, std::ofstream::binary };
+      if (!out.is_open()) {
+         return false;
+      }
+
+      out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      out.write(deflated, deflatedSize);
+      if (!out.flush()) {
+         out.close();
+         std::error_code ec;
+         std::filesystem::remove(tmp, ec);
+         return false;
+      }
+   }
+
+   std::error_code ec;
+   std::filesystem::rename(tmp, entry, ec);
+   if (ec) {
+      std::filesystem::remove(tmp, ec);
+      return false;
+   }
+
+   return true;
+}
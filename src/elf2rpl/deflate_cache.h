@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// On-disk cache of deflated section data.
+//
+// Entries are keyed by the hash and crc of the inflated data, plus a string
+// describing the compression settings. Each entry is a single file, written to
+// a temporary name first and renamed, so several elf2rpl processes can share
+// one cache directory.
+class DeflateCache
+{
+public:
+   bool
+   open(const std::filesystem::path &dir);
+
+   std::filesystem::path
+   entryPath(const char *data,
+             std::size_t size,
+             uint32_t crc,
+             const std::string &settings) const;
+
+   bool
+   load(const std::filesystem::path &entry,
+        std::size_t size,
+        uint32_t crc,
+        std::vector<char> &deflated) const;
+
+   bool
+   store(const std::filesystem::path &entry,
+         std::size_t size,
+         uint32_t crc,
+         const char *deflated,
+         std::size_t deflatedSize) const;
+
+private:
+   std::filesystem::path mDir;
+};
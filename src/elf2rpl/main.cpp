@@ -1,18 +1,45 @@
+#include "byte_swap.h"
+#include "crc32.h"
+#include "deflate_cache.h"
 #include "elf.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "stats.h"
 #include "utils.h"
 #include "rplwrap.h"
+#include "section_data.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
 #include <excmd.h>
 #include <fmt/base.h>
+#include <fmt/format.h>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <zlib.h>
 
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#ifdef HAVE_ZOPFLI
+#include <zopfli.h>
+#endif
+
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
@@ -22,9 +49,44 @@ using std::clog;
 using std::cout;
 
 constexpr auto DeflateMinSectionSize = 0x18u;
+constexpr auto DeflateChunkSize = size_t { 0x8000 };
 constexpr auto CodeBaseAddress = 0x02000000u;
 constexpr auto DataBaseAddress = 0x10000000u;
 constexpr auto LoadBaseAddress = 0xC0000000u;
+constexpr auto DefaultCompressionLevel = 6;
+
+enum class Compressor
+{
+   Zlib,
+   Libdeflate,
+   Zopfli,
+};
+
+struct CompressionOptions
+{
+   Compressor compressor = Compressor::Zlib;
+
+   // 0 stores sections uncompressed
+   int level = DefaultCompressionLevel;
+
+   // Reuse previously deflated sections from here, when open
+   DeflateCache *cache = nullptr;
+};
+
+static const char *
+getCompressorName(Compressor compressor)
+{
+   switch (compressor) {
+   case Compressor::Zlib:
+      return "zlib";
+   case Compressor::Libdeflate:
+      return "libdeflate";
+   case Compressor::Zopfli:
+      return "zopfli";
+   }
+
+   return "unknown";
+}
 
 struct ElfFile
 {
@@ -32,10 +94,11 @@ struct ElfFile
    {
       elf::SectionHeader header;
       std::string name;
-      std::vector<char> data;
+      SectionData data;
       uint32_t index;
    };
 
+   MappedFile input;
    elf::Header header;
    std::vector<std::unique_ptr<Section>> sections;
    size_t num_discarded_sections;
@@ -79,91 +142,126 @@ const static std::string dwarf_prefix(".debug_");
 
 /**
  * Read the .elf file generated by compiler.
+ *
+ * The file is memory mapped, and sections refer to their data in place.
+ * Discarded sections are never read.
  */
 static bool
-readElf(ElfFile &file, const std::string &filename)
+readElf(ElfFile &file, const std::string &filename, std::ostream &err)
 {
-   std::ifstream in { filename, std::ifstream::binary };
-   if (!in.is_open()) {
-      fmt::println(cerr, "Could not open \"{}\" for reading.", filename);
+   auto &in = file.input;
+   if (!in.open(filename)) {
+      fmt::println(err, "Could not open \"{}\" for reading.", filename);
       return false;
    }
 
    // Read header
-   in.read(reinterpret_cast<char *>(&file.header), sizeof(elf::Header));
+   if (in.size() < sizeof(elf::Header)) {
+      fmt::println(err, "File is too small to be an ELF file.");
+      return false;
+   }
+
+   memcpy(&file.header, in.data(), sizeof(elf::Header));
 
    if (file.header.magic != elf::HeaderMagic) {
-      fmt::println(cerr, "Invalid ELF magic header {:08X}", elf::HeaderMagic);
+      fmt::println(err, "Invalid ELF magic header {:08X}", elf::HeaderMagic);
       return false;
    }
 
    if (file.header.fileClass != elf::ELFCLASS32) {
-      fmt::println(cerr, "Unexpected ELF file class {}, expected {}.",
+      fmt::println(err, "Unexpected ELF file class {}, expected {}.",
                    file.header.fileClass,
                    fmt::underlying(elf::ELFCLASS32));
       return false;
    }
 
    if (file.header.encoding != elf::ELFDATA2MSB) {
-      fmt::println(cerr, "Unexpected ELF encoding {}, expected {}.",
+      fmt::println(err, "Unexpected ELF encoding {}, expected {}.",
                    file.header.encoding,
                    fmt::underlying(elf::ELFDATA2MSB));
       return false;
    }
 
    if (file.header.machine != elf::EM_PPC) {
-      fmt::println(cerr, "Unexpected ELF machine type {}, expected {}.",
+      fmt::println(err, "Unexpected ELF machine type {}, expected {}.",
                    file.header.machine,
                    fmt::underlying(elf::EM_PPC));
       return false;
    }
 
    if (file.header.elfVersion != elf::EV_CURRENT) {
-      fmt::println(cerr, "Unexpected ELF version {}, expected {}.",
+      fmt::println(err, "Unexpected ELF version {}, expected {}.",
                    file.header.elfVersion,
                    fmt::underlying(elf::EV_CURRENT));
       return false;
    }
 
-   // Read section headers and data
-   in.seekg(static_cast<size_t>(file.header.shoff));
+   // Read section headers
+   auto shoff = static_cast<size_t>(file.header.shoff);
+   auto shnum = static_cast<size_t>(file.header.shnum);
+   if (shoff > in.size() || shnum > (in.size() - shoff) / sizeof(elf::SectionHeader)) {
+      fmt::println(err, "Section headers are outside of the file.");
+      return false;
+   }
+
+   if (file.header.shstrndx >= shnum) {
+      fmt::println(err, "Invalid section name string table index {}.", file.header.shstrndx);
+      return false;
+   }
 
-   for (auto i = 0u; i < file.header.shnum; ++i) {
+   for (auto i = 0u; i < shnum; ++i) {
       file.sections.emplace_back(std::make_unique<ElfFile::Section>());
       auto &section = *file.sections.back();
 
-      in.read(reinterpret_cast<char *>(&section.header), sizeof(elf::SectionHeader));
+      memcpy(&section.header,
+             in.data() + shoff + i * sizeof(elf::SectionHeader),
+             sizeof(elf::SectionHeader));
       section.index = 0;
 
       if (!section.header.size || section.header.type == elf::SHT_NOBITS) {
          continue;
       }
 
+      if (section.header.offset > in.size() ||
+          section.header.size > in.size() - section.header.offset) {
+         fmt::println(err, "Section {} data is outside of the file.", i);
+         return false;
+      }
+
       if (section.header.addr >= DataBaseAddress && section.header.addr < LoadBaseAddress) {
          section.header.flags |= elf::SHF_WRITE;
       }
-
-      auto pos = in.tellg();
-      in.seekg(static_cast<size_t>(section.header.offset));
-      section.data.resize(section.header.size);
-      in.read(section.data.data(), section.data.size());
-      in.seekg(pos);
    }
 
    // Set section header names
-   auto shStrTab = file.sections[file.header.shstrndx]->data.data();
+   auto &shStrTabHeader = file.sections[file.header.shstrndx]->header;
+   auto shStrTab = in.data() + shStrTabHeader.offset;
+   auto shStrTabSize = static_cast<size_t>(shStrTabHeader.size);
 
    for (auto &section : file.sections) {
-      section->name = shStrTab + section->header.name;
+      auto name = static_cast<size_t>(section->header.name);
+      if (name >= shStrTabSize) {
+         fmt::println(err, "Invalid section name offset {}.", name);
+         return false;
+      }
+
+      section->name.assign(shStrTab + name, strnlen(shStrTab + name, shStrTabSize - name));
    }
 
-   // Mark debugging sections as discarded
+   // Mark debugging sections as discarded, everything else refers to the
+   // mapped file
    uint32_t index = 0;
    file.num_discarded_sections = 0;
    for (auto &section : file.sections) {
       const std::string* name = &section->name;
 
       if (section->header.type == elf::SHT_RELA) {
+         if (section->header.info >= file.sections.size()) {
+            fmt::println(err, "Invalid target section {} for relocation section {}.",
+                         section->header.info, section->name);
+            return false;
+         }
+
          name = &file.sections[section->header.info]->name;
       }
 
@@ -176,10 +274,13 @@ readElf(ElfFile &file, const std::string &filename)
          section->header.addr = 0u;
          section->header.offset = 0u;
          section->header.size = 0u;
-         section->data.clear();
          section->index = UINT32_MAX;
          ++file.num_discarded_sections;
       } else {
+         if (section->header.size && section->header.type != elf::SHT_NOBITS) {
+            section->data.borrow(in.data() + section->header.offset, section->header.size);
+         }
+
          section->index = index;
          ++index;
       }
@@ -199,7 +300,8 @@ readElf(ElfFile &file, const std::string &filename)
  */
 static bool
 generateFileInfoSection(ElfFile &file,
-                        uint32_t flags)
+                        uint32_t flags,
+                        int compressionLevel)
 {
    elf::RplFileInfo info;
    info.version = 0xCAFE0402u;
@@ -219,7 +321,7 @@ generateFileInfoSection(ElfFile &file,
    info.filename = 0u;
    info.flags = flags;
    info.minVersion = 0x5078u;
-   info.compressionLevel = 6;
+   info.compressionLevel = compressionLevel;
    info.fileInfoPad = 0u;
    info.cafeSdkVersion = 0x5335u;
    info.cafeSdkRevision = 0x10D4Bu;
@@ -279,9 +381,8 @@ generateFileInfoSection(ElfFile &file,
    section->header.info = 0u;
    section->header.addralign = 4u;
    section->header.entsize = 0u;
-   section->data.insert(section->data.end(),
-                        reinterpret_cast<char *>(&info),
-                        reinterpret_cast<char *>(&info + 1));
+   section->data = std::vector<char>(reinterpret_cast<char *>(&info),
+                                     reinterpret_cast<char *>(&info + 1));
    file.sections.emplace_back(std::move(section));
    return true;
 }
@@ -289,28 +390,19 @@ generateFileInfoSection(ElfFile &file,
 
 /**
  * Generate SHT_RPL_CRCS section.
+ *
+ * The crcs are filled in later by compressSections, while it goes through the
+ * section data anyway.
  */
 static bool
 generateCrcSection(ElfFile &file)
 {
-   std::vector<be_val<uint32_t>> crcs;
-   for (auto &section : file.sections) {
-      auto crc = uint32_t { 0u };
-
-      if (section->index == UINT32_MAX) {
-         continue;
-      }
-
-      if (section->data.size()) {
-         crc = crc32(0, Z_NULL, 0);
-         crc = crc32(crc, reinterpret_cast<Bytef *>(section->data.data()), section->data.size());
-      }
-
-      crcs.push_back(crc);
-   }
-
-   // Insert a 0 crc for this section
-   crcs.insert(crcs.end() - 1, 0);
+   // One crc for every section that is kept, plus a 0 crc for this section
+   auto numCrcs = 1 + std::count_if(file.sections.begin(), file.sections.end(),
+                                    [](const auto &section) {
+                                       return section->index != UINT32_MAX;
+                                    });
+   std::vector<be_val<uint32_t>> crcs(numCrcs, 0u);
 
    auto section = std::make_unique<ElfFile::Section>();
    section->header.name = 0u;
@@ -323,9 +415,8 @@ generateCrcSection(ElfFile &file)
    section->header.info = 0u;
    section->header.addralign = 4u;
    section->header.entsize = 4u;
-   section->data.insert(section->data.end(),
-                        reinterpret_cast<char *>(crcs.data()),
-                        reinterpret_cast<char *>(crcs.data() + crcs.size()));
+   section->data = std::vector<char>(reinterpret_cast<char *>(crcs.data()),
+                                     reinterpret_cast<char *>(crcs.data() + crcs.size()));
 
    // Insert before FILEINFO
    file.sections.insert(file.sections.end() - 1, std::move(section));
@@ -334,12 +425,12 @@ generateCrcSection(ElfFile &file)
 
 
 static bool
-getSymbol(ElfFile::Section &section,
+getSymbol(const ElfFile::Section &section,
           size_t index,
           elf::Symbol &symbol)
 {
-   auto symbols = reinterpret_cast<elf::Symbol *>(section.data.data());
-   auto numSymbols = section.data.size() / sizeof(elf::Symbol);
+   auto symbols = section.data.view<elf::Symbol>();
+   auto numSymbols = symbols.size();
    if (index >= numSymbols) {
       return false;
    }
@@ -355,7 +446,7 @@ getSymbol(ElfFile::Section &section,
  * The Wii U does not support every type of relocation.
  */
 static bool
-fixRelocations(ElfFile &file)
+fixRelocations(ElfFile &file, std::ostream &err)
 {
    std::set<unsigned int> unsupportedTypes;
    auto result = true;
@@ -373,7 +464,9 @@ fixRelocations(ElfFile &file)
       auto &symbolSection = file.sections[section->header.link];
       // auto &targetSection = file.sections[section->header.info];
 
-      auto rels = reinterpret_cast<elf::Rela *>(section->data.data());
+      // Only copy the relocations if one of them has to be modified
+      auto rels = reinterpret_cast<const elf::Rela *>(section->data.data());
+      elf::Rela *mutableRels = nullptr;
       auto numRels = section->data.size() / sizeof(elf::Rela);
       for (auto i = 0u; i < numRels; ++i) {
          auto info = rels[i].info;
@@ -410,16 +503,21 @@ fixRelocations(ElfFile &file)
          {
             elf::Symbol symbol;
             if (!getSymbol(*symbolSection, index, symbol)) {
-               fmt::println(cerr, "ERROR: Could not find symbol {} for fixing a R_PPC_REL32 relocation", index);
+               fmt::println(err, "ERROR: Could not find symbol {} for fixing a R_PPC_REL32 relocation", index);
                result = false;
             } else {
                newRelocations.emplace_back();
                auto &newRel = newRelocations.back();
 
+               if (!mutableRels) {
+                  mutableRels = reinterpret_cast<elf::Rela *>(section->data.mutate().data());
+                  rels = mutableRels;
+               }
+
                // Modify current relocation to R_PPC_GHS_REL16_HI
-               rels[i].info = (index << 8) | elf::R_PPC_GHS_REL16_HI;
-               rels[i].addend = addend;
-               rels[i].offset = offset;
+               mutableRels[i].info = (index << 8) | elf::R_PPC_GHS_REL16_HI;
+               mutableRels[i].addend = addend;
+               mutableRels[i].offset = offset;
 
                // Create a R_PPC_GHS_REL16_LO
                newRel.info = (index << 8) | elf::R_PPC_GHS_REL16_LO;
@@ -433,15 +531,18 @@ fixRelocations(ElfFile &file)
          default:
             // Only print error once per type
             if (!unsupportedTypes.count(type)) {
-               fmt::println(cerr, "ERROR: Unsupported relocation type {}", type);
+               fmt::println(err, "ERROR: Unsupported relocation type {}", type);
                unsupportedTypes.insert(type);
             }
          }
       }
 
-      section->data.insert(section->data.end(),
-                           reinterpret_cast<char *>(newRelocations.data()),
-                           reinterpret_cast<char *>(newRelocations.data() + newRelocations.size()));
+      if (!newRelocations.empty()) {
+         auto &data = section->data.mutate();
+         data.insert(data.end(),
+                     reinterpret_cast<char *>(newRelocations.data()),
+                     reinterpret_cast<char *>(newRelocations.data() + newRelocations.size()));
+      }
    }
 
    return result && unsupportedTypes.size() == 0;
@@ -477,29 +578,144 @@ fixFileHeader(ElfFile &file)
 
 
 /**
- * Relocate a section to a new address.
+ * A section being moved from its old address range to a new address.
+ */
+struct SectionMove
+{
+   uint32_t sectionIndex;
+   uint32_t oldAddress;
+   uint64_t oldAddressEnd; // inclusive
+   uint32_t newAddress;
+};
+
+
+/**
+ * A range of addresses [start, end) which get delta added to them.
+ */
+struct AddressRange
+{
+   uint64_t start;
+   uint64_t end;
+   uint32_t delta;
+};
+
+using AddressMap = std::vector<AddressRange>;
+
+
+/**
+ * Build the address mapping obtained by applying every move in order.
+ *
+ * Moves are chained: an address moved by one of them is tested against the
+ * following ones using its new value. The result covers the whole 32 bit
+ * address space with ranges sorted by start address, so it can be looked up
+ * with a binary search.
+ */
+template<typename Filter>
+static AddressMap
+buildAddressMap(const std::vector<SectionMove> &moves,
+                Filter &&filter)
+{
+   constexpr auto AddressSpaceEnd = uint64_t { 1 } << 32;
+   AddressMap map { { 0, AddressSpaceEnd, 0 } };
+
+   for (auto &move : moves) {
+      if (!filter(move)) {
+         continue;
+      }
+
+      auto moveStart = static_cast<uint64_t>(move.oldAddress);
+      auto moveEnd = move.oldAddressEnd + 1;
+      auto moveDelta = static_cast<uint32_t>(move.newAddress - move.oldAddress);
+      AddressMap next;
+      next.reserve(map.size() + 4);
+
+      auto push = [&](uint64_t start, uint64_t end, uint32_t delta) {
+         if (start >= end) {
+            return;
+         }
+
+         // Merge with the previous range, unless its image would then wrap
+         if (!next.empty() &&
+             next.back().end == start &&
+             next.back().delta == delta &&
+             (next.back().start + delta) % AddressSpaceEnd + (end - next.back().start) <= AddressSpaceEnd) {
+            next.back().end = end;
+         } else {
+            next.push_back({ start, end, delta });
+         }
+      };
+
+      for (auto &range : map) {
+         // The image of a range never wraps around the address space
+         auto imageStart = (range.start + range.delta) % AddressSpaceEnd;
+         auto imageEnd = imageStart + (range.end - range.start);
+         auto insideStart = std::clamp(moveStart, imageStart, imageEnd);
+         auto insideEnd = std::clamp(moveEnd, imageStart, imageEnd);
+         auto toDomain = [&](uint64_t image) {
+            return range.start + (image - imageStart);
+         };
+
+         push(range.start, toDomain(insideStart), range.delta);
+
+         if (insideStart < insideEnd) {
+            // Split the moved part where its new image would wrap around
+            auto delta = static_cast<uint32_t>(range.delta + moveDelta);
+            auto newImageStart = (insideStart + moveDelta) % AddressSpaceEnd;
+            auto wrap = std::min(insideEnd, insideStart + (AddressSpaceEnd - newImageStart));
+            push(toDomain(insideStart), toDomain(wrap), delta);
+            push(toDomain(wrap), toDomain(insideEnd), delta);
+         }
+
+         push(toDomain(insideEnd), range.end, range.delta);
+      }
+
+      map = std::move(next);
+   }
+
+   return map;
+}
+
+
+static uint32_t
+mapAddress(const AddressMap &map,
+           uint32_t address)
+{
+   auto range = std::upper_bound(map.begin(), map.end(), address,
+                                 [](uint64_t value, const AddressRange &range) {
+                                    return value < range.start;
+                                 });
+   return address + std::prev(range)->delta;
+}
+
+
+/**
+ * Relocate sections to new addresses.
+ *
+ * Symbols and relocations pointing into the moved sections are updated in a
+ * single pass, with the same result as moving each section in turn.
  */
 static bool
-relocateSection(ElfFile &file,
-                ElfFile::Section &section,
-                uint32_t sectionIndex,
-                uint32_t newSectionAddress)
+relocateSections(ElfFile &file,
+                 const std::vector<SectionMove> &moves)
 {
-   auto sectionSize = section.data.size() ? section.data.size() : static_cast<size_t>(section.header.size);
-   auto oldSectionAddress = section.header.addr;
-   auto oldSectionAddressEnd = section.header.addr + sectionSize;
+   if (moves.empty()) {
+      return true;
+   }
+
+   // Relocate symbols pointing into the moved sections
+   auto symbolMap = buildAddressMap(moves, [](const SectionMove &) { return true; });
 
-   // Relocate symbols pointing into this section
    for (auto &symSection : file.sections) {
       if (symSection->header.type != elf::SectionType::SHT_SYMTAB) {
          continue;
       }
 
-      auto symbols = reinterpret_cast<elf::Symbol *>(symSection->data.data());
+      auto symbols = reinterpret_cast<const elf::Symbol *>(symSection->data.data());
+      elf::Symbol *mutableSymbols = nullptr;
       auto numSymbols = symSection->data.size() / sizeof(elf::Symbol);
       for (auto i = 0u; i < numSymbols; ++i) {
          auto type = symbols[i].info & 0xf;
-         auto value = symbols[i].value;
+         auto value = static_cast<uint32_t>(symbols[i].value);
 
          // Only relocate data, func, section symbols
          if (type != elf::STT_OBJECT &&
@@ -508,35 +724,361 @@ relocateSection(ElfFile &file,
             continue;
          }
 
-         if (value >= oldSectionAddress && value <= oldSectionAddressEnd) {
-            symbols[i].value = (value - oldSectionAddress) + newSectionAddress;
+         auto newValue = mapAddress(symbolMap, value);
+         if (newValue != value) {
+            if (!mutableSymbols) {
+               mutableSymbols = reinterpret_cast<elf::Symbol *>(symSection->data.mutate().data());
+               symbols = mutableSymbols;
+            }
+
+            mutableSymbols[i].value = newValue;
          }
       }
    }
 
-   // Relocate relocations pointing into this section
+   // Relocate relocations pointing into the moved sections
    for (auto &relaSection : file.sections) {
-      if (relaSection->header.type != elf::SectionType::SHT_RELA ||
-          relaSection->header.info != sectionIndex) {
+      if (relaSection->header.type != elf::SectionType::SHT_RELA) {
          continue;
       }
 
-      auto rela = reinterpret_cast<elf::Rela *>(relaSection->data.data());
+      auto target = static_cast<uint32_t>(relaSection->header.info);
+      auto isTarget = [target](const SectionMove &move) { return move.sectionIndex == target; };
+      if (std::none_of(moves.begin(), moves.end(), isTarget)) {
+         continue;
+      }
+
+      auto relaMap = buildAddressMap(moves, isTarget);
+      auto rela = reinterpret_cast<const elf::Rela *>(relaSection->data.data());
+      elf::Rela *mutableRela = nullptr;
       auto numRelas = relaSection->data.size() / sizeof(elf::Rela);
       for (auto i = 0u; i < numRelas; ++i) {
-         auto offset = rela[i].offset;
+         auto offset = static_cast<uint32_t>(rela[i].offset);
+         auto newOffset = mapAddress(relaMap, offset);
+
+         if (newOffset != offset) {
+            if (!mutableRela) {
+               mutableRela = reinterpret_cast<elf::Rela *>(relaSection->data.mutate().data());
+               rela = mutableRela;
+            }
+
+            mutableRela[i].offset = newOffset;
+         }
+      }
+   }
+
+   for (auto &move : moves) {
+      file.sections[move.sectionIndex]->header.addr = move.newAddress;
+   }
+
+   return true;
+}
+
+constexpr static std::string_view rplwrap_prefix(RPLWRAP_PREFIX);
+
+/**
+ * elf::Rela in native byte order.
+ */
+struct NativeRela
+{
+   uint32_t offset;
+   uint32_t info;
+   int32_t addend;
+};
+CHECK_SIZE(NativeRela, 0x0C);
+
+/**
+ * Sort every relocation section by offset, and remove R_PPC_NONE entries and
+ * exact duplicates.
+ *
+ * The sort is stable, so the R_PPC_GHS_REL16_HI and R_PPC_GHS_REL16_LO pair
+ * created by fixRelocations for an R_PPC_REL32 ends up next to each other.
+ */
+static bool
+sortRelocations(ElfFile &file,
+                size_t &numNone,
+                size_t &numDuplicates)
+{
+   numNone = 0;
+   numDuplicates = 0;
+
+   for (auto &section : file.sections) {
+      if (section->index == UINT32_MAX ||
+          section->header.type != elf::SHT_RELA) {
+         continue;
+      }
+
+      // Sort and compare in native order, instead of swapping on every access
+      std::vector<NativeRela> rels(section->data.size() / sizeof(elf::Rela));
+      records_to_native<uint32_t>(section->data.data(), rels.data(), rels.size());
+
+      auto isNone = [](const NativeRela &rel) {
+         return (rel.info & 0xff) == elf::R_PPC_NONE;
+      };
+      auto end = std::remove_if(rels.begin(), rels.end(), isNone);
+      numNone += static_cast<size_t>(rels.end() - end);
+      rels.erase(end, rels.end());
+
+      std::stable_sort(rels.begin(), rels.end(),
+                       [](const NativeRela &a, const NativeRela &b) {
+                          return a.offset < b.offset;
+                       });
+
+      // Duplicates share an offset, but other relocations for the same offset
+      // may sit between them
+      std::vector<NativeRela> unique;
+      unique.reserve(rels.size());
+      auto runStart = size_t { 0 };
+      for (auto &rel : rels) {
+         if (!unique.empty() && unique.back().offset != rel.offset) {
+            runStart = unique.size();
+         }
 
-         if (offset >= oldSectionAddress && offset <= oldSectionAddressEnd) {
-            rela[i].offset = (offset - oldSectionAddress) + newSectionAddress;
+         auto duplicate = std::any_of(unique.begin() + runStart, unique.end(),
+                                      [&](const NativeRela &other) {
+                                         return other.info == rel.info &&
+                                                other.addend == rel.addend;
+                                      });
+         if (duplicate) {
+            ++numDuplicates;
+         } else {
+            unique.push_back(rel);
          }
       }
+
+      std::vector<char> data(unique.size() * sizeof(elf::Rela));
+      records_from_native<uint32_t>(unique.data(), data.data(), unique.size());
+      section->data = std::move(data);
+   }
+
+   return true;
+}
+
+
+/**
+ * What pruneImports removed from one import section.
+ */
+struct PrunedImports
+{
+   std::string name;
+   size_t numImports;
+   size_t numRemoved;
+   bool removedSection;
+};
+
+
+/**
+ * Remove the import stubs that no relocation refers to from the import
+ * sections, and their symbols from the symbol table.
+ *
+ * rplimportgen puts every stub in its own section for ld to garbage collect,
+ * but entries that nothing refers to still end up in the output. An import
+ * section left with no stubs is emptied and turned into SHT_NULL, so the
+ * loader skips the whole module. It keeps its index, since symbols are not
+ * renumbered when sections are dropped.
+ */
+static bool
+pruneImports(ElfFile &file,
+             std::vector<PrunedImports> &pruned)
+{
+   constexpr auto StubSize = 8u;
+   pruned.clear();
+
+   for (auto symTabIndex = 0u; symTabIndex < file.sections.size(); ++symTabIndex) {
+      auto &symSection = file.sections[symTabIndex];
+      if (symSection->index == UINT32_MAX ||
+          symSection->header.type != elf::SHT_SYMTAB) {
+         continue;
+      }
+
+      auto symbols = symSection->data.view<elf::Symbol>();
+      auto numSymbols = static_cast<uint32_t>(symbols.size());
+      auto isImportSection = [&](uint32_t shndx) {
+         return shndx < file.sections.size() &&
+                file.sections[shndx]->index != UINT32_MAX &&
+                file.sections[shndx]->header.type == elf::SHT_RPL_IMPORTS;
+      };
+
+      // Find the symbols and the import section addresses which are used by
+      // a relocation, either directly or through a section symbol
+      std::vector<bool> symbolUsed(numSymbols, false);
+      std::vector<std::vector<uint32_t>> usedAddresses(file.sections.size());
+      for (auto &relaSection : file.sections) {
+         if (relaSection->index == UINT32_MAX ||
+             relaSection->header.type != elf::SHT_RELA ||
+             relaSection->header.link != symTabIndex) {
+            continue;
+         }
+
+         auto rels = relaSection->data.view<elf::Rela>();
+         auto numRels = rels.size();
+         for (auto i = 0u; i < numRels; ++i) {
+            auto index = static_cast<uint32_t>(rels[i].info >> 8);
+            if (index >= numSymbols) {
+               continue;
+            }
+
+            symbolUsed[index] = true;
+
+            auto &symbol = symbols[index];
+            if ((symbol.info & 0xf) == elf::STT_SECTION && isImportSection(symbol.shndx)) {
+               auto address = static_cast<uint32_t>(symbol.value + rels[i].addend);
+               usedAddresses[symbol.shndx].push_back(address);
+            }
+         }
+      }
+
+      // A stub is removed when none of the symbols at its address are used
+      std::vector<std::vector<uint32_t>> removedStubs(file.sections.size());
+      std::vector<bool> removeSymbol(numSymbols, false);
+      for (auto shndx = 0u; shndx < file.sections.size(); ++shndx) {
+         if (!isImportSection(shndx)) {
+            continue;
+         }
+
+         auto &section = file.sections[shndx];
+         auto addr = static_cast<uint32_t>(section->header.addr);
+         auto size = static_cast<uint32_t>(section->data.size());
+         std::map<uint32_t, bool> stubs;
+         for (auto i = 0u; i < numSymbols; ++i) {
+            auto type = symbols[i].info & 0xf;
+            auto offset = static_cast<uint32_t>(symbols[i].value - addr);
+            if (symbols[i].shndx != shndx ||
+                (type != elf::STT_FUNC && type != elf::STT_OBJECT) ||
+                offset < StubSize || offset > size || size - offset < StubSize) {
+               continue;
+            }
+
+            stubs[offset] = stubs[offset] || symbolUsed[i];
+         }
+
+         for (auto address : usedAddresses[shndx]) {
+            auto itr = stubs.upper_bound(address - addr);
+            if (itr != stubs.begin() && address - addr - std::prev(itr)->first < StubSize) {
+               std::prev(itr)->second = true;
+            }
+         }
+
+         auto &removed = removedStubs[shndx];
+         for (auto &[offset, used] : stubs) {
+            // Overlapping stubs are not something rplimportgen generates
+            if (!used && (removed.empty() || offset - removed.back() >= StubSize)) {
+               removed.push_back(offset);
+            }
+         }
+
+         auto removedSection = !stubs.empty() && removed.size() == stubs.size() &&
+                               usedAddresses[shndx].empty();
+         if (!removed.empty()) {
+            pruned.push_back({ section->name, stubs.size(), removed.size(), removedSection });
+         }
+
+         if (removedSection) {
+            section->header.type = elf::SHT_NULL;
+            section->header.flags = 0u;
+            section->header.addr = 0u;
+            section->header.size = 0u;
+            section->data.clear();
+         } else if (!removed.empty()) {
+            std::vector<char> data;
+            data.reserve(size - removed.size() * StubSize);
+            auto start = 0u;
+            for (auto offset : removed) {
+               data.insert(data.end(), section->data.data() + start, section->data.data() + offset);
+               start = offset + StubSize;
+            }
+
+            data.insert(data.end(), section->data.data() + start, section->data.data() + size);
+            section->header.size = static_cast<uint32_t>(data.size());
+            section->data = std::move(data);
+         }
+
+         for (auto i = 0u; i < numSymbols; ++i) {
+            if (symbols[i].shndx != shndx || symbolUsed[i]) {
+               continue;
+            }
+
+            auto type = symbols[i].info & 0xf;
+            auto offset = static_cast<uint32_t>(symbols[i].value - addr);
+            if (type == elf::STT_SECTION) {
+               removeSymbol[i] = removedSection;
+            } else if (type == elf::STT_FUNC || type == elf::STT_OBJECT) {
+               removeSymbol[i] = std::binary_search(removed.begin(), removed.end(), offset);
+            }
+         }
+      }
+
+      if (std::none_of(removedStubs.begin(), removedStubs.end(),
+                       [](const std::vector<uint32_t> &removed) { return !removed.empty(); })) {
+         continue;
+      }
+
+      // Number of removed stubs before an address of an import section
+      auto mapAddress = [&](uint32_t shndx, uint32_t address) {
+         auto &removed = removedStubs[shndx];
+         auto offset = address - static_cast<uint32_t>(file.sections[shndx]->header.addr);
+         auto count = std::lower_bound(removed.begin(), removed.end(), offset) - removed.begin();
+         return static_cast<uint32_t>(address - count * StubSize);
+      };
+
+      // Compact the symbol table, moving the symbols after removed stubs
+      std::vector<elf::Symbol> newSymbols;
+      std::vector<uint32_t> newIndices(numSymbols, 0u);
+      auto numLocals = 0u;
+      for (auto i = 0u; i < numSymbols; ++i) {
+         if (removeSymbol[i]) {
+            continue;
+         }
+
+         auto symbol = symbols[i];
+         if (isImportSection(symbol.shndx) && (symbol.info & 0xf) != elf::STT_SECTION) {
+            symbol.value = mapAddress(symbol.shndx, symbol.value);
+         }
+
+         if (i < symSection->header.info) {
+            numLocals++;
+         }
+
+         newIndices[i] = static_cast<uint32_t>(newSymbols.size());
+         newSymbols.push_back(symbol);
+      }
+
+      // Renumber the relocations, and move the ones relative to a section
+      // symbol of an import section
+      for (auto &relaSection : file.sections) {
+         if (relaSection->index == UINT32_MAX ||
+             relaSection->header.type != elf::SHT_RELA ||
+             relaSection->header.link != symTabIndex) {
+            continue;
+         }
+
+         auto rels = reinterpret_cast<elf::Rela *>(relaSection->data.mutate().data());
+         auto numRels = relaSection->data.size() / sizeof(elf::Rela);
+         for (auto i = 0u; i < numRels; ++i) {
+            auto index = static_cast<uint32_t>(rels[i].info >> 8);
+            if (index >= numSymbols) {
+               continue;
+            }
+
+            auto &symbol = symbols[index];
+            if ((symbol.info & 0xf) == elf::STT_SECTION && isImportSection(symbol.shndx)) {
+               auto address = static_cast<uint32_t>(symbol.value + rels[i].addend);
+               rels[i].addend = static_cast<int32_t>(mapAddress(symbol.shndx, address) - symbol.value);
+            }
+
+            rels[i].info = (newIndices[index] << 8) | (rels[i].info & 0xff);
+         }
+      }
+
+      symSection->header.info = numLocals;
+      symSection->header.size = static_cast<uint32_t>(newSymbols.size() * sizeof(elf::Symbol));
+      symSection->data = std::vector<char>(reinterpret_cast<char *>(newSymbols.data()),
+                                           reinterpret_cast<char *>(newSymbols.data() + newSymbols.size()));
    }
 
-   section.header.addr = newSectionAddress;
    return true;
 }
 
-const static std::string rplwrap_prefix(RPLWRAP_PREFIX);
 
 /**
  * Rename __rplwrap_<name> to <name>, and if <name> already exists rename it to
@@ -550,79 +1092,124 @@ renameRplWrap(ElfFile &file)
 {
    auto strtab = getSectionByName(file, ".strtab");
    if (strtab == nullptr) return false;
-   auto strtabd = reinterpret_cast<char *>(strtab->data.data());
+   auto strtabd = strtab->data.data();
+   auto strtabSize = strtab->data.size();
+
+   auto getName = [&](uint32_t offset) {
+      if (offset >= strtabSize) {
+         return std::string_view { };
+      }
+
+      return std::string_view { strtabd + offset, strnlen(strtabd + offset, strtabSize - offset) };
+   };
+
+   auto isRenamable = [](const elf::Symbol &symbol) {
+      // Only rename functions, data
+      auto type = symbol.info & 0xf;
+      return type == elf::STT_OBJECT || type == elf::STT_FUNC;
+   };
 
    for (auto &symSection : file.sections) {
       if (symSection->header.type != elf::SectionType::SHT_SYMTAB) {
          continue;
       }
 
-      auto symbols = reinterpret_cast<elf::Symbol *>(symSection->data.data());
-      auto numSymbols = symSection->data.size() / sizeof(elf::Symbol);
+      auto symbols = symSection->data.view<elf::Symbol>();
+      auto numSymbols = static_cast<uint32_t>(symbols.size());
 
-      // First pass - find all the symbols prefixed with __rplwrap_, don't do
-      // anything yet
-      std::vector<elf::Symbol*> foundRplWraps;
+      // First pass - find all the symbols prefixed with __rplwrap_, indexed by
+      // the <name> part, don't do anything yet
+      std::vector<uint32_t> foundRplWraps;
+      std::vector<bool> doneRplWraps;
+      std::unordered_map<std::string_view, std::vector<size_t>> rplWrapsByName;
 
       for (auto i = 0u; i < numSymbols; ++i) {
-         auto type = symbols[i].info & 0xf;
-
-         // Only rename functions, data
-         if (type != elf::STT_OBJECT &&
-             type != elf::STT_FUNC) {
+         if (!isRenamable(symbols[i])) {
             continue;
          }
 
-         std::string name = &strtabd[symbols[i].name];
-         if (!name.compare(0, rplwrap_prefix.size(), rplwrap_prefix)) {
-            foundRplWraps.push_back(&symbols[i]);
+         auto name = getName(symbols[i].name);
+         if (name.starts_with(rplwrap_prefix)) {
+            rplWrapsByName[name.substr(rplwrap_prefix.size())].push_back(foundRplWraps.size());
+            foundRplWraps.push_back(i);
          }
       }
 
+      if (foundRplWraps.empty()) {
+         continue;
+      }
+
+      doneRplWraps.resize(foundRplWraps.size());
+      auto mutableSymbols = reinterpret_cast<elf::Symbol *>(symSection->data.mutate().data());
+      symbols = symSection->data.view<elf::Symbol>();
+
       // Second pass - Find any symbols that would conflict if __rplwrap_<name>
       // got renamed to <name>, and if so, swap the names
-
       for (auto i = 0u; i < numSymbols; ++i) {
-         auto type = symbols[i].info & 0xf;
-         std::string symName = &strtabd[symbols[i].name];
+         if (!isRenamable(symbols[i])) {
+            continue;
+         }
 
-         // Only rename functions, data
-         if (type != elf::STT_OBJECT &&
-             type != elf::STT_FUNC) {
+         auto symName = getName(symbols[i].name);
+         auto found = rplWrapsByName.find(symName);
+         if (found == rplWrapsByName.end()) {
             continue;
          }
 
-         auto rplWrap = foundRplWraps.begin();
-         while (rplWrap != foundRplWraps.end()) {
-            std::string wrapName = &strtabd[(*rplWrap)->name];
-            // Get the <name> part of __rplwrap_<name>
-            std::string wrapNameBase = wrapName.substr(rplwrap_prefix.size());
+         auto matches = std::move(found->second);
+         rplWrapsByName.erase(found);
+
+         // This symbol can itself be a pending __rplwrap_<name>, in which case
+         // the swaps below change its name
+         auto self = std::lower_bound(foundRplWraps.begin(), foundRplWraps.end(), i);
+         auto selfIndex = static_cast<size_t>(self - foundRplWraps.begin());
+         auto selfPending = self != foundRplWraps.end() && *self == i && !doneRplWraps[selfIndex];
+         if (selfPending) {
+            auto &entries = rplWrapsByName[symName.substr(rplwrap_prefix.size())];
+            std::erase(entries, selfIndex);
+            if (entries.empty()) {
+               rplWrapsByName.erase(symName.substr(rplwrap_prefix.size()));
+            }
+         }
 
-            if (wrapNameBase == symName) {
-               // both __rplwrap_<name> and <name> exist, we can just swap their
-               // name pointers
+         // Both __rplwrap_<name> and <name> exist, we can just swap their name
+         // pointers
+         for (auto match : matches) {
+            auto &wrap = mutableSymbols[foundRplWraps[match]];
 #ifdef DEBUG
-               fmt::println(clog, "DEBUG: renameRplWrap: {} <-> {}",
-                  wrapName, symName);
+            fmt::println(clog, "DEBUG: renameRplWrap: {} <-> {}",
+                         getName(wrap.name), symName);
 #endif //DEBUG
-               std::swap((*rplWrap)->name, symbols[i].name);
-               // We're done, remove symbol from foundRplWraps
-               rplWrap = foundRplWraps.erase(rplWrap);
-            // Otherwise, increment the iterator and go around again
-            } else ++rplWrap;
+            std::swap(wrap.name, mutableSymbols[i].name);
+            // We're done with this one
+            doneRplWraps[match] = true;
+         }
+
+         if (selfPending) {
+            // After the first swap this symbol is named __rplwrap_<symName>, so
+            // it matches itself if it comes later in the list
+            if (matches.front() < selfIndex) {
+               doneRplWraps[selfIndex] = true;
+            } else {
+               rplWrapsByName[symName].push_back(selfIndex);
+            }
          }
       }
 
       // Final pass: rename any remaining (non-conflicting) __rplwrap_<name>
       // symbols to <name>
+      for (auto j = 0u; j < foundRplWraps.size(); ++j) {
+         if (doneRplWraps[j]) {
+            continue;
+         }
 
-      for (auto symbol : foundRplWraps) {
+         auto &symbol = mutableSymbols[foundRplWraps[j]];
 #ifdef DEBUG
          fmt::println(clog, "DEBUG: renameRplWrap: {} -> {}",
-                      std::string{&strtabd[symbol->name]},
-                      std::string{&strtabd[symbol->name] + rplwrap_prefix.length()});
+                      getName(symbol.name),
+                      getName(symbol.name).substr(rplwrap_prefix.length()));
 #endif //DEBUG
-         symbol->name += (uint32_t)rplwrap_prefix.length();
+         symbol.name += (uint32_t)rplwrap_prefix.length();
       }
    }
 
@@ -630,94 +1217,531 @@ renameRplWrap(ElfFile &file)
 }
 
 /**
- * Fix the loader virtual addresses.
+ * Rebuild a string table from the strings at the given offsets, and update the
+ * offsets to point into the new table.
  *
- * Linker script won't put symtab & strtab sections in our loader address, so
- * we must fix that.
+ * Strings that are a suffix of another one share its storage. Offset 0 stays
+ * the empty string.
  */
 static bool
-fixLoaderVirtualAddresses(ElfFile &file)
+mergeStringTable(ElfFile::Section &section,
+                 std::vector<be_val<uint32_t> *> &offsets)
 {
-   auto loadMax = LoadBaseAddress;
-   for (auto &section : file.sections) {
-      if (section->header.addr >= loadMax) {
-         loadMax = section->header.addr + section->data.size();
+   auto data = section.data.data();
+   auto size = section.data.size();
+
+   // Collect the distinct strings being referenced
+   std::vector<std::string_view> strings;
+   strings.reserve(offsets.size());
+   for (auto offset : offsets) {
+      if (*offset >= size) {
+         return false;
+      }
+
+      auto str = std::string_view { data + *offset, strnlen(data + *offset, size - *offset) };
+      if (!str.empty()) {
+         strings.push_back(str);
       }
    }
 
-   // Relocate .symtab and .strtab to be in loader memory
-   for (auto i = 0u; i < file.sections.size(); ++i) {
-      auto &section = file.sections[i];
-      if (section->header.type == elf::SHT_SYMTAB ||
-          section->header.type == elf::SHT_STRTAB) {
-         loadMax = align_up(loadMax, section->header.addralign);
-         relocateSection(file, *section, i, loadMax);
-         section->header.flags |= elf::SHF_ALLOC;
-         loadMax += section->data.size();
+   // Sort by reversed string, so a suffix comes right before the strings
+   // ending with it. Identical strings keep the one that comes first.
+   std::sort(strings.begin(), strings.end(),
+             [](std::string_view a, std::string_view b) {
+                if (a == b) {
+                   return a.data() < b.data();
+                }
+
+                return std::lexicographical_compare(a.rbegin(), a.rend(), b.rbegin(), b.rend());
+             });
+   strings.erase(std::unique(strings.begin(), strings.end()), strings.end());
+
+   // Find the longest string each one is a suffix of
+   std::unordered_map<std::string_view, std::string_view> parents;
+   std::vector<std::string_view> kept;
+   for (auto it = strings.rbegin(); it != strings.rend(); ++it) {
+      if (!kept.empty() && kept.back().ends_with(*it)) {
+         parents[*it] = kept.back();
+      } else {
+         parents[*it] = *it;
+         kept.push_back(*it);
       }
    }
 
-   return true;
+   // Keep the strings in their original order, so the offsets in the symbol
+   // table still compress as well as before
+   std::sort(kept.begin(), kept.end(),
+             [](std::string_view a, std::string_view b) {
+                return a.data() < b.data();
+             });
+
+   std::vector<char> merged(1, '\0');
+   std::unordered_map<std::string_view, uint32_t> keptOffsets;
+   for (auto str : kept) {
+      keptOffsets[str] = static_cast<uint32_t>(merged.size());
+      merged.insert(merged.end(), str.begin(), str.end());
+      merged.push_back('\0');
+   }
+
+   std::unordered_map<std::string_view, uint32_t> newOffsets;
+   for (auto str : strings) {
+      auto parent = parents[str];
+      newOffsets[str] = static_cast<uint32_t>(keptOffsets[parent] + parent.size() - str.size());
+   }
+
+   if (merged.size() > size) {
+      return true;
+   }
+
+   for (auto offset : offsets) {
+      auto str = std::string_view { data + *offset, strnlen(data + *offset, size - *offset) };
+      *offset = str.empty() ? 0u : newOffsets[str];
+   }
+
+#ifdef DEBUG
+   fmt::println(clog, "DEBUG: mergeStringTable: {} shrunk from {} to {} bytes",
+                section.name, size, merged.size());
+#endif //DEBUG
+
+   section.data = std::move(merged);
+   section.header.size = static_cast<uint32_t>(section.data.size());
+   return true;
 }
 
 
 /**
- * zlib deflate any suitable section.
+ * Remove unreferenced strings from the string tables, and merge strings that
+ * are a suffix of another one.
+ *
+ * This drops the __rplwrap_ prefixes that renameRplWrap left behind. Only
+ * string tables used by the section headers and symbol tables are rebuilt,
+ * anything else linking to one leaves it untouched.
  */
 static bool
-deflateSections(ElfFile &file)
+mergeStringTables(ElfFile &file, std::ostream &err)
 {
-   std::vector<char> chunk;
-   chunk.resize(16 * 1024);
+   for (auto i = 0u; i < file.sections.size(); ++i) {
+      auto &section = *file.sections[i];
+      if (section.index == UINT32_MAX ||
+          section.header.type != elf::SHT_STRTAB) {
+         continue;
+      }
+
+      std::vector<be_val<uint32_t> *> offsets;
+      auto unknownUser = false;
+
+      if (i == file.header.shstrndx) {
+         for (auto &other : file.sections) {
+            if (other->index != UINT32_MAX) {
+               offsets.push_back(&other->header.name);
+            }
+         }
+      }
+
+      for (auto &other : file.sections) {
+         if (other->index == UINT32_MAX || other->header.link != i) {
+            continue;
+         }
 
+         if (other->header.type != elf::SHT_SYMTAB) {
+            unknownUser = true;
+            break;
+         }
+
+         auto symbols = reinterpret_cast<elf::Symbol *>(other->data.mutate().data());
+         auto numSymbols = other->data.size() / sizeof(elf::Symbol);
+         for (auto j = 0u; j < numSymbols; ++j) {
+            offsets.push_back(&symbols[j].name);
+         }
+      }
+
+      if (unknownUser || offsets.empty()) {
+         continue;
+      }
+
+      if (!mergeStringTable(section, offsets)) {
+         fmt::println(err, "Invalid string offset in {}", section.name);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+
+/**
+ * Fix the loader virtual addresses.
+ *
+ * Linker script won't put symtab & strtab sections in our loader address, so
+ * we must fix that.
+ */
+static bool
+fixLoaderVirtualAddresses(ElfFile &file)
+{
+   auto loadMax = LoadBaseAddress;
    for (auto &section : file.sections) {
-      if (section->data.size() < DeflateMinSectionSize ||
-          section->header.type == elf::SHT_RPL_CRCS ||
-          section->header.type == elf::SHT_RPL_FILEINFO) {
+      if (section->header.addr >= loadMax) {
+         loadMax = section->header.addr + section->data.size();
+      }
+   }
+
+   // Relocate .symtab and .strtab to be in loader memory
+   std::vector<SectionMove> moves;
+   for (auto i = 0u; i < file.sections.size(); ++i) {
+      auto &section = file.sections[i];
+      if (section->header.type == elf::SHT_SYMTAB ||
+          section->header.type == elf::SHT_STRTAB) {
+         loadMax = align_up(loadMax, section->header.addralign);
+
+         auto sectionSize = section->data.size() ? section->data.size() : static_cast<size_t>(section->header.size);
+         moves.push_back({ i,
+                           section->header.addr,
+                           section->header.addr + static_cast<uint64_t>(sectionSize),
+                           loadMax });
+
+         section->header.flags |= elf::SHF_ALLOC;
+         loadMax += section->data.size();
+      }
+   }
+
+   return relocateSections(file, moves);
+}
+
+
+/**
+ * zlib deflate stream kept between calls on the same thread, so its buffers
+ * only get allocated once.
+ */
+class ZlibDeflater
+{
+public:
+   ~ZlibDeflater()
+   {
+      if (mLevel >= 0) {
+         deflateEnd(&mStream);
+      }
+   }
+
+   z_stream *
+   get(int level)
+   {
+      if (mLevel == level && deflateReset(&mStream) == Z_OK) {
+         return &mStream;
+      }
+
+      if (mLevel >= 0) {
+         deflateEnd(&mStream);
+         mLevel = -1;
+      }
+
+      memset(&mStream, 0, sizeof(mStream));
+      mStream.zalloc = Z_NULL;
+      mStream.zfree = Z_NULL;
+      mStream.opaque = Z_NULL;
+      if (deflateInit(&mStream, level) != Z_OK) {
+         return nullptr;
+      }
+
+      mLevel = level;
+      return &mStream;
+   }
+
+private:
+   z_stream mStream;
+   int mLevel = -1;
+};
+
+
+/**
+ * Compress data into a zlib stream with zlib, and compute its crc in the same
+ * pass, unless crcKnown says crc already holds it.
+ *
+ * The data is fed in chunks small enough to still be in cache when deflate
+ * reads them after the crc.
+ */
+static bool
+compressZlib(const char *data,
+             size_t size,
+             int level,
+             std::vector<char> &out,
+             uint32_t &crc,
+             bool crcKnown)
+{
+   // Allocate enough room to deflate everything in a single call
+   auto offset = out.size();
+   out.resize(offset + deflateBound(nullptr, static_cast<uLong>(size)));
+
+   thread_local ZlibDeflater deflater;
+   auto stream = deflater.get(level);
+   if (!stream) {
+      return false;
+   }
+
+   stream->avail_out = static_cast<uInt>(out.size() - offset);
+   stream->next_out = reinterpret_cast<Bytef *>(out.data() + offset);
+
+   auto ret = Z_OK;
+   auto pos = size_t { 0 };
+   if (!crcKnown) {
+      crc = 0u;
+   }
+
+   do {
+      auto chunk = std::min(size - pos, DeflateChunkSize);
+      if (!crcKnown) {
+         crc = crc32_update(crc, data + pos, chunk);
+      }
+
+      stream->avail_in = static_cast<uInt>(chunk);
+      stream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data + pos));
+      pos += chunk;
+      ret = deflate(stream, pos == size ? Z_FINISH : Z_NO_FLUSH);
+   } while (ret == Z_OK && pos < size);
+
+   if (ret != Z_STREAM_END) {
+      return false;
+   }
+
+   out.resize(offset + stream->total_out);
+   return true;
+}
+
+
+#ifdef HAVE_LIBDEFLATE
+/**
+ * Compress data into a zlib stream with libdeflate.
+ */
+static bool
+compressLibdeflate(const char *data,
+                   size_t size,
+                   int level,
+                   std::vector<char> &out)
+{
+   auto compressor = libdeflate_alloc_compressor(level);
+   if (!compressor) {
+      return false;
+   }
+
+   auto offset = out.size();
+   out.resize(offset + libdeflate_zlib_compress_bound(compressor, size));
+
+   auto written = libdeflate_zlib_compress(compressor,
+                                           data, size,
+                                           out.data() + offset, out.size() - offset);
+   libdeflate_free_compressor(compressor);
+
+   if (!written) {
+      return false;
+   }
+
+   out.resize(offset + written);
+   return true;
+}
+#endif
+
+
+#ifdef HAVE_ZOPFLI
+/**
+ * Compress data into a zlib stream with zopfli.
+ *
+ * Zopfli has no compression levels, it always tries to produce the smallest
+ * output.
+ */
+static bool
+compressZopfli(const char *data,
+               size_t size,
+               std::vector<char> &out)
+{
+   ZopfliOptions options;
+   ZopfliInitOptions(&options);
+
+   unsigned char *compressed = nullptr;
+   size_t compressedSize = 0;
+   ZopfliCompress(&options, ZOPFLI_FORMAT_ZLIB,
+                  reinterpret_cast<const unsigned char *>(data), size,
+                  &compressed, &compressedSize);
+
+   if (!compressed) {
+      return false;
+   }
+
+   out.insert(out.end(),
+              reinterpret_cast<char *>(compressed),
+              reinterpret_cast<char *>(compressed + compressedSize));
+   free(compressed);
+   return true;
+}
+#endif
+
+
+/**
+ * Deflate the data of a single section, prefixed by its inflated size, and
+ * compute the crc of the inflated data, unless crcKnown says crc already holds
+ * it.
+ */
+static bool
+deflateSection(ElfFile::Section &section,
+               const CompressionOptions &compression,
+               uint32_t &crc,
+               bool crcKnown)
+{
+   // Leave space for the 4 bytes inflated size
+   std::vector<char> deflated(4);
+   auto ok = false;
+
+   switch (compression.compressor) {
+   case Compressor::Zlib:
+      ok = compressZlib(section.data.data(), section.data.size(), compression.level, deflated, crc, crcKnown);
+      break;
+#ifdef HAVE_LIBDEFLATE
+   case Compressor::Libdeflate:
+      if (!crcKnown) {
+         crc = crc32_update(0u, section.data.data(), section.data.size());
+      }
+      ok = compressLibdeflate(section.data.data(), section.data.size(), compression.level, deflated);
+      break;
+#endif
+#ifdef HAVE_ZOPFLI
+   case Compressor::Zopfli:
+      if (!crcKnown) {
+         crc = crc32_update(0u, section.data.data(), section.data.size());
+      }
+      ok = compressZopfli(section.data.data(), section.data.size(), deflated);
+      break;
+#endif
+   default:
+      break;
+   }
+
+   if (!ok) {
+      return false;
+   }
+
+   // Set the inflated size at start of section
+   *reinterpret_cast<be_val<uint32_t> *>(&deflated[0]) =
+      static_cast<uint32_t>(section.data.size());
+
+   // Update the section data
+   section.data = std::move(deflated);
+   section.header.flags |= elf::SHF_DEFLATED;
+   return true;
+}
+
+
+/**
+ * Compute the crc of every section for SHT_RPL_CRCS, and deflate any suitable
+ * section.
+ *
+ * Sections that get deflated have their crc computed in the same pass. Every
+ * section is handled independently, so they can be spread over multiple
+ * threads without changing the output. Nothing is compressed at level 0.
+ *
+ * With a cache, sections whose inflated data was already deflated with the
+ * same settings are taken from it instead.
+ */
+static bool
+compressSections(ElfFile &file,
+                 const CompressionOptions &compression,
+                 unsigned jobs,
+                 std::ostream &err)
+{
+   struct Pending
+   {
+      ElfFile::Section *section;
+      size_t crcIndex;
+      bool deflate;
+   };
+
+   auto crcSection = std::find_if(file.sections.begin(), file.sections.end(),
+                                  [](const auto &section) {
+                                     return section->header.type == elf::SHT_RPL_CRCS;
+                                  });
+   if (crcSection == file.sections.end()) {
+      return false;
+   }
+
+   std::vector<uint32_t> crcs((*crcSection)->data.size() / sizeof(uint32_t), 0u);
+   std::vector<Pending> pending;
+   auto crcIndex = size_t { 0 };
+
+   for (auto &section : file.sections) {
+      if (section->index == UINT32_MAX) {
          continue;
       }
 
-      // Allocate space for the 4 bytes inflated size
-      std::vector<char> deflated;
-      deflated.resize(4);
+      auto index = crcIndex++;
+      if (index >= crcs.size()) {
+         return false;
+      }
 
-      // Deflate section data
-      auto stream = z_stream { };
-      memset(&stream, 0, sizeof(stream));
-      stream.zalloc = Z_NULL;
-      stream.zfree = Z_NULL;
-      stream.opaque = Z_NULL;
-      deflateInit(&stream, 6);
+      // SHT_RPL_CRCS itself has a 0 crc
+      if (section->header.type == elf::SHT_RPL_CRCS || !section->data.size()) {
+         continue;
+      }
 
-      stream.avail_in = section->data.size();
-      stream.next_in = reinterpret_cast<Bytef *>(section->data.data());
+      auto deflate = compression.level != 0 &&
+                     section->data.size() >= DeflateMinSectionSize &&
+                     section->header.type != elf::SHT_RPL_FILEINFO;
+      pending.push_back({ section.get(), index, deflate });
+   }
 
-      do {
-         stream.avail_out = static_cast<uInt>(chunk.size());
-         stream.next_out = reinterpret_cast<Bytef *>(chunk.data());
+   // Start with the biggest sections, so one large .text doesn't end up
+   // being compressed last while the other threads sit idle
+   std::stable_sort(pending.begin(), pending.end(),
+                    [](const Pending &a, const Pending &b) {
+                       return a.section->data.size() > b.section->data.size();
+                    });
+
+   auto cache = compression.cache;
+   auto settings = fmt::format("{}{}", getCompressorName(compression.compressor), compression.level);
+
+   std::atomic<bool> result { true };
+   std::mutex errMutex;
+   parallel_for(pending.size(), jobs, [&](size_t i) {
+      auto &item = pending[i];
+      auto &section = *item.section;
+      auto &crc = crcs[item.crcIndex];
+
+      if (!item.deflate) {
+         crc = crc32_update(0u, section.data.data(), section.data.size());
+         return;
+      }
 
-         auto ret = deflate(&stream, Z_FINISH);
-         if (ret == Z_STREAM_ERROR) {
-            deflateEnd(&stream);
-            return false;
+      std::filesystem::path cacheEntry;
+      auto inflatedSize = section.data.size();
+      if (cache) {
+         crc = crc32_update(0u, section.data.data(), inflatedSize);
+         cacheEntry = cache->entryPath(section.data.data(), inflatedSize, crc, settings);
+
+         std::vector<char> deflated;
+         if (cache->load(cacheEntry, inflatedSize, crc, deflated)) {
+            section.data = std::move(deflated);
+            section.header.flags |= elf::SHF_DEFLATED;
+            return;
          }
+      }
 
-         deflated.insert(deflated.end(),
-                         chunk.data(),
-                         reinterpret_cast<char *>(stream.next_out));
-      } while (stream.avail_out == 0);
-      deflateEnd(&stream);
+      // With a cache the crc was computed for the entry name, don't do it twice
+      if (!deflateSection(section, compression, crc, cache != nullptr)) {
+         std::lock_guard lock { errMutex };
+         fmt::println(err, "ERROR: Failed to deflate section {}", section.name);
+         result = false;
+         return;
+      }
 
-      // Set the inflated size at start of section
-      *reinterpret_cast<be_val<uint32_t> *>(&deflated[0]) =
-         static_cast<uint32_t>(section->data.size());
+      if (cache &&
+          !cache->store(cacheEntry, inflatedSize, crc, section.data.data(), section.data.size())) {
+         std::lock_guard lock { errMutex };
+         fmt::println(err, "Warning: Could not write cache entry {}", cacheEntry.string());
+      }
+   });
 
-      // Update the section data
-      section->data = std::move(deflated);
-      section->header.flags |= elf::SHF_DEFLATED;
+   auto crcData = reinterpret_cast<be_val<uint32_t> *>((*crcSection)->data.mutate().data());
+   for (auto i = 0u; i < crcs.size(); ++i) {
+      crcData[i] = crcs[i];
    }
 
-   return true;
+   return result;
 }
 
 
@@ -729,7 +1753,7 @@ deflateSections(ElfFile &file)
  * Data sections > Read sections > Text sections > Temp sections
  */
 static bool
-calculateSectionOffsets(ElfFile &file)
+calculateSectionOffsets(ElfFile &file, std::ostream &err)
 {
    auto offset = file.header.shoff;
    offset += align_up(static_cast<uint32_t>((file.sections.size() - file.num_discarded_sections) * sizeof(elf::SectionHeader)), 64);
@@ -847,7 +1871,7 @@ calculateSectionOffsets(ElfFile &file)
       if (section->header.offset == 0 &&
           section->header.type != elf::SHT_NULL &&
           section->header.type != elf::SHT_NOBITS) {
-         fmt::println(cerr, "Failed to calculate offset for section {} ({})", section->name, section->index);
+         fmt::println(err, "Failed to calculate offset for section {} ({})", section->name, section->index);
          return false;
       }
 
@@ -872,7 +1896,7 @@ calculateSectionOffsets(ElfFile &file)
  * Write out the final RPL.
  */
 static bool
-writeRpl(ElfFile &file, const std::string &filename)
+writeRpl(ElfFile &file, const std::string &filename, std::ostream &err)
 {
    auto shoff = file.header.shoff;
 
@@ -880,7 +1904,7 @@ writeRpl(ElfFile &file, const std::string &filename)
    std::ofstream out { filename, std::ofstream::binary };
 
    if (!out.is_open()) {
-      fmt::println(cerr, "Could not open {} for writing", filename);
+      fmt::println(err, "Could not open {} for writing", filename);
       return false;
    }
 
@@ -907,13 +1931,349 @@ writeRpl(ElfFile &file, const std::string &filename)
    return true;
 }
 
+/**
+ * Settings shared by every conversion.
+ */
+struct ConvertOptions
+{
+   bool isRpl = false;
+   bool mergeStrings = false;
+   bool sortRelocations = false;
+   bool pruneImports = false;
+   CompressionOptions compression;
+};
+
+
+/**
+ * Where to report the statistics of each conversion.
+ *
+ * The JSON records can go to stdout, so batch mode prints its ok and failed
+ * lines under the same mutex.
+ */
+struct StatsOutput
+{
+   bool text = false;
+   std::ostream *json = nullptr;
+   std::mutex mutex;
+};
+
+
+/**
+ * Convert a single ELF file into an RPL/RPX, writing errors to err.
+ */
+static bool
+convertElf(const std::string &src,
+           const std::string &dst,
+           const ConvertOptions &options,
+           unsigned jobs,
+           StatsOutput *statsOutput,
+           std::ostream &err)
+{
+   auto &compression = options.compression;
+   std::optional<ConvertStats> stats;
+   if (statsOutput) {
+      stats.emplace(src, dst);
+   }
+
+   auto endPass = [&](const char *name) {
+      if (stats) {
+         stats->endPass(name);
+      }
+   };
+
+   // Read elf into memory object!
+   ElfFile elf;
+
+   if (!readElf(elf, src, err)) {
+      fmt::println(err, "ERROR: readElf failed.");
+      return false;
+   }
+   endPass("readElf");
+
+   if (!fixRelocations(elf, err)) {
+      fmt::println(err, "ERROR: fixRelocations failed.");
+      return false;
+   }
+   endPass("fixRelocations");
+
+   if (options.sortRelocations) {
+      size_t numNone, numDuplicates;
+      if (!sortRelocations(elf, numNone, numDuplicates)) {
+         fmt::println(err, "ERROR: sortRelocations failed.");
+         return false;
+      }
+      endPass("sortRelocations");
+
+      if (stats) {
+         stats->addCounter("sortRelocations removed R_PPC_NONE", numNone);
+         stats->addCounter("sortRelocations removed duplicates", numDuplicates);
+      }
+   }
+
+   if (options.pruneImports) {
+      std::vector<PrunedImports> pruned;
+      if (!pruneImports(elf, pruned)) {
+         fmt::println(err, "ERROR: pruneImports failed.");
+         return false;
+      }
+      endPass("pruneImports");
+
+      auto numRemoved = size_t { 0 };
+      for (auto &imports : pruned) {
+         fmt::println(err, "{}: removed {} of {} imports{}", imports.name,
+                      imports.numRemoved, imports.numImports,
+                      imports.removedSection ? ", removed the empty module" : "");
+         numRemoved += imports.numRemoved;
+      }
+
+      if (stats) {
+         stats->addCounter("pruneImports removed imports", numRemoved);
+      }
+   }
+
+   if (!renameRplWrap(elf)) {
+      fmt::println(err, "ERROR: renameRplWrap failed.");
+      return false;
+   }
+   endPass("renameRplWrap");
+
+   if (options.mergeStrings) {
+      if (!mergeStringTables(elf, err)) {
+         fmt::println(err, "ERROR: mergeStringTables failed.");
+         return false;
+      }
+      endPass("mergeStringTables");
+   }
+
+   if (!fixLoaderVirtualAddresses(elf)) {
+      fmt::println(err, "ERROR: fixLoaderVirtualAddresses failed.");
+      return false;
+   }
+   endPass("fixLoaderVirtualAddresses");
+
+   if (!generateFileInfoSection(elf, options.isRpl ? 0 : elf::RPL_IS_RPX, compression.level)) {
+      fmt::println(err, "ERROR: generateFileInfoSection failed.");
+      return false;
+   }
+   endPass("generateFileInfoSection");
+
+   if (!generateCrcSection(elf)) {
+      fmt::println(err, "ERROR: generateCrcSection failed.");
+      return false;
+   }
+   endPass("generateCrcSection");
+
+   if (!fixFileHeader(elf)) {
+      fmt::println(err, "ERROR: fixFileHeader failed.");
+      return false;
+   }
+   endPass("fixFileHeader");
+
+   std::vector<size_t> rawSizes;
+   if (stats) {
+      for (auto &section : elf.sections) {
+         rawSizes.push_back(section->data.size());
+      }
+   }
+
+   if (!compressSections(elf, compression, jobs, err)) {
+      fmt::println(err, "ERROR: compressSections failed.");
+      return false;
+   }
+   endPass("compressSections");
+
+   if (!calculateSectionOffsets(elf, err)) {
+      fmt::println(err, "ERROR: calculateSectionOffsets failed.");
+      return false;
+   }
+   endPass("calculateSectionOffsets");
+
+   if (!writeRpl(elf, dst, err)) {
+      fmt::println(err, "ERROR: writeRpl failed.");
+      return false;
+   }
+   endPass("writeRpl");
+
+   if (stats) {
+      for (auto i = 0u; i < elf.sections.size(); ++i) {
+         auto &section = elf.sections[i];
+         if (section->index == UINT32_MAX) {
+            continue;
+         }
+
+         stats->addSection({ section->name,
+                             section->header.type,
+                             rawSizes[i],
+                             section->data.size(),
+                             (section->header.flags & elf::SHF_DEFLATED) != 0 });
+      }
+
+      std::lock_guard lock { statsOutput->mutex };
+      if (statsOutput->text) {
+         stats->printText(cerr);
+      }
+
+      if (statsOutput->json) {
+         stats->printJson(*statsOutput->json);
+         statsOutput->json->flush();
+      }
+   }
+
+   return true;
+}
+
+
+/**
+ * Split a batch line "input.elf:output.rpl" at the first colon that is not part
+ * of a drive letter.
+ */
+static bool
+splitBatchLine(const std::string &line,
+               std::string &src,
+               std::string &dst)
+{
+   auto isDrive = [&](size_t start, size_t colon) {
+      return colon == start + 1 && std::isalpha(static_cast<unsigned char>(line[start]));
+   };
+
+   auto colon = line.find(':');
+   if (colon != std::string::npos && isDrive(0, colon)) {
+      colon = line.find(':', colon + 1);
+   }
+
+   if (colon == std::string::npos || colon == 0 || colon + 1 == line.size()) {
+      return false;
+   }
+
+   src = line.substr(0, colon);
+   dst = line.substr(colon + 1);
+   return true;
+}
+
+
+/**
+ * Convert every "input.elf:output.rpl" line read from in.
+ *
+ * Jobs are started as soon as their line is read, so this also works as a
+ * persistent server fed through a pipe. Files are spread over the worker
+ * threads, and each one gets its sections compressed on a single thread. Once a
+ * job finishes, "ok <line>" or "failed <line>" is printed to stdout, under the
+ * lock of the statistics so they never cut a JSON record written there.
+ */
+static bool
+runBatch(std::istream &in,
+         const ConvertOptions &options,
+         unsigned jobs,
+         StatsOutput *statsOutput)
+{
+   std::mutex mutex;
+   std::condition_variable cond;
+   std::deque<std::string> queue;
+   auto finished = false;
+   std::atomic<bool> result { true };
+
+   std::mutex localOutputMutex;
+   auto &outputMutex = statsOutput ? statsOutput->mutex : localOutputMutex;
+
+   auto runJob = [&](const std::string &line) {
+      // Collected to give every message the name of the input, the ones of
+      // the other jobs would not say which file they are about. A line that
+      // can't be split has no input, it is named by the whole line instead.
+      std::ostringstream err;
+      std::string src, dst;
+      auto ok = splitBatchLine(line, src, dst);
+      auto prefix = ok ? src : line;
+      if (!ok) {
+         fmt::println(err, "Invalid batch line, expected <input.elf>:<output.rpl>");
+      } else {
+         ok = convertElf(src, dst, options, 1, statsOutput, err);
+      }
+
+      if (!ok) {
+         result = false;
+      }
+
+      std::lock_guard lock { outputMutex };
+      std::istringstream messages { err.str() };
+      std::string message;
+      while (std::getline(messages, message)) {
+         fmt::println(cerr, "{}: {}", prefix, message);
+      }
+
+      fmt::println(cout, "{} {}", ok ? "ok" : "failed", line);
+      cout.flush();
+   };
+
+   auto worker = [&]() {
+      while (true) {
+         std::string line;
+
+         {
+            std::unique_lock lock { mutex };
+            cond.wait(lock, [&]() { return finished || !queue.empty(); });
+            if (queue.empty()) {
+               return;
+            }
+
+            line = std::move(queue.front());
+            queue.pop_front();
+         }
+
+         runJob(line);
+      }
+   };
+
+   std::vector<std::thread> threads;
+   if (jobs > 1) {
+      for (auto i = 0u; i < jobs; ++i) {
+         threads.emplace_back(worker);
+      }
+   }
+
+   std::string line;
+   while (std::getline(in, line)) {
+      if (!line.empty() && line.back() == '\r') {
+         line.pop_back();
+      }
+
+      if (line.empty() || line[0] == '#') {
+         continue;
+      }
+
+      if (threads.empty()) {
+         runJob(line);
+         continue;
+      }
+
+      {
+         std::lock_guard lock { mutex };
+         queue.push_back(std::move(line));
+      }
+      cond.notify_one();
+   }
+
+   {
+      std::lock_guard lock { mutex };
+      finished = true;
+   }
+   cond.notify_all();
+
+   for (auto &thread : threads) {
+      thread.join();
+   }
+
+   return result;
+}
+
+
 static void
 show_help(std::ostream& out,
           const excmd::parser& parser,
           const std::string& exec_name)
 {
    fmt::println(out, "Usage:");
-   fmt::println(out, "  {} [options] <input.elf> <output.rpl>\n", exec_name);
+   fmt::println(out, "  {} [options] <input.elf> <output.rpl>", exec_name);
+   fmt::println(out, "  {} [options] --batch <list>\n", exec_name);
    fmt::println(out, "{}", parser.format_help(exec_name));
    fmt::println(out, "Report bugs to {}", PACKAGE_BUGREPORT);
 }
@@ -932,7 +2292,40 @@ int main(int argc, char **argv)
          .add_option("v,version",
                      description { "Show version" })
          .add_option("r,rpl",
-                     description { "Generate an RPL instead of an RPX" });
+                     description { "Generate an RPL instead of an RPX" })
+         .add_option("merge-strings",
+                     description { "Rebuild string tables with only the referenced strings, merging shared suffixes" })
+         .add_option("sort-relocations",
+                     description { "Sort relocations by offset, removing R_PPC_NONE and duplicate entries" })
+         .add_option("prune-imports",
+                     description { "Remove imports that no relocation refers to, and import modules left empty" })
+         .add_option("j,jobs",
+                     description { "Number of threads used to compress sections, or to convert files in batch mode (0 uses one per CPU, default is 1)" },
+                     value<int> {})
+         .add_option("b,batch",
+                     description { "Convert every <input.elf>:<output.rpl> line of this file, - reads them from stdin as they come" },
+                     value<std::string> {})
+         .add_option("z,compression-level",
+                     description { "Compression level, 0 stores sections uncompressed (default is 6)" },
+                     value<int> {})
+         .add_option("cache-dir",
+                     description { "Directory used to cache deflated sections between runs" },
+                     value<std::string> {})
+         .add_option("stats",
+                     description { "Print the time spent in each pass, section sizes and peak memory to STDERR" })
+         .add_option("stats-json",
+                     description { "Append the statistics as a line of JSON to this file, - writes to STDOUT" },
+                     value<std::string> {})
+         .add_option("compressor",
+                     description { "Compression backend: zlib (default)"
+#ifdef HAVE_LIBDEFLATE
+                                   ", libdeflate"
+#endif
+#ifdef HAVE_ZOPFLI
+                                   ", zopfli"
+#endif
+                     },
+                     value<std::string> {});
 
       parser.default_command()
          .add_argument("input.elf",
@@ -958,66 +2351,120 @@ int main(int argc, char **argv)
       return 0;
    }
 
-   if (!options.has("input.elf") || !options.has("output.rpl")) {
+   if (!options.has("batch") && (!options.has("input.elf") || !options.has("output.rpl"))) {
       fmt::println(cerr, "Missing mandatory arguments: <input.elf> <output.rpl>\n");
       show_help(cerr, parser, argv[0]);
       return -1;
    }
 
-   auto src = options.get<std::string>("input.elf");
-   auto dst = options.get<std::string>("output.rpl");
-   auto isRpl = options.has("rpl");
-
-   // Read elf into memory object!
-   ElfFile elf;
+   auto src = options.has("input.elf") ? options.get<std::string>("input.elf") : std::string { };
+   auto dst = options.has("output.rpl") ? options.get<std::string>("output.rpl") : std::string { };
+   ConvertOptions convert;
+   convert.isRpl = options.has("rpl");
+   convert.mergeStrings = options.has("merge-strings");
+   convert.sortRelocations = options.has("sort-relocations");
+   convert.pruneImports = options.has("prune-imports");
+   auto jobs = 1u;
+
+   if (options.has("jobs")) {
+      auto value = options.get<int>("jobs");
+      if (value < 0) {
+         fmt::println(cerr, "Invalid number of jobs: {}", value);
+         return -1;
+      }
 
-   if (!readElf(elf, src)) {
-      fmt::println(cerr, "ERROR: readElf failed.");
-      return -1;
+      jobs = resolve_jobs(value);
    }
 
-   if (!fixRelocations(elf)) {
-      fmt::println(cerr, "ERROR: fixRelocations failed.");
-      return -1;
+   auto &compression = convert.compression;
+   auto maxCompressionLevel = 9;
+
+   if (options.has("compressor")) {
+      auto name = options.get<std::string>("compressor");
+      if (name == "zlib") {
+         compression.compressor = Compressor::Zlib;
+      } else if (name == "libdeflate") {
+#ifdef HAVE_LIBDEFLATE
+         compression.compressor = Compressor::Libdeflate;
+         maxCompressionLevel = 12;
+#else
+         fmt::println(cerr, "This elf2rpl was built without libdeflate support.");
+         return -1;
+#endif
+      } else if (name == "zopfli") {
+#ifdef HAVE_ZOPFLI
+         compression.compressor = Compressor::Zopfli;
+#else
+         fmt::println(cerr, "This elf2rpl was built without zopfli support.");
+         return -1;
+#endif
+      } else {
+         fmt::println(cerr, "Unknown compressor: {}", name);
+         return -1;
+      }
    }
 
-   if (!renameRplWrap(elf)) {
-      fmt::println(cerr, "ERROR: renameRplWrap failed.");
-      return -1;
+   if (options.has("compression-level")) {
+      compression.level = options.get<int>("compression-level");
+      if (compression.level < 0 || compression.level > maxCompressionLevel) {
+         fmt::println(cerr, "Invalid compression level: {}, must be between 0 and {}",
+                      compression.level, maxCompressionLevel);
+         return -1;
+      }
    }
 
-   if (!fixLoaderVirtualAddresses(elf)) {
-      fmt::println(cerr, "ERROR: fixLoaderVirtualAddresses failed.");
-      return -1;
+   DeflateCache cache;
+   if (options.has("cache-dir")) {
+      auto dir = options.get<std::string>("cache-dir");
+      if (cache.open(dir)) {
+         compression.cache = &cache;
+      } else {
+         fmt::println(cerr, "Warning: Could not use cache directory {}", dir);
+      }
    }
 
-   if (!generateFileInfoSection(elf, isRpl ? 0 : elf::RPL_IS_RPX)) {
-      fmt::println(cerr, "ERROR: generateFileInfoSection failed.");
-      return -1;
-   }
+   StatsOutput stats;
+   StatsOutput *statsOutput = nullptr;
+   std::ofstream statsJsonFile;
 
-   if (!generateCrcSection(elf)) {
-      fmt::println(cerr, "ERROR: generateCrcSection failed.");
-      return -1;
+   if (options.has("stats")) {
+      stats.text = true;
+      statsOutput = &stats;
    }
 
-   if (!fixFileHeader(elf)) {
-      fmt::println(cerr, "ERROR: fixFileHeader failed.");
-      return -1;
-   }
+   if (options.has("stats-json")) {
+      auto path = options.get<std::string>("stats-json");
+      if (path == "-") {
+         stats.json = &cout;
+      } else {
+         statsJsonFile.open(path, std::ofstream::app);
+         if (!statsJsonFile.is_open()) {
+            fmt::println(cerr, "Could not open \"{}\" for writing.", path);
+            return -1;
+         }
 
-   if (!deflateSections(elf)) {
-      fmt::println(cerr, "ERROR: deflateSections failed.");
-      return -1;
+         stats.json = &statsJsonFile;
+      }
+
+      statsOutput = &stats;
    }
 
-   if (!calculateSectionOffsets(elf)) {
-      fmt::println(cerr, "ERROR: calculateSectionOffsets failed.");
-      return -1;
+   if (options.has("batch")) {
+      auto list = options.get<std::string>("batch");
+      if (list == "-") {
+         return runBatch(std::cin, convert, jobs, statsOutput) ? 0 : -1;
+      }
+
+      std::ifstream in { list };
+      if (!in.is_open()) {
+         fmt::println(cerr, "Could not open \"{}\" for reading.", list);
+         return -1;
+      }
+
+      return runBatch(in, convert, jobs, statsOutput) ? 0 : -1;
    }
 
-   if (!writeRpl(elf, dst)) {
-      fmt::println(cerr, "ERROR: writeRpl failed.");
+   if (!convertElf(src, dst, convert, jobs, statsOutput, cerr)) {
       return -1;
    }
 
@@ -0,0 +1,168 @@
+#include "stats.h"
+#include "elf.h"
+#include "json.h"
+
+#include <fmt/base.h>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+ConvertStats::ConvertStats(std::string input,
+                           std::string output) :
+   mInput(std::move(input)),
+   mOutput(std::move(output)),
+   mStart(Clock::now()),
+   mLastPass(mStart)
+{
+}
+
+void
+ConvertStats::endPass(const char *name)
+{
+   auto now = Clock::now();
+   mPasses.push_back({ name, std::chrono::duration<double, std::milli>(now - mLastPass).count() });
+   mLastPass = now;
+}
+
+void
+ConvertStats::addSection(Section section)
+{
+   mSections.push_back(std::move(section));
+}
+
+void
+ConvertStats::addCounter(std::string name,
+                         uint64_t value)
+{
+   mCounters.push_back({ std::move(name), value });
+}
+
+static double
+getRatio(const ConvertStats::Section &section)
+{
+   return section.rawSize ? static_cast<double>(section.storedSize) / section.rawSize : 1.0;
+}
+
+static double
+getTotal(const std::vector<ConvertStats::Pass> &passes)
+{
+   auto total = 0.0;
+   for (auto &pass : passes) {
+      total += pass.milliseconds;
+   }
+   return total;
+}
+
+static std::string
+getDisplayName(const ConvertStats::Section &section)
+{
+   if (!section.name.empty()) {
+      return section.name;
+   }
+
+   // Sections generated by elf2rpl have no name
+   switch (section.type) {
+   case elf::SHT_NULL:
+      return "<SHT_NULL>";
+   case elf::SHT_RPL_CRCS:
+      return "<SHT_RPL_CRCS>";
+   case elf::SHT_RPL_FILEINFO:
+      return "<SHT_RPL_FILEINFO>";
+   default:
+      return fmt::format("<{:#x}>", section.type);
+   }
+}
+
+void
+ConvertStats::printText(std::ostream &out) const
+{
+   fmt::println(out, "Statistics for {} -> {}", mInput, mOutput);
+
+   fmt::println(out, "  {:<28} {:>10}", "Pass", "Time (ms)");
+   for (auto &pass : mPasses) {
+      fmt::println(out, "  {:<28} {:>10.3f}", pass.name, pass.milliseconds);
+   }
+   fmt::println(out, "  {:<28} {:>10.3f}", "total", getTotal(mPasses));
+
+   auto totalRaw = std::size_t { 0 };
+   auto totalStored = std::size_t { 0 };
+   fmt::println(out, "  {:<28} {:>10} {:>10} {:>7}", "Section", "Raw", "Stored", "Ratio");
+   for (auto &section : mSections) {
+      fmt::println(out, "  {:<28} {:>10} {:>10} {:>6.1f}%{}",
+                   getDisplayName(section), section.rawSize, section.storedSize,
+                   100.0 * getRatio(section), section.deflated ? "" : " (stored)");
+      totalRaw += section.rawSize;
+      totalStored += section.storedSize;
+   }
+   fmt::println(out, "  {:<28} {:>10} {:>10} {:>6.1f}%",
+                "total", totalRaw, totalStored,
+                totalRaw ? 100.0 * totalStored / totalRaw : 100.0);
+
+   for (auto &counter : mCounters) {
+      fmt::println(out, "  {}: {}", counter.name, counter.value);
+   }
+
+   fmt::println(out, "  Peak memory: {} KiB", getPeakMemory() / 1024);
+}
+
+void
+ConvertStats::printJson(std::ostream &out) const
+{
+   // Everything on a single line, so several conversions can be appended to
+   // the same file as JSON Lines
+   fmt::print(out, "{{\"input\":{},\"output\":{},\"passes\":{{",
+              escape_json(mInput), escape_json(mOutput));
+
+   for (auto i = 0u; i < mPasses.size(); ++i) {
+      fmt::print(out, "{}{}:{:.3f}", i ? "," : "", escape_json(mPasses[i].name), mPasses[i].milliseconds);
+   }
+
+   fmt::print(out, "}},\"total_ms\":{:.3f},\"sections\":[", getTotal(mPasses));
+
+   for (auto i = 0u; i < mSections.size(); ++i) {
+      auto &section = mSections[i];
+      fmt::print(out, "{}{{\"name\":{},\"type\":{},\"raw_size\":{},\"stored_size\":{},\"deflated\":{},\"ratio\":{:.4f}}}",
+                 i ? "," : "", escape_json(getDisplayName(section)), section.type,
+                 section.rawSize, section.storedSize, section.deflated, getRatio(section));
+   }
+
+   fmt::print(out, "],\"counters\":{{");
+
+   for (auto i = 0u; i < mCounters.size(); ++i) {
+      fmt::print(out, "{}{}:{}", i ? "," : "", escape_json(mCounters[i].name), mCounters[i].value);
+   }
+
+   fmt::println(out, "}},\"peak_memory\":{}}}", getPeakMemory());
+}
+
+std::size_t
+getPeakMemory()
+{
+#ifdef _WIN32
+   PROCESS_MEMORY_COUNTERS counters;
+   if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+      return counters.PeakWorkingSetSize;
+   }
+   return 0;
+#else
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) != 0) {
+      return 0;
+   }
+
+#ifdef __APPLE__
+   // Already in bytes
+   return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+   return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Timing and size statistics of a single conversion.
+class ConvertStats
+{
+public:
+   struct Pass
+   {
+      std::string name;
+      double milliseconds;
+   };
+
+   struct Counter
+   {
+      std::string name;
+      uint64_t value;
+   };
+
+   struct Section
+   {
+      std::string name;
+      uint32_t type;
+      std::size_t rawSize;
+      std::size_t storedSize;
+      bool deflated;
+   };
+
+   ConvertStats(std::string input,
+                std::string output);
+
+   // Records the time spent since the previous pass ended
+   void
+   endPass(const char *name);
+
+   void
+   addSection(Section section);
+
+   // Records a pass specific number, like how many entries it removed
+   void
+   addCounter(std::string name,
+              uint64_t value);
+
+   void
+   printText(std::ostream &out) const;
+
+   void
+   printJson(std::ostream &out) const;
+
+private:
+   using Clock = std::chrono::steady_clock;
+
+   std::string mInput;
+   std::string mOutput;
+   Clock::time_point mStart;
+   Clock::time_point mLastPass;
+   std::vector<Pass> mPasses;
+   std::vector<Section> mSections;
+   std::vector<Counter> mCounters;
+};
+
+// Peak resident memory of the process so far, in bytes, or 0 if unknown
+std::size_t
+getPeakMemory();
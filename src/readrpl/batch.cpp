@@ -0,0 +1,370 @@
+#include "batch.h"
+#include "json.h"
+#include "parallel.h"
+#include "print.h"
+#include "rpl_reader.h"
+#include "verify.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fmt/base.h>
+#include <fmt/format.h>
+#include <fmt/ostream.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using std::cerr;
+
+// Number of records formatted before they are written out, per job
+static constexpr auto RecordsPerJob = 16u;
+
+struct BatchRecord
+{
+   std::string text;
+   bool passed = false;
+};
+
+static bool
+hasRplExtension(const std::filesystem::path &path)
+{
+   auto extension = path.extension().string();
+   std::transform(extension.begin(), extension.end(), extension.begin(),
+                  [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+   return extension == ".rpl" || extension == ".rpx";
+}
+
+static void
+readFileList(std::istream &in,
+             std::vector<std::string> &files)
+{
+   std::string line;
+   while (std::getline(in, line)) {
+      if (!line.empty() && line.back() == '\r') {
+         line.pop_back();
+      }
+
+      if (!line.empty()) {
+         files.push_back(line);
+      }
+   }
+}
+
+bool
+collectBatchInputs(const std::string &path,
+                   std::vector<std::string> &files)
+{
+   if (path == "-") {
+      readFileList(std::cin, files);
+      return true;
+   }
+
+   std::error_code ec;
+   if (std::filesystem::is_directory(path, ec)) {
+      auto start = files.size();
+      auto options = std::filesystem::directory_options::skip_permission_denied;
+      for (auto it = std::filesystem::recursive_directory_iterator { path, options, ec };
+           !ec && it != std::filesystem::recursive_directory_iterator {};
+           it.increment(ec)) {
+         if (it->is_regular_file(ec) && hasRplExtension(it->path())) {
+            files.push_back(it->path().string());
+         }
+      }
+
+      if (ec) {
+         fmt::println(cerr, "Could not scan directory \"{}\": {}", path, ec.message());
+         return false;
+      }
+
+      // Directory order depends on the filesystem, sort it to keep the output stable
+      std::sort(files.begin() + start, files.end());
+      return true;
+   }
+
+   std::ifstream in { path };
+   if (!in.is_open()) {
+      fmt::println(cerr, "Could not open \"{}\" for reading", path);
+      return false;
+   }
+
+   readFileList(in, files);
+   return true;
+}
+
+static const elf::RplFileInfo *
+findFileInfo(const Rpl &rpl)
+{
+   for (const auto &section : rpl.sections) {
+      if (section.header.type == elf::SHT_RPL_FILEINFO &&
+          section.data().size() >= sizeof(elf::RplFileInfo)) {
+         return reinterpret_cast<const elf::RplFileInfo *>(section.data().data());
+      }
+   }
+
+   return nullptr;
+}
+
+static std::vector<std::pair<const char *, int64_t>>
+getFileInfoFields(const elf::RplFileInfo &info)
+{
+   return {
+      { "text_size",         info.textSize },
+      { "text_align",        info.textAlign },
+      { "data_size",         info.dataSize },
+      { "data_align",        info.dataAlign },
+      { "load_size",         info.loadSize },
+      { "load_align",        info.loadAlign },
+      { "temp_size",         info.tempSize },
+      { "tramp_adjust",      info.trampAdjust },
+      { "tramp_addition",    info.trampAddition },
+      { "sda_base",          info.sdaBase },
+      { "sda2_base",         info.sda2Base },
+      { "stack_size",        info.stackSize },
+      { "heap_size",         info.heapSize },
+      { "flags",             info.flags },
+      { "min_sdk_version",   info.minVersion },
+      { "compression_level", info.compressionLevel },
+   };
+}
+
+static std::vector<std::string>
+splitLines(const std::string &text)
+{
+   std::vector<std::string> lines;
+   std::istringstream in { text };
+   std::string line;
+   while (std::getline(in, line)) {
+      lines.push_back(line);
+   }
+   return lines;
+}
+
+static std::string
+escapeCsv(const std::string &value)
+{
+   if (value.find_first_of(",\"\n") == std::string::npos) {
+      return value;
+   }
+
+   std::string result = "\"";
+   for (auto c : value) {
+      if (c == '"') {
+         result += '"';
+      }
+      result += c;
+   }
+   result += '"';
+   return result;
+}
+
+static std::string
+formatJsonRecord(const std::string &filename,
+                 const Rpl &rpl,
+                 bool readOk,
+                 const VerifyResult &checks,
+                 bool passed,
+                 const std::string &messages)
+{
+   auto out = fmt::format("{{\"file\":{},\"read\":{},\"passed\":{}",
+                          escape_json(filename), readOk, passed);
+
+   if (!rpl.sections.empty()) {
+      const auto &header = rpl.header;
+      out += fmt::format(",\"header\":{{\"type\":{},\"machine\":{},\"abi\":{},\"entry\":{},"
+                         "\"flags\":{},\"shnum\":{},\"shstrndx\":{}}}",
+                         header.type.value(), header.machine.value(), header.abi.value(),
+                         header.entry.value(), header.flags.value(), header.shnum.value(),
+                         header.shstrndx.value());
+
+      out += ",\"sections\":[";
+      for (auto i = 0u; i < rpl.sections.size(); ++i) {
+         const auto &section = rpl.sections[i];
+         out += fmt::format("{}{{\"name\":{},\"type\":{},\"flags\":{},\"addr\":{},\"offset\":{},"
+                            "\"size\":{},\"data_size\":{}}}",
+                            i ? "," : "", escape_json(section.name),
+                            escape_json(formatSHT(section.header.type)),
+                            section.header.flags.value(), section.header.addr.value(),
+                            section.header.offset.value(), section.header.size.value(),
+                            readOk ? section.dataSize() : 0u);
+      }
+      out += "]";
+   }
+
+   if (auto info = readOk ? findFileInfo(rpl) : nullptr) {
+      auto fields = getFileInfoFields(*info);
+      out += ",\"file_info\":{";
+      for (auto i = 0u; i < fields.size(); ++i) {
+         out += fmt::format("{}\"{}\":{}", i ? "," : "", fields[i].first, fields[i].second);
+      }
+      out += "}";
+   } else {
+      out += ",\"file_info\":null";
+   }
+
+   // Checks which did not run, because the file could not be read or
+   // because of --fail-fast, are null
+   out += ",\"checks\":{";
+   for (auto i = 0u; i < NumVerifyChecks; ++i) {
+      out += fmt::format("{}\"{}\":{}", i ? "," : "",
+                         getVerifyCheckName(static_cast<VerifyCheck>(i)),
+                         checks.completed[i] ? (checks.failed[i] ? "false" : "true") : "null");
+   }
+   out += "},\"messages\":[";
+
+   auto lines = splitLines(messages);
+   for (auto i = 0u; i < lines.size(); ++i) {
+      out += fmt::format("{}{}", i ? "," : "", escape_json(lines[i]));
+   }
+   out += "]}";
+   return out;
+}
+
+static std::string
+formatCsvHeader()
+{
+   auto out = std::string { "file,read,passed,type,machine,entry,shnum,stored_size,inflated_size,deflated_sections" };
+
+   for (auto &field : getFileInfoFields(elf::RplFileInfo {})) {
+      out += fmt::format(",{}", field.first);
+   }
+
+   for (auto i = 0u; i < NumVerifyChecks; ++i) {
+      out += fmt::format(",check_{}", getVerifyCheckName(static_cast<VerifyCheck>(i)));
+   }
+
+   out += ",messages";
+   return out;
+}
+
+static std::string
+formatCsvRecord(const std::string &filename,
+                const Rpl &rpl,
+                bool readOk,
+                const VerifyResult &checks,
+                bool passed,
+                const std::string &messages)
+{
+   auto storedSize = uint64_t { 0 };
+   auto inflatedSize = uint64_t { 0 };
+   auto deflatedSections = 0u;
+
+   for (const auto &section : rpl.sections) {
+      if (section.header.type != elf::SHT_NOBITS) {
+         storedSize += section.header.size;
+      }
+
+      if (readOk) {
+         inflatedSize += section.dataSize();
+      }
+
+      if (section.header.flags & elf::SHF_DEFLATED) {
+         deflatedSections++;
+      }
+   }
+
+   auto out = fmt::format("{},{},{}", escapeCsv(filename), readOk, passed);
+   if (!rpl.sections.empty()) {
+      out += fmt::format(",{},{},{},{},{},{},{}",
+                         rpl.header.type.value(), rpl.header.machine.value(),
+                         rpl.header.entry.value(), rpl.sections.size(),
+                         storedSize, inflatedSize, deflatedSections);
+   } else {
+      out += ",,,,,,,";
+   }
+
+   auto info = readOk ? findFileInfo(rpl) : nullptr;
+   for (auto &field : getFileInfoFields(info ? *info : elf::RplFileInfo {})) {
+      if (info) {
+         out += fmt::format(",{}", field.second);
+      } else {
+         out += ",";
+      }
+   }
+
+   for (auto i = 0u; i < NumVerifyChecks; ++i) {
+      if (checks.completed[i]) {
+         out += fmt::format(",{}", !checks.failed[i]);
+      } else {
+         out += ",";
+      }
+   }
+
+   auto lines = splitLines(messages);
+   auto joined = std::string { };
+   for (auto i = 0u; i < lines.size(); ++i) {
+      joined += (i ? "; " : "") + lines[i];
+   }
+
+   out += "," + escapeCsv(joined);
+   return out;
+}
+
+static BatchRecord
+checkFile(const std::string &filename,
+          BatchFormat format,
+          bool failFast)
+{
+   std::ostringstream messages;
+   VerifyResult checks;
+   MappedFile file;
+   Rpl rpl {};
+
+   auto readOk = false;
+   if (!file.open(filename)) {
+      fmt::println(messages, "Could not open \"{}\" for reading", filename);
+   } else if (readRpl(file, rpl, messages)) {
+      readOk = scanSections(rpl, 1, messages);
+   }
+
+   if (readOk) {
+      VerifyOptions options;
+      options.failFast = failFast;
+      checks = verifyRpl(rpl, options, messages);
+   }
+
+   BatchRecord record;
+   record.passed = readOk && checks.passed();
+   if (format == BatchFormat::Csv) {
+      record.text = formatCsvRecord(filename, rpl, readOk, checks, record.passed, messages.str());
+   } else {
+      record.text = formatJsonRecord(filename, rpl, readOk, checks, record.passed, messages.str());
+   }
+   return record;
+}
+
+bool
+runBatch(const std::vector<std::string> &files,
+         BatchFormat format,
+         unsigned jobs,
+         bool failFast,
+         std::ostream &out)
+{
+   auto result = true;
+
+   if (format == BatchFormat::Csv) {
+      fmt::println(out, "{}", formatCsvHeader());
+   }
+
+   // Check the files in blocks, so records come out in order without keeping
+   // all of them in memory
+   auto blockSize = static_cast<size_t>(jobs) * RecordsPerJob;
+   std::vector<BatchRecord> records;
+
+   for (auto start = size_t { 0 }; start < files.size(); start += blockSize) {
+      auto count = std::min(blockSize, files.size() - start);
+      records.assign(count, {});
+
+      parallel_for(count, jobs, [&](size_t i) {
+         records[i] = checkFile(files[start + i], format, failFast);
+      });
+
+      for (auto &record : records) {
+         fmt::println(out, "{}", record.text);
+         result = record.passed && result;
+      }
+
+      out.flush();
+   }
+
+   return result;
+}
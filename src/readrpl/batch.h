@@ -0,0 +1,28 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class BatchFormat
+{
+   Json,
+   Csv,
+};
+
+// Collects the files to check in batch mode. path is either a directory,
+// which is searched recursively for .rpl and .rpx files, or a file with one
+// path per line, "-" reads the list from stdin.
+bool
+collectBatchInputs(const std::string &path,
+                   std::vector<std::string> &files);
+
+// Checks every file using up to jobs threads, and writes one record per file
+// to out, in the same order as files. Returns false if any file could not be
+// read or failed one of the checks. With failFast the checks of a file stop at
+// its first failure.
+bool
+runBatch(const std::vector<std::string> &files,
+         BatchFormat format,
+         unsigned jobs,
+         bool failFast,
+         std::ostream &out);
@@ -72,8 +72,8 @@ generateExportsDef(const Rpl &rpl,
 
    for (auto &section : rpl.sections) {
       if (section.header.type == elf::SHT_RPL_EXPORTS) {
-         auto exports = reinterpret_cast<const elf::RplExport *>(section.data.data());
-         auto strTab = section.data.data();
+         auto exports = reinterpret_cast<const elf::RplExport *>(section.data().data());
+         auto strTab = section.data().data();
 
          if (section.header.flags & elf::SHF_EXECINSTR) {
             fmt::println(out, "\n:TEXT");
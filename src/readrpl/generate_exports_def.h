@@ -1,5 +1,5 @@
 #pragma once
-#include "readrpl.h"
+#include "rpl_reader.h"
 #include <filesystem>
 #include <string>
 
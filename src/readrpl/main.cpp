@@ -1,18 +1,24 @@
+#include "batch.h"
 #include "elf.h"
 #include "generate_exports_def.h"
+#include "parallel.h"
 #include "print.h"
+#include "size_report.h"
 #include "verify.h"
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <excmd.h>
 #include <fmt/base.h>
-#include <fstream>
+#include <fmt/format.h>
 #include <iostream>
+#include <sstream>
 #include <vector>
-#include <zlib.h>
 
 using std::cerr;
 using std::cout;
@@ -40,73 +46,30 @@ getFileBasename(std::string path)
    return path;
 }
 
-uint32_t
-getSectionIndex(const Rpl &rpl,
-                const Section &section)
+/**
+ * Parse a list of addresses separated by commas or whitespace.
+ */
+static bool
+parseAddresses(std::istream &in,
+               std::vector<uint32_t> &addresses)
 {
-   return static_cast<uint32_t>(&section - &rpl.sections[0]);
-}
-
-bool
-readSection(std::ifstream &fh,
-            Section &section,
-            size_t i)
-{
-   // Read section header
-   fh.read(reinterpret_cast<char*>(&section.header), sizeof(elf::SectionHeader));
-
-   if (section.header.type == elf::SHT_NOBITS || !section.header.size) {
-      return true;
-   }
-
-   // Read section data
-   if (section.header.flags & elf::SHF_DEFLATED) {
-      auto stream = z_stream {};
-      auto ret = Z_OK;
-
-      // Read the original size
-      uint32_t size = 0;
-      fh.seekg(section.header.offset.value());
-      fh.read(reinterpret_cast<char *>(&size), sizeof(uint32_t));
-      size = byte_swap(size);
-      section.data.resize(size);
-
-      // Inflate
-      memset(&stream, 0, sizeof(stream));
-      stream.zalloc = Z_NULL;
-      stream.zfree = Z_NULL;
-      stream.opaque = Z_NULL;
-
-      ret = inflateInit(&stream);
-
-      if (ret != Z_OK) {
-         fmt::println(cerr, "Couldn't decompress .rpx section because inflateInit returned {}", ret);
-         section.data.clear();
-         return false;
-      } else {
-         std::vector<char> temp;
-         temp.resize(section.header.size-sizeof(uint32_t));
-         fh.read(temp.data(), temp.size());
-
-         stream.avail_in = section.header.size;
-         stream.next_in = reinterpret_cast<Bytef *>(temp.data());
-         stream.avail_out = static_cast<uInt>(section.data.size());
-         stream.next_out = reinterpret_cast<Bytef *>(section.data.data());
-
-         ret = inflate(&stream, Z_FINISH);
-
-         if (ret != Z_OK && ret != Z_STREAM_END) {
-            fmt::println(cerr, "Couldn't decompress .rpx section because inflate returned {}", ret);
-            section.data.clear();
+   std::string token;
+   while (in >> token) {
+      std::replace(token.begin(), token.end(), ',', ' ');
+      std::istringstream tokens { token };
+      std::string text;
+
+      while (tokens >> text) {
+         char *end = nullptr;
+         errno = 0;
+         auto value = std::strtoull(text.c_str(), &end, 0);
+         if (errno || *end || value > 0xFFFFFFFFull) {
+            fmt::println(cerr, "Invalid address: {}", text);
             return false;
          }
 
-         inflateEnd(&stream);
+         addresses.push_back(static_cast<uint32_t>(value));
       }
-   } else {
-      section.data.resize(section.header.size);
-      fh.seekg(section.header.offset.value());
-      fh.read(section.data.data(), section.header.size);
    }
 
    return true;
@@ -118,7 +81,8 @@ show_help(std::ostream& out,
           const std::string& exec_name)
 {
    fmt::println(out, "Usage:");
-   fmt::println(out, "  {} [options] <input.rpl>\n", exec_name);
+   fmt::println(out, "  {} [options] <input.rpl>", exec_name);
+   fmt::println(out, "  {} [options] --batch <dir|list>\n", exec_name);
    fmt::println(out, "{}", parser.format_help(exec_name));
    fmt::println(out, "Report bugs to {}", PACKAGE_BUGREPORT);
 }
@@ -154,6 +118,30 @@ int main(int argc, char **argv)
                      description { "Display the RPL crc" })
          .add_option("f,file-info",
                      description { "Display the RPL file info" })
+         .add_option("j,jobs",
+                     description { "Number of threads used to inflate and verify sections, or to check files in batch mode (0 uses one per CPU, default is 1)" },
+                     value<int> {})
+         .add_option("no-verify",
+                     description { "Skip the integrity checks, only the sections that are displayed get read" })
+         .add_option("fail-fast",
+                     description { "Stop the integrity checks at the first error, and exit with an error instead of displaying anything" })
+         .add_option("b,batch",
+                     description { "Check every .rpl and .rpx file in this directory, or every file listed in this file, - reads the list from stdin" },
+                     value<std::string> {})
+         .add_option("format",
+                     description { "Output format of batch mode, json (one object per line) or csv (default is json)" },
+                     value<std::string> {})
+         .add_option("addr2sym",
+                     description { "Display the symbol containing each of these comma separated addresses, - reads them from stdin" },
+                     value<std::string> {})
+         .add_option("size",
+                     description { "Display the stored and inflated size of each section, the size of the imports of each module, and the largest symbols" })
+         .add_option("size-diff",
+                     description { "Display the size changes from this older RPL to input.rpl" },
+                     value<std::string> {})
+         .add_option("size-symbols",
+                     description { "Number of symbols displayed by --size and --size-diff, 0 displays all (default is 20)" },
+                     value<int> {})
          .add_option("exports-def",
                      description { "Generate exports.def for wut library linking" },
                      value<std::string> {});
@@ -185,6 +173,37 @@ int main(int argc, char **argv)
       return ERROR_BAD_ARGUMENTS;
    }
 
+   auto jobs = 1u;
+   if (options.has("jobs")) {
+      auto value = options.get<int>("jobs");
+      if (value < 0) {
+         fmt::println(cerr, "Invalid number of jobs: {}", value);
+         return ERROR_BAD_ARGUMENTS;
+      }
+
+      jobs = resolve_jobs(value);
+   }
+
+   if (options.has("batch")) {
+      auto format = BatchFormat::Json;
+      if (options.has("format")) {
+         auto name = options.get<std::string>("format");
+         if (name == "csv") {
+            format = BatchFormat::Csv;
+         } else if (name != "json") {
+            fmt::println(cerr, "Unknown batch format: {}", name);
+            return ERROR_BAD_ARGUMENTS;
+         }
+      }
+
+      std::vector<std::string> files;
+      if (!collectBatchInputs(options.get<std::string>("batch"), files)) {
+         return ERROR_OPEN_INPUT;
+      }
+
+      return runBatch(files, format, jobs, options.has("fail-fast"), cout) ? 0 : ERROR_BAD_INPUT;
+   }
+
    if (!options.has("input.rpl")) {
       fmt::println(cerr, "Missing mandatory argument: <input.rpl>\n");
       show_help(cerr, parser, argv[0]);
@@ -203,55 +222,71 @@ int main(int argc, char **argv)
    auto dumpSectionRplFileinfo = all || options.has("file-info");
    auto input_rpl = options.get<std::string>("input.rpl");
 
-   // If no options are set (other than "path"), let's default to a summary
-   if (options.set_options.size() == 1) {
+   // If nothing to display is selected, let's default to a summary
+   if (!dumpElfHeader && !dumpSectionSummary && !dumpSectionRela &&
+       !dumpSectionSymtab && !dumpSectionRplExports && !dumpSectionRplImports &&
+       !dumpSectionRplCrcs && !dumpSectionRplFileinfo && !options.has("exports-def") &&
+       !options.has("addr2sym") && !options.has("size") && !options.has("size-diff")) {
       dumpElfHeader = true;
       dumpSectionSummary = true;
       dumpSectionRplFileinfo = true;
    }
 
+   auto sizeSymbols = 20u;
+   if (options.has("size-symbols")) {
+      auto value = options.get<int>("size-symbols");
+      if (value < 0) {
+         fmt::println(cerr, "Invalid number of symbols: {}", value);
+         return ERROR_BAD_ARGUMENTS;
+      }
+
+      sizeSymbols = static_cast<unsigned>(value);
+   }
+
+   std::vector<uint32_t> addresses;
+   if (options.has("addr2sym")) {
+      auto list = options.get<std::string>("addr2sym");
+      auto ok = false;
+      if (list == "-") {
+         ok = parseAddresses(std::cin, addresses);
+      } else {
+         std::istringstream in { list };
+         ok = parseAddresses(in, addresses);
+      }
+
+      if (!ok) {
+         return ERROR_BAD_ARGUMENTS;
+      }
+   }
+
    // Read file
-   std::ifstream fh { input_rpl, std::ifstream::binary };
-   if (!fh.is_open()) {
-       fmt::println(cerr, "Could not open \"{}\" for reading", input_rpl);
+   MappedFile file;
+   if (!file.open(input_rpl)) {
+      fmt::println(cerr, "Could not open \"{}\" for reading", input_rpl);
       return ERROR_OPEN_INPUT;
    }
 
    Rpl rpl;
-   fh.read(reinterpret_cast<char*>(&rpl.header), sizeof rpl.header);
-
-   if (rpl.header.magic != elf::HeaderMagic) {
-      fmt::println(cerr, "Invalid ELF magic header: {:08X}", rpl.header.magic.value());
+   if (!readRpl(file, rpl, cerr)) {
       return ERROR_BAD_INPUT;
    }
 
-   // Read sections
-   for (auto i = 0u; i < rpl.header.shnum; ++i) {
-      Section section;
-      fh.seekg(rpl.header.shoff + rpl.header.shentsize * i);
-
-      if (!readSection(fh, section, i)) {
-         fmt::println(cerr, "Error reading section {}", i);
+   // Verify rpl format
+   if (!options.has("no-verify")) {
+      if (!scanSections(rpl, jobs, cerr)) {
          return ERROR_BAD_INPUT;
       }
 
-      rpl.sections.push_back(section);
-   }
+      VerifyOptions verify;
+      verify.jobs = jobs;
+      verify.failFast = options.has("fail-fast");
 
-   // Set section names
-   auto shStrTab = reinterpret_cast<const char *>(rpl.sections[rpl.header.shstrndx].data.data());
-   for (auto &section : rpl.sections) {
-      section.name = shStrTab + section.header.name;
+      auto result = verifyRpl(rpl, verify, cerr);
+      if (verify.failFast && !result.passed()) {
+         return ERROR_BAD_INPUT;
+      }
    }
 
-   // Verify rpl format
-   verifyFile(rpl);
-   verifyCrcs(rpl);
-   verifyFileBounds(rpl);
-   verifyRelocationTypes(rpl);
-   verifySectionAlignment(rpl);
-   verifySectionOrder(rpl);
-
    // Format shit
    if (dumpElfHeader) {
       printHeader(rpl);
@@ -267,7 +302,7 @@ int main(int argc, char **argv)
       auto printSectionHeader = [&](){
          fmt::println(cout,
             "Section {}: {}, {}, {} bytes",
-            i, formatSHT(section.header.type), section.name, section.data.size());
+            i, formatSHT(section.header.type), section.name, section.data().size());
       };
 
       switch (section.header.type) {
@@ -330,10 +365,45 @@ int main(int argc, char **argv)
       }
    }
 
+   if (options.has("size")) {
+      SizeReport report;
+      buildSizeReport(rpl, report);
+      printSizeReport(report, sizeSymbols);
+   }
+
+   if (options.has("size-diff")) {
+      auto base_rpl = options.get<std::string>("size-diff");
+      MappedFile baseFile;
+      if (!baseFile.open(base_rpl)) {
+         fmt::println(cerr, "Could not open \"{}\" for reading", base_rpl);
+         return ERROR_OPEN_INPUT;
+      }
+
+      Rpl base;
+      if (!readRpl(baseFile, base, cerr) || !scanSections(base, jobs, cerr)) {
+         return ERROR_BAD_INPUT;
+      }
+
+      SizeReport baseReport, report;
+      buildSizeReport(base, baseReport);
+      buildSizeReport(rpl, report);
+      printSizeDiff(baseReport, report, sizeSymbols);
+   }
+
+   if (options.has("addr2sym")) {
+      printAddressSymbols(rpl, addresses);
+   }
+
    if (options.has("exports-def")) {
       auto output = options.get<std::string>("exports-def");
       if (!generateExportsDef(rpl, getFileBasename(input_rpl), output)) {
          return ERROR_OPEN_OUTPUT;
       }
    }
+
+   for (const auto &section : rpl.sections) {
+      if (section.readFailed()) {
+         return ERROR_BAD_INPUT;
+      }
+   }
 }
@@ -1,4 +1,5 @@
 #include "print.h"
+#include "symbol_index.h"
 #include <fmt/base.h>
 #include <iostream>
 #include <string>
@@ -301,7 +302,7 @@ void
 printFileInfo(const Rpl &rpl,
               const Section &section)
 {
-   auto &info = *reinterpret_cast<const elf::RplFileInfo *>(section.data.data());
+   auto &info = *reinterpret_cast<const elf::RplFileInfo *>(section.data().data());
    fmt::println(cout, "  {:<20} = 0x{:08X}", "version",        info.version.value());
    fmt::println(cout, "  {:<20} = 0x{:08X}", "textSize",       info.textSize.value());
    fmt::println(cout, "  {:<20} = 0x{:X}",   "textAlign",      info.textAlign.value());
@@ -318,7 +319,7 @@ printFileInfo(const Rpl &rpl,
    fmt::println(cout, "  {:<20} = 0x{:08X}", "heapSize",       info.heapSize.value());
 
    if (info.filename) {
-      auto filename = section.data.data() + info.filename;
+      auto filename = section.data().data() + info.filename;
       fmt::println(cout, "  {:<20} = {}",    "filename",       filename);
    } else {
       fmt::println(cout, "  {:<20} = 0",     "filename");
@@ -335,7 +336,7 @@ printFileInfo(const Rpl &rpl,
    fmt::println(cout, "  {:<20} = 0x{:X}",   "runtimeFileInfoSize", info.runtimeFileInfoSize.value());
 
    if (info.tagOffset) {
-      const char *tags = section.data.data() + info.tagOffset;
+      const char *tags = section.data().data() + info.tagOffset;
       fmt::println(cout, "  Tags:");
 
       while (*tags) {
@@ -357,11 +358,11 @@ printRela(const Rpl &rpl,
       "  {:<8} {:<8} {:<16} {:<8} {}\n", "Offset", "Info", "Type", "Value", "Name + Addend");
 
    auto &symSec = rpl.sections[section.header.link];
-   auto symbols = reinterpret_cast<const elf::Symbol *>(symSec.data.data());
+   auto symbols = reinterpret_cast<const elf::Symbol *>(symSec.data().data());
    auto &symStrTab = rpl.sections[symSec.header.link];
 
-   auto relas = reinterpret_cast<const elf::Rela *>(section.data.data());
-   auto count = section.data.size() / sizeof(elf::Rela);
+   auto relas = section.data().view<elf::Rela>();
+   auto count = relas.size();
 
    for (auto i = 0u; i < count; ++i) {
       auto &rela = relas[i];
@@ -371,7 +372,7 @@ printRela(const Rpl &rpl,
       auto typeName = formatRelType(type);
 
       auto symbol = symbols[index];
-      auto name = reinterpret_cast<const char*>(symStrTab.data.data()) + symbol.name;
+      auto name = reinterpret_cast<const char*>(symStrTab.data().data()) + symbol.name;
 
       fmt::println(cout,
          "  {:08X} {:08X} {:<16} {:08X} {} + {:X}",
@@ -388,15 +389,15 @@ void
 printSymTab(const Rpl &rpl,
             const Section &section)
 {
-   auto strTab = reinterpret_cast<const char*>(rpl.sections[section.header.link].data.data());
+   auto strTab = reinterpret_cast<const char*>(rpl.sections[section.header.link].data().data());
 
    fmt::println(cout,
       "  {:<4} {:<8} {:<6} {:<8} {:<8} {:<3} {}",
       "Num", "Value", "Size", "Type", "Bind", "Ndx", "Name");
 
    auto id = 0u;
-   auto symbols = reinterpret_cast<const elf::Symbol *>(section.data.data());
-   auto count = section.data.size() / sizeof(elf::Symbol);
+   auto symbols = section.data().view<elf::Symbol>();
+   auto count = symbols.size();
 
    for (auto i = 0u; i < count; ++i) {
       auto &symbol = symbols[i];
@@ -427,7 +428,7 @@ printRplImports(const Rpl &rpl,
                 const Section &section)
 {
    auto sectionIndex = getSectionIndex(rpl, section);
-   auto import = reinterpret_cast<const elf::RplImport *>(section.data.data());
+   auto import = reinterpret_cast<const elf::RplImport *>(section.data().data());
    fmt::println(cout, "  {:<20} = {}", "name", import->name);
    fmt::println(cout, "  {:<20} = 0x{:08X}", "signature", import->signature.value());
    fmt::println(cout, "  {:<20} = {}", "count", import->count);
@@ -438,9 +439,9 @@ printRplImports(const Rpl &rpl,
             continue;
          }
 
-         auto symbols = reinterpret_cast<const elf::Symbol *>(symSection.data.data());
-         auto count = symSection.data.size() / sizeof(elf::Symbol);
-         auto strTab = reinterpret_cast<const char*>(rpl.sections[symSection.header.link].data.data());
+         auto symbols = symSection.data().view<elf::Symbol>();
+         auto count = symbols.size();
+         auto strTab = reinterpret_cast<const char*>(rpl.sections[symSection.header.link].data().data());
 
          for (auto i = 0u; i < count; ++i) {
             auto &symbol = symbols[i];
@@ -459,8 +460,8 @@ void
 printRplCrcs(const Rpl &rpl,
              const Section &section)
 {
-   auto crcs = reinterpret_cast<const elf::RplCrc *>(section.data.data());
-   auto count = section.data.size() / sizeof(elf::RplCrc);
+   auto crcs = section.data().view<elf::RplCrc>();
+   auto count = crcs.size();
 
    for (auto i = 0u; i < count; ++i) {
       fmt::println(cout, "  [{:>2}] 0x{:08X} {}", i, crcs[i].crc.value(), section.name);
@@ -471,8 +472,8 @@ void
 printRplExports(const Rpl &rpl,
                 const Section &section)
 {
-   auto exports = reinterpret_cast<const elf::RplExport *>(section.data.data());
-   auto strTab = section.data.data();
+   auto exports = reinterpret_cast<const elf::RplExport *>(section.data().data());
+   auto strTab = section.data().data();
    fmt::println(cout, "  {:<20} = 0x{:08X}", "signature", exports->signature.value());
    fmt::println(cout, "  {:<20} = {}", "count", exports->count);
 
@@ -484,3 +485,36 @@ printRplExports(const Rpl &rpl,
       fmt::println(cout, "    0x{:08X} {}", value.value(), name);
    }
 }
+
+void
+printAddressSymbols(const Rpl &rpl,
+                    const std::vector<uint32_t> &addresses)
+{
+   SymbolIndex index;
+   for (const auto &section : rpl.sections) {
+      if (section.header.type != elf::SHT_SYMTAB ||
+          section.header.link >= rpl.sections.size()) {
+         continue;
+      }
+
+      const auto &symbols = section.data();
+      const auto &strings = rpl.sections[section.header.link].data();
+      index.addSymbolTable(symbols.data(), symbols.size(), section.header.entsize,
+                           strings.data(), strings.size());
+   }
+
+   index.finalize();
+
+   for (auto address : addresses) {
+      auto symbol = index.find(address);
+      if (!symbol) {
+         fmt::println(cout, "0x{:08X} ??", address);
+         continue;
+      }
+
+      auto sectionName = symbol->section < rpl.sections.size() ?
+                         rpl.sections[symbol->section].name : std::string { };
+      fmt::println(cout, "0x{:08X} {}+0x{:X} {}",
+                   address, symbol->name, address - symbol->address, sectionName);
+   }
+}
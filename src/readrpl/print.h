@@ -1,5 +1,6 @@
 #pragma once
-#include "readrpl.h"
+#include "rpl_reader.h"
+#include <vector>
 
 std::string
 formatSHT(uint32_t type);
@@ -33,3 +34,7 @@ printRplCrcs(const Rpl &rpl,
 void
 printRplExports(const Rpl &rpl,
                 const Section &section);
+
+void
+printAddressSymbols(const Rpl &rpl,
+                    const std::vector<uint32_t> &addresses);
@@ -0,0 +1,342 @@
+#include "size_report.h"
+#include "print.h"
+#include "symbol_index.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fmt/base.h>
+#include <fmt/format.h>
+#include <iostream>
+#include <map>
+#include <string_view>
+
+using std::cout;
+
+struct SizeDiffRow
+{
+   std::string name;
+   int64_t oldSize;
+   int64_t newSize;
+};
+
+/**
+ * Sections without a name, like the RPL CRCs and file info, are shown by
+ * their type instead.
+ */
+static std::string
+sGetSectionName(const Section &section)
+{
+   return section.name.empty() ? formatSHT(section.header.type) : section.name;
+}
+
+/**
+ * The name of the RPL an import section imports from, either from the
+ * .fimport_ or .dimport_ section name or from the import itself.
+ */
+static std::string
+sGetModuleName(const Section &section)
+{
+   using namespace std::string_view_literals;
+   auto name = std::string_view { section.name };
+   if (name.starts_with(".fimport_"sv) || name.starts_with(".dimport_"sv)) {
+      return std::string { name.substr(9) };
+   }
+
+   const auto &data = section.data();
+   if (data.size() > offsetof(elf::RplImport, name)) {
+      auto importName = data.data() + offsetof(elf::RplImport, name);
+      return std::string { importName,
+                           strnlen(importName, data.size() - offsetof(elf::RplImport, name)) };
+   }
+
+   return sGetSectionName(section);
+}
+
+/**
+ * Adds the size of the import symbols of each module to the modules, and
+ * counts them by type.
+ */
+static void
+sAttributeImportSymbols(const Rpl &rpl,
+                        const std::vector<int> &sectionModules,
+                        SizeReport &report)
+{
+   for (const auto &section : rpl.sections) {
+      if (section.header.type != elf::SHT_SYMTAB ||
+          section.header.link >= rpl.sections.size()) {
+         continue;
+      }
+
+      const auto &symbols = section.data();
+      const auto &strings = rpl.sections[section.header.link].data();
+      auto entsize = section.header.entsize ?
+                     static_cast<size_t>(section.header.entsize) :
+                     sizeof(elf::Symbol);
+      if (entsize < sizeof(elf::Symbol)) {
+         continue;
+      }
+
+      for (auto offset = size_t { 0 }; offset + sizeof(elf::Symbol) <= symbols.size();
+           offset += entsize) {
+         auto symbol = reinterpret_cast<const elf::Symbol *>(symbols.data() + offset);
+         if (symbol->shndx >= sectionModules.size() || sectionModules[symbol->shndx] < 0) {
+            continue;
+         }
+
+         auto &module = report.modules[sectionModules[symbol->shndx]];
+         if ((symbol->info & 0xf) == elf::STT_FUNC) {
+            module.functions++;
+         } else {
+            module.data++;
+         }
+
+         module.symbolSize += entsize;
+         if (symbol->name < strings.size()) {
+            module.symbolSize += strnlen(strings.data() + symbol->name,
+                                         strings.size() - symbol->name) + 1;
+         }
+      }
+   }
+}
+
+void
+buildSizeReport(const Rpl &rpl,
+                SizeReport &report)
+{
+   report = SizeReport { };
+   report.fileSize = rpl.fileSize;
+
+   // Sections, and the modules of the import sections
+   std::map<std::string, size_t> moduleIndices;
+   std::vector<int> sectionModules(rpl.sections.size(), -1);
+   for (auto i = 0u; i < rpl.sections.size(); ++i) {
+      const auto &section = rpl.sections[i];
+      auto storedSize = section.header.type == elf::SHT_NOBITS ?
+                        uint64_t { 0 } : uint64_t { section.header.size };
+      report.sections.push_back({
+         sGetSectionName(section),
+         section.header.type,
+         storedSize,
+         section.dataSize(),
+      });
+
+      if (section.header.type != elf::SHT_RPL_IMPORTS) {
+         continue;
+      }
+
+      auto name = sGetModuleName(section);
+      auto [itr, inserted] = moduleIndices.emplace(name, report.modules.size());
+      if (inserted) {
+         report.modules.push_back({});
+         report.modules.back().name = name;
+      }
+
+      auto &module = report.modules[itr->second];
+      module.storedSize += storedSize;
+      module.inflatedSize += section.dataSize();
+      sectionModules[i] = static_cast<int>(itr->second);
+   }
+
+   sAttributeImportSymbols(rpl, sectionModules, report);
+
+   std::sort(report.modules.begin(), report.modules.end(),
+             [](const SizeReport::Module &lhs, const SizeReport::Module &rhs) {
+                auto lhsSize = lhs.inflatedSize + lhs.symbolSize;
+                auto rhsSize = rhs.inflatedSize + rhs.symbolSize;
+                return lhsSize != rhsSize ? lhsSize > rhsSize : lhs.name < rhs.name;
+             });
+
+   // Symbols, the import symbols are left out since they have no size
+   SymbolIndex index;
+   for (const auto &section : rpl.sections) {
+      if (section.header.type != elf::SHT_SYMTAB ||
+          section.header.link >= rpl.sections.size()) {
+         continue;
+      }
+
+      const auto &symbols = section.data();
+      const auto &strings = rpl.sections[section.header.link].data();
+      index.addSymbolTable(symbols.data(), symbols.size(), section.header.entsize,
+                           strings.data(), strings.size());
+   }
+
+   std::map<std::pair<std::string, std::string>, uint64_t> symbolSizes;
+   for (const auto &symbol : index.symbols()) {
+      if (symbol.section >= rpl.sections.size() || sectionModules[symbol.section] >= 0) {
+         continue;
+      }
+
+      symbolSizes[{ sGetSectionName(rpl.sections[symbol.section]), symbol.name }] += symbol.size;
+   }
+
+   for (auto &[key, size] : symbolSizes) {
+      report.symbols.push_back({ key.second, key.first, size });
+   }
+
+   std::stable_sort(report.symbols.begin(), report.symbols.end(),
+                    [](const SizeReport::Symbol &lhs, const SizeReport::Symbol &rhs) {
+                       return lhs.size > rhs.size;
+                    });
+}
+
+static std::string
+sFormatRatio(uint64_t storedSize,
+             uint64_t inflatedSize)
+{
+   if (!inflatedSize) {
+      return "-";
+   }
+
+   return fmt::format("{:.1f}%", 100.0 * storedSize / inflatedSize);
+}
+
+void
+printSizeReport(const SizeReport &report,
+                unsigned maxSymbols)
+{
+   auto totalInflated = uint64_t { 0 };
+   fmt::println(cout, "Section sizes:");
+   fmt::println(cout, "  {:>10} {:>10} {:>6}  {:<16} {}",
+                "Stored", "Inflated", "Ratio", "Type", "Name");
+
+   for (const auto &section : report.sections) {
+      if (!section.storedSize && !section.inflatedSize) {
+         continue;
+      }
+
+      fmt::println(cout, "  {:>10} {:>10} {:>6}  {:<16} {}",
+                   section.storedSize, section.inflatedSize,
+                   sFormatRatio(section.storedSize, section.inflatedSize),
+                   formatSHT(section.type), section.name);
+      totalInflated += section.inflatedSize;
+   }
+
+   fmt::println(cout, "  {:>10} {:>10} {:>6}  {:<16} {}",
+                report.fileSize, totalInflated, sFormatRatio(report.fileSize, totalInflated),
+                "", "TOTAL (file)");
+
+   if (!report.modules.empty()) {
+      fmt::println(cout, "");
+      fmt::println(cout, "Import sizes by module:");
+      fmt::println(cout, "  {:>6} {:>6} {:>10} {:>10} {:>10}  {}",
+                   "Funcs", "Data", "Stored", "Inflated", "Symbols", "Module");
+
+      for (const auto &module : report.modules) {
+         fmt::println(cout, "  {:>6} {:>6} {:>10} {:>10} {:>10}  {}",
+                      module.functions, module.data, module.storedSize,
+                      module.inflatedSize, module.symbolSize, module.name);
+      }
+   }
+
+   auto count = maxSymbols ? std::min<size_t>(maxSymbols, report.symbols.size()) :
+                             report.symbols.size();
+   fmt::println(cout, "");
+   fmt::println(cout, "Largest symbols ({} of {}):", count, report.symbols.size());
+   fmt::println(cout, "  {:>10}  {:<20} {}", "Size", "Section", "Name");
+   for (auto i = 0u; i < count; ++i) {
+      const auto &symbol = report.symbols[i];
+      fmt::println(cout, "  {:>10}  {:<20} {}", symbol.size, symbol.section, symbol.name);
+   }
+}
+
+/**
+ * Prints the rows whose size changed, largest changes first, and only the
+ * first maxRows of them unless it is 0.
+ */
+static void
+sPrintDiffRows(const char *title,
+               const char *nameTitle,
+               std::vector<SizeDiffRow> rows,
+               unsigned maxRows)
+{
+   std::erase_if(rows, [](const SizeDiffRow &row) { return row.oldSize == row.newSize; });
+   std::stable_sort(rows.begin(), rows.end(),
+                    [](const SizeDiffRow &lhs, const SizeDiffRow &rhs) {
+                       auto lhsDelta = lhs.newSize - lhs.oldSize;
+                       auto rhsDelta = rhs.newSize - rhs.oldSize;
+                       return std::abs(lhsDelta) > std::abs(rhsDelta);
+                    });
+
+   auto count = maxRows ? std::min<size_t>(maxRows, rows.size()) : rows.size();
+   fmt::println(cout, "");
+   fmt::println(cout, "{} ({} of {} changed):", title, count, rows.size());
+   if (rows.empty()) {
+      return;
+   }
+
+   fmt::println(cout, "  {:>10} {:>10} {:>10}  {}", "Delta", "Old", "New", nameTitle);
+   for (auto i = 0u; i < count; ++i) {
+      const auto &row = rows[i];
+      fmt::println(cout, "  {:>+10} {:>10} {:>10}  {}",
+                   row.newSize - row.oldSize, row.oldSize, row.newSize, row.name);
+   }
+}
+
+/**
+ * Pairs up the rows of base and report with the same key, a row missing from
+ * either side has a size of 0 there.
+ */
+template<typename Entry, typename GetKey, typename GetSize>
+static std::vector<SizeDiffRow>
+sMatchRows(const std::vector<Entry> &base,
+           const std::vector<Entry> &report,
+           GetKey getKey,
+           GetSize getSize)
+{
+   std::vector<SizeDiffRow> rows;
+   std::map<std::string, size_t> indices;
+   auto add = [&](const Entry &entry, bool isNew) {
+      auto [itr, inserted] = indices.emplace(getKey(entry), rows.size());
+      if (inserted) {
+         rows.push_back({ itr->first, 0, 0 });
+      }
+
+      auto &row = rows[itr->second];
+      (isNew ? row.newSize : row.oldSize) += static_cast<int64_t>(getSize(entry));
+   };
+
+   for (const auto &entry : base) {
+      add(entry, false);
+   }
+
+   for (const auto &entry : report) {
+      add(entry, true);
+   }
+
+   return rows;
+}
+
+void
+printSizeDiff(const SizeReport &base,
+              const SizeReport &report,
+              unsigned maxSymbols)
+{
+   auto delta = static_cast<int64_t>(report.fileSize) - static_cast<int64_t>(base.fileSize);
+   fmt::println(cout, "File size: {} -> {} ({:+})", base.fileSize, report.fileSize, delta);
+
+   auto sectionName = [](const SizeReport::Section &section) { return section.name; };
+   sPrintDiffRows("Stored section sizes", "Section",
+                  sMatchRows(base.sections, report.sections, sectionName,
+                             [](const SizeReport::Section &section) { return section.storedSize; }),
+                  0);
+   sPrintDiffRows("Inflated section sizes", "Section",
+                  sMatchRows(base.sections, report.sections, sectionName,
+                             [](const SizeReport::Section &section) { return section.inflatedSize; }),
+                  0);
+   sPrintDiffRows("Import sizes by module", "Module",
+                  sMatchRows(base.modules, report.modules,
+                             [](const SizeReport::Module &module) { return module.name; },
+                             [](const SizeReport::Module &module) {
+                                return module.inflatedSize + module.symbolSize;
+                             }),
+                  0);
+   sPrintDiffRows("Symbol sizes", "Section / Name",
+                  sMatchRows(base.symbols, report.symbols,
+                             [](const SizeReport::Symbol &symbol) {
+                                return fmt::format("{:<20} {}", symbol.section, symbol.name);
+                             },
+                             [](const SizeReport::Symbol &symbol) { return symbol.size; }),
+                  maxSymbols);
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "rpl_reader.h"
+#include <string>
+#include <vector>
+
+struct SizeReport
+{
+   struct Section
+   {
+      std::string name;
+      uint32_t type;
+      uint64_t storedSize;
+      uint64_t inflatedSize;
+   };
+
+   // The imports of one RPL, from its .fimport_ and .dimport_ sections
+   struct Module
+   {
+      std::string name;
+      uint32_t functions = 0;
+      uint32_t data = 0;
+      uint64_t storedSize = 0;
+      uint64_t inflatedSize = 0;
+
+      // Size of the import symbols and their names in the symbol tables
+      uint64_t symbolSize = 0;
+   };
+
+   // Symbols of the same name in the same section are merged
+   struct Symbol
+   {
+      std::string name;
+      std::string section;
+      uint64_t size;
+   };
+
+   uint64_t fileSize = 0;
+   std::vector<Section> sections;
+   std::vector<Module> modules;
+
+   // Sorted by decreasing size
+   std::vector<Symbol> symbols;
+};
+
+// Attributes the size of rpl to its sections, import modules and symbols,
+// inflating the sections that are not loaded yet.
+void
+buildSizeReport(const Rpl &rpl,
+                SizeReport &report);
+
+// Prints the report, with only the maxSymbols largest symbols unless it is 0
+void
+printSizeReport(const SizeReport &report,
+                unsigned maxSymbols);
+
+// Prints what changed in size from base to report, largest changes first
+void
+printSizeDiff(const SizeReport &base,
+              const SizeReport &report,
+              unsigned maxSymbols);
@@ -1,20 +1,130 @@
 #include "verify.h"
+#include "parallel.h"
 #include <algorithm>
 #include <fmt/base.h>
-#include <iostream>
+#include <fmt/ostream.h>
+#include <sstream>
 #include <string_view>
 #include <unordered_set>
-#include <zlib.h>
-
-using std::cerr;
+#include <vector>
 
 using namespace std::literals;
 
+struct VerifyState
+{
+   VerifyState(const Rpl &rpl) :
+      rpl(rpl)
+   {
+   }
+
+   std::ostream &
+   out(VerifyCheck check)
+   {
+      return messages[check];
+   }
+
+   void
+   fail(VerifyCheck check)
+   {
+      result.failed[check] = true;
+   }
+
+   const Rpl &rpl;
+   VerifyResult result;
+   std::ostringstream messages[NumVerifyChecks];
+
+   // VerifyFile, false when the header is too broken to check the sections
+   bool checkFileSections = true;
+   uint32_t ehsize = 0;
+   uint32_t shentsize = 0;
+   const Section *shStrTabSection = nullptr;
+
+   // VerifyCrcs
+   const elf::RplCrc *crcs = nullptr;
+   std::size_t numCrcs = 0;
+   std::vector<uint32_t> computedCrcs;
+
+   // VerifyFileBounds
+   uint32_t dataMin = 0xFFFFFFFFu;
+   uint32_t dataMax = 0u;
+   uint32_t readMin = 0xFFFFFFFFu;
+   uint32_t readMax = 0u;
+   uint32_t textMin = 0xFFFFFFFFu;
+   uint32_t textMax = 0u;
+   uint32_t tempMin = 0xFFFFFFFFu;
+   uint32_t tempMax = 0u;
+
+   // VerifyRelocationTypes
+   std::unordered_set<unsigned int> unsupportedTypes;
+};
+
+const char *
+getVerifyCheckName(VerifyCheck check)
+{
+   switch (check) {
+   case VerifyFile:
+      return "file";
+   case VerifyCrcs:
+      return "crcs";
+   case VerifyFileBounds:
+      return "file_bounds";
+   case VerifyRelocationTypes:
+      return "relocation_types";
+   case VerifySectionAlignment:
+      return "section_alignment";
+   case VerifySectionOrder:
+      return "section_order";
+   default:
+      return "unknown";
+   }
+}
+
+static bool
+sIsSupportedRelocationType(unsigned int type)
+{
+   switch (type) {
+   case elf::R_PPC_NONE:
+   case elf::R_PPC_ADDR32:
+   case elf::R_PPC_ADDR16_LO:
+   case elf::R_PPC_ADDR16_HI:
+   case elf::R_PPC_ADDR16_HA:
+   case elf::R_PPC_REL24:
+   case elf::R_PPC_REL14:
+   case elf::R_PPC_DTPMOD32:
+   case elf::R_PPC_DTPREL32:
+   case elf::R_PPC_EMB_SDA21:
+   case elf::R_PPC_EMB_RELSDA:
+   case elf::R_PPC_DIAB_SDA21_LO:
+   case elf::R_PPC_DIAB_SDA21_HI:
+   case elf::R_PPC_DIAB_SDA21_HA:
+   case elf::R_PPC_DIAB_RELSDA_LO:
+   case elf::R_PPC_DIAB_RELSDA_HI:
+   case elf::R_PPC_DIAB_RELSDA_HA:
+   case elf::R_PPC_GHS_REL16_HA:
+   case elf::R_PPC_GHS_REL16_HI:
+   case elf::R_PPC_GHS_REL16_LO:
+      // All valid relocations on Wii U
+      return true;
+   default:
+      return false;
+   }
+}
+
+/**
+ * Header part of the loader.elf relocation table validation, returns false
+ * if the table is invalid. Otherwise numRelas and numSymbols are set, and
+ * validateEntries tells if the relocations themselves should be checked.
+ */
 static bool
 sValidateRelocsAddTable(const Rpl &rpl,
-                        const Section &section)
+                        const Section &section,
+                        std::ostream &err,
+                        size_t &numRelas,
+                        size_t &numSymbols,
+                        bool &validateEntries)
 {
    const auto &header = section.header;
+   validateEntries = false;
    if (!header.size) {
       return true;
    }
@@ -25,24 +135,24 @@ sValidateRelocsAddTable(const Rpl &rpl,
    }
 
    if (entsize < sizeof(elf::Rela)) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002E);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002E);
       return false;
    }
 
-   auto numRelas = (header.size / entsize);
+   numRelas = (header.size / entsize);
    if (!numRelas) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000A);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000A);
       return false;
    }
 
    if (!header.link || header.link >= rpl.header.shnum) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000B);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000B);
       return false;
    }
 
    const auto &symbolSection = rpl.sections[header.link];
    if (symbolSection.header.type != elf::SHT_SYMTAB) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000C);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000C);
       return false;
    }
 
@@ -50,33 +160,77 @@ sValidateRelocsAddTable(const Rpl &rpl,
                      static_cast<uint32_t>(symbolSection.header.entsize) :
                      static_cast<uint32_t>(sizeof(elf::Symbol));
    if (symEntsize < sizeof(elf::Symbol)) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002F);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002F);
       return false;
    }
 
    if (header.info >= rpl.header.shnum) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000D);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000D);
       return false;
    }
 
-   const auto &targetSection = rpl.sections[header.info];
-   if (targetSection.header.type != elf::SHT_NULL) {
-      auto numSymbols = symbolSection.data.size() / symEntsize;
-      for (auto i = 0u; i < numRelas; ++i) {
-         auto rela = reinterpret_cast<const elf::Rela *>(section.data.data() + i * entsize);
+   // Never read past the section data
+   numRelas = std::min<size_t>(numRelas, section.data().size() / entsize);
+   numSymbols = symbolSection.data().size() / symEntsize;
+   validateEntries = rpl.sections[header.info].header.type != elf::SHT_NULL;
+   return true;
+}
+
+/**
+ * Walk the relocations of a SHT_RELA section once, for both the loader.elf
+ * table validation and the supported relocation types.
+ */
+static void
+sCheckRelocations(VerifyState &state,
+                  const Section &section,
+                  bool validate)
+{
+   const auto &data = section.data();
+   auto &err = state.out(VerifyFile);
+   auto entsize = section.header.entsize ?
+                  static_cast<size_t>(section.header.entsize) :
+                  sizeof(elf::Rela);
+
+   auto numRelas = size_t { 0 };
+   auto numSymbols = size_t { 0 };
+   auto validateEntries = false;
+   if (validate &&
+       !sValidateRelocsAddTable(state.rpl, section, err, numRelas, numSymbols, validateEntries)) {
+      state.fail(VerifyFile);
+   }
+
+   auto rels = data.view<elf::Rela>();
+   auto numRels = rels.size();
+   auto count = std::max(validateEntries ? numRelas : 0, numRels);
+
+   for (auto i = size_t { 0 }; i < count; ++i) {
+      if (validateEntries && i < numRelas) {
+         auto rela = reinterpret_cast<const elf::Rela *>(data.data() + i * entsize);
          if (rela->info && (rela->info >> 8) >= numSymbols) {
-            fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000F);
-            return false;
+            fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0000F);
+            state.fail(VerifyFile);
+            validateEntries = false;
          }
       }
-   }
 
-   return true;
+      if (i < numRels) {
+         auto type = static_cast<unsigned int>(rels[i].info & 0xFF);
+
+         // Only print error once per type
+         if (!sIsSupportedRelocationType(type) &&
+             !state.unsupportedTypes.contains(type)) {
+            fmt::println(state.out(VerifyRelocationTypes), "Unsupported relocation type {}", type);
+            state.unsupportedTypes.insert(type);
+            state.fail(VerifyRelocationTypes);
+         }
+      }
+   }
 }
 
 static bool
 sValidateSymbolTable(const Rpl &rpl,
-                     const Section &section)
+                     const Section &section,
+                     std::ostream &err)
 {
    auto result = true;
    const auto &header = section.header;
@@ -87,13 +241,13 @@ sValidateSymbolTable(const Rpl &rpl,
    const Section *symStrTabSection = nullptr;
    if (header.link) {
       if (header.link >= rpl.header.shnum) {
-         fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00001);
+         fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00001);
          return false;
       }
 
       symStrTabSection = &rpl.sections[header.link];
       if (symStrTabSection->header.type != elf::SHT_STRTAB) {
-         fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00002);
+         fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00002);
          return false;
       }
    }
@@ -102,22 +256,23 @@ sValidateSymbolTable(const Rpl &rpl,
                   static_cast<uint32_t>(header.entsize) :
                   static_cast<uint32_t>(sizeof(elf::Symbol));
    if (entsize < sizeof(elf::Symbol)) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002D);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002D);
       return false;
    }
 
    auto numSymbols = header.size / entsize;
    if (!numSymbols) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00003);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00003);
       result = false;
    }
 
+   numSymbols = std::min<size_t>(numSymbols, section.data().size() / entsize);
    for (auto i = 0u; i < numSymbols; ++i) {
-      auto symbol = reinterpret_cast<const elf::Symbol *>(section.data.data() + i * entsize);
+      auto symbol = reinterpret_cast<const elf::Symbol *>(section.data().data() + i * entsize);
 
       if (symStrTabSection &&
-          symbol->name > symStrTabSection->data.size()) {
-         fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00004);
+          symbol->name > symStrTabSection->data().size()) {
+         fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00004);
       }
 
       auto type = symbol->info & 0xF;
@@ -126,49 +281,53 @@ sValidateSymbolTable(const Rpl &rpl,
           type != elf::STT_SECTION &&
           type != elf::STT_FILE) {
          if (symbol->shndx >= rpl.header.shnum) {
-            fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00005);
+            fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00005);
             result = false;
          } else if (type == elf::STT_OBJECT) {
             const auto &targetSection = rpl.sections[symbol->shndx];
-            auto targetSectionSize = targetSection.data.size() ?
-                                     static_cast<uint32_t>(targetSection.data.size()) :
+            auto targetSectionSize = targetSection.dataSize() ?
+                                     targetSection.dataSize() :
                                      static_cast<uint32_t>(targetSection.header.size);
 
             if (targetSectionSize &&
                 targetSection.header.flags & elf::SHF_ALLOC) {
                if (targetSection.header.type == elf::SHT_NULL) {
-                  fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00006);
+                  fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00006);
                   result = false;
                }
 
                auto position = symbol->value - targetSection.header.addr;
                if (position > targetSectionSize || position + symbol->size > targetSectionSize) {
-                  std::string_view symName{&symStrTabSection->data[symbol->name]};
+                  std::string_view symName;
+                  if (symStrTabSection && symbol->name < symStrTabSection->data().size()) {
+                     symName = &symStrTabSection->data()[symbol->name];
+                  }
+
                   // Note: GCC sometimes generates the synthetic symbol _SDA_BASE_ outside
                   // of .data, but this seems to be harmless.
                   if (symName != "_SDA_BASE_"sv) {
-                     fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00007);
-                     fmt::println(cerr, "***   section \"{}\", symbol \"{}\"", targetSection.name, symName);
+                     fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00007);
+                     fmt::println(err, "***   section \"{}\", symbol \"{}\"", targetSection.name, symName);
                      result = false;
                   }
                }
             }
          } else if (type == elf::STT_FUNC) {
             const auto &targetSection = rpl.sections[symbol->shndx];
-            auto targetSectionSize = targetSection.data.size() ?
-                                     static_cast<uint32_t>(targetSection.data.size()) :
+            auto targetSectionSize = targetSection.dataSize() ?
+                                     targetSection.dataSize() :
                                      static_cast<uint32_t>(targetSection.header.size);
 
             if (targetSectionSize &&
                 targetSection.header.flags & elf::SHF_ALLOC) {
                if (targetSection.header.type == elf::SHT_NULL) {
-                  fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00008);
+                  fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00008);
                   result = false;
                }
 
                auto position = symbol->value - targetSection.header.addr;
                if (position > targetSectionSize || position + symbol->size > targetSectionSize) {
-                  fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00009);
+                  fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00009);
                   result = false;
                }
             }
@@ -180,48 +339,52 @@ sValidateSymbolTable(const Rpl &rpl,
 }
 
 /**
- * Equivalent to loader.elf ELFFILE_ValidateAndPrepare
+ * Header part of loader.elf ELFFILE_ValidateAndPrepare
  */
-bool
-verifyFile(const Rpl &rpl)
+static void
+sCheckFileHeader(VerifyState &state)
 {
+   const auto &rpl = state.rpl;
    const auto &header = rpl.header;
+   auto &err = state.out(VerifyFile);
    auto result = true;
 
    if (rpl.fileSize < 0x104) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00018);
-      return false;
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00018);
+      state.fail(VerifyFile);
+      state.checkFileSections = false;
+      return;
    }
 
    if (header.magic != elf::HeaderMagic) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00019);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00019);
       result = false;
    }
 
    if (header.fileClass != elf::ELFCLASS32) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001A);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001A);
       result = false;
    }
 
    if (header.elfVersion > elf::EV_CURRENT) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001B);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001B);
       result = false;
    }
 
    if (!header.machine) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001C);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001C);
       result = false;
    }
 
    if (header.version != 1) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001D);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001D);
       result = false;
    }
 
    auto ehsize = static_cast<uint32_t>(header.ehsize);
    if (ehsize) {
       if (header.ehsize < sizeof(elf::Header)) {
-         fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001E);
+         fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001E);
          result = false;
       }
    } else {
@@ -230,18 +393,18 @@ verifyFile(const Rpl &rpl)
 
    auto phoff = header.phoff;
    if (phoff && (phoff < ehsize || phoff >= rpl.fileSize)) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001F);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0001F);
       result = false;
    }
 
    auto shoff = header.shoff;
    if (shoff && (shoff < ehsize || shoff >= rpl.fileSize)) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00020);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00020);
       result = false;
    }
 
    if (header.shstrndx && header.shstrndx >= header.shnum) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00021);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00021);
       result = false;
    }
 
@@ -250,7 +413,7 @@ verifyFile(const Rpl &rpl)
                     static_cast<uint16_t>(32);
    if (header.phoff &&
        (header.phoff + phentsize * header.phnum) > rpl.fileSize) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00022);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00022);
       result = false;
    }
 
@@ -259,144 +422,139 @@ verifyFile(const Rpl &rpl)
                     static_cast<uint32_t>(sizeof(elf::SectionHeader));
    if (header.shoff &&
       (header.shoff + shentsize * header.shnum) > rpl.fileSize) {
-      fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00023);
+      fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00023);
       result = false;
    }
 
-   for (auto &section : rpl.sections) {
-      if (section.header.size &&
-          section.header.type != elf::SHT_NOBITS) {
-         if (section.header.offset < ehsize) {
-            fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00024);
-            result = false;
-         }
-
-         if (section.header.offset >= shoff &&
-             section.header.offset < (shoff + header.shnum * shentsize)) {
-            fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00027);
-            result = false;
-         }
-      }
-   }
-
-   if (header.shstrndx) {
+   if (header.shstrndx && header.shstrndx < rpl.sections.size()) {
       const auto &shStrTabSection = rpl.sections[header.shstrndx];
       if (shStrTabSection.header.type != elf::SHT_STRTAB) {
-         fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002A);
+         fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002A);
          result = false;
       } else {
-         for (auto &section : rpl.sections) {
-            if (section.header.name >= shStrTabSection.data.size()) {
-               fmt::println(cerr, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002B);
-               result = false;
-            }
-         }
+         state.shStrTabSection = &shStrTabSection;
       }
    }
 
-   for (const auto &section : rpl.sections) {
-      if (section.header.type == elf::SHT_RELA) {
-         result = sValidateRelocsAddTable(rpl, section) && result;
-      } else if (section.header.type == elf::SHT_SYMTAB) {
-         result = sValidateSymbolTable(rpl, section) && result;
-      }
+   state.ehsize = ehsize;
+   state.shentsize = shentsize;
+   if (!result) {
+      state.fail(VerifyFile);
    }
-
-   return result;
 }
 
-
 /**
- * Verify values in SHT_RPL_CRCS
+ * Run every per section check on one section
  */
-bool
-verifyCrcs(const Rpl &rpl)
+static void
+sCheckSection(VerifyState &state,
+              const Section &section,
+              uint32_t index)
 {
-   const elf::RplCrc *crcs = NULL;
-   auto result = true;
+   const auto &rpl = state.rpl;
+   const auto &header = section.header;
 
-   for (const auto &section : rpl.sections) {
-      if (section.header.type == elf::SHT_RPL_CRCS) {
-         crcs = reinterpret_cast<const elf::RplCrc *>(section.data.data());
-         break;
-      }
-   }
+   // Equivalent to loader.elf ELFFILE_ValidateAndPrepare
+   if (state.checkFileSections) {
+      auto &err = state.out(VerifyFile);
+      auto shoff = rpl.header.shoff;
 
-   if (!crcs) {
-      return false;
-   }
+      if (header.size && header.type != elf::SHT_NOBITS) {
+         if (header.offset < state.ehsize) {
+            fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00024);
+            state.fail(VerifyFile);
+         }
 
-   auto sectionIndex = 0u;
-   for (const auto &section : rpl.sections) {
-      auto crc = uint32_t { 0u };
-      if (section.header.type != elf::SHT_RPL_CRCS &&
-          section.data.size()) {
-         crc = crc32(0, Z_NULL, 0);
-         crc = crc32(crc, reinterpret_cast<const Bytef *>(section.data.data()), section.data.size());
+         if (header.offset >= shoff &&
+             header.offset < (shoff + rpl.header.shnum * state.shentsize)) {
+            fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD00027);
+            state.fail(VerifyFile);
+         }
       }
 
-      if (crc != crcs[sectionIndex].crc) {
-         fmt::println(cerr,
-                      "Unexpected crc for section {}, read 0x{:08X} but calculated 0x{:08X}",
-                      sectionIndex, crcs[sectionIndex].crc.value(), crc);
-         result = false;
+      if (state.shStrTabSection &&
+          header.name >= state.shStrTabSection->data().size()) {
+         fmt::println(err, "*** Failed ELF file checks (err=0x{:08X})", 0xBAD0002B);
+         state.fail(VerifyFile);
       }
 
-      sectionIndex++;
+      if (header.type == elf::SHT_SYMTAB &&
+          !sValidateSymbolTable(rpl, section, err)) {
+         state.fail(VerifyFile);
+      }
    }
 
-   return result;
-}
-
-
-/**
- * Equivalent to loader.elf LiCheckFileBounds
- */
-bool
-verifyFileBounds(const Rpl &rpl)
-{
-   auto result = true;
-   auto dataMin = 0xFFFFFFFFu;
-   auto dataMax = 0u;
-
-   auto readMin = 0xFFFFFFFFu;
-   auto readMax = 0u;
-
-   auto textMin = 0xFFFFFFFFu;
-   auto textMax = 0u;
-
-   auto tempMin = 0xFFFFFFFFu;
-   auto tempMax = 0u;
+   if (header.type == elf::SHT_RELA) {
+      sCheckRelocations(state, section, state.checkFileSections);
+   }
 
-   for (const auto &section : rpl.sections) {
-      if (section.header.size == 0 ||
-          section.header.type == elf::SHT_RPL_FILEINFO ||
-          section.header.type == elf::SHT_RPL_CRCS ||
-          section.header.type == elf::SHT_NOBITS ||
-          section.header.type == elf::SHT_RPL_IMPORTS) {
-         continue;
+   // Verify values in SHT_RPL_CRCS
+   if (state.crcs) {
+      if (index >= state.numCrcs) {
+         fmt::println(state.out(VerifyCrcs), "Missing crc for section {}", index);
+         state.fail(VerifyCrcs);
+      } else if (state.computedCrcs[index] != state.crcs[index].crc) {
+         fmt::println(state.out(VerifyCrcs),
+                      "Unexpected crc for section {}, read 0x{:08X} but calculated 0x{:08X}",
+                      index, state.crcs[index].crc.value(), state.computedCrcs[index]);
+         state.fail(VerifyCrcs);
       }
+   }
 
-      if ((section.header.flags & elf::SHF_EXECINSTR) &&
-           section.header.type != elf::SHT_RPL_EXPORTS) {
-         textMin = std::min<uint32_t>(textMin, section.header.offset);
-         textMax = std::max<uint32_t>(textMax, section.header.offset + section.header.size);
+   // Equivalent to loader.elf LiCheckFileBounds
+   if (header.size != 0 &&
+       header.type != elf::SHT_RPL_FILEINFO &&
+       header.type != elf::SHT_RPL_CRCS &&
+       header.type != elf::SHT_NOBITS &&
+       header.type != elf::SHT_RPL_IMPORTS) {
+      if ((header.flags & elf::SHF_EXECINSTR) &&
+           header.type != elf::SHT_RPL_EXPORTS) {
+         state.textMin = std::min<uint32_t>(state.textMin, header.offset);
+         state.textMax = std::max<uint32_t>(state.textMax, header.offset + header.size);
       } else {
-         if (section.header.flags & elf::SHF_ALLOC) {
-            if (section.header.flags & elf::SHF_WRITE) {
-               dataMin = std::min<uint32_t>(dataMin, section.header.offset);
-               dataMax = std::max<uint32_t>(dataMax, section.header.offset + section.header.size);
+         if (header.flags & elf::SHF_ALLOC) {
+            if (header.flags & elf::SHF_WRITE) {
+               state.dataMin = std::min<uint32_t>(state.dataMin, header.offset);
+               state.dataMax = std::max<uint32_t>(state.dataMax, header.offset + header.size);
             } else {
-               readMin = std::min<uint32_t>(readMin, section.header.offset);
-               readMax = std::max<uint32_t>(readMax, section.header.offset + section.header.size);
+               state.readMin = std::min<uint32_t>(state.readMin, header.offset);
+               state.readMax = std::max<uint32_t>(state.readMax, header.offset + header.size);
             }
          } else {
-            tempMin = std::min<uint32_t>(tempMin, section.header.offset);
-            tempMax = std::max<uint32_t>(tempMax, section.header.offset + section.header.size);
+            state.tempMin = std::min<uint32_t>(state.tempMin, header.offset);
+            state.tempMax = std::max<uint32_t>(state.tempMax, header.offset + header.size);
          }
       }
    }
 
+   // Verify that section.addr is aligned by section.addralign
+   if (!align_check(header.addr, header.addralign)) {
+      fmt::println(state.out(VerifySectionAlignment), "Unaligned section {}, addr {}, addralign {}",
+                   index, header.addr, header.addralign);
+      state.fail(VerifySectionAlignment);
+   }
+}
+
+/**
+ * Equivalent to loader.elf LiCheckFileBounds, once the ranges of every
+ * section are known
+ */
+static void
+sCheckFileBounds(VerifyState &state)
+{
+   const auto &rpl = state.rpl;
+   auto &err = state.out(VerifyFileBounds);
+   auto result = true;
+
+   auto dataMin = state.dataMin;
+   auto dataMax = state.dataMax;
+   auto readMin = state.readMin;
+   auto readMax = state.readMax;
+   auto textMin = state.textMin;
+   auto textMax = state.textMax;
+   auto tempMin = state.tempMin;
+   auto tempMax = state.tempMax;
+
    if (dataMin == 0xFFFFFFFFu) {
       dataMin = (rpl.header.shnum * rpl.header.shentsize) + rpl.header.shoff;
       dataMax = dataMin;
@@ -418,183 +576,169 @@ verifyFileBounds(const Rpl &rpl)
    }
 
    if (dataMin < rpl.header.shoff) {
-      fmt::println(cerr,
+      fmt::println(err,
                    "*** SecHrs, FileInfo, or CRCs in bad spot in file. Return {}.", -470026);
       result = false;
    }
 
    // Data
    if (dataMin > dataMax) {
-      fmt::println(cerr, "*** DataMin > DataMax. break.");
+      fmt::println(err, "*** DataMin > DataMax. break.");
       result = false;
    }
 
    if (dataMin > readMin) {
-      fmt::println(cerr, "*** DataMin > ReadMin. break.");
+      fmt::println(err, "*** DataMin > ReadMin. break.");
       result = false;
    }
 
    if (dataMax > readMin) {
-      fmt::println(cerr, "*** DataMax > ReadMin, break.");
+      fmt::println(err, "*** DataMax > ReadMin, break.");
       result = false;
    }
 
    // Read
    if (readMin > readMax) {
-      fmt::println(cerr, "*** ReadMin > ReadMax. break.");
+      fmt::println(err, "*** ReadMin > ReadMax. break.");
       result = false;
    }
 
    if (readMin > textMin) {
-      fmt::println(cerr, "*** ReadMin > TextMin. break.");
+      fmt::println(err, "*** ReadMin > TextMin. break.");
       result = false;
    }
 
    if (readMax > textMin) {
-      fmt::println(cerr, "*** ReadMax > TextMin. break.");
+      fmt::println(err, "*** ReadMax > TextMin. break.");
       result = false;
    }
 
    // Text
    if (textMin > textMax) {
-      fmt::println(cerr, "*** TextMin > TextMax. break.");
+      fmt::println(err, "*** TextMin > TextMax. break.");
       result = false;
    }
 
    if (textMin > tempMin) {
-      fmt::println(cerr, "*** TextMin > TempMin. break.");
+      fmt::println(err, "*** TextMin > TempMin. break.");
       result = false;
    }
 
    if (textMax > tempMin) {
-      fmt::println(cerr, "*** TextMax > TempMin. break.");
+      fmt::println(err, "*** TextMax > TempMin. break.");
       result = false;
    }
 
    // Temp
    if (tempMin > tempMax) {
-      fmt::println(cerr, "*** TempMin > TempMax. break.");
+      fmt::println(err, "*** TempMin > TempMax. break.");
       result = false;
    }
 
    if (!result) {
-      fmt::println(cerr, "dataMin = 0x{:08X}", dataMin);
-      fmt::println(cerr, "dataMax = 0x{:08X}", dataMax);
-      fmt::println(cerr, "readMin = 0x{:08X}", readMin);
-      fmt::println(cerr, "readMax = 0x{:08X}", readMax);
-      fmt::println(cerr, "textMin = 0x{:08X}", textMin);
-      fmt::println(cerr, "textMax = 0x{:08X}", textMax);
-      fmt::println(cerr, "tempMin = 0x{:08X}", tempMin);
-      fmt::println(cerr, "tempMax = 0x{:08X}", tempMax);
+      fmt::println(err, "dataMin = 0x{:08X}", dataMin);
+      fmt::println(err, "dataMax = 0x{:08X}", dataMax);
+      fmt::println(err, "readMin = 0x{:08X}", readMin);
+      fmt::println(err, "readMax = 0x{:08X}", readMax);
+      fmt::println(err, "textMin = 0x{:08X}", textMin);
+      fmt::println(err, "textMax = 0x{:08X}", textMax);
+      fmt::println(err, "tempMin = 0x{:08X}", tempMin);
+      fmt::println(err, "tempMax = 0x{:08X}", tempMax);
+      state.fail(VerifyFileBounds);
    }
-
-   return result;
 }
 
-
 /**
- * Check that the rpl only uses relocation types which are supported by
- * loader.elf
+ * Verify that the last two sections are the uncompressed CRCS and FILEINFO
  */
-bool
-verifyRelocationTypes(const Rpl &rpl)
+static void
+sCheckSectionOrder(VerifyState &state)
 {
-   std::unordered_set<unsigned int> unsupportedTypes;
+   const auto &rpl = state.rpl;
+   auto &err = state.out(VerifySectionOrder);
 
-   for (auto &section : rpl.sections) {
-      if (section.header.type != elf::SHT_RELA) {
-         continue;
-      }
+   if (rpl.sections.size() < 2) {
+      fmt::println(err, "***shnum = {}, missing CRCS and FILEINFO sections", rpl.sections.size());
+      state.fail(VerifySectionOrder);
+      return;
+   }
 
-      // auto &symbolSection = rpl.sections[section.header.link];
-      // auto &targetSection = rpl.sections[section.header.info];
-      auto rels = reinterpret_cast<const elf::Rela *>(section.data.data());
-      auto numRels = section.data.size() / sizeof(elf::Rela);
-
-      for (auto i = 0u; i < numRels; ++i) {
-         auto info = rels[i].info;
-         // auto addend = rels[i].addend;
-         // auto offset = rels[i].offset;
-         // auto index = info >> 8;
-         auto type = info & 0xFF;
-
-         switch (type) {
-         case elf::R_PPC_NONE:
-         case elf::R_PPC_ADDR32:
-         case elf::R_PPC_ADDR16_LO:
-         case elf::R_PPC_ADDR16_HI:
-         case elf::R_PPC_ADDR16_HA:
-         case elf::R_PPC_REL24:
-         case elf::R_PPC_REL14:
-         case elf::R_PPC_DTPMOD32:
-         case elf::R_PPC_DTPREL32:
-         case elf::R_PPC_EMB_SDA21:
-         case elf::R_PPC_EMB_RELSDA:
-         case elf::R_PPC_DIAB_SDA21_LO:
-         case elf::R_PPC_DIAB_SDA21_HI:
-         case elf::R_PPC_DIAB_SDA21_HA:
-         case elf::R_PPC_DIAB_RELSDA_LO:
-         case elf::R_PPC_DIAB_RELSDA_HI:
-         case elf::R_PPC_DIAB_RELSDA_HA:
-         case elf::R_PPC_GHS_REL16_HA:
-         case elf::R_PPC_GHS_REL16_HI:
-         case elf::R_PPC_GHS_REL16_LO:
-            // All valid relocations on Wii U, do nothing
-            break;
-         default:
-            // Only print error once per type
-            if (!unsupportedTypes.contains(type)) {
-               fmt::println(cerr, "Unsupported relocation type {}", type);
-               unsupportedTypes.insert(type);
-            }
-         }
-      }
+   const auto &lastSection = rpl.sections[rpl.sections.size() - 1];
+   const auto &penultimateSection = rpl.sections[rpl.sections.size() - 2];
+
+   if (lastSection.header.type != elf::SHT_RPL_FILEINFO ||
+      (lastSection.header.flags & elf::SHF_DEFLATED)) {
+      fmt::println(err, "***shnum-1 section type = 0x{:08X}, flags=0x{:08X}",
+                   lastSection.header.type.value(),
+                   lastSection.header.flags.value());
+      state.fail(VerifySectionOrder);
    }
 
-   return unsupportedTypes.empty();
+   if (penultimateSection.header.type != elf::SHT_RPL_CRCS ||
+      (penultimateSection.header.flags & elf::SHF_DEFLATED)) {
+      fmt::println(err, "***shnum-2 section type = 0x{:08X}, flags=0x{:08X}",
+                   penultimateSection.header.type.value(),
+                   penultimateSection.header.flags.value());
+      state.fail(VerifySectionOrder);
+   }
 }
 
-
-/**
- * Verify that section.addr is aligned by section.addralign
- */
-bool
-verifySectionAlignment(const Rpl &rpl)
+VerifyResult
+verifyRpl(const Rpl &rpl,
+          const VerifyOptions &options,
+          std::ostream &err)
 {
-   auto result = true;
-   for (auto &section : rpl.sections) {
-      if (!align_check(section.header.addr, section.header.addralign)) {
-         fmt::println(cerr, "Unaligned section {}, addr {}, addralign {}",
-                      getSectionIndex(rpl, section),
-                      section.header.addr,
-                      section.header.addralign);
-         result = false;
+   VerifyState state { rpl };
+
+   // The crcs and sizes are all that is needed from most of the section
+   // data, so scan it up front on up to options.jobs threads without keeping
+   // it in memory
+   parallel_for(rpl.sections.size(), options.jobs, [&](size_t i) {
+      std::string error;
+      rpl.sections[i].scan(error);
+   });
+
+   for (const auto &section : rpl.sections) {
+      if (section.header.type == elf::SHT_RPL_CRCS) {
+         state.crcs = reinterpret_cast<const elf::RplCrc *>(section.data().data());
+         state.numCrcs = section.data().size() / sizeof(elf::RplCrc);
+         break;
       }
    }
-   return result;
-}
 
+   if (state.crcs) {
+      state.computedCrcs.resize(rpl.sections.size(), 0u);
+      for (auto i = 0u; i < rpl.sections.size(); ++i) {
+         if (rpl.sections[i].header.type != elf::SHT_RPL_CRCS) {
+            state.computedCrcs[i] = rpl.sections[i].crc;
+         }
+      }
+   } else {
+      fmt::println(state.out(VerifyCrcs), "Missing SHT_RPL_CRCS section");
+      state.fail(VerifyCrcs);
+   }
 
-bool
-verifySectionOrder(const Rpl &rpl)
-{
-   auto lastSection = rpl.sections[rpl.header.shnum - 1];
-   auto penultimateSection = rpl.sections[rpl.header.shnum - 2];
+   sCheckFileHeader(state);
 
+   auto stopped = options.failFast && !state.result.passed();
+   for (auto i = 0u; i < rpl.sections.size() && !stopped; ++i) {
+      sCheckSection(state, rpl.sections[i], i);
+      stopped = options.failFast && !state.result.passed();
+   }
 
-   if (lastSection.header.type != elf::SHT_RPL_FILEINFO ||
-      (lastSection.header.flags & elf::SHF_DEFLATED)) {
-      fmt::println(cerr, "***shnum-1 section type = 0x{:08X}, flags=0x{:08X}",
-                   lastSection.header.type.value(),
-                   lastSection.header.flags.value());
+   if (!stopped) {
+      sCheckFileBounds(state);
+      stopped = options.failFast && !state.result.passed();
    }
 
-   if (penultimateSection.header.type != elf::SHT_RPL_CRCS ||
-      (penultimateSection.header.flags & elf::SHF_DEFLATED)) {
-      fmt::println(cerr, "***shnum-2 section type = 0x{:08X}, flags=0x{:08X}",
-                   penultimateSection.header.type.value(),
-                   penultimateSection.header.flags.value());
+   if (!stopped) {
+      sCheckSectionOrder(state);
    }
 
-   return true;
+   for (auto i = 0u; i < NumVerifyChecks; ++i) {
+      state.result.completed[i] = !stopped || state.result.failed[i];
+      err << state.messages[i].str();
+   }
+
+   return state.result;
 }
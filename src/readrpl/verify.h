@@ -1,20 +1,53 @@
 #pragma once
-#include "readrpl.h"
+#include "rpl_reader.h"
+#include <ostream>
 
-bool
-verifyFile(const Rpl &rpl);
+enum VerifyCheck
+{
+   VerifyFile,
+   VerifyCrcs,
+   VerifyFileBounds,
+   VerifyRelocationTypes,
+   VerifySectionAlignment,
+   VerifySectionOrder,
+   NumVerifyChecks,
+};
 
-bool
-verifyCrcs(const Rpl &rpl);
+struct VerifyOptions
+{
+   // Number of threads used to compute the section crcs
+   unsigned jobs = 1;
 
-bool
-verifyFileBounds(const Rpl &rpl);
+   // Stop at the first section which fails any check
+   bool failFast = false;
+};
 
-bool
-verifyRelocationTypes(const Rpl &rpl);
+struct VerifyResult
+{
+   // A check stopped early by failFast is neither completed nor failed
+   bool completed[NumVerifyChecks] = { };
+   bool failed[NumVerifyChecks] = { };
 
-bool
-verifySectionAlignment(const Rpl &rpl);
+   bool
+   passed() const
+   {
+      for (auto i = 0u; i < NumVerifyChecks; ++i) {
+         if (failed[i]) {
+            return false;
+         }
+      }
 
-bool
-verifySectionOrder(const Rpl &rpl);
+      return true;
+   }
+};
+
+const char *
+getVerifyCheckName(VerifyCheck check);
+
+// Runs every check in a single pass over the sections, their symbols and
+// their relocations. The messages of each check are printed to err after
+// the pass, grouped by check.
+VerifyResult
+verifyRpl(const Rpl &rpl,
+          const VerifyOptions &options,
+          std::ostream &err);
@@ -1,3 +1,4 @@
+#include "elf_object.h"
 #include "utils.h"
 
 #include <algorithm>
@@ -93,6 +94,46 @@ writeExports(std::ofstream &out,
    fmt::println(out, "");
 }
 
+static void
+writeExportsObject(ElfObjectWriter &object,
+                   bool isData,
+                   const std::vector<std::string> &exports)
+{
+   // Same contents as writeExports, without going through the assembler
+   uint32_t signature = crc32(0, Z_NULL, 0);
+   for (const auto &name : exports) {
+      signature = crc32(signature, reinterpret_cast<const Bytef *>(name.data()), name.size() + 1);
+   }
+
+   std::vector<be_val<uint32_t>> table;
+   table.push_back(static_cast<uint32_t>(exports.size()));
+   table.push_back(signature);
+
+   auto nameOffset = 8 + 8 * exports.size();
+   for (const auto &name : exports) {
+      table.push_back(0u);
+      table.push_back(static_cast<uint32_t>(nameOffset));
+      nameOffset += name.size() + 1;
+   }
+
+   std::vector<char> data(table.size() * sizeof(uint32_t));
+   std::memcpy(data.data(), table.data(), data.size());
+   for (const auto &name : exports) {
+      data.insert(data.end(), name.c_str(), name.c_str() + name.size() + 1);
+   }
+
+   auto section = isData ?
+      object.addSection(".dexports", elf::SHT_RPL_EXPORTS, elf::SHF_ALLOC, 16, std::move(data)) :
+      object.addSection(".fexports", elf::SHT_RPL_EXPORTS, elf::SHF_ALLOC | elf::SHF_EXECINSTR,
+                        16, std::move(data));
+
+   // The address of each export is filled in by the linker
+   for (auto i = 0u; i < exports.size(); ++i) {
+      auto symbol = object.addSymbol(exports[i], elf::STT_NOTYPE, elf::SHN_UNDEF, 0, 0);
+      object.addRelocation(section, 8 + 8 * i, symbol, elf::R_PPC_ADDR32, 0);
+   }
+}
+
 static void
 show_help(std::ostream& out,
           const excmd::parser& parser,
@@ -118,14 +159,16 @@ int main(int argc, char **argv)
          .add_option("H,help",
                      description { "Show help" })
          .add_option("v,version",
-                     description { "Show version" });
+                     description { "Show version" })
+         .add_option("object",
+                     description { "Write a relocatable ELF object instead of assembly, so it does not need to be assembled" });
 
       parser.default_command()
          .add_argument("input.def",
                        description { "Path to input exports def file" },
                        value<std::string> {})
          .add_argument("output.S",
-                       description { "Path to output assembly file" },
+                       description { "Path to output assembly file, or object file with --object" },
                        value<std::string> {});
 
       options = parser.parse(argc, argv);
@@ -208,7 +251,30 @@ int main(int argc, char **argv)
    std::sort(funcExports.begin(), funcExports.end());
    std::sort(dataExports.begin(), dataExports.end());
 
-   {
+   if (options.has("object")) {
+      ElfObjectWriter object;
+      if (funcExports.size() > 0) {
+         writeExportsObject(object, false, funcExports);
+      }
+
+      if (dataExports.size() > 0) {
+         writeExportsObject(object, true, dataExports);
+      }
+
+      auto dst = options.get<std::string>("output.S");
+      std::ofstream out{dst, std::ofstream::binary};
+
+      if (!out.is_open()) {
+         fmt::println(cerr, "Could not open file \"{}\" for writing.", dst);
+         return -1;
+      }
+
+      std::string error;
+      if (!object.write(out, error)) {
+         fmt::println(cerr, "{}", error);
+         return -1;
+      }
+   } else {
       auto dst = options.get<std::string>("output.S");
       std::ofstream out{dst};
 
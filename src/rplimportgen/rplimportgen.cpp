@@ -1,13 +1,19 @@
+#include "elf_object.h"
+#include "parallel.h"
 #include "utils.h"
 #include "rplwrap.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstddef>
 #include <excmd.h>
+#include <filesystem>
 #include <fmt/base.h>
 #include <fmt/ostream.h>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <zlib.h>
@@ -28,6 +34,13 @@ enum class ReadMode
    DATA_WRAP,
 };
 
+struct DefFile
+{
+   std::string moduleName;
+   std::vector<std::string> funcExports;
+   std::vector<std::string> dataExports;
+};
+
 static void
 writeExports(std::ostream &out,
              const std::string &moduleName,
@@ -72,23 +85,328 @@ writeExports(std::ostream &out,
    }
 }
 
+static void
+writeExportsObject(ElfObjectWriter &object,
+                   const std::string &moduleName,
+                   bool isData,
+                   const std::vector<std::string> &exports)
+{
+   // Same contents as writeExports, without going through the assembler
+   auto prefix = isData ? ".dimport_" + moduleName : ".fimport_" + moduleName;
+   auto flags = isData ? uint32_t { elf::SHF_ALLOC } :
+                         uint32_t { elf::SHF_ALLOC | elf::SHF_EXECINSTR };
+
+   std::size_t next_multiple = (moduleName.size() + 1ull + 8ull) & ~7ull;
+   std::vector<char> header(8 + next_multiple, 0);
+   header[3] = 1;
+   std::copy(moduleName.begin(), moduleName.end(), header.begin() + 8);
+   object.addSection(prefix, elf::SHT_RPL_IMPORTS, flags, 16, std::move(header));
+
+   auto type = isData ? uint32_t { elf::STT_OBJECT } : uint32_t { elf::STT_FUNC };
+   for (auto &name : exports) {
+      auto section = object.addSection(prefix + "." + name, elf::SHT_RPL_IMPORTS, flags, 1,
+                                       std::vector<char>(8, 0));
+      object.addSymbol(name, type, section, 0, 0);
+   }
+}
+
 static void
 writeLinkerScript(std::ostream &out,
-                  const std::string &name)
+                  const std::vector<std::string> &names)
+{
+   fmt::println(out, "SECTIONS\n{{");
+
+   for (auto &name : names) {
+      fmt::println(out,
+                   "   .fimport_{0} ALIGN(16) : {{\n"
+                   "      KEEP ( *(.fimport_{0}) )\n"
+                   "      *(.fimport_{0}.*)\n"
+                   "   }} > loadmem\n"
+                   "   .dimport_{0} ALIGN(16) : {{\n"
+                   "      KEEP ( *(.dimport_{0}) )\n"
+                   "      *(.dimport_{0}.*)\n"
+                   "   }} > loadmem",
+                   name);
+   }
+
+   fmt::println(out, "}}");
+}
+
+/**
+ * Parses an exports def file into def, errors are printed to err.
+ */
+static bool
+readDefFile(const std::string &path,
+            DefFile &def,
+            std::ostream &err)
+{
+   ReadMode readMode = ReadMode::INVALID;
+   std::ifstream input{path};
+
+   if (!input.is_open()) {
+      fmt::println(err, "Could not open file \"{}\" for reading.", path);
+      return false;
+   }
+
+   std::string line;
+   while (std::getline(input, line)) {
+      // Trim comments
+      std::size_t commentOffset = line.find("//");
+      if (commentOffset != std::string::npos) {
+         line = line.substr(0, commentOffset);
+      }
+
+      // Trim whitespace
+      line = trim(line);
+
+      // Skip blank lines
+      if (line.length() == 0) {
+         continue;
+      }
+
+      // Look for section headers
+      if (line[0] == ':') {
+         if (line.substr(1) == "TEXT") {
+            readMode = ReadMode::TEXT;
+         } else if (line.substr(1) == "TEXT_WRAP") {
+            readMode = ReadMode::TEXT_WRAP;
+         } else if (line.substr(1) == "DATA") {
+            readMode = ReadMode::DATA;
+         } else if (line.substr(1) == "DATA_WRAP") {
+            readMode = ReadMode::DATA_WRAP;
+         } else if (line.substr(1, 4) == "NAME") {
+            def.moduleName = line.substr(6);
+         } else {
+            fmt::println(err, "Unexpected section type: {}", line.substr(1));
+            return false;
+         }
+         continue;
+      }
+
+      if (readMode == ReadMode::TEXT) {
+         def.funcExports.push_back(line);
+      } else if (readMode == ReadMode::TEXT_WRAP) {
+         def.funcExports.push_back(std::string(RPLWRAP_PREFIX) + line);
+      } else if (readMode == ReadMode::DATA) {
+         def.dataExports.push_back(line);
+      } else if (readMode == ReadMode::DATA_WRAP) {
+         def.dataExports.push_back(std::string(RPLWRAP_PREFIX) + line);
+      } else {
+         fmt::println(err, "Unexpected section data: {:x}.", static_cast<unsigned>(readMode));
+         return false;
+      }
+   }
+
+   return true;
+}
+
+/**
+ * Generates the assembly, or the object file when object is set, for the
+ * imports of def.
+ */
+static bool
+generateImports(const DefFile &def,
+                bool object,
+                std::string &output,
+                std::ostream &err)
+{
+   std::ostringstream out;
+   if (object) {
+      ElfObjectWriter writer;
+      if (def.funcExports.size() > 0) {
+         writeExportsObject(writer, def.moduleName, false, def.funcExports);
+      }
+
+      if (def.dataExports.size() > 0) {
+         writeExportsObject(writer, def.moduleName, true, def.dataExports);
+      }
+
+      std::string error;
+      if (!writer.write(out, error)) {
+         fmt::println(err, "{}", error);
+         return false;
+      }
+   } else {
+      if (def.funcExports.size() > 0) {
+         writeExports(out, def.moduleName, false, def.funcExports);
+      }
+
+      if (def.dataExports.size() > 0) {
+         writeExports(out, def.moduleName, true, def.dataExports);
+      }
+   }
+
+   output = std::move(out).str();
+   return true;
+}
+
+/**
+ * Writes contents to path, unless the file already has exactly these contents.
+ * Leaving it untouched keeps its timestamp, so make does not rebuild
+ * everything that depends on it.
+ */
+static bool
+writeIfChanged(const std::string &path,
+               const std::string &contents,
+               std::ostream &err)
+{
+   {
+      std::ifstream existing{path, std::ifstream::binary | std::ifstream::ate};
+      if (existing.is_open() &&
+          existing.tellg() == static_cast<std::streamoff>(contents.size())) {
+         std::string current(contents.size(), '\0');
+         existing.seekg(0);
+         if (existing.read(current.data(), current.size()) && current == contents) {
+            return true;
+         }
+      }
+   }
+
+   std::ofstream output{path, std::ofstream::binary};
+   if (!output.is_open()) {
+      fmt::println(err, "Could not open file \"{}\" for writing.", path);
+      return false;
+   }
+
+   output.write(contents.data(), contents.size());
+   if (!output) {
+      fmt::println(err, "Could not write file \"{}\".", path);
+      return false;
+   }
+
+   return true;
+}
+
+/**
+ * Collects the def files of batch mode, every .def file in a directory, or
+ * every file listed one per line in a file, - reads the list from stdin.
+ */
+static bool
+collectDefFiles(const std::string &path,
+                std::vector<std::string> &files)
+{
+   std::error_code ec;
+   if (path != "-" && std::filesystem::is_directory(path, ec)) {
+      for (auto it = std::filesystem::directory_iterator { path, ec };
+           !ec && it != std::filesystem::directory_iterator {};
+           it.increment(ec)) {
+         if (it->is_regular_file(ec) && it->path().extension() == ".def") {
+            files.push_back(it->path().string());
+         }
+      }
+
+      if (ec) {
+         fmt::println(cerr, "Could not scan directory \"{}\": {}", path, ec.message());
+         return false;
+      }
+
+      // Directory order depends on the filesystem, sort it to keep the output stable
+      std::sort(files.begin(), files.end());
+      return true;
+   }
+
+   std::ifstream file;
+   if (path != "-") {
+      file.open(path);
+      if (!file.is_open()) {
+         fmt::println(cerr, "Could not open file \"{}\" for reading.", path);
+         return false;
+      }
+   }
+
+   auto &in = path == "-" ? std::cin : file;
+   std::string line;
+   while (std::getline(in, line)) {
+      line = trim(line);
+      if (!line.empty()) {
+         files.push_back(line);
+      }
+   }
+
+   return true;
+}
+
+/**
+ * Generates the imports of every def file into outputDir, using up to jobs
+ * threads. Each def file gets its own linker script, unless linkerScript
+ * names a single one for all of them.
+ */
+static bool
+runBatch(const std::vector<std::string> &files,
+         const std::filesystem::path &outputDir,
+         const std::string &linkerScript,
+         bool object,
+         unsigned jobs)
 {
-   fmt::println(out,
-                "SECTIONS\n"
-                "{{\n"
-                "   .fimport_{0} ALIGN(16) : {{\n"
-                "      KEEP ( *(.fimport_{0}) )\n"
-                "      *(.fimport_{0}.*)\n"
-                "   }} > loadmem\n"
-                "   .dimport_{0} ALIGN(16) : {{\n"
-                "      KEEP ( *(.dimport_{0}) )\n"
-                "      *(.dimport_{0}.*)\n"
-                "   }} > loadmem\n"
-                "}}",
-                name);
+   // The outputs are named after the def files, two with the same name would
+   // overwrite each other
+   std::map<std::string, std::string> stems;
+   for (const auto &file : files) {
+      auto stem = std::filesystem::path { file }.stem().string();
+      auto [it, inserted] = stems.emplace(stem, file);
+      if (!inserted) {
+         fmt::println(cerr, "\"{}\" and \"{}\" would both write the outputs of \"{}\"",
+                      it->second, file, stem);
+         return false;
+      }
+   }
+
+   std::error_code ec;
+   std::filesystem::create_directories(outputDir, ec);
+   if (ec) {
+      fmt::println(cerr, "Could not create directory \"{}\": {}", outputDir.string(), ec.message());
+      return false;
+   }
+
+   std::vector<DefFile> defs(files.size());
+   std::vector<std::string> errors(files.size());
+   std::vector<char> succeeded(files.size(), 0);
+
+   parallel_for(files.size(), jobs, [&](size_t i) {
+      std::ostringstream err;
+      auto stem = std::filesystem::path { files[i] }.stem().string();
+      auto output = std::string { };
+      auto ok = readDefFile(files[i], defs[i], err) &&
+                generateImports(defs[i], object, output, err) &&
+                writeIfChanged((outputDir / (stem + (object ? ".o" : ".S"))).string(),
+                               output, err);
+
+      if (ok && linkerScript.empty()) {
+         std::ostringstream script;
+         writeLinkerScript(script, { defs[i].moduleName });
+         ok = writeIfChanged((outputDir / (stem + ".ld")).string(), script.str(), err);
+      }
+
+      if (!ok) {
+         fmt::println(err, "Error processing \"{}\"", files[i]);
+      }
+
+      errors[i] = err.str();
+      succeeded[i] = ok;
+   });
+
+   auto result = true;
+   for (auto i = 0u; i < files.size(); ++i) {
+      if (!succeeded[i]) {
+         fmt::print(cerr, "{}", errors[i]);
+         result = false;
+      }
+   }
+
+   if (result && !linkerScript.empty()) {
+      std::vector<std::string> names;
+      for (const auto &def : defs) {
+         if (std::find(names.begin(), names.end(), def.moduleName) == names.end()) {
+            names.push_back(def.moduleName);
+         }
+      }
+
+      std::ostringstream script;
+      writeLinkerScript(script, names);
+      result = writeIfChanged(linkerScript, script.str(), cerr);
+   }
+
+   return result;
 }
 
 static void
@@ -97,7 +415,8 @@ show_help(std::ostream& out,
           const std::string& exec_name)
 {
    fmt::println(out, "Usage:");
-   fmt::println(out, "  {} [options] <input.def> <output.S> [<output.ld>]\n", exec_name);
+   fmt::println(out, "  {} [options] <input.def> <output.S> [<output.ld>]", exec_name);
+   fmt::println(out, "  {} [options] --batch <defs> --output-dir <dir>\n", exec_name);
    fmt::println(out, "{}", parser.format_help(exec_name));
    fmt::println(out, "Report bugs to {}", PACKAGE_BUGREPORT);
 }
@@ -105,9 +424,6 @@ show_help(std::ostream& out,
 int
 main(int argc, char **argv)
 {
-   std::string moduleName;
-   std::vector<std::string> funcExports, dataExports;
-   ReadMode readMode = ReadMode::INVALID;
    excmd::parser parser;
    excmd::option_state options;
 
@@ -119,6 +435,20 @@ main(int argc, char **argv)
                      description { "Show help" })
          .add_option("v,version",
                      description { "Show version" })
+         .add_option("object",
+                     description { "Write a relocatable ELF object instead of assembly, so it does not need to be assembled" })
+         .add_option("b,batch",
+                     description { "Process every .def file in this directory, or every file listed in this file, - reads the list from stdin" },
+                     value<std::string> {})
+         .add_option("o,output-dir",
+                     description { "Directory of the outputs of batch mode, named after each .def file, created if missing" },
+                     value<std::string> {})
+         .add_option("linker-script",
+                     description { "Write one linker script for every module of batch mode to this file, instead of one per module" },
+                     value<std::string> {})
+         .add_option("j,jobs",
+                     description { "Number of threads used in batch mode (0 uses one per CPU, default is 1)" },
+                     value<int> {})
          ;
 
       parser.default_command()
@@ -126,7 +456,7 @@ main(int argc, char **argv)
                        description { "Path to input exports def file" },
                        value<std::string> {})
          .add_argument("output.S",
-                       description { "Path to output assembly file" },
+                       description { "Path to output assembly file, or object file with --object" },
                        value<std::string> {})
          .add_argument("output.ld",
                        description { "Path to output linker script" },
@@ -152,98 +482,65 @@ main(int argc, char **argv)
       return 0;
    }
 
-   if (!options.has("input.def") || !options.has("output.S")) {
-      fmt::println(cerr, "Missing mandatory arguments: <input.def> <output.S>\n");
-      show_help(cerr, parser, argv[0]);
-      return -1;
-   }
+   auto object = options.has("object");
 
-   {
-      auto input_def = options.get<std::string>("input.def");
-      std::ifstream input{input_def};
-
-      if (!input.is_open()) {
-         fmt::println(cerr, "Could not open file \"{}\" for reading.", input_def);
+   if (options.has("batch")) {
+      if (!options.has("output-dir")) {
+         fmt::println(cerr, "Missing mandatory option for batch mode: --output-dir\n");
+         show_help(cerr, parser, argv[0]);
          return -1;
       }
 
-      std::string line;
-      while (std::getline(input, line)) {
-         // Trim comments
-         std::size_t commentOffset = line.find("//");
-         if (commentOffset != std::string::npos) {
-            line = line.substr(0, commentOffset);
-         }
-
-         // Trim whitespace
-         line = trim(line);
-
-         // Skip blank lines
-         if (line.length() == 0) {
-            continue;
+      auto jobs = 1u;
+      if (options.has("jobs")) {
+         auto value = options.get<int>("jobs");
+         if (value < 0) {
+            fmt::println(cerr, "Invalid number of jobs: {}", value);
+            return -1;
          }
 
-         // Look for section headers
-         if (line[0] == ':') {
-            if (line.substr(1) == "TEXT") {
-               readMode = ReadMode::TEXT;
-            } else if (line.substr(1) == "TEXT_WRAP") {
-               readMode = ReadMode::TEXT_WRAP;
-            } else if (line.substr(1) == "DATA") {
-               readMode = ReadMode::DATA;
-            } else if (line.substr(1) == "DATA_WRAP") {
-               readMode = ReadMode::DATA_WRAP;
-            } else if (line.substr(1, 4) == "NAME") {
-               moduleName = line.substr(6);
-            } else {
-               fmt::println(cerr, "Unexpected section type: {}", line.substr(1));
-               return -1;
-            }
-            continue;
-         }
+         jobs = resolve_jobs(value);
+      }
 
-         if (readMode == ReadMode::TEXT) {
-            funcExports.push_back(line);
-         } else if (readMode == ReadMode::TEXT_WRAP) {
-            funcExports.push_back(std::string(RPLWRAP_PREFIX) + line);
-         } else if (readMode == ReadMode::DATA) {
-            dataExports.push_back(line);
-         } else if (readMode == ReadMode::DATA_WRAP) {
-            dataExports.push_back(std::string(RPLWRAP_PREFIX) + line);
-         } else {
-            fmt::println(cerr, "Unexpected section data: {:x}.", static_cast<unsigned>(readMode));
-            return -1;
-         }
+      std::vector<std::string> files;
+      if (!collectDefFiles(options.get<std::string>("batch"), files)) {
+         return -1;
       }
+
+      auto linkerScript = options.has("linker-script") ?
+                          options.get<std::string>("linker-script") : std::string { };
+      return runBatch(files, options.get<std::string>("output-dir"), linkerScript,
+                      object, jobs) ? 0 : -1;
    }
 
-   {
-      auto output_S = options.get<std::string>("output.S");
-      std::ofstream output{output_S};
+   if (options.has("linker-script")) {
+      fmt::println(cerr, "--linker-script only works with --batch, give the linker script as <output.ld> instead\n");
+      show_help(cerr, parser, argv[0]);
+      return -1;
+   }
 
-      if (!output.is_open()) {
-         fmt::println(cerr, "Could not open file \"{}\" for writing.", output_S);
-         return -1;
-      }
+   if (!options.has("input.def") || !options.has("output.S")) {
+      fmt::println(cerr, "Missing mandatory arguments: <input.def> <output.S>\n");
+      show_help(cerr, parser, argv[0]);
+      return -1;
+   }
 
-      if (funcExports.size() > 0) {
-         writeExports(output, moduleName, false, funcExports);
-      }
+   DefFile def;
+   if (!readDefFile(options.get<std::string>("input.def"), def, cerr)) {
+      return -1;
+   }
 
-      if (dataExports.size() > 0) {
-         writeExports(output, moduleName, true, dataExports);
-      }
+   std::string output;
+   if (!generateImports(def, object, output, cerr) ||
+       !writeIfChanged(options.get<std::string>("output.S"), output, cerr)) {
+      return -1;
    }
 
    if (options.has("output.ld")) {
-      auto output_ld = options.get<std::string>("output.ld");
-      std::ofstream output{output_ld};
-
-      if (!output.is_open()) {
-         fmt::println(cerr, "Could not open file \"{}\" for writing.", output_ld);
+      std::ostringstream script;
+      writeLinkerScript(script, { def.moduleName });
+      if (!writeIfChanged(options.get<std::string>("output.ld"), script.str(), cerr)) {
          return -1;
       }
-
-      writeLinkerScript(output, moduleName);
    }
 }
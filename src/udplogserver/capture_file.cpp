@@ -0,0 +1,203 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "capture_file.h"
+#include "mapped_file.h"
+
+#include <chrono>
+#include <cstring>
+#include <fmt/base.h>
+#include <fmt/chrono.h>
+#include <fmt/ostream.h>
+#include <string_view>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+bool
+CaptureFile::open(const std::string& filename,
+                  std::size_t size)
+{
+   close();
+
+   // Positions in the ring stay aligned to records
+   size &= ~(RECORD_ALIGN - 1);
+   auto fileSize = sizeof(CaptureHeader) + size;
+   void *ptr = nullptr;
+
+#ifdef _WIN32
+   auto file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                           nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+   if (file == INVALID_HANDLE_VALUE)
+      return false;
+
+   // Mapping more than the file holds extends it
+   auto fileSize64 = static_cast<std::uint64_t>(fileSize);
+   mMapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+                                 static_cast<DWORD>(fileSize64 >> 32),
+                                 static_cast<DWORD>(fileSize64),
+                                 nullptr);
+   CloseHandle(file);
+   if (!mMapping)
+      return false;
+
+   ptr = MapViewOfFile(mMapping, FILE_MAP_WRITE, 0, 0, fileSize);
+   if (!ptr) {
+      CloseHandle(mMapping);
+      mMapping = nullptr;
+      return false;
+   }
+#else
+   auto fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0)
+      return false;
+
+   if (ftruncate(fd, fileSize) == 0)
+      ptr = mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   ::close(fd);
+   if (!ptr || ptr == MAP_FAILED)
+      return false;
+#endif
+
+   mHeader = static_cast<CaptureHeader *>(ptr);
+   mRing = static_cast<char *>(ptr) + sizeof(CaptureHeader);
+   mSize = size;
+
+   std::memcpy(mHeader->magic, MAGIC, sizeof MAGIC);
+   mHeader->size = size;
+   mHeader->tail = 0;
+   mHeader->head = 0;
+   return true;
+}
+
+void
+CaptureFile::close()
+{
+   if (!mHeader)
+      return;
+
+#ifdef _WIN32
+   UnmapViewOfFile(mHeader);
+   CloseHandle(mMapping);
+   mMapping = nullptr;
+#else
+   munmap(mHeader, sizeof(CaptureHeader) + mSize);
+#endif
+
+   mHeader = nullptr;
+   mRing = nullptr;
+   mSize = 0;
+}
+
+std::size_t
+CaptureFile::size_at(const char *ring,
+                     std::size_t ringSize,
+                     std::uint64_t pos)
+{
+   auto remaining = ringSize - pos % ringSize;
+   if (remaining < sizeof(RecordHeader))
+      return remaining;
+
+   RecordHeader header;
+   std::memcpy(&header, ring + pos % ringSize, sizeof header);
+   if (header.size == WRAP)
+      return remaining;
+   return record_size(header.size);
+}
+
+void
+CaptureFile::write(std::int64_t time,
+                   const sockaddr_in& source,
+                   const char *data,
+                   std::size_t size)
+{
+   auto needed = record_size(size);
+   auto head = mHeader->head;
+   auto tail = mHeader->tail;
+
+   auto remaining = mSize - head % mSize;
+   auto skipped = remaining < needed ? remaining : 0;
+   if (skipped + needed > mSize)
+      return;
+
+   // Drop the oldest records until there's room, before overwriting them
+   while (head + skipped + needed - tail > mSize)
+      tail += size_at(mRing, mSize, tail);
+   mHeader->tail = tail;
+
+   if (skipped >= sizeof(RecordHeader)) {
+      RecordHeader wrap = {0, 0, 0, WRAP};
+      std::memcpy(mRing + head % mSize, &wrap, sizeof wrap);
+   }
+   head += skipped;
+
+   RecordHeader header = {
+      time,
+      source.sin_addr.s_addr,
+      source.sin_port,
+      static_cast<std::uint16_t>(size),
+   };
+   auto pos = head % mSize;
+   std::memcpy(mRing + pos, &header, sizeof header);
+   std::memcpy(mRing + pos + sizeof header, data, size);
+
+   // Only now the record is part of the ring
+   mHeader->head = head + needed;
+}
+
+bool
+CaptureFile::dump(const std::string& filename,
+                  std::ostream& out)
+{
+   MappedFile file;
+   if (!file.open(filename) || file.size() < sizeof(CaptureHeader))
+      return false;
+
+   CaptureHeader header;
+   std::memcpy(&header, file.data(), sizeof header);
+   if (std::memcmp(header.magic, MAGIC, sizeof MAGIC) != 0
+       || header.size == 0
+       || header.size % RECORD_ALIGN != 0
+       || header.size > file.size() - sizeof header
+       || header.tail > header.head
+       || header.head - header.tail > header.size)
+      return false;
+
+   auto ring = file.data() + sizeof header;
+   auto ringSize = static_cast<std::size_t>(header.size);
+   for (auto pos = header.tail; pos < header.head; pos += size_at(ring, ringSize, pos)) {
+      auto offset = pos % ringSize;
+      if (ringSize - offset < sizeof(RecordHeader))
+         continue;
+
+      RecordHeader record;
+      std::memcpy(&record, ring + offset, sizeof record);
+      if (record.size == WRAP)
+         continue;
+      if (record_size(record.size) > ringSize - offset)
+         return false;
+
+      sockaddr_in source = {};
+      source.sin_family = AF_INET;
+      source.sin_addr.s_addr = record.address;
+      source.sin_port = record.port;
+
+      using namespace std::chrono;
+      auto time = sys_time<microseconds>{duration_cast<microseconds>(nanoseconds{record.time})};
+      auto seconds = floor<std::chrono::seconds>(time);
+      fmt::println(out, "{:%F %T}.{:06} [{}] {}",
+                   seconds,
+                   (time - seconds).count(),
+                   to_string(source),
+                   std::string_view{ring + offset + sizeof record, record.size});
+   }
+
+   return true;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "net.h"
+
+// Ring of datagrams kept in a memory mapped file of fixed size, so a long run
+// keeps only its latest logs, and whatever was written survives the server
+// being killed.
+//
+// The file starts with a CaptureHeader, followed by the ring of records. Each
+// record is a RecordHeader and the payload, padded to 8 bytes. Positions only
+// ever grow, the oldest records are dropped to make room for new ones. A record
+// that does not fit before the end of the ring goes to its start, leaving a wrap
+// marker behind when the header still fits there. Everything is stored in the
+// byte order of the host that captured it.
+class CaptureFile
+{
+public:
+   CaptureFile() = default;
+   CaptureFile(const CaptureFile&) = delete;
+   CaptureFile& operator =(const CaptureFile&) = delete;
+
+   ~CaptureFile()
+   {
+      close();
+   }
+
+   // Creates or truncates filename to hold size bytes of records
+   bool
+   open(const std::string& filename,
+        std::size_t size);
+
+   void
+   close();
+
+   // time is in nanoseconds since the epoch, size must fit in 16 bits
+   void
+   write(std::int64_t time,
+         const sockaddr_in& source,
+         const char *data,
+         std::size_t size);
+
+   // Prints the records of a capture file, oldest first, returns false if it
+   // isn't one
+   static bool
+   dump(const std::string& filename,
+        std::ostream& out);
+
+private:
+   struct CaptureHeader
+   {
+      char magic[8];
+      std::uint64_t size;
+      // Position of the oldest record, and where the next one goes
+      std::uint64_t tail;
+      std::uint64_t head;
+   };
+
+   struct RecordHeader
+   {
+      std::int64_t time;
+      // Both in network byte order
+      std::uint32_t address;
+      std::uint16_t port;
+      std::uint16_t size;
+   };
+
+   static constexpr char MAGIC[8] = {'U', 'D', 'P', 'L', 'O', 'G', 'C', '1'};
+   static constexpr std::uint16_t WRAP = UINT16_MAX;
+   static constexpr std::size_t RECORD_ALIGN = 8;
+
+   static std::size_t
+   record_size(std::size_t size)
+   {
+      return (sizeof(RecordHeader) + size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+   }
+
+   // Size taken by the record at pos, including the space skipped before a wrap
+   static std::size_t
+   size_at(const char *ring,
+           std::size_t ringSize,
+           std::uint64_t pos);
+
+   CaptureHeader *mHeader = nullptr;
+   char *mRing = nullptr;
+   std::size_t mSize = 0;
+#ifdef _WIN32
+   void *mMapping = nullptr;
+#endif
+};
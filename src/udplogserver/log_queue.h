@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "net.h"
+
+// Single producer, single consumer queue of datagrams, with no locks, so the
+// receiving thread never waits for the one writing them out.
+//
+// Records are stored back to back in a ring of bytes, each one a header followed
+// by its payload, padded to RECORD_ALIGN. A record that does not fit before the
+// end of the ring goes to its start, leaving a wrap marker behind when the header
+// still fits there.
+class LogQueue
+{
+public:
+   // capacity must be a power of two
+   explicit
+   LogQueue(std::size_t capacity) :
+      mBuffer{std::make_unique<char[]>(capacity)},
+      mCapacity{capacity}
+   {
+   }
+
+   // Called by the producer, returns false when the queue is full
+   bool
+   push(std::int64_t time,
+        const sockaddr_in& source,
+        const char *data,
+        std::uint32_t size)
+   {
+      auto needed = record_size(size);
+      auto head = mHead.load(std::memory_order_relaxed);
+      auto tail = mTail.load(std::memory_order_acquire);
+
+      auto remaining = mCapacity - (head & (mCapacity - 1));
+      auto skipped = remaining < needed ? remaining : 0;
+      if (head + skipped + needed - tail > mCapacity)
+         return false;
+
+      if (skipped >= sizeof(Header)) {
+         Header wrap = {0, WRAP, {}};
+         std::memcpy(&mBuffer[head & (mCapacity - 1)], &wrap, sizeof wrap);
+      }
+      head += skipped;
+
+      Header header = {time, size, source};
+      auto pos = head & (mCapacity - 1);
+      std::memcpy(&mBuffer[pos], &header, sizeof header);
+      std::memcpy(&mBuffer[pos + sizeof header], data, size);
+
+      mHead.store(head + needed, std::memory_order_release);
+      return true;
+   }
+
+   // Called by the consumer, passes every queued record to
+   // func(std::int64_t time, const sockaddr_in&, const char *, std::uint32_t) and
+   // returns how many
+   template<typename Func>
+   std::size_t
+   drain(Func&& func)
+   {
+      auto head = mHead.load(std::memory_order_acquire);
+      auto tail = mTail.load(std::memory_order_relaxed);
+      std::size_t count = 0;
+
+      while (tail != head) {
+         auto pos = tail & (mCapacity - 1);
+         auto remaining = mCapacity - pos;
+         Header header;
+         if (remaining >= sizeof header)
+            std::memcpy(&header, &mBuffer[pos], sizeof header);
+         if (remaining < sizeof header || header.size == WRAP) {
+            tail += remaining;
+            mTail.store(tail, std::memory_order_release);
+            continue;
+         }
+
+         func(header.time, header.source, &mBuffer[pos + sizeof header], header.size);
+         ++count;
+
+         // The space is reused only after func is done with the payload
+         tail += record_size(header.size);
+         mTail.store(tail, std::memory_order_release);
+      }
+
+      return count;
+   }
+
+private:
+   struct Header
+   {
+      std::int64_t time;
+      std::uint32_t size;
+      sockaddr_in source;
+   };
+
+   static constexpr std::uint32_t WRAP = UINT32_MAX;
+   static constexpr std::size_t RECORD_ALIGN = 8;
+
+   static std::size_t
+   record_size(std::uint32_t size)
+   {
+      return (sizeof(Header) + size + RECORD_ALIGN - 1) & ~(RECORD_ALIGN - 1);
+   }
+
+   std::unique_ptr<char[]> mBuffer;
+   std::size_t mCapacity;
+
+   // Positions only ever grow, and are kept apart so the two threads don't
+   // share a cache line
+   alignas(64) std::atomic<std::size_t> mHead = 0;
+   alignas(64) std::atomic<std::size_t> mTail = 0;
+};
@@ -0,0 +1,145 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "log_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fmt/base.h>
+#include <fmt/ostream.h>
+#include <iostream>
+
+using std::cerr;
+using std::clog;
+using std::cout;
+
+LogWriter::LogWriter(LogQueue& queue,
+                     bool prefix,
+                     std::filesystem::path outputDir,
+                     CaptureFile *capture) :
+   mQueue{queue},
+   mPrefix{prefix},
+   mOutputDir{std::move(outputDir)},
+   mCapture{capture}
+{
+}
+
+LogWriter::~LogWriter()
+{
+   stop();
+}
+
+void
+LogWriter::start()
+{
+   mThread = std::thread{&LogWriter::run, this};
+}
+
+void
+LogWriter::notify()
+{
+   mWakeups.fetch_add(1, std::memory_order_release);
+   mWakeups.notify_one();
+}
+
+void
+LogWriter::stop()
+{
+   if (!mThread.joinable())
+      return;
+   mStopping = true;
+   notify();
+   mThread.join();
+}
+
+void
+LogWriter::run()
+{
+   while (true) {
+      // Anything pushed after this changes mWakeups, so the wait below won't block
+      auto wakeups = mWakeups.load(std::memory_order_acquire);
+      write_all();
+
+      if (mStopping) {
+         // Pushed before stop(), but maybe after write_all() looked
+         write_all();
+         break;
+      }
+
+      mWakeups.wait(wakeups, std::memory_order_acquire);
+   }
+}
+
+void
+LogWriter::write_all()
+{
+   mQueue.drain([this](std::int64_t time,
+                       const sockaddr_in& source,
+                       const char *data,
+                       std::uint32_t size)
+   {
+      if (mCapture)
+         mCapture->write(time, source, data, size);
+
+      std::string prefix;
+      if (mPrefix)
+         prefix = "[" + to_string(source) + "] ";
+
+      if (mOutputDir.empty()) {
+         mStdout += prefix;
+         mStdout.append(data, size);
+         mStdout.push_back('\n');
+         return;
+      }
+
+      auto& output = get_output(source);
+      if (!output.file)
+         return;
+      *output.file << prefix;
+      output.file->write(data, size);
+      output.file->put('\n');
+      if (!output.touched) {
+         output.touched = true;
+         mTouched.push_back(&output);
+      }
+   });
+
+   // Flush once for everything drained, not once per datagram
+   if (!mStdout.empty()) {
+      cout.write(mStdout.data(), mStdout.size());
+      cout.flush();
+      mStdout.clear();
+   }
+
+   for (auto output : mTouched) {
+      output->file->flush();
+      output->touched = false;
+   }
+   mTouched.clear();
+}
+
+LogWriter::Output&
+LogWriter::get_output(const sockaddr_in& source)
+{
+   auto key = std::uint64_t{source.sin_addr.s_addr} << 16 | source.sin_port;
+   auto [it, inserted] = mOutputs.try_emplace(key);
+   if (!inserted)
+      return it->second;
+
+   // 192.168.1.10:4405 is written to 192.168.1.10_4405.log
+   auto name = to_string(source);
+   std::replace(name.begin(), name.end(), ':', '_');
+   auto path = mOutputDir / (name + ".log");
+
+   auto file = std::make_unique<std::ofstream>(path, std::ios::binary | std::ios::app);
+   if (*file) {
+      fmt::println(clog, "Writing logs from {} to {}", to_string(source), path.string());
+      it->second.file = std::move(file);
+   } else {
+      // Reported once, the console's logs are dropped from then on
+      fmt::println(cerr, "Failed to open {}: {}", path.string(), std::strerror(errno));
+   }
+   return it->second;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "capture_file.h"
+#include "log_queue.h"
+
+// Writes the datagrams of a LogQueue from a thread of its own, to stdout or to
+// one file per console, and to a CaptureFile if there is one.
+class LogWriter
+{
+public:
+   // With an empty outputDir everything goes to stdout. With prefix, every line
+   // starts with the address of its console.
+   LogWriter(LogQueue& queue,
+             bool prefix,
+             std::filesystem::path outputDir,
+             CaptureFile *capture = nullptr);
+
+   ~LogWriter();
+
+   void
+   start();
+
+   // Tells the thread that records were pushed
+   void
+   notify();
+
+   // Writes what is left in the queue, then waits for the thread to end
+   void
+   stop();
+
+private:
+   struct Output
+   {
+      std::unique_ptr<std::ofstream> file;
+      bool touched = false;
+   };
+
+   void
+   run();
+
+   void
+   write_all();
+
+   Output&
+   get_output(const sockaddr_in& source);
+
+   LogQueue& mQueue;
+   bool mPrefix;
+   std::filesystem::path mOutputDir;
+   CaptureFile *mCapture;
+
+   std::thread mThread;
+   std::atomic<unsigned> mWakeups = 0;
+   std::atomic<bool> mStopping = false;
+
+   // Used only by the thread
+   std::unordered_map<std::uint64_t, Output> mOutputs;
+   std::vector<Output *> mTouched;
+   std::string mStdout;
+};
@@ -1,31 +1,57 @@
-#ifdef _WIN32
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#else
-#include <arpa/inet.h>
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifndef _WIN32
 #include <fcntl.h>
-#include <sys/socket.h>
+#include <poll.h>
 #include <sys/stat.h>
-#include <sys/types.h>
 #include <unistd.h>
 #endif
 
+#include <algorithm>
+#include <chrono>
 #include <csignal>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <excmd.h>
+#include <filesystem>
 #include <fmt/base.h>
 #include <fmt/ostream.h>
 #include <iostream>
-#include <stdexcept>
+#include <memory>
+#include <string>
 #include <string_view>
+#include <system_error>
 
-#ifdef HAVE_CONFIG_H
-#include <config.h>
-#endif
+#include "capture_file.h"
+#include "log_queue.h"
+#include "log_writer.h"
+#include "net.h"
 
 #define SERVER_PORT 4405
 
+// Larger than any log message, longer datagrams are truncated
+#define MAX_DATAGRAM_SIZE 2048
+
+// Most datagrams received and written at once
+#define BATCH_SIZE 64
+
+// Holds the bursts of logs sent while a title starts
+#define DEFAULT_RECEIVE_BUFFER_SIZE (4 * 1024 * 1024)
+
+// Datagrams waiting to be written, in bytes, must be a power of two
+#define QUEUE_SIZE (16 * 1024 * 1024)
+
+// Logs kept by --capture, in MiB
+#define DEFAULT_CAPTURE_SIZE 64
+
+// Linux tells how many datagrams didn't fit in the receive buffer
+#if defined(HAVE_RECVMMSG) && defined(SO_RXQ_OVFL)
+#define COUNT_KERNEL_DROPS 1
+#endif
+
 /*
  * Note: you can get the same functionality from (OpenBSD) netcat:
  *     nc -4 -l -u 4405
@@ -45,35 +71,156 @@ void handle_ctrl_c(int)
    interrupted = 1;
 }
 
-static std::string
-to_string(const sockaddr_in& addr)
+volatile std::sig_atomic_t counters_requested;
+
+extern "C"
+void handle_usr1(int)
+{
+   counters_requested = 1;
+}
+
+// Datagrams received together, each with its source
+struct Batch
+{
+   char buffers[BATCH_SIZE][MAX_DATAGRAM_SIZE];
+   std::size_t sizes[BATCH_SIZE];
+   sockaddr_in sources[BATCH_SIZE];
+#ifdef HAVE_RECVMMSG
+   mmsghdr messages[BATCH_SIZE];
+   iovec vectors[BATCH_SIZE];
+#endif
+#ifdef COUNT_KERNEL_DROPS
+   char controls[BATCH_SIZE][CMSG_SPACE(sizeof(std::uint32_t))];
+   // Datagrams dropped since the socket was created, as of the last one received
+   std::uint32_t kernelDrops;
+#endif
+};
+
+// Shown on SIGUSR1 and at exit
+struct Counters
+{
+   std::uint64_t packets = 0;
+   std::uint64_t bytes = 0;
+   std::uint64_t kernelDrops = 0;
+   std::uint64_t queueDrops = 0;
+   std::uint64_t peakRate = 0;
+
+   // Datagrams received in the second that started at secondStart
+   std::uint64_t secondPackets = 0;
+   std::chrono::steady_clock::time_point secondStart;
+};
+
+// Waits up to timeout milliseconds for a datagram, returns poll()'s result
+static int
+wait_readable(socket_t fd,
+              int timeout)
+{
+#ifdef _WIN32
+   WSAPOLLFD pfd = { fd, POLLRDNORM, 0 };
+   return WSAPoll(&pfd, 1, timeout);
+#else
+   pollfd pfd = { fd, POLLIN, 0 };
+   return poll(&pfd, 1, timeout);
+#endif
+}
+
+// Receives the datagrams already queued on the socket, up to BATCH_SIZE, of which
+// there is at least one. Returns how many, or -1 on errors.
+static int
+receive_batch(socket_t fd,
+              Batch& batch)
 {
-   char result[INET_ADDRSTRLEN];
-   if (!inet_ntop(addr.sin_family, &addr.sin_addr, result, sizeof result))
-      throw std::logic_error{"cannot print address"};
-   return result + ":"s + std::to_string(ntohs(addr.sin_port));
+#ifdef HAVE_RECVMMSG
+   for (int i = 0; i < BATCH_SIZE; ++i) {
+      batch.vectors[i] = { batch.buffers[i], MAX_DATAGRAM_SIZE };
+      batch.messages[i] = {};
+      batch.messages[i].msg_hdr.msg_name = &batch.sources[i];
+      batch.messages[i].msg_hdr.msg_namelen = sizeof batch.sources[i];
+      batch.messages[i].msg_hdr.msg_iov = &batch.vectors[i];
+      batch.messages[i].msg_hdr.msg_iovlen = 1;
+#ifdef COUNT_KERNEL_DROPS
+      batch.messages[i].msg_hdr.msg_control = batch.controls[i];
+      batch.messages[i].msg_hdr.msg_controllen = sizeof batch.controls[i];
+#endif
+   }
+
+   int count = recvmmsg(fd, batch.messages, BATCH_SIZE, MSG_DONTWAIT, nullptr);
+   for (int i = 0; i < count; ++i) {
+      batch.sizes[i] = batch.messages[i].msg_len;
+#ifdef COUNT_KERNEL_DROPS
+      // Only sent once something was dropped
+      auto header = &batch.messages[i].msg_hdr;
+      for (auto cmsg = CMSG_FIRSTHDR(header); cmsg; cmsg = CMSG_NXTHDR(header, cmsg)) {
+         if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            std::uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof drops);
+            batch.kernelDrops = std::max(batch.kernelDrops, drops);
+         }
+      }
+#endif
+   }
+   return count;
+#else
+   int count = 0;
+   while (count < BATCH_SIZE) {
+      // The first datagram is known to be there
+      if (count > 0 && wait_readable(fd, 0) != 1)
+         break;
+
+#ifdef _WIN32
+      int fromLen = sizeof batch.sources[count];
+#else
+      socklen_t fromLen = sizeof batch.sources[count];
+#endif
+      int recvd = recvfrom(fd,
+                           batch.buffers[count],
+                           MAX_DATAGRAM_SIZE,
+                           0,
+                           reinterpret_cast<struct sockaddr *>(&batch.sources[count]),
+                           &fromLen);
+      if (recvd < 0)
+         return count > 0 ? count : -1;
+      batch.sizes[count++] = recvd;
+   }
+   return count;
+#endif
 }
 
-static std::string
-errno_to_string()
+// Asks for a receive buffer of size bytes, returns the size the kernel reports
+static int
+set_receive_buffer_size(socket_t fd,
+                        int size)
 {
+#ifdef SO_RCVBUFFORCE
+   // Goes over the net.core.rmem_max limit, when running with CAP_NET_ADMIN
+   if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof size) < 0)
+#endif
+      setsockopt(fd, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char *>(&size), sizeof size);
+
+   int actual = 0;
 #ifdef _WIN32
-   char *s = nullptr;
-   FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER
-                 | FORMAT_MESSAGE_FROM_SYSTEM,
-                 nullptr,
-                 WSAGetLastError(),
-                 MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
-                 reinterpret_cast<LPTSTR>(&s),
-                 0,
-                 nullptr);
-   std::string result = s;
-   LocalFree(s);
-   return result;
+   int actualLen = sizeof actual;
+#else
+   socklen_t actualLen = sizeof actual;
+#endif
+   getsockopt(fd, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<char *>(&actual), &actualLen);
+   return actual;
+}
+
+static void
+print_counters(std::ostream& out,
+               const Counters& counters)
+{
+   // The second in progress counts too, it can only be lower than a whole one
+   auto peakRate = std::max(counters.peakRate, counters.secondPackets);
+   fmt::println(out, "Received {} datagrams, {} bytes.", counters.packets, counters.bytes);
+   fmt::println(out, "Peak rate: {} datagrams/s.", peakRate);
+#ifdef COUNT_KERNEL_DROPS
+   fmt::println(out, "Dropped by the system: {} datagrams.", counters.kernelDrops);
 #else
-   char result[256];
-   return strerror_r(errno, result, sizeof result);
+   fmt::println(out, "Dropped by the system: unknown on this platform.");
 #endif
+   fmt::println(out, "Dropped because output couldn't keep up: {} datagrams.", counters.queueDrops);
 }
 
 static void
@@ -96,6 +243,11 @@ int main(int argc, char **argv)
 
    unsigned short port = SERVER_PORT;
    bool verbose = false;
+   int receiveBufferSize = DEFAULT_RECEIVE_BUFFER_SIZE;
+   bool prefix = false;
+   std::filesystem::path outputDir;
+   CaptureFile capture;
+   bool capturing = false;
 
    try {
       parser.global_options()
@@ -105,6 +257,25 @@ int main(int argc, char **argv)
                      description { "Show version" })
          .add_option("v,verbose",
                      description { "Print verbose messages to STDERR" })
+         .add_option("b,buffer-size",
+                     description { "Set the receive buffer size of the socket, in bytes (default is "s
+                                   + std::to_string(DEFAULT_RECEIVE_BUFFER_SIZE) + ")"s },
+                     value<int> {})
+         .add_option("p,prefix",
+                     description { "Start every line with the address of the console that sent it" })
+         .add_option("o,output-dir",
+                     description { "Write the logs of each console to its own file in this directory" },
+                     value<std::string> {})
+         .add_option("c,capture",
+                     description { "Also keep the latest logs in this file, as a ring of binary records" },
+                     value<std::string> {})
+         .add_option("capture-size",
+                     description { "Set how much a capture file holds, in MiB (default is "s
+                                   + std::to_string(DEFAULT_CAPTURE_SIZE) + ")"s },
+                     value<int> {})
+         .add_option("dump",
+                     description { "Print the logs kept in a capture file, then exit" },
+                     value<std::string> {})
          ;
       parser.default_command()
          .add_argument("port",
@@ -131,11 +302,58 @@ int main(int argc, char **argv)
       return 0;
    }
 
+   if (options.has("dump")) {
+      auto filename = options.get<std::string>("dump");
+      if (!CaptureFile::dump(filename, cout)) {
+         fmt::println(cerr, "Failed to read capture file {}", filename);
+         return -1;
+      }
+      return 0;
+   }
+
    if (options.has("port"))
       port = options.get<int>("port");
 
    verbose = options.has("verbose");
 
+   if (options.has("buffer-size")) {
+      receiveBufferSize = options.get<int>("buffer-size");
+      if (receiveBufferSize <= 0) {
+         fmt::println(cerr, "Invalid receive buffer size: {}", receiveBufferSize);
+         return -1;
+      }
+   }
+
+   prefix = options.has("prefix");
+
+   if (options.has("output-dir")) {
+      outputDir = options.get<std::string>("output-dir");
+      std::error_code error;
+      std::filesystem::create_directories(outputDir, error);
+      if (error) {
+         fmt::println(cerr, "Failed to create {}: {}", outputDir.string(), error.message());
+         return -1;
+      }
+   }
+
+   if (options.has("capture")) {
+      auto filename = options.get<std::string>("capture");
+      int size = DEFAULT_CAPTURE_SIZE;
+      if (options.has("capture-size"))
+         size = options.get<int>("capture-size");
+      if (size <= 0) {
+         fmt::println(cerr, "Invalid capture size: {}", size);
+         return -1;
+      }
+      if (!capture.open(filename, std::size_t(size) * 1024 * 1024)) {
+         fmt::println(cerr, "Failed to create capture file {}: {}", filename, strerror(errno));
+         return -1;
+      }
+      capturing = true;
+      if (verbose)
+         fmt::println(clog, "Capturing the latest {} MiB of logs to {}", size, filename);
+   }
+
 #ifdef _WIN32
    WSADATA wsaData;
    if (WSAStartup(MAKEWORD(2, 2), &wsaData) == SOCKET_ERROR) {
@@ -160,6 +378,20 @@ int main(int argc, char **argv)
    if (verbose)
       fmt::println(clog, "Created socket {}", fd);
 
+   // Enlarge the receive buffer, so bursts aren't dropped while output is written
+   auto actualBufferSize = set_receive_buffer_size(fd, receiveBufferSize);
+   if (verbose)
+      fmt::println(clog, "Receive buffer is {} bytes", actualBufferSize);
+   // Linux reports twice the size it was given, so this only warns when it was capped
+   if (options.has("buffer-size") && actualBufferSize < receiveBufferSize)
+      fmt::println(cerr, "Receive buffer is only {} bytes, the system limits it", actualBufferSize);
+
+#ifdef COUNT_KERNEL_DROPS
+   int one = 1;
+   if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof one) < 0 && verbose)
+      fmt::println(clog, "Cannot count the datagrams the system drops: {}", errno_to_string());
+#endif
+
    // Bind socket
    struct sockaddr_in addr;
    memset(&addr, 0, sizeof(addr));
@@ -182,48 +414,66 @@ int main(int argc, char **argv)
    }
 
    // Receive data
-   char buffer[2048];
+   auto batch = std::make_unique<Batch>();
+   LogQueue queue{QUEUE_SIZE};
+   LogWriter writer{queue, prefix, outputDir, capturing ? &capture : nullptr};
+   Counters counters;
    bool running = true;
 
+   // Writing happens on its own thread, so slow output never delays receiving
+   writer.start();
+
    std::signal(SIGINT, handle_ctrl_c);
+#ifdef SIGUSR1
+   std::signal(SIGUSR1, handle_usr1);
+#endif
 
    while (running) {
+      if (wait_readable(fd, 250) == 1) {
+         int count = receive_batch(fd, *batch);
+         if (count > 0) {
+            // The datagrams of a batch arrived together, they share a timestamp
+            auto now = std::chrono::system_clock::now();
+            auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
 
-      fd_set fdsRead;
-      FD_ZERO(&fdsRead);
-      FD_SET(fd, &fdsRead);
-
-      struct timeval tv;
-      tv.tv_sec = 0;
-      tv.tv_usec = 250'000;
+            std::size_t bytes = 0;
+            for (int i = 0; i < count; ++i) {
+               if (batch->sizes[i] == 0)
+                  continue;
+               if (!queue.push(time, batch->sources[i], batch->buffers[i], batch->sizes[i]))
+                  ++counters.queueDrops;
+               bytes += batch->sizes[i];
+            }
+            // Once for the whole batch
+            writer.notify();
+            if (verbose)
+               fmt::println(clog, "Received {} datagrams, {} bytes.", count, bytes);
 
-      if (select(fd + 1, &fdsRead, NULL, NULL, &tv) == 1) {
-         struct sockaddr_in from;
-#ifdef _WIN32
-         int fromLen = sizeof(from);
-#else
-         socklen_t fromLen = sizeof(from);
+            counters.packets += count;
+            counters.bytes += bytes;
+#ifdef COUNT_KERNEL_DROPS
+            counters.kernelDrops = batch->kernelDrops;
 #endif
-         int recvd = recvfrom(fd,
-                              buffer,
-                              sizeof(buffer),
-                              0,
-                              reinterpret_cast<struct sockaddr *>(&from),
-                              &fromLen);
-
-         if (recvd > 0) {
-            if (verbose)
-               fmt::println(clog, "Received {} bytes.", recvd);
-            fmt::println(cout, "{}", std::string_view{buffer, static_cast<std::size_t>(recvd)});
-            cout.flush();
+            auto tick = std::chrono::steady_clock::now();
+            if (tick - counters.secondStart >= 1s) {
+               counters.peakRate = std::max(counters.peakRate, counters.secondPackets);
+               counters.secondPackets = 0;
+               counters.secondStart = tick;
+            }
+            counters.secondPackets += count;
          } else {
             if (verbose) {
                auto msg = errno_to_string();
-               fmt::println(clog, "recvfrom() returned {}: {}", recvd, msg);
+               fmt::println(clog, "Receiving returned {}: {}", count, msg);
             }
          }
       }
 
+      if (counters_requested) {
+         counters_requested = 0;
+         print_counters(clog, counters);
+      }
+
       if (interrupted) {
          if (verbose)
             fmt::println(clog, "\nInterrupted.");
@@ -233,6 +483,9 @@ int main(int argc, char **argv)
       }
    }
 
+   writer.stop();
+   print_counters(clog, counters);
+
 #ifdef _WIN32
    closesocket(fd);
    WSACleanup();
@@ -0,0 +1,42 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "net.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std::literals;
+
+std::string
+to_string(const sockaddr_in& addr)
+{
+   char result[INET_ADDRSTRLEN];
+   if (!inet_ntop(addr.sin_family, &addr.sin_addr, result, sizeof result))
+      throw std::logic_error{"cannot print address"};
+   return result + ":"s + std::to_string(ntohs(addr.sin_port));
+}
+
+std::string
+errno_to_string()
+{
+#ifdef _WIN32
+   char *s = nullptr;
+   FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER
+                 | FORMAT_MESSAGE_FROM_SYSTEM,
+                 nullptr,
+                 WSAGetLastError(),
+                 MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
+                 reinterpret_cast<LPTSTR>(&s),
+                 0,
+                 nullptr);
+   std::string result = s;
+   LocalFree(s);
+   return result;
+#else
+   char result[256];
+   return strerror_r(errno, result, sizeof result);
+#endif
+}
@@ -1,15 +1,30 @@
 #include <stdlib.h>
+#include <string.h>
+#include "../utils/filecopy.h"
+#include "../utils/progress.h"
 #include "BufferFileEntry.h"
 
+bool BufferFileEntry::needsUpdate(const uint8_t *archive_data) {
+    return memcmp(archive_data, this->buffer.data(), this->size) != 0;
+}
+
 void BufferFileEntry::write(FILE *f_out, off_t base_offset) {
-    printf("Writing %s...\n", getFullPath().c_str());
+    if (progress_show_files()) {
+        printf("Writing %s...\n", getFullPath().c_str());
+    }
 
-    if(fseeko64(f_out, base_offset + this->offset + ROMFS_FILEPARTITION_OFS, SEEK_SET) != 0){
-        fprintf(stderr, "Failed to seek!\n");
+    if (!file_write_at(f_out, this->buffer.data(), this->size, base_offset + this->offset + ROMFS_FILEPARTITION_OFS)) {
+        fprintf(stderr, "Failed to write to output!\n");
         exit(EXIT_FAILURE);
     }
+}
+
+void BufferFileEntry::writeStream(FILE *f_out) {
+    if (progress_show_files()) {
+        printf("Writing %s...\n", getFullPath().c_str());
+    }
 
-    if (fwrite(&this->buffer[0], 1, this->size , f_out) != this->size) {
+    if (fwrite(this->buffer.data(), 1, this->size, f_out) != this->size) {
         fprintf(stderr, "Failed to write to output!\n");
         exit(EXIT_FAILURE);
     }
@@ -4,13 +4,17 @@
 
 class BufferFileEntry final : public FileEntry {
 public:
-    BufferFileEntry(std::string &&name, std::vector<uint8_t> &&data) : FileEntry(std::move(name)) {
+    BufferFileEntry(std::string_view name, std::vector<uint8_t> &&data) : FileEntry(name) {
         this->buffer = std::move(data);
         this->size = buffer.size();
     }
 
     void write(FILE *f_out, off_t base_offset) override;
 
+    void writeStream(FILE *f_out) override;
+
+    bool needsUpdate(const uint8_t *archive_data) override;
+
 private:
     std::vector<uint8_t> buffer;
 };
@@ -8,12 +8,14 @@ class DirectoryEntry : public NodeEntry {
 public:
     ~DirectoryEntry() override {
         for (auto const &e : children) {
-            delete e;
+            if (!e->isInArena()) {
+                delete e;
+            }
         }
         children.clear();
     }
 
-    explicit DirectoryEntry(std::string &&name) : NodeEntry(std::move(name), true) {
+    explicit DirectoryEntry(std::string_view name) : NodeEntry(name, true) {
 
     }
 
@@ -23,6 +25,11 @@ public:
 
     std::string getFullPath() override;
 
+    /* Path of the directory on disk, from its own path or its parent's plus its name. */
+    std::string getOSPath();
+
+    void setOSPath(std::string_view path);
+
     bool addChild(NodeEntry *file);
 
     void printRecursive(int indentation) override {
@@ -33,29 +40,18 @@ public:
         }
     }
 
-    void calculateFileOffsets(romfs_ctx_t *ptr, uint32_t *entry_offset) override;
-
-    virtual void calculateDirOffsets(romfs_ctx_t *ptr, uint32_t *entry_offset);
-
-    void populate(romfs_infos_t *romfs_infos) override;
-
-    virtual void updateSiblingAndChildEntries();
-
     void write(FILE *pIobuf, off_t offset) override;
 
+    /* Appends every file below this directory to files, in the order of the file table. */
+    void collectFiles(std::vector<FileEntry *> &files);
+
     virtual void moveChildren(DirectoryEntry &dirInput);
 
     void clearChildren();
 
-    void fillRomFSInformation(romfs_ctx_t *romfs_ctx) override;
 protected:
-    virtual void updateEntryOffset(uint32_t *entry_offset);
-
     std::vector<NodeEntry *> children;
 
-    DirectoryEntry *sibling = nullptr;
-    DirectoryEntry *dirChild = nullptr;
-    FileEntry *fileChild = nullptr;
-
-    bool entry_offset_set = false;
+private:
+    std::string_view osPath;
 };
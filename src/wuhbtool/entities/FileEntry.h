@@ -1,20 +1,23 @@
 #pragma once
 
+#include <cstdint>
 #include "NodeEntry.h"
 #include "../services/RomFSStructs.h"
 
 class FileEntry : public NodeEntry {
 public:
-    explicit FileEntry(std::string &&name) : NodeEntry(std::move(name), false) {
+    explicit FileEntry(std::string_view name) : NodeEntry(name, false) {
     }
 
-    void calculateFileOffsets(romfs_ctx_t *ptr, uint32_t *entry_offset) override;
+    /* Writes the data of this file at the current position of f_out, which may not be seekable. */
+    virtual void writeStream(FILE *f_out) = 0;
 
-    void populate(romfs_infos_t *romfs_infos) override;
+    /* Whether archive_data, the size bytes stored for this file in an existing archive, differ from its contents. */
+    virtual bool needsUpdate(const uint8_t *archive_data) = 0;
 
-    void fillRomFSInformation(romfs_ctx_t *romfs_ctx) override;
-
-    FileEntry *sibling = nullptr;
     uint64_t size = 0;
 
+    /* Set when deduplicating, this file shares the data of an identical file laid out before it. */
+    FileEntry *duplicateOf = nullptr;
+
 };
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string_view>
+
+#include "DirectoryEntry.h"
+#include "OSFileEntry.h"
+
+/*
+ * Owns the nodes of scanned trees, keeping them in large contiguous blocks instead
+ * of one heap allocation each. Its nodes aren't deleted by their parents, they are
+ * all destroyed with the arena. Safe to use from several threads.
+ */
+class NodeArena {
+public:
+    ~NodeArena() {
+        for (auto &dir : directories) {
+            dir.clearChildren();
+        }
+    }
+
+    DirectoryEntry *newDirectory(std::string_view name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &dir = directories.emplace_back(name);
+        dir.in_arena = true;
+        return &dir;
+    }
+
+    OSFileEntry *newFile(std::string_view name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &file = files.emplace_back(name);
+        file.in_arena = true;
+        return &file;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<DirectoryEntry> directories;
+    std::deque<OSFileEntry> files;
+};
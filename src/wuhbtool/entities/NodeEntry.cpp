@@ -1,6 +1,12 @@
 #include "NodeEntry.h"
 #include "DirectoryEntry.h"
 #include "../utils/utils.h"
+#include "../utils/stringpool.h"
+
+std::string_view NodeEntry::intern(std::string_view str) {
+    static StringPool pool;
+    return pool.intern(str);
+}
 
 DirectoryEntry * NodeEntry::getParent() {
     if (this->parent && this->parent->isDirNode()) {
@@ -11,13 +17,18 @@ DirectoryEntry * NodeEntry::getParent() {
 
 std::string NodeEntry::getPath() {
     if (parent) {
-        return parent->getPath() + parent->getName() + OS_PATH_SEPARATOR;
+        std::string path = parent->getPath();
+        path += parent->getName();
+        path += OS_PATH_SEPARATOR;
+        return path;
     }
     return OS_PATH_SEPARATOR;
 }
 
 std::string NodeEntry::getFullPath() {
-    return getPath() + getName();
+    std::string path = getPath();
+    path += getName();
+    return path;
 }
 
 void NodeEntry::setParent(DirectoryEntry *_parent) {
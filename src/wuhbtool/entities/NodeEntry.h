@@ -3,6 +3,7 @@
 #include <cstdio>
 #include <utility>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "../services/RomFSStructs.h"
@@ -13,12 +14,13 @@ class NodeEntry {
 public:
     virtual ~NodeEntry() = default;
 
-    explicit NodeEntry(std::string &&name, bool is_dir_node) {
-        this->name = std::move(name);
+    explicit NodeEntry(std::string_view name, bool is_dir_node) {
+        this->name = intern(name);
         this->is_dir_node = is_dir_node;
     }
 
-    virtual const std::string &getName() const {
+    /* Points into the pool of names, which lives until the program exits. */
+    virtual std::string_view getName() const {
         return name;
     }
 
@@ -30,32 +32,37 @@ public:
         return !is_dir_node;
     }
 
+    /* Nodes of a NodeArena are destroyed with it, not by their parent. */
+    bool isInArena() const {
+        return in_arena;
+    }
+
     void setParent(DirectoryEntry *_parent);
 
     DirectoryEntry * getParent();
 
     virtual void printRecursive(int indentation) {
-        printf("%s%s\n", std::string(indentation, ' ').c_str(), getName().c_str());
+        printf("%s%.*s\n", std::string(indentation, ' ').c_str(), static_cast<int>(getName().size()), getName().data());
     }
 
     virtual std::string getPath();
 
     virtual std::string getFullPath();
 
-    virtual void populate(romfs_infos_t *romfs_infos) = 0;
-
-    virtual void calculateFileOffsets(romfs_ctx_t *romfs_ctx, uint32_t *entry_offset) = 0;
-
     virtual void write(FILE *pIobuf, off_t offset) = 0;
 
-    virtual void fillRomFSInformation(romfs_ctx_t *romfs_ctx) = 0;
-
-
     uint64_t offset = 0;
     uint64_t entry_offset = 0;
 
+protected:
+    /* Every name and path of the tree is stored once, in a shared pool. */
+    static std::string_view intern(std::string_view str);
+
 private:
+    friend class NodeArena;
+
     NodeEntry *parent = nullptr;
-    std::string name;
+    std::string_view name;
     bool is_dir_node;
+    bool in_arena = false;
 };
@@ -1,14 +1,25 @@
+#include "../utils/filecopy.h"
 #include "../utils/filepath.h"
+#include "../utils/progress.h"
 
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <stdlib.h>
+#include <string.h>
+#include "mapped_file.h"
 #include "OSFileEntry.h"
+#include "DirectoryEntry.h"
 
 void OSFileEntry::write(FILE *f_out, off_t base_offset) {
-    printf("Writing %s...\n", getFullPath().c_str());
+    if (progress_show_files()) {
+        printf("Writing %s...\n", getFullPath().c_str());
+    }
+
+    filepath_t path;
+    filepath_init(&path);
+    filepath_set(&path, getOSPath().c_str());
 
-    FILE *f_in = os_fopen(this->osPath.os_path, OS_MODE_READ);
+    FILE *f_in = os_fopen(path.os_path, OS_MODE_READ);
 
     if (f_in == nullptr) {
         fprintf(stderr, "Failed to open %s!\n", getFullPath().c_str());
@@ -16,38 +27,61 @@ void OSFileEntry::write(FILE *f_out, off_t base_offset) {
     }
 
     /* Write files. */
-    auto *buffer = static_cast<unsigned char *>(malloc(0x400000));
-    if (buffer == nullptr) {
-        fprintf(stderr, "Failed to allocate work buffer!\n");
+    if (!file_copy_range(f_in, f_out, base_offset + this->offset + ROMFS_FILEPARTITION_OFS, this->size)) {
+        fprintf(stderr, "Failed to copy %s to output!\n", path.char_path);
         exit(EXIT_FAILURE);
     }
 
-    if(fseeko64(f_out, base_offset + this->offset + ROMFS_FILEPARTITION_OFS, SEEK_SET) != 0){
-        fprintf(stderr, "Failed to seek!\n");
+    os_fclose(f_in);
+}
+
+void OSFileEntry::writeStream(FILE *f_out) {
+    if (progress_show_files()) {
+        printf("Writing %s...\n", getFullPath().c_str());
+    }
+
+    filepath_t path;
+    filepath_init(&path);
+    filepath_set(&path, getOSPath().c_str());
+
+    FILE *f_in = os_fopen(path.os_path, OS_MODE_READ);
+
+    if (f_in == nullptr) {
+        fprintf(stderr, "Failed to open %s!\n", getFullPath().c_str());
         exit(EXIT_FAILURE);
     }
-    uint64_t offset = 0;
-    uint64_t read_size = 0x400000;
-    while (offset < this->size) {
-        if (this->size - offset < read_size) {
-            read_size = this->size - offset;
-        }
-
-        if (fread(buffer, 1, read_size, f_in) != read_size) {
-            fprintf(stderr, "Failed to read from %s!\n", this->osPath.char_path);
-            exit(EXIT_FAILURE);
-        }
-
-        if (fwrite(buffer, 1, read_size, f_out) != read_size) {
-            fprintf(stderr, "Failed to write to output!\n");
-            exit(EXIT_FAILURE);
-        }
-
-        offset += read_size;
+
+    if (!file_copy_stream(f_in, f_out, this->size)) {
+        fprintf(stderr, "Failed to copy %s to output!\n", path.char_path);
+        exit(EXIT_FAILURE);
     }
 
     os_fclose(f_in);
-    free(buffer);
+}
+
+bool OSFileEntry::needsUpdate(const uint8_t *archive_data) {
+    if (this->size == 0) {
+        return false;
+    }
+
+    /* A file that can't be read any more is rewritten, which reports the error. */
+    MappedFile mapped;
+    if (!mapped.open(getOSPath()) || mapped.size() != this->size) {
+        return true;
+    }
+
+    return memcmp(archive_data, mapped.data(), this->size) != 0;
+}
+
+std::string OSFileEntry::getOSPath() {
+    if (!osPath.empty() || !getParent()) {
+        return std::string(osPath);
+    }
+
+    std::string path = getParent()->getOSPath();
+    path += OS_PATH_SEPARATOR;
+    path += getName();
+    return path;
 }
 
 FileEntry *OSFileEntry::fromPath(const char* inputPath, const char* filename) {
@@ -61,7 +95,7 @@ FileEntry *OSFileEntry::fromPath(const char* inputPath, const char* filename) {
         exit(EXIT_FAILURE);
     }
 
-    auto res = new OSFileEntry(cur_path, filename);
+    auto res = new OSFileEntry(filename, cur_path.char_path);
     res->size = cur_stats.st_size;
 
     return res;
@@ -4,14 +4,27 @@
 
 class OSFileEntry final : public FileEntry {
 public:
-    OSFileEntry(filepath_t &path, std::string &&name) : FileEntry(std::move(name)) {
-        this->osPath = path;
+    /* Without an osPath, the file is at its parent's OS path plus its name. */
+    explicit OSFileEntry(std::string_view name, std::string_view osPath = {}) : FileEntry(name) {
+        this->osPath = intern(osPath);
     }
 
     void write(FILE *pIobuf, off_t offset) override;
 
+    void writeStream(FILE *f_out) override;
+
+    /*
+     * Compares the file with its copy in the archive. Modification times can't
+     * tell: files copied with their times or unpacked can be older than the
+     * archive, and an interrupted update leaves a new archive with old data.
+     */
+    bool needsUpdate(const uint8_t *archive_data) override;
+
+    /* Path of the file on disk, as UTF-8. */
+    std::string getOSPath();
+
     static FileEntry* fromPath(const char* inputPath, const char* filename);
 
 private:
-    filepath_t osPath;
+    std::string_view osPath;
 };
@@ -9,9 +9,4 @@ public:
     }
 
     std::string getPath() override;
-
-    void updateEntryOffset(uint32_t *entry_offset) override;
-
-    void populate(romfs_infos_t *romfs_infos) override;
-
 };
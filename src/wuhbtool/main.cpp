@@ -1,14 +1,20 @@
 #include <cstring>
 #include <algorithm>
 #include <excmd.h>
+#include <fstream>
 #include <iostream>
 #include <fmt/base.h>
 #include <fmt/ostream.h>
 
+#include "parallel.h"
+
+#include "utils/progress.h"
+
 #include "entities/RootEntry.h"
 #include "entities/OSFileEntry.h"
 #include "entities/BufferFileEntry.h"
 
+#include "services/RomFSReader.h"
 #include "services/RomFSService.h"
 #include "services/TgaGzService.h"
 
@@ -26,20 +32,40 @@ static void deinitializeFreeImage() {
 static inline void addFolderIfNotEmpty(DirectoryEntry *parent, DirectoryEntry *child) {
    if (!child->getChildren().empty()) {
       parent->addChild(child);
-   } else {
+   } else if (!child->isInArena()) {
       delete child;
    }
 }
 
-static void addImageResource(DirectoryEntry *parent, const char* name, int width, int height, int bpp, excmd::option_state &options, const char *optName) {
+static void addImageResource(std::vector<TgaGzImage> &images, const char* name, unsigned width, unsigned height, unsigned bpp, excmd::option_state &options, const char *optName) {
    if (!options.has(optName))
       return;
 
-   std::string path = options.get<std::string>(optName);
-   FileEntry *file = createTgaGzFileEntry(path.c_str(), width, height, bpp, name);
-   if (file) {
-      parent->addChild(file);
+   images.push_back({options.get<std::string>(optName), width, height, bpp, name});
+}
+
+/* Reads one archive path per line, from a file or from stdin for "-". */
+static bool readAccessOrder(const std::string &path, std::vector<std::string> &paths) {
+   std::ifstream file;
+   if (path != "-") {
+      file.open(path);
+      if (!file) {
+         fmt::println(cerr, "Could not open access order file {}", path);
+         return false;
+      }
    }
+
+   std::istream &in = path == "-" ? std::cin : file;
+   std::string line;
+   while (std::getline(in, line)) {
+      if (!line.empty() && line.back() == '\r') {
+         line.pop_back();
+      }
+      if (!line.empty()) {
+         paths.push_back(line);
+      }
+   }
+   return true;
 }
 
 static void
@@ -48,7 +74,10 @@ show_help(std::ostream& out,
           const std::string& exec_name)
 {
    fmt::println(out, "Usage:");
-   fmt::println(out, "  {} [options] <executable.rpx> <output.wuhb>\n", exec_name);
+   fmt::println(out, "  {} [options] <executable.rpx> <output.wuhb>", exec_name);
+   fmt::println(out, "  {} list <archive.wuhb>", exec_name);
+   fmt::println(out, "  {} extract <archive.wuhb> <directory> [path]", exec_name);
+   fmt::println(out, "  {} cat <archive.wuhb> <path>\n", exec_name);
    fmt::println(out, "{}", parser.format_help(exec_name));
    fmt::println(out, "Report bugs to {}", PACKAGE_BUGREPORT);
 }
@@ -57,6 +86,7 @@ int main(int argc, char **argv) {
    excmd::parser parser;
    excmd::option_state options;
    using excmd::description;
+   using excmd::optional;
    using excmd::value;
 
    try {
@@ -86,6 +116,29 @@ int main(int argc, char **argv) {
             .add_option("drc-image",
                         description{"Splash Screen image shown on the DRC (854x480)"},
                         value<std::string>{})
+            .add_option("image-cache-dir",
+                        description{"Directory used to cache converted images between runs"},
+                        value<std::string>{})
+            .add_option("dedup",
+                        description{"Store the data of identical content files only once"})
+            .add_option("update",
+                        description{"Only rewrite the files whose contents changed, when the layout of the existing output is the same"})
+            .add_option("align",
+                        description{"Alignment of the files in the archive, a power of 2 (default is 16)"},
+                        value<unsigned>{})
+            .add_option("small-file-size",
+                        description{"Place the files smaller than this together, with 16 byte alignment"},
+                        value<unsigned>{})
+            .add_option("access-order",
+                        description{"Place the files listed in this file first, in that order, one archive path like /content/file.bin per line, - reads the list from stdin"},
+                        value<std::string>{})
+            .add_option("quiet",
+                        description{"Only print errors"})
+            .add_option("progress",
+                        description{"Show a single line with the bytes written, files per second and MiB/s instead of every file written"})
+            .add_option("j,jobs",
+                        description{"Number of images converted, directories scanned and files written at the same time (0 uses one per CPU, default is 1)"},
+                        value<int>{})
          ;
 
       parser.default_command()
@@ -93,7 +146,32 @@ int main(int argc, char **argv) {
                        description{"Path to RPX file"},
                        value<std::string>{})
             .add_argument("output.wuhb",
-                       description{"Path to WUHB file"},
+                       description{"Path to WUHB file, - writes it to stdout"},
+                       value<std::string>{});
+
+      parser.add_command("list")
+            .add_argument("archive.wuhb",
+                       description{"Path to WUHB file to list the files of"},
+                       value<std::string>{});
+
+      parser.add_command("extract")
+            .add_argument("archive.wuhb",
+                       description{"Path to WUHB file to extract"},
+                       value<std::string>{})
+            .add_argument("directory",
+                       description{"Directory the files are extracted to"},
+                       value<std::string>{})
+            .add_argument("path",
+                       description{"Only extract this file or directory of the archive, like /content/data"},
+                       optional{},
+                       value<std::string>{});
+
+      parser.add_command("cat")
+            .add_argument("archive.wuhb",
+                       description{"Path to WUHB file to read from"},
+                       value<std::string>{})
+            .add_argument("path",
+                       description{"File of the archive written to stdout, like /meta/meta.ini"},
                        value<std::string>{});
 
       options = parser.parse(argc, argv);
@@ -118,10 +196,81 @@ int main(int argc, char **argv) {
       return EXIT_SUCCESS;
    }
 
+   if (options.has("quiet") && options.has("progress")) {
+      fmt::println(cerr, "--quiet and --progress can't be used together");
+      return EXIT_FAILURE;
+   }
+   if (options.has("quiet")) {
+      progress_set_mode(ProgressMode::Quiet);
+   } else if (options.has("progress")) {
+      progress_set_mode(ProgressMode::Progress);
+   }
+
+   if (options.has("list")) {
+      romfs::ListArchive(options.get<std::string>("archive.wuhb").c_str());
+      return EXIT_SUCCESS;
+   }
+
+   if (options.has("extract")) {
+      std::string path = options.has("path") ? options.get<std::string>("path") : "";
+      romfs::ExtractArchive(options.get<std::string>("archive.wuhb").c_str(),
+                            options.get<std::string>("directory").c_str(), path);
+      return EXIT_SUCCESS;
+   }
+
+   if (options.has("cat")) {
+      FILE *f_stdout = os_take_stdout();
+      if (f_stdout == nullptr) {
+         fmt::println(cerr, "Could not write to stdout");
+         return EXIT_FAILURE;
+      }
+      romfs::CatFile(options.get<std::string>("archive.wuhb").c_str(), options.get<std::string>("path"), f_stdout);
+      fclose(f_stdout);
+      return EXIT_SUCCESS;
+   }
+
+   unsigned jobs = 1;
+   if (options.has("jobs")) {
+      int value = options.get<int>("jobs");
+      if (value < 0) {
+         fmt::println(cerr, "Invalid number of jobs: {}", value);
+         return EXIT_FAILURE;
+      }
+      jobs = resolve_jobs(value);
+   }
+
+   romfs::LayoutPolicy layout;
+   if (options.has("align")) {
+      layout.alignment = options.get<unsigned>("align");
+      if (layout.alignment < 0x10 || (layout.alignment & (layout.alignment - 1)) != 0) {
+         fmt::println(cerr, "Invalid alignment: {}, it must be a power of 2 of at least 16", layout.alignment);
+         return EXIT_FAILURE;
+      }
+   }
+   if (options.has("small-file-size")) {
+      layout.small_file_size = options.get<unsigned>("small-file-size");
+   }
+   if (options.has("access-order") && !readAccessOrder(options.get<std::string>("access-order"), layout.access_order)) {
+      return EXIT_FAILURE;
+   }
+
+   /* With - as output, the archive goes to stdout and every message to stderr. */
+   std::string outputPath = options.get<std::string>("output.wuhb");
+   FILE *f_stream = nullptr;
+   if (outputPath == "-") {
+      f_stream = os_take_stdout();
+      if (f_stream == nullptr) {
+         fmt::println(cerr, "Could not write to stdout");
+         return EXIT_FAILURE;
+      }
+   }
+
    // Set up FreeImage
    FreeImage_Initialise();
    atexit(deinitializeFreeImage);
 
+   /* Declared first, so the nodes it owns outlive root. */
+   NodeArena arena;
    auto root = new RootEntry();
 
    auto codeFolder = new DirectoryEntry("code");
@@ -185,9 +334,20 @@ int main(int argc, char **argv) {
       metaFolder->addChild(metaIni);
    }
 
-   addImageResource(metaFolder, "iconTex.tga.gz",     128, 128, 32, options, "icon");
-   addImageResource(metaFolder, "bootTvTex.tga.gz",  1280, 720, 24, options, "tv-image");
-   addImageResource(metaFolder, "bootDrcTex.tga.gz",  854, 480, 24, options, "drc-image");
+   std::vector<TgaGzImage> images;
+   addImageResource(images, "iconTex.tga.gz",     128, 128, 32, options, "icon");
+   addImageResource(images, "bootTvTex.tga.gz",  1280, 720, 24, options, "tv-image");
+   addImageResource(images, "bootDrcTex.tga.gz",  854, 480, 24, options, "drc-image");
+
+   std::string imageCacheDir = options.has("image-cache-dir") ? options.get<std::string>("image-cache-dir") : "";
+   {
+      ProgressTimer timer("Images");
+      for (auto const &file : createTgaGzFileEntries(images, jobs, imageCacheDir)) {
+         if (file) {
+            metaFolder->addChild(file);
+         }
+      }
+   }
 
    addFolderIfNotEmpty(root, codeFolder);
    addFolderIfNotEmpty(root, metaFolder);
@@ -199,12 +359,18 @@ int main(int argc, char **argv) {
       filepath_init(&dirpath);
       filepath_set(&dirpath, contentPath.c_str());
 
-      auto contentFolder = romfs::CreateFolderFromPath(dirpath, "content");
+      ProgressTimer timer("Scan");
+      auto contentFolder = romfs::CreateFolderFromPath(dirpath, "content", jobs, arena);
       addFolderIfNotEmpty(root, contentFolder);
    }
 
-   std::string outputPath = options.get<std::string>("output.wuhb");
-   romfs::CreateArchive(root, outputPath.c_str());
+   if (options.has("dedup")) {
+      ProgressTimer timer("Dedup");
+      romfs::DeduplicateFiles(root, jobs);
+   }
+
+   romfs::CreateArchive(root, outputPath.c_str(), jobs, options.has("update"), layout, f_stream);
+   progress_print_summary();
 
    delete root;
 }
@@ -0,0 +1,247 @@
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <set>
+#include "RomFSMetadata.h"
+#include "RomFSService.h"
+#include "../utils/progress.h"
+#include "../utils/utils.h"
+
+namespace romfs {
+
+namespace {
+
+   constexpr uint32_t NO_INDEX = 0xFFFFFFFF;
+
+   uint32_t GetHashTableCount(uint32_t num_entries) {
+      if (num_entries < 3) {
+         return 3;
+      } else if (num_entries < 19) {
+         return num_entries | 1;
+      }
+      uint32_t count = num_entries;
+      while (count % 2 == 0 || count % 3 == 0 || count % 5 == 0 || count % 7 == 0 || count % 11 == 0 || count % 13 == 0 || count % 17 == 0) {
+         count++;
+      }
+      return count;
+   }
+
+   /* Table entries are only 4 byte aligned, so their fields are stored byte by byte. */
+   void PutWord(std::vector<uint8_t> &table, uint64_t offset, uint32_t value) {
+      value = be_word(value);
+      memcpy(&table[offset], &value, sizeof(value));
+   }
+
+   void PutDword(std::vector<uint8_t> &table, uint64_t offset, uint64_t value) {
+      value = be_dword(value);
+      memcpy(&table[offset], &value, sizeof(value));
+   }
+
+   uint32_t HashName(uint32_t parent_offset, std::string_view name) {
+      return CalcPathHash(parent_offset, reinterpret_cast<const unsigned char *>(name.data()), 0, name.size());
+   }
+
+   /* The nodes of the tree in the orders the tables need, with the index of each one's parent directory. */
+   struct FlatTree {
+      /* Depth first, parents before children, the order of the directory table and its hash chains. */
+      std::vector<DirectoryEntry *> dirs;
+      std::vector<uint32_t> dir_parents;
+
+      /* The files of subdirectories before the files of their parent, the order of the file table. */
+      std::vector<FileEntry *> files;
+      std::vector<uint32_t> file_parents;
+
+      /* Depth first, in the order of the children, the order of the file hash chains. */
+      std::vector<FileEntry *> hashed_files;
+   };
+
+   void Flatten(DirectoryEntry *dir, uint32_t parent, FlatTree &tree) {
+      uint32_t index = tree.dirs.size();
+      tree.dirs.push_back(dir);
+      tree.dir_parents.push_back(parent);
+
+      for (auto const &e : dir->getChildren()) {
+         if (e->isDirNode()) {
+            Flatten(static_cast<DirectoryEntry *>(e), index, tree);
+         } else {
+            tree.hashed_files.push_back(static_cast<FileEntry *>(e));
+         }
+      }
+      for (auto const &e : dir->getChildren()) {
+         if (e->isFileNode()) {
+            tree.files.push_back(static_cast<FileEntry *>(e));
+            tree.file_parents.push_back(index);
+         }
+      }
+   }
+
+   /*
+    * Places the files again following layout: first the ones in the access order,
+    * then the small ones, then the rest in tree order. Updates the partition size.
+    */
+   void ApplyLayout(const std::vector<FileEntry *> &files, const LayoutPolicy &layout, romfs_ctx_t *romfs_ctx) {
+      std::map<std::string, FileEntry *> by_path;
+      for (auto const &file : files) {
+         by_path.emplace(file->getFullPath(), file);
+      }
+
+      /* Duplicates are placed with the file they share their data with. */
+      std::vector<FileEntry *> ordered;
+      std::set<FileEntry *> placed;
+      auto place = [&](FileEntry *file) {
+         if (!file->duplicateOf && placed.insert(file).second) {
+            ordered.push_back(file);
+         }
+      };
+
+      uint32_t num_missing = 0;
+      for (auto const &path : layout.access_order) {
+         auto itr = by_path.find(path.starts_with("/") ? path : "/" + path);
+         if (itr == by_path.end()) {
+            num_missing++;
+            continue;
+         }
+         place(itr->second);
+      }
+      if (num_missing) {
+         progress_log("%u paths of the access order are not in the archive\n", num_missing);
+      }
+
+      for (auto const &file : files) {
+         if (file->size < layout.small_file_size) {
+            place(file);
+         }
+      }
+      for (auto const &file : files) {
+         place(file);
+      }
+
+      uint64_t partition_size = 0;
+      for (auto const &file : ordered) {
+         uint64_t alignment = file->size < layout.small_file_size ? 0x10 : layout.alignment;
+         file->offset = align<uint64_t>(partition_size + ROMFS_FILEPARTITION_OFS, alignment) - ROMFS_FILEPARTITION_OFS;
+         partition_size = file->offset + file->size;
+      }
+      for (auto const &file : files) {
+         if (file->duplicateOf) {
+            file->offset = file->duplicateOf->offset;
+         }
+      }
+      romfs_ctx->file_partition_size = partition_size;
+   }
+
+}
+
+void BuildMetadata(DirectoryEntry *root, const LayoutPolicy &layout, Metadata &metadata) {
+   FlatTree tree;
+   Flatten(root, 0, tree);
+
+   romfs_ctx_t &ctx = metadata.ctx;
+   memset(&ctx, 0, sizeof(ctx));
+
+   /* Entry offsets. The root directory is counted twice, as it always was, so archives don't change. */
+   ctx.num_dirs = tree.dirs.size() + 1;
+   ctx.dir_table_size = 0x18;
+   uint32_t entry_offset = 0;
+   for (auto const &dir : tree.dirs) {
+      dir->entry_offset = entry_offset;
+      entry_offset += 0x18 + align<uint32_t>(dir->getName().size(), 4);
+   }
+   ctx.dir_table_size += entry_offset;
+
+   ctx.num_files = tree.files.size();
+   entry_offset = 0;
+   for (auto const &file : tree.files) {
+      file->entry_offset = entry_offset;
+      entry_offset += 0x20 + align<uint32_t>(file->getName().size(), 4);
+   }
+   ctx.file_table_size = entry_offset;
+
+   /* File partition offsets, duplicates always come after the file they share their data with. */
+   for (auto const &file : tree.files) {
+      if (file->duplicateOf) {
+         file->offset = file->duplicateOf->offset;
+      } else {
+         ctx.file_partition_size = align<uint64_t>(ctx.file_partition_size, 0x10);
+         file->offset = ctx.file_partition_size;
+         ctx.file_partition_size += file->size;
+      }
+   }
+   if (!layout.isDefault()) {
+      ApplyLayout(tree.files, layout, &ctx);
+   }
+
+   /* Sibling and child links, children of a directory come in the same order in both arrays. */
+   size_t num_dirs = tree.dirs.size();
+   std::vector<uint32_t> dir_child(num_dirs, NO_INDEX), dir_file(num_dirs, NO_INDEX), dir_sibling(num_dirs, NO_INDEX);
+   std::vector<uint32_t> last_dir(num_dirs, NO_INDEX), last_file(num_dirs, NO_INDEX);
+   std::vector<uint32_t> file_sibling(tree.files.size(), NO_INDEX);
+   for (uint32_t i = 1; i < num_dirs; i++) {
+      uint32_t parent = tree.dir_parents[i];
+      (last_dir[parent] == NO_INDEX ? dir_child[parent] : dir_sibling[last_dir[parent]]) = i;
+      last_dir[parent] = i;
+   }
+   for (uint32_t i = 0; i < tree.files.size(); i++) {
+      uint32_t parent = tree.file_parents[i];
+      (last_file[parent] == NO_INDEX ? dir_file[parent] : file_sibling[last_file[parent]]) = i;
+      last_file[parent] = i;
+   }
+
+   auto dir_offset = [&](uint32_t index) {
+      return index == NO_INDEX ? ROMFS_ENTRY_EMPTY : static_cast<uint32_t>(tree.dirs[index]->entry_offset);
+   };
+   auto file_offset = [&](uint32_t index) {
+      return index == NO_INDEX ? ROMFS_ENTRY_EMPTY : static_cast<uint32_t>(tree.files[index]->entry_offset);
+   };
+
+   /* Tables, new entries go at the head of their hash chain. The root directory is its own parent. */
+   uint32_t dir_hash_table_entry_count = GetHashTableCount(ctx.num_dirs);
+   uint32_t file_hash_table_entry_count = GetHashTableCount(ctx.num_files);
+   ctx.dir_hash_table_size = 4 * dir_hash_table_entry_count;
+   ctx.file_hash_table_size = 4 * file_hash_table_entry_count;
+   metadata.dir_hash_table.assign(dir_hash_table_entry_count, be_word(ROMFS_ENTRY_EMPTY));
+   metadata.file_hash_table.assign(file_hash_table_entry_count, be_word(ROMFS_ENTRY_EMPTY));
+   metadata.dir_table.assign(ctx.dir_table_size, 0);
+   metadata.file_table.assign(ctx.file_table_size, 0);
+
+   for (uint32_t i = 0; i < num_dirs; i++) {
+      auto const &dir = tree.dirs[i];
+      uint64_t entry = dir->entry_offset;
+      uint32_t parent = dir_offset(tree.dir_parents[i]);
+      std::string_view name = dir->getName();
+      uint32_t bucket = HashName(parent, name) % dir_hash_table_entry_count;
+
+      PutWord(metadata.dir_table, entry + offsetof(romfs_direntry_t, parent), parent);
+      PutWord(metadata.dir_table, entry + offsetof(romfs_direntry_t, sibling), dir_offset(dir_sibling[i]));
+      PutWord(metadata.dir_table, entry + offsetof(romfs_direntry_t, child), dir_offset(dir_child[i]));
+      PutWord(metadata.dir_table, entry + offsetof(romfs_direntry_t, file), file_offset(dir_file[i]));
+      memcpy(&metadata.dir_table[entry + offsetof(romfs_direntry_t, hash)], &metadata.dir_hash_table[bucket], 4);
+      metadata.dir_hash_table[bucket] = be_word(entry);
+      PutWord(metadata.dir_table, entry + offsetof(romfs_direntry_t, name_size), name.size());
+      memcpy(&metadata.dir_table[entry + offsetof(romfs_direntry_t, name)], name.data(), name.size());
+   }
+
+   for (uint32_t i = 0; i < tree.files.size(); i++) {
+      auto const &file = tree.files[i];
+      uint64_t entry = file->entry_offset;
+      std::string_view name = file->getName();
+
+      PutWord(metadata.file_table, entry + offsetof(romfs_fentry_t, parent), dir_offset(tree.file_parents[i]));
+      PutWord(metadata.file_table, entry + offsetof(romfs_fentry_t, sibling), file_offset(file_sibling[i]));
+      PutDword(metadata.file_table, entry + offsetof(romfs_fentry_t, offset), file->offset);
+      PutDword(metadata.file_table, entry + offsetof(romfs_fentry_t, size), file->size);
+      PutWord(metadata.file_table, entry + offsetof(romfs_fentry_t, name_size), name.size());
+      memcpy(&metadata.file_table[entry + offsetof(romfs_fentry_t, name)], name.data(), name.size());
+   }
+
+   for (auto const &file : tree.hashed_files) {
+      uint64_t entry = file->entry_offset;
+      uint32_t bucket = HashName(file->getParent()->entry_offset, file->getName()) % file_hash_table_entry_count;
+      memcpy(&metadata.file_table[entry + offsetof(romfs_fentry_t, hash)], &metadata.file_hash_table[bucket], 4);
+      metadata.file_hash_table[bucket] = be_word(entry);
+   }
+
+   metadata.files = std::move(tree.files);
+}
+
+}
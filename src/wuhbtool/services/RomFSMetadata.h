@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "RomFSStructs.h"
+#include "../entities/DirectoryEntry.h"
+
+namespace romfs {
+
+   /* Where files go in the file partition, the default is tree order with 0x10 alignment. */
+   struct LayoutPolicy {
+      /* Alignment of the files in the archive, counted from the start of the file. */
+      uint64_t alignment = 0x10;
+
+      /* Files smaller than this only get 0x10 alignment, and are placed together. */
+      uint64_t small_file_size = 0;
+
+      /* Paths of the files placed first, in this order, like "/content/data.bin". */
+      std::vector<std::string> access_order;
+
+      bool isDefault() const {
+         return alignment == 0x10 && small_file_size == 0 && access_order.empty();
+      }
+   };
+
+   /* The tables of an archive, already in the byte order they are written in. */
+   struct Metadata {
+      romfs_ctx_t ctx;
+      std::vector<uint32_t> dir_hash_table;
+      std::vector<uint8_t> dir_table;
+      std::vector<uint32_t> file_hash_table;
+      std::vector<uint8_t> file_table;
+
+      /* Every file, in the order of the file table. */
+      std::vector<FileEntry *> files;
+   };
+
+   /*
+    * Flattens the tree under root into arrays once, then computes the table offsets,
+    * the sibling and child links, the hash chains and where every file goes in the
+    * file partition, in linear passes over them. Sets the offset and entry_offset of
+    * every node.
+    */
+   void BuildMetadata(DirectoryEntry *root, const LayoutPolicy &layout, Metadata &metadata);
+
+}
@@ -0,0 +1,404 @@
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include "RomFSReader.h"
+#include "RomFSService.h"
+#include "../utils/filepath.h"
+#include "../utils/progress.h"
+
+namespace romfs {
+
+namespace {
+
+   uint32_t ReadWord(const uint8_t *ptr) {
+      uint32_t value;
+      memcpy(&value, ptr, sizeof(value));
+      return be_word(value);
+   }
+
+   uint64_t ReadDword(const uint8_t *ptr) {
+      uint64_t value;
+      memcpy(&value, ptr, sizeof(value));
+      return be_dword(value);
+   }
+
+   /* Names that can't be created on disk, or would escape the directory they are extracted to. */
+   bool IsValidName(std::string_view name) {
+      if (name.empty() || name == "." || name == "..") {
+         return false;
+      }
+#ifdef _WIN32
+      return name.find_first_of(std::string_view("/\\\0", 3)) == std::string_view::npos;
+#else
+      return name.find_first_of(std::string_view("/\0", 2)) == std::string_view::npos;
+#endif
+   }
+
+   using DirCallback = std::function<void(const std::string &path)>;
+   using FileCallback = std::function<void(const std::string &path, const FileInfo &info)>;
+
+   /*
+    * Calls on_dir for dir and every directory below it, then on_file for each of their
+    * files, parents before children. Paths are relative to dir and start with a "/".
+    * budget is the number of entries the archive can have, so links that loop fail
+    * instead of going on forever, and paths must fit on disk, which limits the depth.
+    */
+   bool WalkDir(const RomFSReader &reader, uint32_t dir, const std::string &path, uint64_t &budget,
+                const DirCallback &on_dir, const FileCallback &on_file) {
+      DirInfo dir_info;
+      if (path.size() >= MAX_OSPATH || !reader.getDir(dir, dir_info)) {
+         return false;
+      }
+      on_dir(path);
+
+      for (uint32_t entry = dir_info.file; entry != ROMFS_ENTRY_EMPTY;) {
+         FileInfo info;
+         if (budget-- == 0 || !reader.getFile(entry, info) || !IsValidName(info.name)) {
+            return false;
+         }
+         on_file(path + "/" + std::string(info.name), info);
+         entry = info.sibling;
+      }
+
+      for (uint32_t entry = dir_info.child; entry != ROMFS_ENTRY_EMPTY;) {
+         DirInfo info;
+         if (budget-- == 0 || !reader.getDir(entry, info) || !IsValidName(info.name)) {
+            return false;
+         }
+         if (!WalkDir(reader, entry, path + "/" + std::string(info.name), budget, on_dir, on_file)) {
+            return false;
+         }
+         entry = info.sibling;
+      }
+
+      return true;
+   }
+
+   void OpenArchive(RomFSReader &reader, const char *archivePath) {
+      if (!reader.open(archivePath)) {
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   const uint8_t *GetFileData(const RomFSReader &reader, const std::string &path, const FileInfo &info) {
+      const uint8_t *data = reader.getFileData(info);
+      if (data == nullptr) {
+         fprintf(stderr, "The data of %s is outside of the archive!\n", path.c_str());
+         exit(EXIT_FAILURE);
+      }
+      return data;
+   }
+
+   void MakeDirectory(const std::string &path) {
+      filepath_t dirpath;
+      filepath_init(&dirpath);
+      filepath_set(&dirpath, path.c_str());
+      if (os_makedir(dirpath.os_path) != 0 && errno != EEXIST) {
+         fprintf(stderr, "Failed to create directory %s!\n", path.c_str());
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   void WriteFile(const std::string &path, const uint8_t *data, uint64_t size) {
+      filepath_t outpath;
+      filepath_init(&outpath);
+      filepath_set(&outpath, path.c_str());
+
+      FILE *f_out = os_fopen(outpath.os_path, OS_MODE_WRITE);
+      if (f_out == nullptr) {
+         fprintf(stderr, "Failed to open %s!\n", path.c_str());
+         exit(EXIT_FAILURE);
+      }
+      if (fwrite(data, 1, size, f_out) != size || fclose(f_out) != 0) {
+         fprintf(stderr, "Failed to write %s!\n", path.c_str());
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   void PrintHashStats(const char *title, const HashStats &stats) {
+      printf("%s: %u entries in %u buckets, %u empty, longest chain %u, %.2f entries read per lookup\n",
+             title, stats.num_entries, stats.num_buckets, stats.num_empty, stats.longest_chain, stats.average_reads);
+   }
+
+}
+
+bool RomFSReader::open(const std::string &path) {
+   if (!archive.open(path)) {
+      fprintf(stderr, "Failed to open %s!\n", path.c_str());
+      return false;
+   }
+
+   romfs_header_t header;
+   if (archive.size() < sizeof(header) || memcmp(archive.data(), "WUHB", 4) != 0) {
+      fprintf(stderr, "%s is not a WUHB archive!\n", path.c_str());
+      return false;
+   }
+   memcpy(&header, archive.data(), sizeof(header));
+
+   uint64_t size = archive.size();
+   auto inside = [size](uint64_t offset, uint64_t length) {
+      return offset <= size && length <= size - offset;
+   };
+
+   uint64_t dir_hash_table_ofs = be_dword(header.dir_hash_table_ofs);
+   uint64_t dir_hash_table_size = be_dword(header.dir_hash_table_size);
+   uint64_t dir_table_ofs = be_dword(header.dir_table_ofs);
+   uint64_t file_hash_table_ofs = be_dword(header.file_hash_table_ofs);
+   uint64_t file_hash_table_size = be_dword(header.file_hash_table_size);
+   uint64_t file_table_ofs = be_dword(header.file_table_ofs);
+   dir_table_size = be_dword(header.dir_table_size);
+   file_table_size = be_dword(header.file_table_size);
+   file_partition_ofs = be_dword(header.file_partition_ofs);
+
+   if (!inside(dir_hash_table_ofs, dir_hash_table_size) || !inside(dir_table_ofs, dir_table_size) ||
+       !inside(file_hash_table_ofs, file_hash_table_size) || !inside(file_table_ofs, file_table_size) ||
+       !inside(file_partition_ofs, 0) || dir_hash_table_size < 4 || file_hash_table_size < 4 ||
+       dir_hash_table_size / 4 > UINT32_MAX || file_hash_table_size / 4 > UINT32_MAX) {
+      fprintf(stderr, "%s has invalid tables!\n", path.c_str());
+      return false;
+   }
+
+   data = reinterpret_cast<const uint8_t *>(archive.data());
+   dir_hash_table = data + dir_hash_table_ofs;
+   dir_buckets = dir_hash_table_size / 4;
+   dir_table = data + dir_table_ofs;
+   file_hash_table = data + file_hash_table_ofs;
+   file_buckets = file_hash_table_size / 4;
+   file_table = data + file_table_ofs;
+   return true;
+}
+
+bool RomFSReader::getDir(uint32_t entry, DirInfo &info) const {
+   if (entry > dir_table_size || dir_table_size - entry < sizeof(romfs_direntry_t)) {
+      return false;
+   }
+
+   const uint8_t *ptr = dir_table + entry;
+   uint32_t name_size = ReadWord(ptr + offsetof(romfs_direntry_t, name_size));
+   if (name_size > dir_table_size - entry - sizeof(romfs_direntry_t)) {
+      return false;
+   }
+
+   info.parent = ReadWord(ptr + offsetof(romfs_direntry_t, parent));
+   info.sibling = ReadWord(ptr + offsetof(romfs_direntry_t, sibling));
+   info.child = ReadWord(ptr + offsetof(romfs_direntry_t, child));
+   info.file = ReadWord(ptr + offsetof(romfs_direntry_t, file));
+   info.hash = ReadWord(ptr + offsetof(romfs_direntry_t, hash));
+   info.name = std::string_view(reinterpret_cast<const char *>(ptr + offsetof(romfs_direntry_t, name)), name_size);
+   return true;
+}
+
+bool RomFSReader::getFile(uint32_t entry, FileInfo &info) const {
+   if (entry > file_table_size || file_table_size - entry < sizeof(romfs_fentry_t)) {
+      return false;
+   }
+
+   const uint8_t *ptr = file_table + entry;
+   uint32_t name_size = ReadWord(ptr + offsetof(romfs_fentry_t, name_size));
+   if (name_size > file_table_size - entry - sizeof(romfs_fentry_t)) {
+      return false;
+   }
+
+   info.parent = ReadWord(ptr + offsetof(romfs_fentry_t, parent));
+   info.sibling = ReadWord(ptr + offsetof(romfs_fentry_t, sibling));
+   info.offset = ReadDword(ptr + offsetof(romfs_fentry_t, offset));
+   info.size = ReadDword(ptr + offsetof(romfs_fentry_t, size));
+   info.hash = ReadWord(ptr + offsetof(romfs_fentry_t, hash));
+   info.name = std::string_view(reinterpret_cast<const char *>(ptr + offsetof(romfs_fentry_t, name)), name_size);
+   return true;
+}
+
+const uint8_t *RomFSReader::getFileData(const FileInfo &info) const {
+   uint64_t available = archive.size() - file_partition_ofs;
+   if (info.offset > available || info.size > available - info.offset) {
+      return nullptr;
+   }
+   return data + file_partition_ofs + info.offset;
+}
+
+uint32_t RomFSReader::findDirChild(uint32_t dir, std::string_view name) const {
+   uint32_t hash = CalcPathHash(dir, reinterpret_cast<const unsigned char *>(name.data()), 0, name.size());
+   uint32_t entry = ReadWord(dir_hash_table + 4 * (hash % dir_buckets));
+
+   /* A chain can't have more entries than the table, unless it loops. */
+   for (uint64_t n = 0; entry != ROMFS_ENTRY_EMPTY && n <= dir_table_size / sizeof(romfs_direntry_t); n++) {
+      DirInfo info;
+      if (!getDir(entry, info)) {
+         break;
+      }
+      if (info.parent == dir && info.name == name) {
+         return entry;
+      }
+      entry = info.hash;
+   }
+   return ROMFS_ENTRY_EMPTY;
+}
+
+uint32_t RomFSReader::findFileChild(uint32_t dir, std::string_view name) const {
+   uint32_t hash = CalcPathHash(dir, reinterpret_cast<const unsigned char *>(name.data()), 0, name.size());
+   uint32_t entry = ReadWord(file_hash_table + 4 * (hash % file_buckets));
+
+   for (uint64_t n = 0; entry != ROMFS_ENTRY_EMPTY && n <= file_table_size / sizeof(romfs_fentry_t); n++) {
+      FileInfo info;
+      if (!getFile(entry, info)) {
+         break;
+      }
+      if (info.parent == dir && info.name == name) {
+         return entry;
+      }
+      entry = info.hash;
+   }
+   return ROMFS_ENTRY_EMPTY;
+}
+
+uint32_t RomFSReader::findDir(std::string_view path) const {
+   uint32_t dir = 0;
+   while (!path.empty() && dir != ROMFS_ENTRY_EMPTY) {
+      size_t end = std::min(path.find('/'), path.size());
+      if (end > 0) {
+         dir = findDirChild(dir, path.substr(0, end));
+      }
+      path.remove_prefix(std::min(end + 1, path.size()));
+   }
+   return dir;
+}
+
+uint32_t RomFSReader::findFile(std::string_view path) const {
+   size_t slash = path.rfind('/');
+   std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+   if (name.empty()) {
+      return ROMFS_ENTRY_EMPTY;
+   }
+
+   uint32_t dir = slash == std::string_view::npos ? 0 : findDir(path.substr(0, slash));
+   return dir == ROMFS_ENTRY_EMPTY ? ROMFS_ENTRY_EMPTY : findFileChild(dir, name);
+}
+
+HashStats RomFSReader::getHashStats(const uint8_t *hash_table, uint32_t num_buckets, bool dirs) const {
+   HashStats stats;
+   stats.num_buckets = num_buckets;
+
+   uint64_t max_length = dirs ? dir_table_size / sizeof(romfs_direntry_t) : file_table_size / sizeof(romfs_fentry_t);
+   uint64_t total_reads = 0;
+   for (uint32_t i = 0; i < num_buckets; i++) {
+      uint32_t length = 0;
+      uint32_t entry = ReadWord(hash_table + 4 * i);
+      while (entry != ROMFS_ENTRY_EMPTY && length <= max_length) {
+         DirInfo dir_info;
+         FileInfo file_info;
+         if (dirs ? !getDir(entry, dir_info) : !getFile(entry, file_info)) {
+            break;
+         }
+         length++;
+         entry = dirs ? dir_info.hash : file_info.hash;
+      }
+
+      /* Finding the n-th entry of a chain reads n entries. */
+      stats.num_entries += length;
+      stats.num_empty += length == 0;
+      stats.longest_chain = std::max(stats.longest_chain, length);
+      total_reads += static_cast<uint64_t>(length) * (length + 1) / 2;
+   }
+
+   if (stats.num_entries) {
+      stats.average_reads = static_cast<double>(total_reads) / stats.num_entries;
+   }
+   return stats;
+}
+
+HashStats RomFSReader::getDirHashStats() const {
+   return getHashStats(dir_hash_table, dir_buckets, true);
+}
+
+HashStats RomFSReader::getFileHashStats() const {
+   return getHashStats(file_hash_table, file_buckets, false);
+}
+
+void ListArchive(const char *archivePath) {
+   RomFSReader reader;
+   OpenArchive(reader, archivePath);
+
+   uint32_t num_files = 0;
+   uint64_t total_size = 0;
+   uint64_t budget = reader.getMaxEntries();
+   auto on_file = [&](const std::string &path, const FileInfo &info) {
+      printf("%12llu  %s\n", static_cast<unsigned long long>(info.size), path.c_str());
+      num_files++;
+      total_size += info.size;
+   };
+   if (!WalkDir(reader, 0, "", budget, [](const std::string &) {}, on_file)) {
+      fprintf(stderr, "%s is corrupt!\n", archivePath);
+      exit(EXIT_FAILURE);
+   }
+
+   printf("%u files, %llu bytes\n", num_files, static_cast<unsigned long long>(total_size));
+   PrintHashStats("Directories", reader.getDirHashStats());
+   PrintHashStats("Files", reader.getFileHashStats());
+}
+
+void ExtractArchive(const char *archivePath, const char *outputDir, std::string_view path) {
+   RomFSReader reader;
+   OpenArchive(reader, archivePath);
+
+   std::string outputPath = outputDir;
+   MakeDirectory(outputPath);
+
+   /* A single file goes right into outputDir. */
+   uint32_t file = path.empty() ? ROMFS_ENTRY_EMPTY : reader.findFile(path);
+   if (file != ROMFS_ENTRY_EMPTY) {
+      FileInfo info;
+      if (!reader.getFile(file, info) || !IsValidName(info.name)) {
+         fprintf(stderr, "%s is corrupt!\n", archivePath);
+         exit(EXIT_FAILURE);
+      }
+      std::string name(info.name);
+      if (progress_show_files()) {
+         printf("Extracting %s...\n", name.c_str());
+      }
+      WriteFile(outputPath + OS_PATH_SEPARATOR + name, GetFileData(reader, name, info), info.size);
+      return;
+   }
+
+   uint32_t dir = reader.findDir(path);
+   if (dir == ROMFS_ENTRY_EMPTY) {
+      fprintf(stderr, "%.*s is not in %s!\n", static_cast<int>(path.size()), path.data(), archivePath);
+      exit(EXIT_FAILURE);
+   }
+
+   uint64_t budget = reader.getMaxEntries();
+   auto on_dir = [&](const std::string &dir_path) {
+      MakeDirectory(outputPath + dir_path);
+   };
+   auto on_file = [&](const std::string &file_path, const FileInfo &info) {
+      if (progress_show_files()) {
+         printf("Extracting %s...\n", file_path.c_str());
+      }
+      WriteFile(outputPath + file_path, GetFileData(reader, file_path, info), info.size);
+   };
+   if (!WalkDir(reader, dir, "", budget, on_dir, on_file)) {
+      fprintf(stderr, "%s is corrupt!\n", archivePath);
+      exit(EXIT_FAILURE);
+   }
+}
+
+void CatFile(const char *archivePath, std::string_view path, FILE *f_out) {
+   RomFSReader reader;
+   OpenArchive(reader, archivePath);
+
+   FileInfo info;
+   uint32_t file = reader.findFile(path);
+   if (file == ROMFS_ENTRY_EMPTY || !reader.getFile(file, info)) {
+      fprintf(stderr, "%.*s is not in %s!\n", static_cast<int>(path.size()), path.data(), archivePath);
+      exit(EXIT_FAILURE);
+   }
+
+   std::string name(path);
+   const uint8_t *data = GetFileData(reader, name, info);
+   if (fwrite(data, 1, info.size, f_out) != info.size || fflush(f_out) != 0) {
+      fprintf(stderr, "Failed to write to output!\n");
+      exit(EXIT_FAILURE);
+   }
+}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "mapped_file.h"
+#include "RomFSStructs.h"
+
+namespace romfs {
+
+   struct DirInfo {
+      uint32_t parent;
+      uint32_t sibling;
+      uint32_t child;
+      uint32_t file;
+      uint32_t hash;
+      std::string_view name;
+   };
+
+   struct FileInfo {
+      uint32_t parent;
+      uint32_t sibling;
+      uint64_t offset;
+      uint64_t size;
+      uint32_t hash;
+      std::string_view name;
+   };
+
+   /* Length of the hash chains of a table, to see how well its entries are spread. */
+   struct HashStats {
+      uint32_t num_entries = 0;
+      uint32_t num_buckets = 0;
+      uint32_t num_empty = 0;
+      uint32_t longest_chain = 0;
+
+      /* Entries read to find each entry of the table, on average. */
+      double average_reads = 0;
+   };
+
+   /*
+    * An archive mapped in memory, which finds paths one component at a time through
+    * its hash tables, the same way the console does, so only the entries on the way
+    * are read. Every offset read from the archive is checked against its size.
+    */
+   class RomFSReader {
+   public:
+      /* Maps the archive, checking that its header and tables are inside of it. */
+      bool open(const std::string &path);
+
+      /* Entries are given by their offset in their table, the root directory is at 0. */
+      bool getDir(uint32_t entry, DirInfo &info) const;
+
+      bool getFile(uint32_t entry, FileInfo &info) const;
+
+      /* Data of a file, or nullptr if it isn't inside the archive. */
+      const uint8_t *getFileData(const FileInfo &info) const;
+
+      /* Entry of the directory or file at path, like "/content/data.bin", or ROMFS_ENTRY_EMPTY. */
+      uint32_t findDir(std::string_view path) const;
+
+      uint32_t findFile(std::string_view path) const;
+
+      /* Most entries the tables can hold, to stop following links that loop. */
+      uint64_t getMaxEntries() const {
+         return dir_table_size / sizeof(romfs_direntry_t) + file_table_size / sizeof(romfs_fentry_t);
+      }
+
+      HashStats getDirHashStats() const;
+
+      HashStats getFileHashStats() const;
+
+   private:
+      /* Entry of the child of dir called name, in one of the two tables. */
+      uint32_t findDirChild(uint32_t dir, std::string_view name) const;
+
+      uint32_t findFileChild(uint32_t dir, std::string_view name) const;
+
+      HashStats getHashStats(const uint8_t *hash_table, uint32_t num_buckets, bool dirs) const;
+
+      MappedFile archive;
+      const uint8_t *data = nullptr;
+      uint64_t file_partition_ofs = 0;
+
+      const uint8_t *dir_hash_table = nullptr;
+      uint32_t dir_buckets = 0;
+      const uint8_t *dir_table = nullptr;
+      uint64_t dir_table_size = 0;
+
+      const uint8_t *file_hash_table = nullptr;
+      uint32_t file_buckets = 0;
+      const uint8_t *file_table = nullptr;
+      uint64_t file_table_size = 0;
+   };
+
+   /* Prints every file of the archive with its size, then how well its hash tables spread the entries. */
+   void ListArchive(const char *archivePath);
+
+   /* Extracts the file or directory at path, everything when it is empty, into outputDir. */
+   void ExtractArchive(const char *archivePath, const char *outputDir, std::string_view path);
+
+   /* Writes the data of the file at path to f_out. */
+   void CatFile(const char *archivePath, std::string_view path, FILE *f_out);
+
+}
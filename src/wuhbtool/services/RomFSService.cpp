@@ -1,7 +1,16 @@
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "hash.h"
+#include "mapped_file.h"
+#include "parallel.h"
 #include "RomFSService.h"
+#include "../utils/progress.h"
 #include "../utils/utils.h"
 #include "../entities/OSFileEntry.h"
 
@@ -17,143 +26,353 @@ namespace {
       }
    }
 
-   uint32_t GetHashTableCount(uint32_t num_entries) {
-      if (num_entries < 3) {
-         return 3;
-      } else if (num_entries < 19) {
-         return num_entries | 1;
+   struct PendingFolder {
+      DirectoryEntry *entry;
+      filepath_t path;
+   };
+
+   /*
+    * Adds the entries of the directory at dirpath to dir, sorted by name, and
+    * appends its subdirectories to subfolders, to be scanned next.
+    */
+   void ScanFolder(DirectoryEntry *dir, filepath_t &dirpath, NodeArena &arena, std::vector<PendingFolder> &subfolders) {
+      osdirent_t *cur_dirent = nullptr;
+      os_stat64_t cur_stats;
+
+      osdir_t *osdir = nullptr;
+      if ((osdir = os_opendir(dirpath.os_path)) == nullptr) {
+         fprintf(stderr, "Failed to open directory %s!\n", dirpath.char_path);
+         exit(EXIT_FAILURE);
+      }
+
+#ifndef _WIN32
+      int dir_fd = dirfd(osdir);
+#endif
+
+      std::vector<std::pair<std::string, NodeEntry *>> children;
+      while ((cur_dirent = os_readdir(osdir))) {
+#ifdef _WIN32
+         char name[MAX_OSPATH] = {};
+         os_strncpy_to_char(name, cur_dirent->d_name, MAX_OSPATH - 1);
+#else
+         const char *name = cur_dirent->d_name;
+#endif
+
+         if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            /* Special case . and .. */
+            continue;
+         }
+
+         /* Directories need no stat when readdir gives their type, files still need their size. */
+         bool is_dir = false;
+#ifdef DT_DIR
+         is_dir = cur_dirent->d_type == DT_DIR;
+#endif
+         if (!is_dir) {
+#ifdef _WIN32
+            filepath_t cur_sum_path;
+            filepath_copy(&cur_sum_path, &dirpath);
+            filepath_os_append(&cur_sum_path, cur_dirent->d_name);
+            int res = os_stat(cur_sum_path.os_path, &cur_stats);
+#else
+            int res = fstatat(dir_fd, cur_dirent->d_name, &cur_stats, 0);
+#endif
+            if (res == -1) {
+               fprintf(stderr, "Failed to stat %s" OS_PATH_SEPARATOR "%s\n", dirpath.char_path, name);
+               exit(EXIT_FAILURE);
+            }
+            is_dir = (cur_stats.st_mode & S_IFMT) == S_IFDIR;
+         }
+
+         /* Only directories keep their full path, until they are scanned; files find it through their parents. */
+         if (is_dir) {
+            auto directoryEntry = arena.newDirectory(name);
+            children.emplace_back(name, directoryEntry);
+            subfolders.push_back({directoryEntry, dirpath});
+            filepath_os_append(&subfolders.back().path, cur_dirent->d_name);
+         } else if ((cur_stats.st_mode & S_IFMT) == S_IFREG) {
+            auto fileEntry = arena.newFile(name);
+            fileEntry->size = cur_stats.st_size;
+            children.emplace_back(name, fileEntry);
+         } else {
+            fprintf(stderr, "Invalid FS object type for %s!\n", name);
+            exit(EXIT_FAILURE);
+         }
       }
-      uint32_t count = num_entries;
-      while (count % 2 == 0 || count % 3 == 0 || count % 5 == 0 || count % 7 == 0 || count % 11 == 0 || count % 13 == 0 || count % 17 == 0) {
-         count++;
+
+      os_closedir(osdir);
+
+      /* readdir order depends on the file system, sort to always build the same archive. */
+      std::sort(children.begin(), children.end(), [](const auto &a, const auto &b) {
+         return a.first < b.first;
+      });
+      for (auto const &e : children) {
+         dir->addChild(e.second);
       }
-      return count;
    }
 
-}
+   /* Maps the data of file, which must still have the size it had when scanned. */
+   void MapFile(OSFileEntry *file, MappedFile &mapped) {
+      std::string path = file->getOSPath();
+      if (!mapped.open(path) || mapped.size() != file->size) {
+         fprintf(stderr, "Failed to read %s!\n", path.c_str());
+         exit(EXIT_FAILURE);
+      }
+   }
 
-uint32_t CalcPathHash(uint32_t parent, const unsigned char *path, uint32_t start, size_t path_len) {
-   uint32_t hash = parent ^ 123456789;
-   for (uint32_t i = 0; i < path_len; i++) {
-      hash = (hash >> 5) | (hash << 27);
-      hash ^= NormalizeChar(path[start + i]);
+   bool SameContents(OSFileEntry *a, OSFileEntry *b) {
+      MappedFile mapped_a, mapped_b;
+      MapFile(a, mapped_a);
+      MapFile(b, mapped_b);
+      return memcmp(mapped_a.data(), mapped_b.data(), a->size) == 0;
    }
 
-   return hash;
-}
+   /* Whether the next size bytes of f_in are the same as expected. */
+   bool MatchesArchive(FILE *f_in, const void *expected, uint64_t size) {
+      std::vector<uint8_t> current(size);
+      if (fread(current.data(), 1, size, f_in) != size) {
+         return false;
+      }
+      return memcmp(current.data(), expected, size) == 0;
+   }
 
-DirectoryEntry *CreateFolderFromPath(filepath_t &dirpath, const char *name) {
-   osdirent_t *cur_dirent = nullptr;
-   filepath_t cur_path;
-   filepath_t cur_sum_path;
-   os_stat64_t cur_stats;
+   /* Sorts the files to write by offset, without duplicates, which are written by the file they share their data with. */
+   void SortByOffset(std::vector<FileEntry *> &files) {
+      std::erase_if(files, [](FileEntry *file) {
+         return file->duplicateOf != nullptr;
+      });
 
-   auto *curDir = new DirectoryEntry(name);
+      std::stable_sort(files.begin(), files.end(), [](const FileEntry *a, const FileEntry *b) {
+         return a->offset < b->offset;
+      });
+   }
 
-   osdir_t *dir = nullptr;
-   if ((dir = os_opendir(dirpath.os_path)) == nullptr) {
-      fprintf(stderr, "Failed to open directory %s!\n", dirpath.char_path);
-      exit(EXIT_FAILURE);
+   void StartProgress(const std::vector<FileEntry *> &files) {
+      uint64_t total_size = 0;
+      for (auto const &file : files) {
+         total_size += file->size;
+      }
+      progress_start(files.size(), total_size);
+   }
+
+   /* Every offset is known, so files can be written in any order, by several threads. */
+   void WriteFiles(std::vector<FileEntry *> &files, FILE *f_out, off_t base_offset, unsigned jobs) {
+      /* The files are written at their offsets without going through the stdio buffer. */
+      if (fflush(f_out) != 0) {
+         fprintf(stderr, "Failed to write to output!\n");
+         exit(EXIT_FAILURE);
+      }
+
+      SortByOffset(files);
+      StartProgress(files);
+      parallel_for(files.size(), jobs, [&](size_t i) {
+         files[i]->write(f_out, base_offset);
+         progress_file_done(files[i]->size);
+      });
+      progress_finish();
+   }
+
+   /* Writes size zero bytes at the current position of f_out. */
+   void WritePadding(FILE *f_out, uint64_t size) {
+      static const uint8_t zeroes[0x1000] = {};
+      while (size > 0) {
+         uint64_t chunk = std::min<uint64_t>(size, sizeof(zeroes));
+         if (fwrite(zeroes, 1, chunk, f_out) != chunk) {
+            fprintf(stderr, "Failed to write to output!\n");
+            exit(EXIT_FAILURE);
+         }
+         size -= chunk;
+      }
    }
 
-   while ((cur_dirent = os_readdir(dir))) {
-      filepath_init(&cur_path);
-      filepath_set(&cur_path, "");
-      filepath_os_set(&cur_path, cur_dirent->d_name);
+   /*
+    * Writes the files one after the other in offset order, padding included, from
+    * position in the archive, so f_out never seeks. Returns the position after the
+    * last file.
+    */
+   uint64_t StreamFiles(std::vector<FileEntry *> &files, FILE *f_out, uint64_t position) {
+      SortByOffset(files);
+      StartProgress(files);
+      for (auto const &file : files) {
+         uint64_t file_ofs = ROMFS_FILEPARTITION_OFS + file->offset;
+         WritePadding(f_out, file_ofs - position);
+         file->writeStream(f_out);
+         position = file_ofs + file->size;
+         progress_file_done(file->size);
+      }
+      progress_finish();
+      return position;
+   }
 
-      if (strcmp(cur_path.char_path, ".") == 0 || strcmp(cur_path.char_path, "..") == 0) {
-         /* Special case . and .. */
-         continue;
+   /*
+    * Rewrites the out of date files of an existing archive in place, when its
+    * header and tables are the same as the ones in metadata. Returns false
+    * when the archive must be rebuilt instead.
+    */
+   bool UpdateArchive(filepath_t &outpath, const romfs_header_t &header,
+                      const Metadata &metadata, uint64_t dir_hash_table_ofs, unsigned jobs) {
+      const romfs_ctx_t &romfs_ctx = metadata.ctx;
+      os_stat64_t archive_stats;
+      if (os_stat(outpath.os_path, &archive_stats) == -1) {
+         progress_log("%s doesn't exist, creating it...\n", outpath.char_path);
+         return false;
       }
 
-      filepath_copy(&cur_sum_path, &dirpath);
-      filepath_os_append(&cur_sum_path, cur_dirent->d_name);
+      uint64_t archive_size = dir_hash_table_ofs + romfs_ctx.dir_hash_table_size + romfs_ctx.dir_table_size +
+                              romfs_ctx.file_hash_table_size + romfs_ctx.file_table_size;
+      if (static_cast<uint64_t>(archive_stats.st_size) != archive_size) {
+         progress_log("Archive size changed, rebuilding %s...\n", outpath.char_path);
+         return false;
+      }
 
-      if (os_stat(cur_sum_path.os_path, &cur_stats) == -1) {
-         fprintf(stderr, "Failed to stat %s\n", cur_sum_path.char_path);
+      FILE *f_archive = os_fopen(outpath.os_path, OS_MODE_EDIT);
+      if (f_archive == nullptr) {
+         fprintf(stderr, "Failed to open %s!\n", outpath.char_path);
          exit(EXIT_FAILURE);
       }
 
-      if ((cur_stats.st_mode & S_IFMT) == S_IFDIR) {
-         auto directoryEntry = CreateFolderFromPath(cur_sum_path, cur_path.char_path);
-         curDir->addChild(directoryEntry);
-      } else if ((cur_stats.st_mode & S_IFMT) == S_IFREG) {
-         auto fileEntry = new OSFileEntry(cur_sum_path, cur_path.char_path);
-         fileEntry->size = cur_stats.st_size;
-         curDir->addChild(fileEntry);
-      } else {
-         fprintf(stderr, "Invalid FS object type for %s!\n", cur_path.char_path);
+      progress_log("Comparing metadata...\n");
+      bool same_layout = MatchesArchive(f_archive, &header, sizeof(header)) &&
+                         fseeko64(f_archive, dir_hash_table_ofs, SEEK_SET) == 0 &&
+                         MatchesArchive(f_archive, metadata.dir_hash_table.data(), romfs_ctx.dir_hash_table_size) &&
+                         MatchesArchive(f_archive, metadata.dir_table.data(), romfs_ctx.dir_table_size) &&
+                         MatchesArchive(f_archive, metadata.file_hash_table.data(), romfs_ctx.file_hash_table_size) &&
+                         MatchesArchive(f_archive, metadata.file_table.data(), romfs_ctx.file_table_size);
+      if (!same_layout) {
+         progress_log("Layout changed, rebuilding %s...\n", outpath.char_path);
+         fclose(f_archive);
+         return false;
+      }
+
+      /* Every file is compared with its copy in the archive, so nothing depends on modification times. */
+      MappedFile archive;
+      if (!archive.open(outpath.char_path) || archive.size() != archive_size) {
+         progress_log("Failed to read %s, rebuilding it...\n", outpath.char_path);
+         fclose(f_archive);
+         return false;
+      }
+
+      progress_log("Comparing files...\n");
+      auto archive_data = reinterpret_cast<const uint8_t *>(archive.data()) + ROMFS_FILEPARTITION_OFS;
+      std::vector<uint8_t> stale(metadata.files.size());
+      parallel_for(metadata.files.size(), jobs, [&](size_t i) {
+         FileEntry *file = metadata.files[i];
+         stale[i] = !file->duplicateOf && file->needsUpdate(archive_data + file->offset);
+      });
+      archive.close();
+
+      std::vector<FileEntry *> files;
+      for (size_t i = 0; i < metadata.files.size(); i++) {
+         if (stale[i]) {
+            files.push_back(metadata.files[i]);
+         }
+      }
+
+      progress_log("Updating %zu files...\n", files.size());
+      WriteFiles(files, f_archive, 0, jobs);
+
+      if (fclose(f_archive) != 0) {
+         fprintf(stderr, "Failed to write to output!\n");
          exit(EXIT_FAILURE);
       }
+      return true;
    }
 
-   os_closedir(dir);
-   return curDir;
 }
 
-void CreateArchive(DirectoryEntry *root, const char *outputFilePath) {
-   romfs_ctx_t romfs_ctx;
-   memset(&romfs_ctx, 0, sizeof(romfs_ctx));
+uint32_t CalcPathHash(uint32_t parent, const unsigned char *path, uint32_t start, size_t path_len) {
+   uint32_t hash = parent ^ 123456789;
+   for (uint32_t i = 0; i < path_len; i++) {
+      hash = (hash >> 5) | (hash << 27);
+      hash ^= NormalizeChar(path[start + i]);
+   }
 
-   romfs_ctx.dir_table_size = 0x18; /* Root directory. */
-   romfs_ctx.num_dirs = 1;
+   return hash;
+}
 
-   root->fillRomFSInformation(&romfs_ctx);
+DirectoryEntry *CreateFolderFromPath(filepath_t &dirpath, const char *name, unsigned jobs, NodeArena &arena) {
+   auto *root = arena.newDirectory(name);
+   root->setOSPath(dirpath.char_path);
+
+   /* Scan one level of the tree at a time, each of its directories on any thread. */
+   std::vector<PendingFolder> level;
+   level.push_back({root, dirpath});
+   while (!level.empty()) {
+      std::vector<std::vector<PendingFolder>> found(level.size());
+      parallel_for(level.size(), jobs, [&](size_t i) {
+         ScanFolder(level[i].entry, level[i].path, arena, found[i]);
+      });
+
+      std::vector<PendingFolder> next;
+      for (auto &subfolders : found) {
+         next.insert(next.end(), subfolders.begin(), subfolders.end());
+      }
+      level = std::move(next);
+   }
 
-   uint32_t dir_hash_table_entry_count = GetHashTableCount(romfs_ctx.num_dirs);
-   uint32_t file_hash_table_entry_count = GetHashTableCount(romfs_ctx.num_files);
-   romfs_ctx.dir_hash_table_size = 4 * dir_hash_table_entry_count;
-   romfs_ctx.file_hash_table_size = 4 * file_hash_table_entry_count;
+   return root;
+}
 
-   auto dir_hash_table = static_cast<uint32_t *>(malloc(romfs_ctx.dir_hash_table_size));
-   if (dir_hash_table == nullptr) {
-      fprintf(stderr, "Failed to allocate directory hash table!\n");
-      exit(EXIT_FAILURE);
-   }
+void DeduplicateFiles(DirectoryEntry *root, unsigned jobs) {
+   std::vector<FileEntry *> files;
+   root->collectFiles(files);
 
-   for (uint32_t i = 0; i < dir_hash_table_entry_count; i++) {
-      dir_hash_table[i] = be_word(ROMFS_ENTRY_EMPTY);
+   /* Only files of the same size can be identical, so only those are hashed. */
+   std::map<uint64_t, uint32_t> size_counts;
+   for (auto const &file : files) {
+      size_counts[file->size]++;
    }
 
-   auto file_hash_table = static_cast<uint32_t *>(malloc(romfs_ctx.file_hash_table_size));
-   if (file_hash_table == nullptr) {
-      fprintf(stderr, "Failed to allocate file hash table!\n");
-      exit(EXIT_FAILURE);
+   std::vector<OSFileEntry *> candidates;
+   for (auto const &file : files) {
+      auto osFile = dynamic_cast<OSFileEntry *>(file);
+      if (osFile && osFile->size && size_counts[osFile->size] > 1) {
+         candidates.push_back(osFile);
+      }
    }
 
-   for (uint32_t i = 0; i < file_hash_table_entry_count; i++) {
-      file_hash_table[i] = be_word(ROMFS_ENTRY_EMPTY);
-   }
+   progress_log("Hashing %zu files...\n", candidates.size());
+   std::vector<uint64_t> hashes(candidates.size());
+   parallel_for(candidates.size(), jobs, [&](size_t i) {
+      MappedFile mapped;
+      MapFile(candidates[i], mapped);
+      hashes[i] = hash64(mapped.data(), mapped.size());
+   });
+
+   /* Candidates are in layout order, so the first of identical files keeps its data. */
+   std::map<std::pair<uint64_t, uint64_t>, std::vector<OSFileEntry *>> originals;
+   uint32_t num_duplicates = 0;
+   uint64_t saved_size = 0;
+   for (size_t i = 0; i < candidates.size(); i++) {
+      auto file = candidates[i];
+      auto &same_hash = originals[{file->size, hashes[i]}];
+      for (auto const &original : same_hash) {
+         if (SameContents(original, file)) {
+            file->duplicateOf = original;
+            break;
+         }
+      }
 
-   auto dir_table = static_cast<romfs_direntry_t *>(calloc(1, romfs_ctx.dir_table_size));
-   if (dir_table == nullptr) {
-      fprintf(stderr, "Failed to allocate directory table!\n");
-      exit(EXIT_FAILURE);
+      if (file->duplicateOf) {
+         num_duplicates++;
+         saved_size += file->size;
+      } else {
+         same_hash.push_back(file);
+      }
    }
 
-   auto file_table = static_cast<romfs_fentry_t *>(calloc(1, romfs_ctx.file_table_size));
-   if (file_table == nullptr) {
-      fprintf(stderr, "Failed to allocate file table!\n");
-      exit(EXIT_FAILURE);
-   }
+   progress_log("Found %u duplicate files, saving %llu bytes\n", num_duplicates, static_cast<unsigned long long>(saved_size));
+}
 
-   romfs_infos_t infos;
-   infos.file_table = file_table;
-   infos.dir_table = dir_table;
-   infos.dir_hash_table = dir_hash_table;
-   infos.file_hash_table = file_hash_table;
-   infos.dir_hash_table_entry_count = dir_hash_table_entry_count;
-   infos.file_hash_table_entry_count = file_hash_table_entry_count;
-
-   printf("Calculating metadata...\n");
-   uint32_t entry_offset = 0;
-   root->calculateDirOffsets(&romfs_ctx, &entry_offset);
-   entry_offset = 0;
-   root->calculateFileOffsets(&romfs_ctx, &entry_offset);
-   printf("Updating sibling and child entries...\n");
-   root->updateSiblingAndChildEntries();
-   printf("Populating data...\n");
-   root->populate(&infos);
+void CreateArchive(DirectoryEntry *root, const char *outputFilePath, unsigned jobs, bool update,
+                   const LayoutPolicy &layout, FILE *f_stream) {
+   progress_log("Calculating metadata...\n");
+   Metadata metadata;
+   {
+      ProgressTimer timer("Metadata");
+      BuildMetadata(root, layout, metadata);
+   }
+   const romfs_ctx_t &romfs_ctx = metadata.ctx;
 
    romfs_header_t header;
    memset(&header, 0, sizeof(header));
@@ -181,55 +400,75 @@ void CreateArchive(DirectoryEntry *root, const char *outputFilePath) {
    filepath_init(&outpath);
    filepath_set(&outpath, outputFilePath);
 
+   if (update && f_stream) {
+      progress_log("Can't update a stream, writing all of it...\n");
+   } else if (update) {
+      ProgressTimer timer("Update");
+      if (UpdateArchive(outpath, header, metadata, dir_hash_table_ofs, jobs)) {
+         return;
+      }
+   }
+
+   ProgressTimer timer("Write");
+
    off_t base_offset = 0;
-   FILE *f_out = nullptr;
+   FILE *f_out = f_stream;
 
-   if ((f_out = os_fopen(outpath.os_path, OS_MODE_WRITE)) == NULL) {
+   if (f_out == nullptr && (f_out = os_fopen(outpath.os_path, OS_MODE_WRITE)) == NULL) {
       fprintf(stderr, "Failed to open %s!\n", outpath.char_path);
       exit(EXIT_FAILURE);
    }
 
-   printf("Writing header...\n");
-   if(fseeko64(f_out, base_offset, SEEK_SET) != 0){
+   /* Pipes and other outputs that can't seek get everything in offset order. */
+   os_stat64_t out_stats;
+   bool streaming = f_stream || (os_fstat(fileno(f_out), &out_stats) == 0 && (out_stats.st_mode & S_IFMT) != S_IFREG);
+
+   progress_log("Writing header...\n");
+   if(!streaming && fseeko64(f_out, base_offset, SEEK_SET) != 0){
       fprintf(stderr, "Failed to seek!\n");
       exit(EXIT_FAILURE);
    }
    fwrite(&header, 1, sizeof(header), f_out);
 
-   root->write(f_out, base_offset);
+   std::vector<FileEntry *> files = metadata.files;
+   if (streaming) {
+      uint64_t position = StreamFiles(files, f_out, sizeof(header));
+      WritePadding(f_out, dir_hash_table_ofs - position);
+   } else {
+      WriteFiles(files, f_out, base_offset, jobs);
+   }
 
-   printf("Writing dir_hash_table...\n");
-   if(fseeko64(f_out, base_offset + dir_hash_table_ofs, SEEK_SET) != 0){
+   progress_log("Writing dir_hash_table...\n");
+   if(!streaming && fseeko64(f_out, base_offset + dir_hash_table_ofs, SEEK_SET) != 0){
       fprintf(stderr, "Failed to seek!\n");
       exit(EXIT_FAILURE);
    }
-   if (fwrite(dir_hash_table, 1, romfs_ctx.dir_hash_table_size, f_out) != romfs_ctx.dir_hash_table_size) {
+   if (fwrite(metadata.dir_hash_table.data(), 1, romfs_ctx.dir_hash_table_size, f_out) != romfs_ctx.dir_hash_table_size) {
       fprintf(stderr, "Failed to write dir hash table!\n");
       exit(EXIT_FAILURE);
    }
-   free(dir_hash_table);
 
-   printf("Writing dir_table...\n");
-   if (fwrite(dir_table, 1, romfs_ctx.dir_table_size, f_out) != romfs_ctx.dir_table_size) {
+   progress_log("Writing dir_table...\n");
+   if (fwrite(metadata.dir_table.data(), 1, romfs_ctx.dir_table_size, f_out) != romfs_ctx.dir_table_size) {
       fprintf(stderr, "Failed to write dir table!\n");
       exit(EXIT_FAILURE);
    }
-   free(dir_table);
 
-   printf("Writing file_hash_table...\n");
-   if (fwrite(file_hash_table, 1, romfs_ctx.file_hash_table_size, f_out) != romfs_ctx.file_hash_table_size) {
+   progress_log("Writing file_hash_table...\n");
+   if (fwrite(metadata.file_hash_table.data(), 1, romfs_ctx.file_hash_table_size, f_out) != romfs_ctx.file_hash_table_size) {
       fprintf(stderr, "Failed to write file hash table!\n");
       exit(EXIT_FAILURE);
    }
-   free(file_hash_table);
 
-   printf("Writing file_table...\n");
-   if (fwrite(file_table, 1, romfs_ctx.file_table_size, f_out) != romfs_ctx.file_table_size) {
+   progress_log("Writing file_table...\n");
+   if (fwrite(metadata.file_table.data(), 1, romfs_ctx.file_table_size, f_out) != romfs_ctx.file_table_size) {
       fprintf(stderr, "Failed to write file table!\n");
       exit(EXIT_FAILURE);
    }
-   free(file_table);
-   fclose(f_out);
+   if (fclose(f_out) != 0) {
+      fprintf(stderr, "Failed to write to output!\n");
+      exit(EXIT_FAILURE);
+   }
 }
 
 }
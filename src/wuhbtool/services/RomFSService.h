@@ -1,8 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <string>
+#include <vector>
+#include "RomFSMetadata.h"
 #include "RomFSStructs.h"
 #include "../entities/DirectoryEntry.h"
+#include "../entities/NodeArena.h"
 
 namespace romfs {
 
@@ -15,7 +19,28 @@ namespace romfs {
    }
 
    uint32_t CalcPathHash(uint32_t parent, const unsigned char *path, uint32_t start, size_t path_len);
-   DirectoryEntry *CreateFolderFromPath(filepath_t &dirpath, const char *name);
-   void CreateArchive(DirectoryEntry *root, const char *outputFilePath);
+
+   /*
+    * Scans the tree at dirpath, up to jobs directories at the same time, sorting the
+    * children by name. Its nodes are allocated in arena.
+    */
+   DirectoryEntry *CreateFolderFromPath(filepath_t &dirpath, const char *name, unsigned jobs, NodeArena &arena);
+   
+   /*
+    * Points every content file at the first identical file laid out before it, so
+    * its data is only stored once. Hashes up to jobs files at the same time.
+    */
+   void DeduplicateFiles(DirectoryEntry *root, unsigned jobs);
+
+   /*
+    * Writes the archive, copying up to jobs files at the same time. With update, an
+    * existing archive with the same layout only has its out of date files rewritten.
+    * Files are placed in the file partition following layout.
+    *
+    * Outputs that can't seek, like pipes, and f_stream when given instead of the
+    * output path, are written strictly in offset order, one file after the other.
+    */
+   void CreateArchive(DirectoryEntry *root, const char *outputFilePath, unsigned jobs, bool update,
+                      const LayoutPolicy &layout, FILE *f_stream = nullptr);
 
 }
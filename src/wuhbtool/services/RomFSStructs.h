@@ -71,16 +71,5 @@ typedef struct {
     char name[];
 } romfs_fentry_t;
 
-typedef struct romfs_infos {
-    uint32_t * dir_hash_table;
-    uint32_t * file_hash_table;
-
-    romfs_direntry_t * dir_table;
-    romfs_fentry_t * file_table;
-
-    uint32_t file_hash_table_entry_count;
-    uint32_t dir_hash_table_entry_count;
-} romfs_infos_t;
-
 #define ROMFS_ENTRY_EMPTY 0xFFFFFFFF
 #define ROMFS_FILEPARTITION_OFS 0x200
@@ -1,5 +1,14 @@
 #include "TgaGzService.h"
 #include "../entities/BufferFileEntry.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <system_error>
 #include <vector>
 #include <zlib.h>
 #include <stdlib.h>
@@ -7,11 +16,24 @@
 
 namespace {
 
+   /* Bump when the conversion below changes, so cached entries made the old way aren't used. */
+   constexpr unsigned TGA_CONVERSION_VERSION = 1;
+
+   /*
+    * FreeImage doesn't document its plugins as thread safe, so only one image at a
+    * time goes through it. Reading the cache, compressing and writing it still run
+    * in parallel.
+    */
+   std::mutex freeimage_mutex;
+
    struct FiMemoryFile {
       std::vector<uint8_t> data;
       std::size_t pos;
 
-      FiMemoryFile() : data{}, pos{} { }
+      /* Reserving the expected size keeps writes from reallocating. */
+      explicit FiMemoryFile(std::size_t capacity) : data{}, pos{} {
+         data.reserve(capacity);
+      }
 
       long getSize() {
          return pos > data.size() ? pos : data.size();
@@ -91,68 +113,154 @@ namespace {
    };
 
    std::vector<uint8_t> gzCompress(const void* data, size_t size) {
-      std::vector<uint8_t> buffer;
-      uint8_t chunk[16*1024];
-
       z_stream z = {};
       deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, MAX_WBITS | 16, 8, Z_DEFAULT_STRATEGY);
 
+      /* The bound holds all of the output, so a single call finishes the stream. */
+      std::vector<uint8_t> buffer(deflateBound(&z, size));
       z.avail_in = size;
       z.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+      z.avail_out = buffer.size();
+      z.next_out = buffer.data();
+
+      int ret = deflate(&z, Z_FINISH);
+      if (ret != Z_STREAM_END) {
+         deflateEnd(&z);
+         fprintf(stderr, "Zlib compression error\n");
+         exit(EXIT_FAILURE);
+      }
 
-      do {
-         z.avail_out = sizeof(chunk);
-         z.next_out = static_cast<Bytef*>(chunk);
-
-         int ret = deflate(&z, Z_FINISH);
-         if (ret == Z_STREAM_ERROR) {
-            deflateEnd(&z);
-            fprintf(stderr, "Zlib compression error\n");
-            exit(EXIT_FAILURE);
-         }
-
-         buffer.insert(buffer.end(), chunk, static_cast<uint8_t*>(z.next_out));
-      } while (z.avail_out == 0);
-
+      buffer.resize(z.total_out);
       deflateEnd(&z);
       return buffer;
    }
 
-}
+   /*
+    * Names the cache entry of an image after its contents and the conversion,
+    * including its version and the one of FreeImage.
+    */
+   std::filesystem::path cachePath(const std::string &cacheDir, const char* inputFile, unsigned width, unsigned height, unsigned bpp) {
+      MappedFile input;
+      if (!input.open(inputFile)) {
+         return {};
+      }
 
-FileEntry* createTgaGzFileEntry(const char* inputFile, unsigned width, unsigned height, unsigned bpp, const char* filename) {
-   FREE_IMAGE_FORMAT fif = FreeImage_GetFIFFromFilename(inputFile);
-   if (fif == FIF_UNKNOWN || !FreeImage_FIFSupportsReading(fif)) {
-      fprintf(stderr, "Unknown or unsupported image format: %s\n", inputFile);
-      return nullptr;
+      char name[96];
+      snprintf(name, sizeof(name), "%016llx-%ux%ux%u-v%u-fi%s.tga.gz",
+               static_cast<unsigned long long>(hash64(input.data(), input.size())), width, height, bpp,
+               TGA_CONVERSION_VERSION, FreeImage_GetVersion());
+      return std::filesystem::path(cacheDir) / name;
    }
 
-   FIBITMAP* bmp = FreeImage_Load(fif, inputFile, 0);
+   bool loadCached(const std::filesystem::path &entry, std::vector<uint8_t> &data) {
+      std::ifstream in(entry, std::ifstream::binary);
+      if (!in.is_open()) {
+         return false;
+      }
 
-   if (bmp && (FreeImage_GetImageType(bmp) != FIT_BITMAP || FreeImage_GetBPP(bmp) != bpp)) {
-      FIBITMAP* newbmp = bpp == 24 ? FreeImage_ConvertTo24Bits(bmp) : FreeImage_ConvertTo32Bits(bmp);
-      FreeImage_Unload(bmp);
-      bmp = newbmp;
+      data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+      /* Anything but a gzip stream is a damaged entry. */
+      return data.size() > 18 && data[0] == 0x1f && data[1] == 0x8b;
    }
 
-   if (bmp && (FreeImage_GetWidth(bmp) != width || FreeImage_GetHeight(bmp) != height)) {
-      fprintf(stderr, "Warning: Image %s has incorrect size (expected %dx%d), resizing...\n", inputFile, width, height);
-      FIBITMAP* newbmp = FreeImage_Rescale(bmp, width, height, FILTER_BILINEAR);
+   /* Written to a unique name first and renamed, so other builds never see a partial entry. */
+   void storeCached(const std::filesystem::path &entry, const std::vector<uint8_t> &data) {
+      std::error_code ec;
+      std::filesystem::create_directories(entry.parent_path(), ec);
+
+      auto tmp = entry;
+      char suffix[32];
+      snprintf(suffix, sizeof(suffix), ".%08x.tmp", std::random_device{}());
+      tmp += suffix;
+
+      bool written;
+      {
+         std::ofstream out(tmp, std::ofstream::binary);
+         out.write(reinterpret_cast<const char *>(data.data()), data.size());
+         written = static_cast<bool>(out.flush());
+      }
+
+      if (written) {
+         std::filesystem::rename(tmp, entry, ec);
+      }
+      if (!written || ec) {
+         std::filesystem::remove(tmp, ec);
+         fprintf(stderr, "Warning: Could not write cache entry %s\n", entry.string().c_str());
+      }
+   }
+
+   /* Loads, converts and resizes an image, then saves it as an uncompressed TGA to tga. */
+   bool convertToTga(const char* inputFile, unsigned width, unsigned height, unsigned bpp, FiMemoryFile &tga) {
+      FREE_IMAGE_FORMAT fif = FreeImage_GetFIFFromFilename(inputFile);
+      if (fif == FIF_UNKNOWN || !FreeImage_FIFSupportsReading(fif)) {
+         fprintf(stderr, "Unknown or unsupported image format: %s\n", inputFile);
+         return false;
+      }
+
+      FIBITMAP* bmp = FreeImage_Load(fif, inputFile, 0);
+
+      if (bmp && (FreeImage_GetImageType(bmp) != FIT_BITMAP || FreeImage_GetBPP(bmp) != bpp)) {
+         FIBITMAP* newbmp = bpp == 24 ? FreeImage_ConvertTo24Bits(bmp) : FreeImage_ConvertTo32Bits(bmp);
+         FreeImage_Unload(bmp);
+         bmp = newbmp;
+      }
+
+      if (bmp && (FreeImage_GetWidth(bmp) != width || FreeImage_GetHeight(bmp) != height)) {
+         fprintf(stderr, "Warning: Image %s has incorrect size (expected %dx%d), resizing...\n", inputFile, width, height);
+         FIBITMAP* newbmp = FreeImage_Rescale(bmp, width, height, FILTER_BILINEAR);
+         FreeImage_Unload(bmp);
+         bmp = newbmp;
+      }
+
+      if (!bmp) {
+         fprintf(stderr, "Failed to load image: %s\n", inputFile);
+         return false;
+      }
+
+      FreeImage_SaveToHandle(FIF_TARGA, bmp, const_cast<FreeImageIO*>(&FiMemoryFileIO), &tga, TARGA_DEFAULT);
       FreeImage_Unload(bmp);
-      bmp = newbmp;
+      tga.ensureSize();
+      return true;
    }
 
-   if (!bmp) {
-      fprintf(stderr, "Failed to load image: %s\n", inputFile);
-      return nullptr;
+}
+
+FileEntry* createTgaGzFileEntry(const char* inputFile, unsigned width, unsigned height, unsigned bpp, const char* filename,
+                                const std::string &cacheDir) {
+   std::filesystem::path cacheEntry;
+   if (!cacheDir.empty()) {
+      cacheEntry = cachePath(cacheDir, inputFile, width, height, bpp);
+
+      std::vector<uint8_t> cached;
+      if (!cacheEntry.empty() && loadCached(cacheEntry, cached)) {
+         return new BufferFileEntry(filename, std::move(cached));
+      }
    }
 
-   FiMemoryFile tga;
-   FreeImage_SaveToHandle(FIF_TARGA, bmp, const_cast<FreeImageIO*>(&FiMemoryFileIO), &tga, TARGA_DEFAULT);
-   FreeImage_Unload(bmp);
-   tga.ensureSize();
+   /* Uncompressed TGA: the 18 byte header, the pixels, and room for the footer. */
+   FiMemoryFile tga(18 + static_cast<std::size_t>(width) * height * (bpp / 8) + 64);
+   {
+      std::lock_guard<std::mutex> lock(freeimage_mutex);
+      if (!convertToTga(inputFile, width, height, bpp, tga)) {
+         return nullptr;
+      }
+   }
 
    std::vector<uint8_t> data = gzCompress(tga.data.data(), tga.data.size());
 
+   if (!cacheEntry.empty()) {
+      storeCached(cacheEntry, data);
+   }
+
    return new BufferFileEntry(filename, std::move(data));
 }
+
+std::vector<FileEntry *> createTgaGzFileEntries(const std::vector<TgaGzImage> &images, unsigned jobs, const std::string &cacheDir) {
+   std::vector<FileEntry *> entries(images.size());
+   parallel_for(images.size(), jobs, [&](size_t i) {
+      const auto &image = images[i];
+      entries[i] = createTgaGzFileEntry(image.inputFile.c_str(), image.width, image.height, image.bpp, image.filename, cacheDir);
+   });
+   return entries;
+}
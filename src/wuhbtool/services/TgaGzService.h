@@ -1,7 +1,29 @@
 #pragma once
 #include <cstdint>
+#include <string>
+#include <vector>
 #include <FreeImage.h>
 
 #include "../entities/FileEntry.h"
 
-FileEntry* createTgaGzFileEntry(const char* inputFile, unsigned width, unsigned height, unsigned bpp, const char* filename);
+struct TgaGzImage {
+   std::string inputFile;
+   unsigned width;
+   unsigned height;
+   unsigned bpp;
+   const char *filename;
+};
+
+/*
+ * Converts an image to a gzipped TGA of the given size. With a cacheDir, the result is
+ * stored there keyed by a hash of the input file, the size and the versions of the
+ * conversion and of FreeImage, and reused by later runs without loading the image.
+ */
+FileEntry* createTgaGzFileEntry(const char* inputFile, unsigned width, unsigned height, unsigned bpp, const char* filename,
+                                const std::string &cacheDir);
+
+/*
+ * Converts up to jobs images at the same time, the entries of failed ones are nullptr.
+ * Only the cache and compression run in parallel, FreeImage gets one image at a time.
+ */
+std::vector<FileEntry *> createTgaGzFileEntries(const std::vector<TgaGzImage> &images, unsigned jobs, const std::string &cacheDir);
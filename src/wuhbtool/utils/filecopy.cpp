@@ -0,0 +1,237 @@
+#include <cerrno>
+#include <memory>
+#include <mutex>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#endif
+
+#include "filecopy.h"
+#include "filepath.h"
+
+namespace {
+
+    constexpr size_t COPY_BUFFER_SIZE = 0x400000;
+
+#ifdef __linux__
+    /* Errors meaning this way of copying isn't supported for these files. */
+    bool is_unsupported(int error) {
+        return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP ||
+               error == ENOTTY || error == EBADF || error == ETXTBSY;
+    }
+
+    /* Shares the extents of f_in with f_out, on file systems with reflinks. */
+    bool clone_range(int fd_in, int fd_out, uint64_t out_offset, uint64_t size) {
+#ifdef FICLONERANGE
+        struct stat out_stats;
+        if (size == 0 || fstat(fd_out, &out_stats) != 0 || out_stats.st_blksize <= 0 ||
+            out_offset % out_stats.st_blksize != 0) {
+            return false;
+        }
+
+        struct file_clone_range range = {};
+        range.src_fd = fd_in;
+        range.src_offset = 0;
+        range.src_length = size;
+        range.dest_offset = out_offset;
+        return ioctl(fd_out, FICLONERANGE, &range) == 0;
+#else
+        (void) fd_in;
+        (void) fd_out;
+        (void) out_offset;
+        (void) size;
+        return false;
+#endif
+    }
+
+    /* Sends from *copied to size to the current position of fd_out, updating *copied. */
+    bool kernel_stream(int fd_in, int fd_out, uint64_t size, uint64_t *copied, bool *unsupported) {
+        *unsupported = false;
+
+        while (*copied < size) {
+            off_t in_pos = *copied;
+            ssize_t res = sendfile(fd_out, fd_in, &in_pos, size - *copied);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res < 0 && is_unsupported(errno)) {
+                *unsupported = true;
+                return false;
+            }
+            if (res <= 0) {
+                return false;
+            }
+            *copied += res;
+        }
+
+        return true;
+    }
+
+    /*
+     * Copies from *copied to size inside the kernel, updating *copied. Returns
+     * false on errors other than the kernel not supporting it, or when f_in
+     * is shorter than size.
+     */
+    bool kernel_copy(int fd_in, int fd_out, uint64_t out_offset, uint64_t size, uint64_t *copied, bool *unsupported) {
+        *unsupported = false;
+
+        while (*copied < size) {
+            off64_t in_pos = *copied;
+            off64_t out_pos = out_offset + *copied;
+            ssize_t res = copy_file_range(fd_in, &in_pos, fd_out, &out_pos, size - *copied, 0);
+            if (res < 0 && errno == EINTR) {
+                continue;
+            }
+            if (res < 0 && is_unsupported(errno)) {
+                break;
+            }
+            if (res <= 0) {
+                return false;
+            }
+            *copied += res;
+        }
+
+        if (*copied == size) {
+            return true;
+        }
+
+        /* sendfile writes at the current position of the output, which is shared by every thread. */
+        static std::mutex sendfile_mutex;
+        std::lock_guard<std::mutex> lock(sendfile_mutex);
+        if (lseek(fd_out, out_offset + *copied, SEEK_SET) < 0) {
+            return false;
+        }
+        return kernel_stream(fd_in, fd_out, size, copied, unsupported);
+    }
+#endif
+
+    /* Copies from copied to size of f_in, writing at out_offset, or at the current position of f_out if streaming. */
+    bool buffered_copy(FILE *f_in, FILE *f_out, uint64_t out_offset, uint64_t size, uint64_t copied, bool streaming) {
+        static thread_local std::unique_ptr<unsigned char[]> buffer;
+        if (!buffer) {
+            buffer.reset(new (std::nothrow) unsigned char[COPY_BUFFER_SIZE]);
+            if (!buffer) {
+                fprintf(stderr, "Failed to allocate work buffer!\n");
+                return false;
+            }
+        }
+
+        if (fseeko64(f_in, copied, SEEK_SET) != 0) {
+            return false;
+        }
+
+        while (copied < size) {
+            uint64_t read_size = COPY_BUFFER_SIZE;
+            if (size - copied < read_size) {
+                read_size = size - copied;
+            }
+
+            if (fread(buffer.get(), 1, read_size, f_in) != read_size) {
+                return false;
+            }
+
+            if (streaming ? fwrite(buffer.get(), 1, read_size, f_out) != read_size :
+                            !file_write_at(f_out, buffer.get(), read_size, out_offset + copied)) {
+                return false;
+            }
+
+            copied += read_size;
+        }
+
+        return true;
+    }
+
+}
+
+bool file_write_at(FILE *f_out, const void *data, uint64_t size, uint64_t out_offset) {
+    auto bytes = static_cast<const unsigned char *>(data);
+
+#ifdef _WIN32
+    auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(f_out)));
+    while (size > 0) {
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = static_cast<DWORD>(out_offset);
+        overlapped.OffsetHigh = static_cast<DWORD>(out_offset >> 32);
+
+        DWORD chunk = size < 0x40000000 ? static_cast<DWORD>(size) : 0x40000000;
+        DWORD written = 0;
+        if (!WriteFile(handle, bytes, chunk, &written, &overlapped) || written == 0) {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+        out_offset += written;
+    }
+#else
+    int fd_out = fileno(f_out);
+    while (size > 0) {
+        ssize_t res = pwrite(fd_out, bytes, size, out_offset);
+        if (res < 0 && errno == EINTR) {
+            continue;
+        }
+        if (res <= 0) {
+            return false;
+        }
+        bytes += res;
+        size -= res;
+        out_offset += res;
+    }
+#endif
+
+    return true;
+}
+
+bool file_copy_range(FILE *f_in, FILE *f_out, uint64_t out_offset, uint64_t size) {
+    uint64_t copied = 0;
+
+#ifdef __linux__
+    int fd_in = fileno(f_in);
+    int fd_out = fileno(f_out);
+    if (clone_range(fd_in, fd_out, out_offset, size)) {
+        return true;
+    }
+
+    bool unsupported = false;
+    if (kernel_copy(fd_in, fd_out, out_offset, size, &copied, &unsupported)) {
+        return true;
+    }
+    if (!unsupported) {
+        return false;
+    }
+#endif
+
+    return buffered_copy(f_in, f_out, out_offset, size, copied, false);
+}
+
+bool file_copy_stream(FILE *f_in, FILE *f_out, uint64_t size) {
+    uint64_t copied = 0;
+
+#ifdef __linux__
+    /* sendfile writes to the file descriptor directly, so what is buffered in f_out must go first. */
+    if (fflush(f_out) != 0) {
+        return false;
+    }
+
+    bool unsupported = false;
+    if (kernel_stream(fileno(f_in), fileno(f_out), size, &copied, &unsupported)) {
+        return true;
+    }
+    if (!unsupported) {
+        return false;
+    }
+#endif
+
+    return buffered_copy(f_in, f_out, 0, size, copied, true);
+}
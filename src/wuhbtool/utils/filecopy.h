@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+/*
+ * file_write_at and file_copy_range write at the given offset of f_out without
+ * using or moving its stdio position, so several threads can write to the same
+ * file at once. Anything buffered in f_out must be flushed before calling them.
+ */
+
+/* Writes size bytes of data to out_offset in f_out. */
+bool file_write_at(FILE *f_out, const void *data, uint64_t size, uint64_t out_offset);
+
+/*
+ * Copies the first size bytes of f_in to out_offset in f_out.
+ *
+ * On Linux the data is cloned with FICLONERANGE when the offsets allow it, or
+ * copied inside the kernel with copy_file_range or sendfile. Elsewhere, or when
+ * the file systems don't support those, it goes through a per-thread buffer that
+ * is reused between calls.
+ *
+ * Returns false if f_in has less than size bytes, or on any read/write error.
+ */
+bool file_copy_range(FILE *f_in, FILE *f_out, uint64_t out_offset, uint64_t size);
+
+/*
+ * Copies the first size bytes of f_in to the current position of f_out, which
+ * doesn't need to be seekable, like a pipe.
+ *
+ * On Linux the data is copied inside the kernel with sendfile. Elsewhere, or
+ * when that isn't supported, it goes through the per-thread buffer.
+ *
+ * Returns false if f_in has less than size bytes, or on any read/write error.
+ */
+bool file_copy_stream(FILE *f_in, FILE *f_out, uint64_t size);
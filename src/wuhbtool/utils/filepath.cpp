@@ -7,6 +7,10 @@
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
 #endif
 
 #include "types.h"
@@ -44,6 +48,24 @@ int os_rmdir(const oschar_t *dir) {
 #endif
 }
 
+FILE *os_take_stdout(void) {
+    fflush(stdout);
+#ifdef _WIN32
+    int fd = _dup(_fileno(stdout));
+    if (fd == -1 || _dup2(_fileno(stderr), _fileno(stdout)) == -1) {
+        return NULL;
+    }
+    _setmode(fd, _O_BINARY);
+    return _fdopen(fd, "wb");
+#else
+    int fd = dup(fileno(stdout));
+    if (fd == -1 || dup2(fileno(stderr), fileno(stdout)) == -1) {
+        return NULL;
+    }
+    return fdopen(fd, "wb");
+#endif
+}
+
 void filepath_update(filepath_t *fpath) {
     memset(fpath->os_path, 0, MAX_OSPATH * sizeof(oschar_t));
     os_strncpy(fpath->os_path, fpath->char_path, MAX_OSPATH);
@@ -1,4 +1,5 @@
 #pragma once
+#include <stdio.h>
 #include <string>
 #include "types.h"
 #include <dirent.h>
@@ -31,6 +32,7 @@ typedef struct _stati64 os_stat64_t;
 #define os_closedir _wclosedir
 #define os_readdir _wreaddir
 #define os_stat _wstati64
+#define os_fstat _fstati64
 #define os_fclose fclose
 
 #define OS_MODE_READ L"rb"
@@ -47,6 +49,7 @@ typedef struct stat os_stat64_t;
 #define os_closedir closedir
 #define os_readdir readdir
 #define os_stat stat
+#define os_fstat fstat
 #define os_fclose fclose
 
 #define OS_MODE_READ "rb"
@@ -67,6 +70,12 @@ void os_strncpy_to_char(char *dst, const oschar_t *src, size_t size);
 int os_makedir(const oschar_t *dir);
 int os_rmdir(const oschar_t *dir);
 
+/*
+ * Returns a binary stream writing to the original stdout, and points stdout at
+ * stderr, so messages printed afterwards don't mix with the data written to it.
+ */
+FILE *os_take_stdout(void);
+
 void filepath_init(filepath_t *fpath);
 void filepath_copy(filepath_t *fpath, filepath_t *copy);
 void filepath_os_append(filepath_t *fpath, oschar_t *path);
@@ -0,0 +1,133 @@
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "progress.h"
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    constexpr auto REDRAW_INTERVAL = std::chrono::milliseconds(250);
+
+    ProgressMode mode = ProgressMode::Verbose;
+
+    /* Steps in the order they first ran, with their total time. */
+    std::mutex steps_mutex;
+    std::vector<std::pair<std::string, double>> steps;
+
+    uint64_t total_files = 0;
+    uint64_t total_bytes = 0;
+    std::atomic<uint64_t> files_done{0};
+    std::atomic<uint64_t> bytes_done{0};
+    Clock::time_point write_start;
+    double write_seconds = 0;
+
+    std::mutex redraw_mutex;
+    Clock::time_point last_redraw;
+
+    double seconds_since(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    double mib(uint64_t bytes) {
+        return bytes / (1024.0 * 1024.0);
+    }
+
+    void draw_line(uint64_t files, uint64_t bytes, double seconds) {
+        double files_per_second = seconds > 0 ? files / seconds : 0;
+        double mib_per_second = seconds > 0 ? mib(bytes) / seconds : 0;
+        printf("\rWritten %llu/%llu files, %.1f/%.1f MiB, %.0f files/s, %.1f MiB/s ",
+               static_cast<unsigned long long>(files), static_cast<unsigned long long>(total_files),
+               mib(bytes), mib(total_bytes), files_per_second, mib_per_second);
+        fflush(stdout);
+    }
+
+}
+
+void progress_set_mode(ProgressMode new_mode) {
+    mode = new_mode;
+}
+
+bool progress_show_files() {
+    return mode == ProgressMode::Verbose;
+}
+
+void progress_log(const char *format, ...) {
+    if (mode == ProgressMode::Quiet) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+void progress_start(uint64_t num_files, uint64_t num_bytes) {
+    total_files = num_files;
+    total_bytes = num_bytes;
+    files_done = 0;
+    bytes_done = 0;
+    write_start = Clock::now();
+    last_redraw = write_start;
+}
+
+void progress_file_done(uint64_t size) {
+    uint64_t files = ++files_done;
+    uint64_t bytes = bytes_done += size;
+    if (mode != ProgressMode::Progress) {
+        return;
+    }
+
+    /* Threads that find the line being redrawn just go on. */
+    std::unique_lock<std::mutex> lock(redraw_mutex, std::try_to_lock);
+    auto now = Clock::now();
+    if (lock.owns_lock() && now - last_redraw >= REDRAW_INTERVAL) {
+        last_redraw = now;
+        draw_line(files, bytes, seconds_since(write_start));
+    }
+}
+
+void progress_finish() {
+    write_seconds += seconds_since(write_start);
+    if (mode == ProgressMode::Progress) {
+        draw_line(files_done, bytes_done, seconds_since(write_start));
+        printf("\n");
+    }
+}
+
+ProgressTimer::ProgressTimer(const char *step) : step(step), start(Clock::now()) {
+}
+
+ProgressTimer::~ProgressTimer() {
+    double seconds = seconds_since(start);
+
+    std::lock_guard<std::mutex> lock(steps_mutex);
+    for (auto &e : steps) {
+        if (e.first == step) {
+            e.second += seconds;
+            return;
+        }
+    }
+    steps.emplace_back(step, seconds);
+}
+
+void progress_print_summary() {
+    if (mode == ProgressMode::Quiet) {
+        return;
+    }
+
+    printf("Summary:\n");
+    for (auto const &e : steps) {
+        printf("  %-10s %9.3f s\n", e.first.c_str(), e.second);
+    }
+    if (write_seconds > 0) {
+        printf("  Wrote %llu files, %.1f MiB, %.0f files/s, %.1f MiB/s\n",
+               static_cast<unsigned long long>(files_done.load()), mib(bytes_done),
+               files_done / write_seconds, mib(bytes_done) / write_seconds);
+    }
+}
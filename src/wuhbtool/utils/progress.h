@@ -0,0 +1,49 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+/* How much is printed while building an archive, set once from the command line. */
+enum class ProgressMode {
+    /* A line for every step and every file written. */
+    Verbose,
+    /* A line for every step, and a single line updated while files are written. */
+    Progress,
+    /* Only errors. */
+    Quiet,
+};
+
+void progress_set_mode(ProgressMode mode);
+
+/* Whether a line is printed for every file written. */
+bool progress_show_files();
+
+/* Prints a step message like printf, unless quiet. */
+void progress_log(const char *format, ...);
+
+/* Starts counting the files written, out of num_files totalling num_bytes. */
+void progress_start(uint64_t num_files, uint64_t num_bytes);
+
+/*
+ * Counts a file written, from any thread. In progress mode this redraws the
+ * progress line with the bytes written, files per second and MiB/s, a few times
+ * a second at most.
+ */
+void progress_file_done(uint64_t size);
+
+/* Stops counting, and keeps the totals for the summary. */
+void progress_finish();
+
+/* Adds the time from its creation to its destruction to a step of the summary. */
+class ProgressTimer {
+public:
+    explicit ProgressTimer(const char *step);
+
+    ~ProgressTimer();
+
+private:
+    const char *step;
+    std::chrono::steady_clock::time_point start;
+};
+
+/* Prints the time of every step and the write throughput, unless quiet. */
+void progress_print_summary();
@@ -0,0 +1,34 @@
+#include <cstring>
+#include "stringpool.h"
+
+std::string_view StringPool::intern(std::string_view str) {
+    if (str.empty()) {
+        return "";
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto itr = strings.find(str);
+    if (itr != strings.end()) {
+        return *itr;
+    }
+
+    char *storage;
+    if (str.size() > BLOCK_SIZE / 4) {
+        /* Long strings get a block of their own, so they don't waste the rest of the current one. */
+        blocks.insert(blocks.begin(), std::make_unique<char[]>(str.size()));
+        storage = blocks.front().get();
+    } else {
+        if (BLOCK_SIZE - block_used < str.size()) {
+            blocks.push_back(std::make_unique<char[]>(BLOCK_SIZE));
+            block_used = 0;
+        }
+        storage = blocks.back().get() + block_used;
+        block_used += str.size();
+    }
+
+    memcpy(storage, str.data(), str.size());
+    std::string_view pooled(storage, str.size());
+    strings.insert(pooled);
+    return pooled;
+}
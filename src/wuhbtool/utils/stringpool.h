@@ -0,0 +1,26 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * Keeps one copy of every string, back to back in large blocks that live as long
+ * as the pool, so many short names don't each need their own allocation.
+ * Safe to use from several threads.
+ */
+class StringPool {
+public:
+    /* Returns the pooled copy of str, which stays valid as long as the pool. */
+    std::string_view intern(std::string_view str);
+
+private:
+    static constexpr size_t BLOCK_SIZE = 0x10000;
+
+    std::mutex mutex;
+    std::unordered_set<std::string_view> strings;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t block_used = BLOCK_SIZE;
+};